@@ -0,0 +1,339 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/foreach.hpp>
+#include "city.h"
+#include "mapped_file.hh"
+#include "seq_arena.hh"
+#include "tagged_alignment.hh"
+
+// Binary cache of parsed alignments.
+//
+// Parsing a PSL or BLAST file, looking up each alignment's sequence names, and
+// walking each alignment's blocks to find its mismatches takes a large part of
+// the running time of the alignment-based scores. Since the result depends
+// only on the alignment file, the two sequence files, the alignment type, and
+// --strand-specific, it can be written once to a compact binary file next to
+// the alignment file and memory-mapped on subsequent runs.
+//
+// The cache holds every alignment that passes the strand check, before any
+// other filtering, so that thresholds such as --min-segment-len and
+// --min-frac-identity can be changed between runs without invalidating it. A
+// cache whose key (see alignment_cache_key) does not match the current inputs
+// is ignored and rewritten.
+//
+// The file layout, in native byte order, is:
+//
+// - header: magic, version, the five key fields, and the number of
+//   alignments, segments, and mismatch positions (all uint64_t);
+//
+// - for each alignment: its alignment_identity (four doubles);
+//
+// - for each alignment: a_idx, b_idx, and number of segments (uint32_t);
+//
+// - for each segment, in alignment order: a_start, a_end, b_start, b_end,
+//   and number of a and b mismatches (uint32_t);
+//
+// - for each segment, in the same order: its a mismatches followed by its b
+//   mismatches (uint32_t).
+
+namespace re {
+namespace matched {
+
+struct alignment_cache_key
+{
+  uint64_t alignment_type;      // hash of the --alignment-type string
+  uint64_t strand_specific;
+  uint64_t alignments_checksum; // checksum of the alignment file's bytes
+  uint64_t A_checksum;          // checksum of the names and seqs of A
+  uint64_t B_checksum;          // checksum of the names and seqs of B
+
+  bool operator==(const alignment_cache_key& other) const
+  {
+    return alignment_type      == other.alignment_type      &&
+           strand_specific     == other.strand_specific     &&
+           alignments_checksum == other.alignments_checksum &&
+           A_checksum          == other.A_checksum          &&
+           B_checksum          == other.B_checksum;
+  }
+};
+
+namespace detail
+{
+  const uint64_t alignment_cache_magic   = 0x6568636163616552ULL; // "Reacache"
+  const uint64_t alignment_cache_version = 2;
+
+  struct alignment_cache_header
+  {
+    uint64_t magic;
+    uint64_t version;
+    alignment_cache_key key;
+    uint64_t num_alignments;
+    uint64_t num_segments;
+    uint64_t num_mismatches;
+  };
+
+  const size_t identity_record_size  = 4; // in doubles
+  const size_t alignment_record_size = 3; // in uint32_t's
+  const size_t segment_record_size   = 6; // in uint32_t's
+
+  inline uint64_t checksum_string(string_ref s, uint64_t seed)
+  {
+    uint64_t h = CityHash64WithSeed(s.data(), s.size(), seed);
+    // Mix in the length so that, e.g., ("ab", "c") and ("a", "bc") differ.
+    return CityHash64WithSeeds(reinterpret_cast<const char *>(&h), sizeof(h), seed, s.size());
+  }
+
+  // Creates an empty file whose name is filename followed by a unique suffix,
+  // and returns its name. Cache files are written under such a name and then
+  // renamed (see rename_temp_file), so that an interrupted run never leaves a
+  // truncated cache behind, and so that concurrent writers of the same cache
+  // file, such as the jobs of ref-eval --serve, never write to the same file.
+  inline std::string make_temp_file(const std::string& filename)
+  {
+    std::string pattern = filename + ".tmp.XXXXXX";
+    std::vector<char> buf(pattern.begin(), pattern.end());
+    buf.push_back('\0');
+    int fd = mkstemp(&buf[0]);
+    if (fd == -1)
+      throw std::runtime_error("Can't create a temporary file for " + filename + ": " + std::strerror(errno));
+    fchmod(fd, 0644);
+    close(fd);
+    return std::string(&buf[0]);
+  }
+
+  inline void rename_temp_file(const std::string& tmp_filename, const std::string& filename)
+  {
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+      std::string err = std::strerror(errno);
+      std::remove(tmp_filename.c_str());
+      throw std::runtime_error("Can't rename " + tmp_filename + " to " + filename + ": " + err);
+    }
+  }
+} // namespace detail
+
+// Returns a checksum of the bytes of the given file, which is read as is,
+// i.e., without decompression.
+uint64_t checksum_file(const std::string& filename)
+{
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  if (!ifs)
+    throw std::runtime_error("Can't open " + filename + ".");
+  std::vector<char> buf(1 << 20);
+  uint64_t h = 0, total = 0;
+  for (;;) {
+    ifs.read(&buf[0], buf.size());
+    std::streamsize n = ifs.gcount();
+    if (n <= 0)
+      break;
+    h = CityHash64WithSeed(&buf[0], n, h);
+    total += n;
+  }
+  if (ifs.bad())
+    throw std::runtime_error("Error reading " + filename + ".");
+  return CityHash64WithSeeds(reinterpret_cast<const char *>(&h), sizeof(h), h, total);
+}
+
+// Returns a checksum of the given sequence names and sequences, in order.
+uint64_t checksum_seqs(const seq_arena& names,
+                       const seq_arena& seqs)
+{
+  uint64_t h = names.size();
+  for (size_t i = 0; i < names.size(); ++i) {
+    h = detail::checksum_string(names[i], h);
+    h = detail::checksum_string(seqs[i], h);
+  }
+  return h;
+}
+
+alignment_cache_key make_alignment_cache_key(const std::string& alignment_type,
+                                             bool strand_specific,
+                                             const std::string& alignments_filename,
+                                             uint64_t A_checksum,
+                                             uint64_t B_checksum)
+{
+  alignment_cache_key key;
+  key.alignment_type      = CityHash64(alignment_type.data(), alignment_type.size());
+  key.strand_specific     = strand_specific;
+  key.alignments_checksum = checksum_file(alignments_filename);
+  key.A_checksum          = A_checksum;
+  key.B_checksum          = B_checksum;
+  return key;
+}
+
+std::string alignment_cache_filename(const std::string& alignments_filename)
+{
+  return alignments_filename + ".recache";
+}
+
+// Loads the alignments in the given cache file into set (which is cleared
+// first). Returns false, leaving set empty, if the cache file does not exist,
+// was made from different inputs than those described by key, or is
+// malformed.
+bool load_alignment_cache(alignment_set& set,
+                          const std::string& cache_filename,
+                          const alignment_cache_key& key)
+{
+  std::vector<tagged_alignment>& alignments = set.alignments;
+  alignments.clear();
+  set.identities.clear();
+
+  mapped_file f(cache_filename);
+  if (f.data == NULL || f.size < sizeof(detail::alignment_cache_header))
+    return false;
+
+  detail::alignment_cache_header header;
+  std::memcpy(&header, f.data, sizeof(header));
+  if (header.magic   != detail::alignment_cache_magic   ||
+      header.version != detail::alignment_cache_version ||
+      !(header.key == key))
+    return false;
+
+  // Check that the file has exactly the size implied by the header, so that
+  // none of the reads below can run past the end of the mapping.
+  uint64_t identities_size = header.num_alignments * detail::identity_record_size * sizeof(double);
+  uint64_t num_words = header.num_alignments * detail::alignment_record_size +
+                       header.num_segments   * detail::segment_record_size +
+                       header.num_mismatches;
+  if (f.size != sizeof(header) + identities_size + num_words * sizeof(uint32_t))
+    return false;
+
+  set.identities.resize(header.num_alignments);
+  if (header.num_alignments > 0)
+    std::memcpy(&set.identities[0], f.data + sizeof(header), identities_size);
+
+  const uint32_t *al_rec  = reinterpret_cast<const uint32_t *>(f.data + sizeof(header) + identities_size);
+  const uint32_t *seg_rec = al_rec  + header.num_alignments * detail::alignment_record_size;
+  const uint32_t *mm      = seg_rec + header.num_segments   * detail::segment_record_size;
+  const uint32_t *seg_end = mm;
+  const uint32_t *mm_end  = mm + header.num_mismatches;
+
+  alignments.resize(header.num_alignments);
+  for (size_t i = 0; i < alignments.size(); ++i, al_rec += detail::alignment_record_size) {
+    tagged_alignment& l = alignments[i];
+    l.a_idx = al_rec[0];
+    l.b_idx = al_rec[1];
+    if (al_rec[2] > static_cast<uint64_t>(seg_end - seg_rec) / detail::segment_record_size) {
+      alignments.clear();
+      set.identities.clear();
+      return false;
+    }
+    l.segments.resize(al_rec[2]);
+    for (size_t j = 0; j < l.segments.size(); ++j, seg_rec += detail::segment_record_size) {
+      alignment_segment& seg = l.segments[j];
+      seg.a_start = seg_rec[0];
+      seg.a_end   = seg_rec[1];
+      seg.b_start = seg_rec[2];
+      seg.b_end   = seg_rec[3];
+      if (static_cast<uint64_t>(seg_rec[4]) + seg_rec[5] > static_cast<uint64_t>(mm_end - mm)) {
+        alignments.clear();
+        set.identities.clear();
+        return false;
+      }
+      seg.a_mismatches.assign(mm, mm + seg_rec[4]); mm += seg_rec[4];
+      seg.b_mismatches.assign(mm, mm + seg_rec[5]); mm += seg_rec[5];
+    }
+  }
+  if (seg_rec != seg_end || mm != mm_end) {
+    alignments.clear();
+    set.identities.clear();
+    return false;
+  }
+  return true;
+}
+
+// Writes the given alignments to the given cache file. The file is written
+// under a temporary name and then renamed (see detail::make_temp_file).
+void save_alignment_cache(const alignment_set& set,
+                          const std::string& cache_filename,
+                          const alignment_cache_key& key)
+{
+  const std::vector<tagged_alignment>& alignments = set.alignments;
+  assert(set.identities.size() == alignments.size());
+  detail::alignment_cache_header header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic   = detail::alignment_cache_magic;
+  header.version = detail::alignment_cache_version;
+  header.key     = key;
+
+  std::vector<uint32_t> al_recs, seg_recs, mms;
+  al_recs.reserve(alignments.size() * detail::alignment_record_size);
+  const uint64_t max_value = 0xffffffffULL;
+  BOOST_FOREACH(const tagged_alignment& l, alignments) {
+    if (l.a_idx > max_value || l.b_idx > max_value || l.segments.size() > max_value)
+      throw std::runtime_error("Alignments are too large to cache.");
+    al_recs.push_back(l.a_idx);
+    al_recs.push_back(l.b_idx);
+    al_recs.push_back(l.segments.size());
+    BOOST_FOREACH(const alignment_segment& seg, l.segments) {
+      if (std::max(std::max(seg.a_start, seg.a_end), std::max(seg.b_start, seg.b_end)) > max_value)
+        throw std::runtime_error("Alignments are too large to cache.");
+      seg_recs.push_back(seg.a_start);
+      seg_recs.push_back(seg.a_end);
+      seg_recs.push_back(seg.b_start);
+      seg_recs.push_back(seg.b_end);
+      seg_recs.push_back(seg.a_mismatches.size());
+      seg_recs.push_back(seg.b_mismatches.size());
+      mms.insert(mms.end(), seg.a_mismatches.begin(), seg.a_mismatches.end());
+      mms.insert(mms.end(), seg.b_mismatches.begin(), seg.b_mismatches.end());
+    }
+  }
+  header.num_alignments = alignments.size();
+  header.num_segments   = seg_recs.size() / detail::segment_record_size;
+  header.num_mismatches = mms.size();
+
+  std::string tmp_filename = detail::make_temp_file(cache_filename);
+  {
+    std::ofstream ofs(tmp_filename.c_str(), std::ios::binary | std::ios::trunc);
+    if (!ofs) {
+      std::remove(tmp_filename.c_str());
+      throw std::runtime_error("Can't open " + tmp_filename + " for writing.");
+    }
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (!set.identities.empty())
+      ofs.write(reinterpret_cast<const char *>(&set.identities[0]), set.identities.size() * sizeof(alignment_identity));
+    if (!al_recs.empty())
+      ofs.write(reinterpret_cast<const char *>(&al_recs[0]), al_recs.size() * sizeof(uint32_t));
+    if (!seg_recs.empty())
+      ofs.write(reinterpret_cast<const char *>(&seg_recs[0]), seg_recs.size() * sizeof(uint32_t));
+    if (!mms.empty())
+      ofs.write(reinterpret_cast<const char *>(&mms[0]), mms.size() * sizeof(uint32_t));
+    ofs.close();
+    if (!ofs) {
+      std::remove(tmp_filename.c_str());
+      throw std::runtime_error("Error writing " + tmp_filename + ".");
+    }
+  }
+  detail::rename_temp_file(tmp_filename, cache_filename);
+}
+
+} // namespace matched
+} // namespace re
@@ -0,0 +1,388 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Micro-benchmarks of REF-EVAL's core kernels, over synthetic inputs made
+// from fixed random seeds, so that runs on the same machine can be compared.
+// Run by "make bench". Each benchmark prints one line of JSON:
+//
+//   {"benchmark": ..., "runs": ..., "median_seconds": ..., "min_seconds": ...,
+//    "items": ..., "item_unit": ..., "items_per_second": ...}
+//
+// where items_per_second is computed from the median. If an argument is
+// given, only the benchmarks whose names contain it are run.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "opts.hh"
+#include "fasta.hh"
+#include "expr.hh"
+#include "re_matched.hh"
+#include "re_oomatched.hh"
+#include "re_kmer.hh"
+
+using namespace std;
+
+string filter;
+
+// Runs f at least 3 times and for at least min_seconds in total, and prints
+// the timings. f does the same work, on the same input, each time.
+template<typename F>
+void bench(const string& name, size_t items, const string& item_unit, F f, double min_seconds = 0.5)
+{
+  if (name.find(filter) == string::npos)
+    return;
+  vector<double> times;
+  double total = 0.0;
+  while (times.size() < 3 || total < min_seconds) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    f();
+    double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    times.push_back(t);
+    total += t;
+  }
+  sort(times.begin(), times.end());
+  double median = times[times.size() / 2];
+  cout << "{\"benchmark\": \"" << name << "\""
+       << ", \"runs\": " << times.size()
+       << ", \"median_seconds\": " << median
+       << ", \"min_seconds\": " << times[0]
+       << ", \"items\": " << items
+       << ", \"item_unit\": \"" << item_unit << "\""
+       << ", \"items_per_second\": " << items / median << "}" << endl;
+}
+
+// Keeps the compiler from optimizing away a result.
+volatile size_t sink;
+
+string random_seq(mt19937& rng, size_t len)
+{
+  uniform_int_distribution<int> base(0, 3);
+  string s(len, ' ');
+  for (size_t j = 0; j < len; ++j)
+    s[j] = "ACGT"[base(rng)];
+  return s;
+}
+
+// Returns s with a fraction rate of its bases changed.
+string mutate(mt19937& rng, string s, double rate)
+{
+  uniform_real_distribution<double> u(0.0, 1.0);
+  for (size_t j = 0; j < s.size(); ++j)
+    if (u(rng) < rate)
+      s[j] = s[j] == 'A' ? 'C' : 'A';
+  return s;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// kmer hashing and hash tables
+////////////////////////////////////////////////////////////////////////////
+
+template<typename Ht>
+void bench_kmer_table(const string& name, const string& seq, size_t k)
+{
+  size_t n = seq.size() - k + 1;
+  bench("kmer_table_insert/" + name, n, "kmers", [&] {
+    Ht ht(2 * n, kmer_key_hash(k), kmer_key_equal_to(k));
+    re::kmer::empty_key_initializer<Ht> eki(ht, k);
+    for (size_t j = 0; j < n; ++j)
+      ht[seq.data() + j].weights[0] += 1.0;
+    sink = ht.size();
+  });
+
+  Ht ht(2 * n, kmer_key_hash(k), kmer_key_equal_to(k));
+  re::kmer::empty_key_initializer<Ht> eki(ht, k);
+  for (size_t j = 0; j < n; ++j)
+    ht[seq.data() + j].weights[0] += 1.0;
+  bench("kmer_table_lookup/" + name, n, "kmers", [&] {
+    size_t found = 0;
+    for (size_t j = 0; j < n; ++j)
+      found += ht.find(seq.data() + j) != ht.end();
+    sink = found;
+  });
+}
+
+template<typename Ht>
+void bench_packed_kmer_table(const string& name, const packed_seqs& p, size_t k)
+{
+  size_t n = p.length(0) - k + 1;
+  bench("kmer_table_insert/" + name, n, "kmers", [&] {
+    Ht ht(2 * n);
+    re::kmer::empty_key_initializer<Ht> eki(ht, k);
+    for (size_t j = 0; j < n; ++j)
+      ht[p.kmer(0, j, k)].weights[0] += 1.0;
+    sink = ht.size();
+  });
+}
+
+void bench_kmers()
+{
+  mt19937 rng(1);
+  size_t k = 25;
+  string seq = random_seq(rng, 1000000);
+  size_t n = seq.size() - k + 1;
+
+  bench("kmer_hash", n, "kmers", [&] {
+    kmer_key_hash h(k);
+    size_t x = 0;
+    for (size_t j = 0; j < n; ++j)
+      x ^= h(seq.data() + j);
+    sink = x;
+  });
+
+  bench_kmer_table<re::kmer::sparse_double_kmer_map>("sparse_double", seq, k);
+  bench_kmer_table<re::kmer::sparse_float_kmer_map> ("sparse_float",  seq, k);
+  bench_kmer_table<re::kmer::dense_double_kmer_map> ("dense_double",  seq, k);
+  bench_kmer_table<re::kmer::dense_float_kmer_map>  ("dense_float",   seq, k);
+
+  seq_arena arena;
+  arena.push_back(seq);
+  packed_seqs p(arena);
+  bench_packed_kmer_table<re::kmer::sparse_double_packed_kmer_map>("sparse_double_packed", p, k);
+  bench_packed_kmer_table<re::kmer::dense_double_packed_kmer_map> ("dense_double_packed",  p, k);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// PSL parsing and segments
+////////////////////////////////////////////////////////////////////////////
+
+// A set of contigs A, each a mutated copy of part of a reference sequence in
+// B, and their alignments to B in PSL format, each with three blocks.
+struct synthetic_alignments
+{
+  vector<string> A, B, psl_lines;
+  vector<size_t> b_idxs;
+
+  synthetic_alignments(size_t num_B, size_t B_len, size_t num_A, size_t A_len, double mismatch_rate)
+  {
+    mt19937 rng(2);
+    for (size_t i = 0; i < num_B; ++i)
+      B.push_back(random_seq(rng, B_len));
+    uniform_int_distribution<size_t> which_B(0, num_B - 1), start(0, B_len - A_len - 10);
+    for (size_t i = 0; i < num_A; ++i) {
+      size_t b = which_B(rng), t = start(rng);
+      // Three blocks, separated by a 5-base deletion from a and a 5-base
+      // insertion into a.
+      size_t len = A_len / 3;
+      string a = B[b].substr(t, len) + B[b].substr(t + len + 5, len) +
+                 random_seq(rng, 5) + B[b].substr(t + 2 * len + 5, len);
+      a = mutate(rng, a, mismatch_rate);
+      size_t mismatches = 0;
+      for (size_t j = 0; j < len; ++j) {
+        mismatches += a[j]               != B[b][t + j];
+        mismatches += a[len + j]         != B[b][t + len + 5 + j];
+        mismatches += a[2 * len + 5 + j] != B[b][t + 2 * len + 5 + j];
+      }
+      ostringstream oss;
+      oss << 3 * len - mismatches << "\t" << mismatches << "\t0\t0\t1\t5\t1\t5\t+\t"
+          << "a" << i << "\t" << a.size() << "\t0\t" << a.size() << "\t"
+          << "b" << b << "\t" << B_len << "\t" << t << "\t" << t + 3 * len + 5 << "\t3\t"
+          << len << "," << len << "," << len << ",\t"
+          << 0 << "," << len << "," << 2 * len + 5 << ",\t"
+          << t << "," << t + len + 5 << "," << t + 2 * len + 5 << ",";
+      A.push_back(a);
+      b_idxs.push_back(b);
+      psl_lines.push_back(oss.str());
+    }
+  }
+};
+
+void bench_psl()
+{
+  synthetic_alignments s(100, 20000, 10000, 1500, 0.01);
+
+  bench("psl_parse_line", s.psl_lines.size(), "lines", [&] {
+    psl_alignment al;
+    size_t x = 0;
+    for (size_t i = 0; i < s.psl_lines.size(); ++i) {
+      al.parse_line(s.psl_lines[i]);
+      x += al.matches();
+    }
+    sink = x;
+  });
+
+  vector<psl_alignment> als(s.psl_lines.size());
+  for (size_t i = 0; i < als.size(); ++i)
+    als[i].parse_line(s.psl_lines[i]);
+  size_t bases = 0;
+  for (size_t i = 0; i < als.size(); ++i)
+    bases += als[i].matches() + als[i].mis_matches();
+  bench("psl_segments", bases, "aligned bases", [&] {
+    size_t x = 0;
+    for (size_t i = 0; i < als.size(); ++i) {
+      psl_alignment::segments_type segs = als[i].segments(s.A[i], s.B[s.b_idxs[i]]);
+      for (psl_alignment::segments_type::const_iterator it = segs.begin(); it != segs.end(); ++it)
+        x += it->b_mismatches.size();
+    }
+    sink = x;
+  });
+}
+
+////////////////////////////////////////////////////////////////////////////
+// mask and smart_pairset
+////////////////////////////////////////////////////////////////////////////
+
+void bench_mask_and_pairset()
+{
+  mt19937 rng(3);
+  size_t len = 10000, num_intervals = 200;
+  uniform_int_distribution<size_t> pos(0, len - 1001), interval_len(100, 1000), mismatch(0, 999);
+  vector<size_t> starts, ends;
+  vector<vector<size_t> > exceptions(num_intervals);
+  for (size_t i = 0; i < num_intervals; ++i) {
+    starts.push_back(pos(rng));
+    ends.push_back(starts.back() + interval_len(rng) - 1);
+    for (size_t j = 0; j < 10; ++j)
+      exceptions[i].push_back(starts.back() + mismatch(rng) % (ends.back() - starts.back() + 1));
+    sort(exceptions[i].begin(), exceptions[i].end());
+  }
+  size_t bases = 0;
+  for (size_t i = 0; i < num_intervals; ++i)
+    bases += ends[i] - starts[i] + 1;
+
+  bench("mask_add", bases, "bases", [&] {
+    mask m(len);
+    for (size_t i = 0; i < num_intervals; ++i)
+      m.add_interval_with_exceptions(starts[i], ends[i], exceptions[i].begin(), exceptions[i].end());
+    sink = m.num_ones();
+  });
+
+  bench("smart_pairset_add", num_intervals, "squares", [&] {
+    smart_pairset ps(len);
+    for (size_t i = 0; i < num_intervals; ++i)
+      ps.add_square_with_exceptions(starts[i], ends[i], exceptions[i].begin(), exceptions[i].end());
+    sink = num_intervals;
+  });
+
+  smart_pairset ps(len);
+  for (size_t i = 0; i < num_intervals; ++i)
+    ps.add_square_with_exceptions(starts[i], ends[i], exceptions[i].begin(), exceptions[i].end());
+  bench("smart_pairset_size", num_intervals, "squares", [&] {
+    sink = ps.size();
+  });
+}
+
+////////////////////////////////////////////////////////////////////////////
+// process_alignments
+////////////////////////////////////////////////////////////////////////////
+
+// Alignments of contigs to B, with on average density alignments covering
+// each base of B.
+vector<re::matched::tagged_alignment> make_tagged_alignments(
+    size_t A_card, size_t B_card, size_t B_len, double density)
+{
+  mt19937 rng(4);
+  size_t seg_len = 500;
+  size_t num = static_cast<size_t>(density * B_card * B_len / seg_len);
+  uniform_int_distribution<size_t> a(0, A_card - 1), b(0, B_card - 1), start(0, B_len - seg_len), mm(0, seg_len - 1);
+  vector<re::matched::tagged_alignment> als(num);
+  for (size_t i = 0; i < num; ++i) {
+    als[i].a_idx = a(rng);
+    als[i].b_idx = b(rng);
+    alignment_segment seg;
+    seg.b_start = start(rng);
+    seg.b_end   = seg.b_start + seg_len - 1;
+    seg.a_start = 0;
+    seg.a_end   = seg_len - 1;
+    for (size_t j = 0; j < 5; ++j) {
+      size_t x = mm(rng);
+      seg.a_mismatches.push_back(x);
+      seg.b_mismatches.push_back(seg.b_start + x);
+    }
+    sort(seg.a_mismatches.begin(), seg.a_mismatches.end());
+    sort(seg.b_mismatches.begin(), seg.b_mismatches.end());
+    als[i].segments.push_back(seg);
+  }
+  return als;
+}
+
+void bench_process_alignments()
+{
+  size_t A_card = 2000, B_card = 1000, B_len = 2000;
+  vector<size_t> B_lengths(B_card, B_len);
+  vector<double> tau_B(B_card, 1.0 / B_card);
+  double densities[] = {0.5, 2.0, 8.0};
+  for (size_t d = 0; d < 3; ++d) {
+    vector<re::matched::tagged_alignment> als = make_tagged_alignments(A_card, B_card, B_len, densities[d]);
+    ostringstream name;
+    name << "process_alignments/nucl/density_" << densities[d];
+    bench(name.str(), als.size(), "alignments", [&] {
+      re::matched::nucl_helper h(B_lengths, tau_B, 0);
+      re::matched::process_alignments(h, als, A_card, B_card, 0);
+      sink = static_cast<size_t>(h.get_recall() * 1e6);
+    });
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Matching
+////////////////////////////////////////////////////////////////////////////
+
+// A random bipartite graph with the given number of nodes on each side and
+// edges, with the weight of each edge set by its B node, as in the contig
+// scores. With fewer edges than nodes, the graph falls apart into many small
+// components, as contig graphs usually do; with more, it has one giant
+// component.
+void bench_matching(const string& graph_name, size_t card, size_t num_edges)
+{
+  mt19937 rng(5);
+  uniform_int_distribution<size_t> node(0, card - 1);
+  uniform_real_distribution<double> w(0.0, 1.0);
+  vector<double> B_weights(card);
+  for (size_t i = 0; i < card; ++i)
+    B_weights[i] = w(rng);
+  vector<re::oomatched::matching_edge> edges(num_edges);
+  for (size_t i = 0; i < num_edges; ++i) {
+    edges[i].a_idx  = node(rng);
+    edges[i].b_idx  = node(rng);
+    edges[i].weight = B_weights[edges[i].b_idx];
+  }
+  re::oomatched::collapse_parallel_edges(edges);
+  re::oomatched::matching_components comps;
+  re::oomatched::find_components(comps, edges, card, card);
+
+  const char *algorithms[] = {"lemon", "bipartite", "greedy"};
+  for (size_t i = 0; i < 3; ++i) {
+    for (int weighted = 0; weighted < 2; ++weighted) {
+      string name = "matching/" + graph_name + "/" + algorithms[i] + (weighted ? "/weighted" : "/unweighted");
+      bench(name, edges.size(), "edges", [&] {
+        vector<size_t> mates;
+        sink = static_cast<size_t>(re::oomatched::max_matching(edges, comps, card, weighted, algorithms[i], mates));
+      });
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1)
+    filter = argv[1];
+  bench_kmers();
+  bench_psl();
+  bench_mask_and_pairset();
+  bench_process_alignments();
+  bench_matching("sparse", 200000, 160000);
+  bench_matching("giant_component", 5000, 15000);
+  return 0;
+}
@@ -0,0 +1,518 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////
+// Matching algorithms specialized to bipartite graphs.
+//
+// The graph has num_left nodes on the left, num_right nodes on the right, and
+// the given edges between them. Both functions set right_mate_edges[v] to the
+// index of the edge that matches right node v, or to bipartite_edge::npos if v
+// is not matched.
+//
+// - hopcroft_karp() finds a maximum cardinality matching, in O(E sqrt(V))
+//   time.
+//
+// - max_weight_matching() finds a maximum weight matching (which need not be
+//   of maximum cardinality) by successive shortest paths: it repeatedly
+//   augments along the path of largest gain, found by Dijkstra's algorithm
+//   over reduced costs, until no path has positive gain. This takes
+//   O(k E log V) time, where k is the size of the matching. Edges with
+//   nonpositive weight are never used. If the weight of each edge depends
+//   only on its right node, as for the contig scores, a greedy algorithm is
+//   used instead, which is usually much faster.
+//
+// - greedy_matching() finds a matching with at least half the maximum weight
+//   in O(E log E) time, for graphs too large for the exact algorithms (see
+//   below).
+//
+// These give the same sizes and weights as lemon's general-graph
+// MaxMatching and MaxWeightedMatching, but the matching chosen among several
+// optimal ones may differ.
+////////////////////////////////////////////////////////////////////////////
+
+struct bipartite_edge
+{
+  size_t left, right;
+  double weight;
+  static const size_t npos = static_cast<size_t>(-1);
+};
+
+const size_t bipartite_edge::npos;
+
+namespace detail
+{
+  // Lists the indices of the edges incident to each left node, in CSR form.
+  inline void bipartite_left_adjacency(size_t num_left,
+                                       const std::vector<bipartite_edge>& edges,
+                                       std::vector<size_t>& offsets,
+                                       std::vector<size_t>& adj)
+  {
+    offsets.assign(num_left + 1, 0);
+    for (size_t e = 0; e < edges.size(); ++e)
+      ++offsets[edges[e].left + 1];
+    for (size_t u = 0; u < num_left; ++u)
+      offsets[u + 1] += offsets[u];
+    adj.resize(edges.size());
+    std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t e = 0; e < edges.size(); ++e)
+      adj[next[edges[e].left]++] = e;
+  }
+}
+
+inline void hopcroft_karp(size_t num_left,
+                          size_t num_right,
+                          const std::vector<bipartite_edge>& edges,
+                          std::vector<size_t>& right_mate_edges)
+{
+  const size_t npos = bipartite_edge::npos;
+  const size_t inf  = static_cast<size_t>(-1);
+  std::vector<size_t> offsets, adj;
+  detail::bipartite_left_adjacency(num_left, edges, offsets, adj);
+
+  std::vector<size_t> left_mate_edges(num_left, npos);
+  right_mate_edges.assign(num_right, npos);
+  std::vector<size_t> dist(num_left), queue, stack, path, next_arc(num_left);
+  queue.reserve(num_left);
+
+  for (;;) {
+    // Find the length of the shortest augmenting paths, labeling each left
+    // node with its distance from the free left nodes.
+    queue.clear();
+    for (size_t u = 0; u < num_left; ++u) {
+      dist[u] = (left_mate_edges[u] == npos) ? 0 : inf;
+      if (dist[u] == 0)
+        queue.push_back(u);
+    }
+    bool found = false;
+    for (size_t qi = 0; qi < queue.size(); ++qi) {
+      size_t u = queue[qi];
+      for (size_t k = offsets[u]; k < offsets[u + 1]; ++k) {
+        size_t m = right_mate_edges[edges[adj[k]].right];
+        if (m == npos) {
+          found = true;
+        } else if (dist[edges[m].left] == inf) {
+          dist[edges[m].left] = dist[u] + 1;
+          queue.push_back(edges[m].left);
+        }
+      }
+    }
+    if (!found)
+      break;
+
+    // Augment along a maximal set of vertex-disjoint shortest paths, found by
+    // depth-first search along the layers. The search is iterative, since the
+    // paths can be long.
+    for (size_t u = 0; u < num_left; ++u)
+      next_arc[u] = offsets[u];
+    for (size_t root = 0; root < num_left; ++root) {
+      if (left_mate_edges[root] != npos)
+        continue;
+      stack.assign(1, root);
+      path.clear();
+      while (!stack.empty()) {
+        size_t u = stack.back();
+        if (next_arc[u] == offsets[u + 1]) {
+          // Dead end; don't visit u again in this phase.
+          dist[u] = inf;
+          stack.pop_back();
+          if (!path.empty())
+            path.pop_back();
+          continue;
+        }
+        size_t e = adj[next_arc[u]++];
+        size_t m = right_mate_edges[edges[e].right];
+        if (m == npos) {
+          path.push_back(e);
+          for (size_t i = 0; i < path.size(); ++i) {
+            left_mate_edges[edges[path[i]].left] = path[i];
+            right_mate_edges[edges[path[i]].right] = path[i];
+          }
+          break;
+        }
+        size_t u2 = edges[m].left;
+        if (dist[u2] != inf && dist[u2] == dist[u] + 1) {
+          stack.push_back(u2);
+          path.push_back(e);
+        }
+      }
+    }
+  }
+}
+
+namespace detail
+{
+  // Compares right nodes by decreasing weight, breaking ties by index.
+  struct heavier_right_node
+  {
+    const std::vector<double>& weights;
+    heavier_right_node(const std::vector<double>& weights) : weights(weights) {}
+    bool operator()(size_t v1, size_t v2) const
+    {
+      return weights[v1] > weights[v2] || (weights[v1] == weights[v2] && v1 < v2);
+    }
+  };
+
+  // Finds a maximum weight matching when the weight of each edge depends only
+  // on its right node, as given by right_weights. The sets of right nodes that
+  // can be covered by a matching form a matroid, so it is enough to go
+  // through the right nodes from heaviest to lightest, adding each one to the
+  // matching if there is an augmenting path from it. Left nodes visited by a
+  // failed search can never be part of a later augmenting path, so they are
+  // removed from the graph.
+  inline void right_weighted_matching(size_t num_left,
+                                      size_t num_right,
+                                      const std::vector<bipartite_edge>& edges,
+                                      const std::vector<double>& right_weights,
+                                      std::vector<size_t>& right_mate_edges)
+  {
+    const size_t npos = bipartite_edge::npos;
+
+    // List the edges incident to each right node, in CSR form.
+    std::vector<size_t> offsets(num_right + 1, 0), adj(edges.size());
+    for (size_t e = 0; e < edges.size(); ++e)
+      ++offsets[edges[e].right + 1];
+    for (size_t v = 0; v < num_right; ++v)
+      offsets[v + 1] += offsets[v];
+    std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t e = 0; e < edges.size(); ++e)
+      adj[next[edges[e].right]++] = e;
+
+    std::vector<size_t> order;
+    for (size_t v = 0; v < num_right; ++v)
+      if (right_weights[v] > 0)
+        order.push_back(v);
+    std::sort(order.begin(), order.end(), heavier_right_node(right_weights));
+
+    std::vector<size_t> left_mate_edges(num_left, npos);
+    right_mate_edges.assign(num_right, npos);
+    std::vector<size_t> left_stamp(num_left, 0), next_arc(num_right);
+    std::vector<bool> dead(num_left, false);
+    std::vector<size_t> stack, path, visited;
+    for (size_t i = 0; i < order.size(); ++i) {
+      size_t root = order[i], stamp = i + 1;
+      bool augmented = false;
+      stack.assign(1, root);
+      path.clear();
+      visited.clear();
+      next_arc[root] = offsets[root];
+      while (!stack.empty() && !augmented) {
+        size_t v = stack.back();
+        if (next_arc[v] == offsets[v + 1]) {
+          stack.pop_back();
+          if (!path.empty())
+            path.pop_back();
+          continue;
+        }
+        size_t e = adj[next_arc[v]++];
+        size_t u = edges[e].left;
+        if (dead[u] || left_stamp[u] == stamp)
+          continue;
+        left_stamp[u] = stamp;
+        visited.push_back(u);
+        path.push_back(e);
+        if (left_mate_edges[u] == npos) {
+          for (size_t k = 0; k < path.size(); ++k) {
+            left_mate_edges[edges[path[k]].left] = path[k];
+            right_mate_edges[edges[path[k]].right] = path[k];
+          }
+          augmented = true;
+        } else {
+          size_t v2 = edges[left_mate_edges[u]].right;
+          next_arc[v2] = offsets[v2];
+          stack.push_back(v2);
+        }
+      }
+      if (!augmented)
+        for (size_t k = 0; k < visited.size(); ++k)
+          dead[visited[k]] = true;
+    }
+  }
+}
+
+inline void max_weight_matching(size_t num_left,
+                                size_t num_right,
+                                const std::vector<bipartite_edge>& edges,
+                                std::vector<size_t>& right_mate_edges)
+{
+  // If the weight of each edge depends only on its right node, as for the
+  // contig scores, a simpler greedy algorithm applies.
+  {
+    const double unset = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> right_weights(num_right, unset);
+    bool right_weighted = true;
+    for (size_t e = 0; e < edges.size() && right_weighted; ++e) {
+      double& w = right_weights[edges[e].right];
+      if (w != w) // unset
+        w = edges[e].weight;
+      else if (w != edges[e].weight)
+        right_weighted = false;
+    }
+    if (right_weighted) {
+      detail::right_weighted_matching(num_left, num_right, edges, right_weights, right_mate_edges);
+      return;
+    }
+  }
+
+  // This is min-cost flow from a source s, through the left nodes and then
+  // the right nodes, to a sink t, where each edge costs minus its weight. The
+  // residual graph has arcs s -> u for each free left node u, u -> v for each
+  // unmatched edge, v -> u for each matched edge, and v -> t for each free
+  // right node v. Node potentials (pot_left, pot_right, pot_t, and 0 for s)
+  // keep the reduced costs nonnegative, so Dijkstra's algorithm applies.
+  const size_t npos = bipartite_edge::npos;
+  const double inf  = std::numeric_limits<double>::infinity();
+  std::vector<size_t> offsets, adj;
+  detail::bipartite_left_adjacency(num_left, edges, offsets, adj);
+
+  std::vector<size_t> left_mate_edges(num_left, npos);
+  right_mate_edges.assign(num_right, npos);
+
+  // Initial potentials are the shortest path distances from s, which are
+  // easy to find since the graph starts out acyclic.
+  std::vector<double> pot_left(num_left, 0.0), pot_right(num_right, 0.0);
+  for (size_t e = 0; e < edges.size(); ++e)
+    if (edges[e].weight > 0)
+      pot_right[edges[e].right] = std::min(pot_right[edges[e].right], -edges[e].weight);
+  double pot_t = 0.0;
+  for (size_t v = 0; v < num_right; ++v)
+    pot_t = std::min(pot_t, pot_right[v]);
+
+  // Dijkstra's algorithm works on node ids: left nodes are [0, num_left),
+  // right nodes are [num_left, num_left + num_right), and t is the last.
+  const size_t t = num_left + num_right;
+  std::vector<double> dist(t + 1);
+  std::vector<size_t> pred_edge(num_right); // the edge by which each right node was reached
+  size_t t_pred = npos;                     // the right node by which t was reached
+  std::vector<bool> done(t + 1);
+  typedef std::pair<double, size_t> entry;
+  std::priority_queue<entry, std::vector<entry>, std::greater<entry> > Q;
+
+  for (;;) {
+    std::fill(dist.begin(), dist.end(), inf);
+    std::fill(done.begin(), done.end(), false);
+    for (size_t u = 0; u < num_left; ++u) {
+      if (left_mate_edges[u] == npos) {
+        dist[u] = std::max(0.0, -pot_left[u]);
+        Q.push(entry(dist[u], u));
+      }
+    }
+    while (!Q.empty()) {
+      double d = Q.top().first;
+      size_t x = Q.top().second;
+      Q.pop();
+      if (done[x])
+        continue;
+      done[x] = true;
+      if (x == t)
+        break;
+      if (x < num_left) {
+        size_t u = x;
+        for (size_t k = offsets[u]; k < offsets[u + 1]; ++k) {
+          size_t e = adj[k];
+          if (e == left_mate_edges[u] || edges[e].weight <= 0)
+            continue;
+          size_t v = edges[e].right;
+          double nd = d + std::max(0.0, -edges[e].weight + pot_left[u] - pot_right[v]);
+          if (nd < dist[num_left + v]) {
+            dist[num_left + v] = nd;
+            pred_edge[v] = e;
+            Q.push(entry(nd, num_left + v));
+          }
+        }
+      } else {
+        size_t v = x - num_left;
+        size_t m = right_mate_edges[v];
+        if (m == npos) {
+          double nd = d + std::max(0.0, pot_right[v] - pot_t);
+          if (nd < dist[t]) {
+            dist[t] = nd;
+            t_pred = v;
+            Q.push(entry(nd, t));
+          }
+        } else {
+          size_t u = edges[m].left;
+          double nd = d + std::max(0.0, edges[m].weight + pot_right[v] - pot_left[u]);
+          if (nd < dist[u]) {
+            dist[u] = nd;
+            Q.push(entry(nd, u));
+          }
+        }
+      }
+    }
+    Q = std::priority_queue<entry, std::vector<entry>, std::greater<entry> >();
+
+    // Stop if there is no augmenting path, or if the best one would not
+    // increase the weight of the matching.
+    if (dist[t] == inf || dist[t] + pot_t >= 0)
+      break;
+
+    // Update the potentials. Capping the distances at dist[t] keeps the
+    // reduced costs nonnegative even though the search stopped early.
+    for (size_t u = 0; u < num_left; ++u)
+      pot_left[u] += std::min(dist[u], dist[t]);
+    for (size_t v = 0; v < num_right; ++v)
+      pot_right[v] += std::min(dist[num_left + v], dist[t]);
+    pot_t += dist[t];
+
+    // Augment along the path, from t back to s.
+    size_t v = t_pred;
+    for (;;) {
+      size_t e = pred_edge[v];
+      size_t u = edges[e].left;
+      size_t old = left_mate_edges[u];
+      left_mate_edges[u] = e;
+      right_mate_edges[v] = e;
+      if (old == npos)
+        break;
+      v = edges[old].right;
+    }
+  }
+}
+
+namespace detail
+{
+  // Orders edge indices by decreasing weight, breaking ties by index.
+  struct heavier_edge
+  {
+    const std::vector<double>& weights;
+    heavier_edge(const std::vector<double>& weights) : weights(weights) {}
+    bool operator()(size_t e1, size_t e2) const
+    {
+      return weights[e1] > weights[e2] || (weights[e1] == weights[e2] && e1 < e2);
+    }
+  };
+}
+
+// Finds an approximate maximum weight matching (or, if use_weights is false,
+// an approximate maximum cardinality matching, i.e., with all weights taken
+// to be 1), and returns an upper bound on the weight of a maximum matching.
+//
+// The matching is built greedily, taking edges from heaviest to lightest and
+// skipping those with an already-matched endpoint, which gives at least half
+// the maximum weight. It is then improved by local search: a free right node
+// v can take the left node u of a matched edge (u, v'), and the freed right
+// node v' can in turn take a free left node u', whenever this increases the
+// weight. The search makes at most max_passes passes over the free right
+// nodes, each linear in the number of edges. (For cardinality, once no such
+// paths of three edges remain, the matching is at least 2/3 of the maximum.)
+//
+// The upper bound is the least of twice the greedy weight, the sum over the
+// left nodes of their heaviest edges, and the same sum over the right nodes.
+inline double greedy_matching(size_t num_left,
+                              size_t num_right,
+                              const std::vector<bipartite_edge>& edges,
+                              bool use_weights,
+                              std::vector<size_t>& right_mate_edges,
+                              size_t max_passes = 4)
+{
+  const size_t npos = bipartite_edge::npos;
+  std::vector<double> weights(edges.size());
+  for (size_t e = 0; e < edges.size(); ++e)
+    weights[e] = use_weights ? edges[e].weight : 1.0;
+
+  // Upper bounds from the heaviest edge at each node.
+  std::vector<double> left_max(num_left, 0.0), right_max(num_right, 0.0);
+  for (size_t e = 0; e < edges.size(); ++e) {
+    left_max[edges[e].left]   = std::max(left_max[edges[e].left],   weights[e]);
+    right_max[edges[e].right] = std::max(right_max[edges[e].right], weights[e]);
+  }
+  double left_bound = 0.0, right_bound = 0.0;
+  for (size_t u = 0; u < num_left;  ++u) left_bound  += left_max[u];
+  for (size_t v = 0; v < num_right; ++v) right_bound += right_max[v];
+
+  // Greedy matching.
+  std::vector<size_t> order;
+  order.reserve(edges.size());
+  for (size_t e = 0; e < edges.size(); ++e)
+    if (weights[e] > 0)
+      order.push_back(e);
+  std::sort(order.begin(), order.end(), detail::heavier_edge(weights));
+  std::vector<size_t> left_mate_edges(num_left, npos);
+  right_mate_edges.assign(num_right, npos);
+  double greedy_weight = 0.0;
+  for (size_t k = 0; k < order.size(); ++k) {
+    size_t e = order[k];
+    if (left_mate_edges[edges[e].left] == npos && right_mate_edges[edges[e].right] == npos) {
+      left_mate_edges[edges[e].left] = right_mate_edges[edges[e].right] = e;
+      greedy_weight += weights[e];
+    }
+  }
+
+  // Local improvement. For each free right node v, consider each edge
+  // e1 = (u, v) whose left node u is matched by m = (u, v'). Replacing m by e1
+  // gains weights[e1] - weights[m]; also matching v' by some e2 = (u', v')
+  // with u' free gains weights[e2] more.
+  std::vector<size_t> offsets(num_right + 1, 0), adj(order.size());
+  for (size_t k = 0; k < order.size(); ++k)
+    ++offsets[edges[order[k]].right + 1];
+  for (size_t v = 0; v < num_right; ++v)
+    offsets[v + 1] += offsets[v];
+  std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+  for (size_t k = 0; k < order.size(); ++k)
+    adj[next[edges[order[k]].right]++] = order[k]; // heaviest first
+  for (size_t pass = 0; pass < max_passes; ++pass) {
+    bool improved = false;
+    for (size_t v = 0; v < num_right; ++v) {
+      if (right_mate_edges[v] != npos)
+        continue;
+      double best_gain = 0.0;
+      size_t best_e1 = npos, best_e2 = npos;
+      for (size_t k1 = offsets[v]; k1 < offsets[v + 1]; ++k1) {
+        size_t e1 = adj[k1];
+        size_t m = left_mate_edges[edges[e1].left]; // u is matched, or the greedy pass would have taken e1
+        double gain = weights[e1] - weights[m];
+        size_t e2 = npos;
+        size_t v2 = edges[m].right;
+        for (size_t k2 = offsets[v2]; k2 < offsets[v2 + 1]; ++k2) {
+          size_t e = adj[k2];
+          if (left_mate_edges[edges[e].left] == npos) {
+            e2 = e; // the heaviest, since adj is sorted
+            break;
+          }
+        }
+        if (e2 != npos)
+          gain += weights[e2];
+        if (gain > best_gain) {
+          best_gain = gain;
+          best_e1 = e1;
+          best_e2 = e2;
+        }
+      }
+      if (best_e1 == npos)
+        continue;
+      right_mate_edges[edges[left_mate_edges[edges[best_e1].left]].right] = npos;
+      left_mate_edges[edges[best_e1].left] = right_mate_edges[v] = best_e1;
+      if (best_e2 != npos)
+        left_mate_edges[edges[best_e2].left] = right_mate_edges[edges[best_e2].right] = best_e2;
+      improved = true;
+    }
+    if (!improved)
+      break;
+  }
+
+  return std::min(2 * greedy_weight, std::min(left_bound, right_bound));
+}
@@ -24,6 +24,7 @@
 #include "lazycsv.hh"
 #include "line_stream.hh"
 #include "alignment_segment.hh"
+#include "string_ref.hh"
 
 namespace detail
 {
@@ -40,9 +41,11 @@ class blast_alignment
 {
 public:
   // Realization of Alignment concept
-  void parse_line(const std::string& line) { lazy_csv.parse_line(line); }
+  void parse_line(const std::string& line) { lazy_csv.parse_line(line); parse_fields(); }
   std::string a_name()        const { return lazy_csv.at<std::string>(0); }
   std::string b_name()        const { return lazy_csv.at<std::string>(2); }
+  string_ref  a_name_ref()    const { return string_ref(lazy_csv.begin(0), lazy_csv.end(0)); }
+  string_ref  b_name_ref()    const { return string_ref(lazy_csv.begin(2), lazy_csv.end(2)); }
   double      frac_identity_wrt_a() const { return 1.0 * nident() * (qframe() == 0 ? 1 : 3) / qlen(); }
   double      frac_identity_wrt_b() const { return 1.0 * nident() * (sframe() == 0 ? 1 : 3) / slen(); }
   int         num_identity_wrt_a()  const { return       nident() * (qframe() == 0 ? 1 : 3)         ; }
@@ -53,7 +56,7 @@ public:
   int         num_indel_wrt_b()     const { return       gaps()   * (sframe() == 0 ? 1 : 3)         ; }
   typedef detail::blast_alignment_input_stream input_stream_type;
   typedef detail::blast_alignment_segments     segments_type;
-  segments_type segments(const std::string& a, const std::string& b) const; // defined below
+  segments_type segments(string_ref a, string_ref b) const; // defined below
 
   inline bool is_on_valid_strand(bool strand_specific) const
   {
@@ -66,26 +69,38 @@ public:
   inline int num_identity() const { return nident(); } // right?
   inline int num_indel()    const { return gaps(); } // right?
 
-  // For use by blast-specific algorithms:
-  inline  int         qlen  ()        const { return lazy_csv.at<int>        ( 1); }
-  inline  int         slen  ()        const { return lazy_csv.at<int>        ( 3); }
-  inline  int         qstart()        const { return lazy_csv.at<int>        ( 4) - 1; } // 1-based -> 0-based
-  inline  int         qend  ()        const { return lazy_csv.at<int>        ( 5) - 1; }
-  inline  int         sstart()        const { return lazy_csv.at<int>        ( 6) - 1; }
-  inline  int         send  ()        const { return lazy_csv.at<int>        ( 7) - 1; }
+  // For use by blast-specific algorithms. The integer fields are parsed once,
+  // by parse_line; the rest are converted on demand.
+  inline  int         qlen  ()        const { return ints[ 1]; }
+  inline  int         slen  ()        const { return ints[ 3]; }
+  inline  int         qstart()        const { return ints[ 4] - 1; } // 1-based -> 0-based
+  inline  int         qend  ()        const { return ints[ 5] - 1; }
+  inline  int         sstart()        const { return ints[ 6] - 1; }
+  inline  int         send  ()        const { return ints[ 7] - 1; }
   inline  std::string qseq  ()        const { return lazy_csv.at<std::string>( 8); }
   inline  std::string sseq  ()        const { return lazy_csv.at<std::string>( 9); }
   inline  double      evalue()        const { return lazy_csv.at<double>     (10); }
-  inline  int         nident()        const { return lazy_csv.at<int>        (15); }
-  inline  int         gaps  ()        const { return lazy_csv.at<int>        (19); }
-  inline  int         qframe()        const { return lazy_csv.at<int>        (21); }
-  inline  int         sframe()        const { return lazy_csv.at<int>        (22); }
+  inline  int         nident()        const { return ints[15]; }
+  inline  int         gaps  ()        const { return ints[19]; }
+  inline  int         qframe()        const { return ints[21]; }
+  inline  int         sframe()        const { return ints[22]; }
 
   bool operator==(const blast_alignment& other) const { return lazy_csv == other.lazy_csv; }
   bool operator!=(const blast_alignment& other) const { return !(*this == other); }
 
 private:
   lazycsv<23, '\t'> lazy_csv;
+
+  // Cached integer fields, indexed by column; only the columns read by the
+  // accessors above are filled in.
+  boost::array<int, 23> ints;
+
+  void parse_fields()
+  {
+    static const size_t cols[] = { 1, 3, 4, 5, 6, 7, 15, 19, 21, 22 };
+    for (size_t i = 0; i < sizeof(cols)/sizeof(cols[0]); ++i)
+      ints[cols[i]] = parse_integer<int>(lazy_csv.begin(cols[i]), lazy_csv.end(cols[i]));
+  }
 };
 
 namespace detail
@@ -260,7 +275,7 @@ namespace detail
 
 } // namespace detail
 
-blast_alignment::segments_type blast_alignment::segments(const std::string& /*a*/, const std::string& /*b*/) const
+blast_alignment::segments_type blast_alignment::segments(string_ref /*a*/, string_ref /*b*/) const
 {
   return blast_alignment::segments_type(*this);
 }
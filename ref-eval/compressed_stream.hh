@@ -0,0 +1,305 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <boost/shared_ptr.hpp>
+
+// Transparent decompression of input files.
+//
+// open_compressed_or_throw() looks at the first bytes of a file and returns an
+// std::istream that yields the file's uncompressed contents:
+//
+// - BGZF files (as written by bgzip and samtools) are decompressed a batch of
+//   blocks at a time, with the blocks of each batch inflated in parallel, since
+//   BGZF blocks are independent of each other.
+//
+// - Other gzip files are decompressed sequentially by zlib.
+//
+// - Anything else is read as is.
+//
+// Decompression errors (e.g., a truncated file) are reported by throwing
+// std::runtime_error from the stream's read operations, rather than by
+// silently setting the stream's failbit as if the end of file had been reached.
+
+namespace detail
+{
+  ////////////////////////////////////////////////////////////////////////////
+  // gzip_streambuf decompresses a (possibly multi-member) gzip file with
+  // zlib's gz* interface.
+  ////////////////////////////////////////////////////////////////////////////
+
+  class gzip_streambuf : public std::streambuf
+  {
+  public:
+    gzip_streambuf(const std::string& filename)
+    : filename(filename),
+      gz(gzopen(filename.c_str(), "rb")),
+      buf(256 * 1024)
+    {
+      if (gz == NULL)
+        throw std::runtime_error("Could not open file '" + filename + "'.");
+      gzbuffer(gz, 256 * 1024);
+    }
+
+    ~gzip_streambuf() { gzclose(gz); }
+
+  protected:
+    int_type underflow()
+    {
+      if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+      int n = gzread(gz, &buf[0], buf.size());
+      if (n < 0) {
+        int errnum;
+        throw std::runtime_error("Could not decompress '" + filename + "': " + gzerror(gz, &errnum));
+      }
+      if (n == 0)
+        return traits_type::eof();
+      setg(&buf[0], &buf[0], &buf[0] + n);
+      return traits_type::to_int_type(*gptr());
+    }
+
+  private:
+    std::string filename;
+    gzFile gz;
+    std::vector<char> buf;
+
+    gzip_streambuf(const gzip_streambuf&);
+    gzip_streambuf& operator=(const gzip_streambuf&);
+  };
+
+  ////////////////////////////////////////////////////////////////////////////
+  // bgzf_streambuf decompresses a BGZF file. It reads a batch of compressed
+  // blocks sequentially, inflates all the blocks of the batch in parallel,
+  // and then hands out their contents in order.
+  ////////////////////////////////////////////////////////////////////////////
+
+  // Checks whether header (of length 18) is a BGZF block header. This is the
+  // same check as the one done by check_header() in sam/bgzf.c.
+  inline bool is_bgzf_header(const unsigned char *header)
+  {
+    return header[0] == 31 && header[1] == 139 && header[2] == Z_DEFLATED &&
+           (header[3] & 4) != 0 &&                        // FLG.FEXTRA
+           (header[10] | (header[11] << 8)) == 6 &&       // XLEN
+           header[12] == 'B' && header[13] == 'C' &&      // SI1, SI2
+           (header[14] | (header[15] << 8)) == 2;         // SLEN
+  }
+
+  class bgzf_streambuf : public std::streambuf
+  {
+  public:
+    static const size_t header_length = 18;
+    static const size_t max_block_size = 64 * 1024;
+    static const size_t batch_size = 256; // at most 16 MB of uncompressed data at a time
+
+    bgzf_streambuf(const std::string& filename)
+    : filename(filename),
+      fp(fopen(filename.c_str(), "rb")),
+      compressed(batch_size),
+      uncompressed(batch_size),
+      uncompressed_lengths(batch_size),
+      errors(batch_size),
+      next_block(0),
+      num_blocks(0),
+      at_eof(false)
+    {
+      if (fp == NULL)
+        throw std::runtime_error("Could not open file '" + filename + "'.");
+      for (size_t i = 0; i < batch_size; ++i) {
+        compressed[i].resize(max_block_size);
+        uncompressed[i].resize(max_block_size);
+      }
+    }
+
+    ~bgzf_streambuf() { fclose(fp); }
+
+  protected:
+    int_type underflow()
+    {
+      if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+      // Skip past empty blocks, such as the EOF marker block.
+      while (next_block < num_blocks && uncompressed_lengths[next_block] == 0)
+        ++next_block;
+      if (next_block == num_blocks) {
+        if (at_eof)
+          return traits_type::eof();
+        read_batch();
+        return underflow();
+      }
+      char *b = &uncompressed[next_block][0];
+      setg(b, b, b + uncompressed_lengths[next_block]);
+      ++next_block;
+      return traits_type::to_int_type(*gptr());
+    }
+
+  private:
+    std::string filename;
+    FILE *fp;
+    std::vector<std::vector<unsigned char> > compressed;
+    std::vector<std::vector<char> >          uncompressed;
+    std::vector<int>                         uncompressed_lengths;
+    std::vector<const char *>                errors;
+    size_t next_block, num_blocks;
+    bool at_eof;
+
+    void fail(const std::string& msg)
+    {
+      throw std::runtime_error("Could not decompress '" + filename + "': " + msg);
+    }
+
+    // Reads the next batch of blocks and inflates them.
+    void read_batch()
+    {
+      next_block = num_blocks = 0;
+      std::vector<size_t> block_lengths(batch_size);
+      while (num_blocks < batch_size) {
+        unsigned char *block = &compressed[num_blocks][0];
+        size_t count = fread(block, 1, header_length, fp);
+        if (count == 0) {
+          at_eof = true;
+          break;
+        }
+        if (count != header_length)
+          fail("truncated block header");
+        if (!is_bgzf_header(block))
+          fail("invalid block header");
+        size_t block_length = (block[16] | (block[17] << 8)) + 1;
+        if (block_length < header_length + 8)
+          fail("invalid block size");
+        size_t remaining = block_length - header_length;
+        if (fread(block + header_length, 1, remaining, fp) != remaining)
+          fail("truncated block");
+        block_lengths[num_blocks] = block_length;
+        ++num_blocks;
+      }
+
+      #pragma omp parallel for
+      for (int i = 0; i < static_cast<int>(num_blocks); ++i)
+        uncompressed_lengths[i] = inflate_block(i, block_lengths[i]);
+
+      for (size_t i = 0; i < num_blocks; ++i)
+        if (errors[i] != NULL)
+          fail(errors[i]);
+    }
+
+    // Inflates the i'th block of the batch. This is called from several
+    // threads at once, so it records errors instead of throwing them.
+    int inflate_block(size_t i, size_t block_length)
+    {
+      const unsigned char *block = &compressed[i][0];
+      errors[i] = NULL;
+
+      z_stream zs;
+      zs.zalloc   = Z_NULL;
+      zs.zfree    = Z_NULL;
+      zs.opaque   = Z_NULL;
+      zs.next_in  = const_cast<unsigned char *>(block + header_length);
+      zs.avail_in = block_length - header_length - 8; // exclude CRC32 and ISIZE
+      zs.next_out  = reinterpret_cast<unsigned char *>(&uncompressed[i][0]);
+      zs.avail_out = max_block_size;
+
+      if (inflateInit2(&zs, -15) != Z_OK) { // raw deflate data, no zlib header
+        errors[i] = "inflate init failed";
+        return 0;
+      }
+      int status = inflate(&zs, Z_FINISH);
+      inflateEnd(&zs);
+      if (status != Z_STREAM_END) {
+        errors[i] = "inflate failed";
+        return 0;
+      }
+
+      // Check the uncompressed length against the block's ISIZE field.
+      const unsigned char *isize = block + block_length - 4;
+      unsigned long expected = isize[0] | (isize[1] << 8) | (isize[2] << 16) | (static_cast<unsigned long>(isize[3]) << 24);
+      if (zs.total_out != expected) {
+        errors[i] = "uncompressed block size does not match its header";
+        return 0;
+      }
+      return zs.total_out;
+    }
+
+    bgzf_streambuf(const bgzf_streambuf&);
+    bgzf_streambuf& operator=(const bgzf_streambuf&);
+  };
+
+  ////////////////////////////////////////////////////////////////////////////
+  // streambuf_istream is an istream that owns its streambuf.
+  ////////////////////////////////////////////////////////////////////////////
+
+  template<typename Streambuf>
+  class streambuf_istream : public std::istream
+  {
+  public:
+    streambuf_istream(const std::string& filename)
+    : std::istream(NULL),
+      buf(filename)
+    {
+      rdbuf(&buf);
+      // Rethrow exceptions from buf (e.g., about corrupt input) instead of
+      // just setting badbit.
+      exceptions(std::ios::badbit);
+    }
+
+  private:
+    Streambuf buf;
+  };
+} // namespace detail
+
+// Returns the kind of compression used by filename: "bgzf", "gzip", or
+// "none".
+std::string detect_compression(const std::string& filename)
+{
+  unsigned char header[detail::bgzf_streambuf::header_length];
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  if (!ifs)
+    throw std::runtime_error("Could not open file '" + filename + "'.");
+  ifs.read(reinterpret_cast<char *>(header), sizeof(header));
+  size_t count = ifs.gcount();
+  if (count < 2 || header[0] != 31 || header[1] != 139)
+    return "none";
+  if (count == sizeof(header) && detail::is_bgzf_header(header))
+    return "bgzf";
+  return "gzip";
+}
+
+boost::shared_ptr<std::istream> open_compressed_or_throw(const std::string& filename)
+{
+  std::string compression = detect_compression(filename);
+  if (compression == "bgzf")
+    return boost::shared_ptr<std::istream>(new detail::streambuf_istream<detail::bgzf_streambuf>(filename));
+  else if (compression == "gzip")
+    return boost::shared_ptr<std::istream>(new detail::streambuf_istream<detail::gzip_streambuf>(filename));
+  else {
+    boost::shared_ptr<std::istream> ifs(new std::ifstream(filename.c_str()));
+    if (!*ifs)
+      throw std::runtime_error("Could not open file '" + filename + "'.");
+    return ifs;
+  }
+}
@@ -27,7 +27,7 @@ void read_rsem_expr(expr& tau,
                     const std::string& filename,
                     const fasta& fa)
 {
-  boost::shared_ptr<std::ifstream> ifs = open_or_throw(filename);
+  boost::shared_ptr<std::istream> ifs = open_or_throw(filename);
   std::string line;
   lazycsv<8, '\t'> lc;
 
@@ -47,13 +47,13 @@ void read_rsem_expr(expr& tau,
       // Parse the line.
       lc.parse_line(line);
       // Check the sequence name and get the corresponding idx.
-      std::string name = lc.at<std::string>(0);
-      if (fa.names_to_idxs.count(name) == 0)
-        throw std::runtime_error("Sequence name " + name + " is not found in the corresponding fasta file.");
-      size_t idx = fa.names_to_idxs.find(name)->second;
+      string_ref name(lc.begin(0), lc.end(0));
+      size_t idx = fa.names_to_idxs.find(name);
+      if (idx == name_index::npos)
+        throw std::runtime_error("Sequence name " + name.str() + " is not found in the corresponding fasta file.");
       // Check that the idx has not already been seen.
       if (seen[idx])
-        throw std::runtime_error("Duplicate sequence name " + name);
+        throw std::runtime_error("Duplicate sequence name " + name.str());
       // Actually extract the expression.
       tau[idx] = lc.at<double>(5) / 1000000.0;
       seen[idx] = true;
@@ -62,7 +62,7 @@ void read_rsem_expr(expr& tau,
     // Check that all idxs were seen.
     for (size_t i = 0; i < fa.card; ++i)
       if (!seen[i])
-        throw std::runtime_error("No expression for sequence name " + fa.names[i]);
+        throw std::runtime_error("No expression for sequence name " + fa.names[i].str());
 
   } catch (const std::runtime_error& x) {
     throw std::runtime_error("Can't parse " + filename + ": " + x.what());
@@ -22,6 +22,7 @@
 #include <string>
 #include "line_stream.hh"
 #include "alignment_segment.hh"
+#include "string_ref.hh"
 
 namespace detail
 {
@@ -40,11 +41,13 @@ public:
   void parse_line(const std::string& /*line*/) { throw std::runtime_error("Not implemented."); }
   std::string a_name()        const { return a_name_; }
   std::string b_name()        const { return b_name_; }
+  string_ref  a_name_ref()    const { return a_name_; }
+  string_ref  b_name_ref()    const { return b_name_; }
   double      frac_identity() const { return frac_identity_; }
   double      frac_indel()    const { return frac_indel_; }
   typedef detail::fake_alignment_input_stream   input_stream_type;
   typedef const std::vector<alignment_segment>& segments_type;
-  segments_type segments(const std::string& /*a*/, const std::string& /*b*/) const { return alignment_segments; }
+  segments_type segments(string_ref /*a*/, string_ref /*b*/) const { return alignment_segments; }
 
   // Data
   std::string a_name_, b_name_;
@@ -18,36 +18,153 @@
 // along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <boost/foreach.hpp>
 #include "util.hh"
-#include "deweylab/bio/formats/fasta.hh"
+#include "mapped_file.hh"
+#include "name_index.hh"
+#include "seq_arena.hh"
 
+// The sequences and names of a FASTA file. Both are held in arenas (see
+// seq_arena.hh), so seqs[i] and names[i] are string_refs into a single buffer
+// each, rather than separately allocated strings.
 struct fasta
 {
   size_t card;
-  std::vector<std::string> seqs;
-  std::vector<std::string> names;
-  std::map<std::string, size_t> names_to_idxs;
+  seq_arena seqs;
+  seq_arena names;
+  name_index names_to_idxs;
   std::vector<size_t> lengths;
 };
 
+namespace detail {
+
+  inline bool is_fasta_whitespace(char c)
+  {
+    switch (c) {
+      case ' ': case '\t': case '\n': case '\r': case '\f': case '\v':
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // The extent of one record within the text of a FASTA file. The sequence
+  // range still contains line breaks and any other whitespace.
+  struct fasta_record_extent
+  {
+    const char *name_beg, *name_end;
+    const char *seq_beg, *seq_end;
+  };
+
+  // Splits the text [beg, end) into records, following the same rules as
+  // deweylab::bio::formats::fasta::InputStream: a record starts at any '>'
+  // that is not within a title line, its name is the title up to the first
+  // whitespace character, and its sequence is everything up to the next
+  // record. Text before the first '>' is ignored.
+  //
+  // The '>' characters are found in parallel, one chunk of the text at a
+  // time. Those that turn out to be within a title line are then dropped in a
+  // serial pass, which only needs to look at the '>' characters themselves.
+  void find_fasta_records(std::vector<fasta_record_extent>& recs,
+                          const char *beg, const char *end)
+  {
+    const size_t chunk_size = 1 << 20;
+    size_t num_chunks = (end - beg + chunk_size - 1) / chunk_size;
+    std::vector<std::vector<const char *> > starts(num_chunks);
+    #pragma omp parallel for
+    for (int c = 0; c < static_cast<int>(num_chunks); ++c) {
+      const char *p = beg + c * chunk_size;
+      const char *chunk_end = std::min(p + chunk_size, end);
+      while ((p = static_cast<const char *>(std::memchr(p, '>', chunk_end - p))) != NULL)
+        starts[c].push_back(p++);
+    }
+
+    const char *title_end = beg;
+    for (size_t c = 0; c < num_chunks; ++c) {
+      BOOST_FOREACH(const char *p, starts[c]) {
+        if (p < title_end)
+          continue;
+        if (!recs.empty())
+          recs.back().seq_end = p;
+        fasta_record_extent r;
+        r.name_beg = p + 1;
+        title_end = static_cast<const char *>(std::memchr(r.name_beg, '\n', end - r.name_beg));
+        if (title_end == NULL)
+          title_end = end;
+        r.name_end = r.name_beg;
+        while (r.name_end != title_end && !is_fasta_whitespace(*r.name_end))
+          ++r.name_end;
+        r.seq_beg = title_end == end ? end : title_end + 1;
+        r.seq_end = end;
+        recs.push_back(r);
+      }
+    }
+  }
+
+  // Parses the text [beg, end) of a FASTA file into fa. Each step apart from
+  // building the name index runs in parallel.
+  void parse_fasta(fasta& fa, const char *beg, const char *end,
+                   const std::string& filename)
+  {
+    std::vector<fasta_record_extent> recs;
+    find_fasta_records(recs, beg, end);
+    size_t n = recs.size();
+
+    std::vector<size_t> name_lengths(n);
+    fa.lengths.resize(n);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < static_cast<int>(n); ++i) {
+      const fasta_record_extent& r = recs[i];
+      name_lengths[i] = r.name_end - r.name_beg;
+      size_t len = 0;
+      for (const char *c = r.seq_beg; c != r.seq_end; ++c)
+        len += !is_fasta_whitespace(*c);
+      fa.lengths[i] = len;
+    }
+
+    fa.names.allocate(name_lengths);
+    fa.seqs.allocate(fa.lengths);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < static_cast<int>(n); ++i) {
+      const fasta_record_extent& r = recs[i];
+      std::copy(r.name_beg, r.name_end, fa.names.data(i));
+      std::remove_copy_if(r.seq_beg, r.seq_end, fa.seqs.data(i), is_fasta_whitespace);
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      if (!fa.names_to_idxs.insert(fa.names[i]))
+        throw std::runtime_error("Found duplicate sequence id in " + filename + ".");
+      assert(fa.names_to_idxs.find(fa.names[i]) == i);
+    }
+    fa.card = n;
+  }
+
+} // namespace detail
+
+// Reads the FASTA file filename into fa. Uncompressed files are memory-mapped
+// and parsed in place; compressed files are first decompressed into memory.
 void read_fasta(fasta& fa, const std::string& filename)
 {
   try {
-    boost::shared_ptr<std::ifstream> ifs = open_or_throw(filename);
-    deweylab::bio::formats::fasta::InputStream is(*ifs);
-    deweylab::bio::formats::fasta::Record rec;
-    size_t idx = 0;
-    while (is >> rec) {
-      if (fa.names_to_idxs.count(rec.id) != 0)
-        throw std::runtime_error("Found duplicate sequence id in " + filename + ".");
-      fa.names_to_idxs[rec.id] = idx;
-      fa.names  .push_back(rec.id);
-      fa.seqs   .push_back(rec.sequence);
-      fa.lengths.push_back(rec.sequence.size());
-      assert(fa.names[fa.names_to_idxs[rec.id]] == rec.id);
-      ++idx;
+    if (detect_compression(filename) == "none") {
+      mapped_file f(filename);
+      if (f.data != NULL) {
+        detail::parse_fasta(fa, f.data, f.data + f.size, filename);
+        return;
+      }
     }
-    fa.card = fa.seqs.size();
+    boost::shared_ptr<std::istream> ifs = open_or_throw(filename);
+    std::vector<char> text;
+    std::vector<char> buf(1 << 20);
+    while (ifs->read(&buf[0], buf.size()) || ifs->gcount() > 0)
+      text.insert(text.end(), buf.begin(), buf.begin() + ifs->gcount());
+    if (ifs->bad())
+      throw std::runtime_error("Error reading " + filename + ".");
+    const char *beg = text.empty() ? NULL : &text[0];
+    detail::parse_fasta(fa, beg, beg + text.size(), filename);
   } catch (const std::runtime_error& x) {
     throw std::runtime_error("Can't parse " + filename + ": " + x.what());
   }
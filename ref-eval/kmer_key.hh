@@ -18,6 +18,7 @@
 // along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
+#include <stdint.h>
 #include "city.h"
 
 typedef const char * kmer_key;
@@ -52,3 +53,16 @@ struct kmer_key_equal_to
     return true;
   }
 };
+
+// A kmer packed into a word by packed_seqs (see packed_seqs.hh). Unlike a
+// kmer_key, it does not point into the sequences, and equal kmers are equal
+// words, so the kmer length is not needed to hash or compare it.
+typedef uint64_t packed_kmer_key;
+
+struct packed_kmer_key_hash
+{
+  size_t operator()(packed_kmer_key k) const
+  {
+    return CityHash64(reinterpret_cast<const char *>(&k), sizeof(k));
+  }
+};
@@ -0,0 +1,204 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+#include <sparsehash/sparse_hash_map>
+#include <sparsehash/dense_hash_map>
+#include "expr.hh"
+#include "kmer_key.hh"
+#include "packed_seqs.hh"
+#include "seq_arena.hh"
+#include "skip_Ns.hh"
+
+// Support for scoring several expression profiles in one pass, which the kmer
+// and kc scores do when --A-expr or --B-expr is given several times (see
+// num_expr_profiles in opts.hh). Their usual kmer tables hold a fixed number
+// of weights per kmer, so instead, each distinct kmer is given an id the first
+// time it is seen, and a kmer_profile_table holds the kmer's weights under
+// every profile in the id's row. The sequences are thus walked, and each kmer
+// hashed, only once, however many profiles there are.
+
+namespace re {
+
+// The id map of the same kind (sparse or dense, with the same key, hash, and
+// equality) as the kmer map Ht.
+template<typename Ht>
+struct id_map_of;
+
+template<typename K, typename V, typename H, typename E, typename A>
+struct id_map_of<google::sparse_hash_map<K, V, H, E, A> >
+{
+  typedef google::sparse_hash_map<K, size_t, H, E> type;
+};
+
+template<typename K, typename V, typename H, typename E, typename A>
+struct id_map_of<google::dense_hash_map<K, V, H, E, A> >
+{
+  typedef google::dense_hash_map<K, size_t, H, E> type;
+};
+
+// Sets the empty key of a dense id map, as empty_key_initializer does for the
+// kmer maps.
+template<typename Ids>
+struct id_map_empty_key_initializer
+{
+  id_map_empty_key_initializer(Ids&, size_t)
+  {}
+};
+
+template<typename H, typename E, typename A>
+struct id_map_empty_key_initializer<google::dense_hash_map<kmer_key, size_t, H, E, A> >
+{
+  std::string empty_string;
+  id_map_empty_key_initializer(google::dense_hash_map<kmer_key, size_t, H, E, A>& ids, size_t kmerlen)
+  : empty_string(kmerlen, ' ')
+  {
+    ids.set_empty_key(empty_string.c_str());
+  }
+};
+
+template<typename H, typename E, typename A>
+struct id_map_empty_key_initializer<google::dense_hash_map<packed_kmer_key, size_t, H, E, A> >
+{
+  id_map_empty_key_initializer(google::dense_hash_map<packed_kmer_key, size_t, H, E, A>& ids, size_t)
+  {
+    ids.set_empty_key(~packed_kmer_key(0));
+  }
+};
+
+// The weights of the kmers in ids, width per kmer.
+template<typename Ids, typename Number>
+class kmer_profile_table
+{
+public:
+  typedef typename Ids::key_type key_type;
+  typedef Number                 number_type;
+
+  kmer_profile_table(Ids& ids, size_t width)
+  : width(width),
+    ids(ids)
+  {}
+
+  // Returns the row of kmer x, adding a row of zeros if x is new.
+  Number *row(const key_type& x)
+  {
+    std::pair<typename Ids::iterator, bool> r = ids.insert(std::make_pair(x, size()));
+    if (r.second)
+      weights.resize(weights.size() + width, 0);
+    return &weights[r.first->second * width];
+  }
+
+  const Number *row_at(size_t id) const { return &weights[id * width]; }
+  size_t size() const { return weights.size() / width; }
+
+  const size_t width;
+
+private:
+  Ids& ids;
+  std::vector<Number> weights;
+};
+
+// Adds the expression of sequence i under each profile in taus to columns
+// [column, column + taus.size()) of the row of kmer x.
+template<typename Table>
+struct add_profile_weights
+{
+  Table& table;
+  const std::vector<const expr *>& taus;
+  size_t column;
+
+  add_profile_weights(Table& table, const std::vector<const expr *>& taus, size_t column)
+  : table(table), taus(taus), column(column)
+  {}
+
+  void operator()(size_t i, const typename Table::key_type& x)
+  {
+    typename Table::number_type *row = table.row(x) + column;
+    for (size_t p = 0; p < taus.size(); ++p)
+      row[p] += (*taus[p])[i];
+  }
+};
+
+// Calls f(i, x) for each kmer x of each sequence i of A, and of its reverse
+// complement in A_rc unless strand_specific, skipping the kmers that contain
+// an N. The kmers are visited in the same order as by count_kmers (in
+// re_kmer.hh).
+template<typename F>
+void for_each_kmer(
+    const seq_arena& A,
+    const seq_arena& A_rc,
+    size_t kmerlen,
+    bool strand_specific,
+    F& f)
+{
+  size_t num_strands = strand_specific ? 1 : 2;
+  for (size_t i = 0; i < A.size(); ++i) {
+    for (size_t which = 0; which < num_strands; ++which) {
+      string_ref a = which == 0 ? A[i] : A_rc[i];
+      if (a.size() >= kmerlen) {
+        const char *beg = a.data();
+        const char *a_end = a.data() + a.size() + 1 - kmerlen;
+        beg = skip_Ns(beg, a_end, kmerlen, true);
+        for (; beg != a_end; ++beg) {
+          beg = skip_Ns(beg, a_end, kmerlen, false);
+          if (beg == a_end)
+            break;
+          f(i, beg);
+        }
+      }
+    }
+  }
+}
+
+// Like for_each_kmer, but for packed sequences, in the same order as by
+// count_packed_kmers (in re_kmer.hh).
+template<typename F>
+void for_each_packed_kmer(
+    const packed_seqs& A,
+    size_t kmerlen,
+    bool strand_specific,
+    F& f)
+{
+  size_t shift = 2 * (kmerlen - 1);
+  for (size_t i = 0; i < A.size(); ++i) {
+    const packed_seqs::exception_run *r = A.exceptions_begin(i), *r_end = A.exceptions_end(i);
+    for (size_t p = 0; p < A.length(i); ++r) {
+      size_t q = r == r_end ? A.length(i) : r->start - A.offset(i);
+      if (q - p >= kmerlen) {
+        packed_kmer_key x = A.kmer(i, p, kmerlen);
+        for (size_t j = p; ; ++j) {
+          f(i, x);
+          if (!strand_specific)
+            f(i, packed_seqs::reverse_complement_kmer(x, kmerlen));
+          if (j + kmerlen == q)
+            break;
+          x = (x >> 2) | (static_cast<packed_kmer_key>(A.base(i, j + kmerlen)) << shift);
+        }
+      }
+      if (r == r_end)
+        break;
+      p = r->end() - A.offset(i);
+    }
+  }
+}
+
+} // namespace re
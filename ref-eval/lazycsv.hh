@@ -18,9 +18,75 @@
 // along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
+#include <limits>
+#include <stdexcept>
+#include <string>
 #include <boost/lexical_cast.hpp>
 #include <boost/array.hpp>
 
+// Parses the decimal integer in [beg, end), without first copying it into a
+// std::string. This is similar in spirit to C++17's std::from_chars, except
+// that the whole range must be consumed; anything else (including an empty
+// range or a value that does not fit in T) is an error.
+template<typename T>
+T parse_integer(const char *beg, const char *end)
+{
+  const char *p = beg;
+  bool negative = false;
+  if (p != end && *p == '-' && std::numeric_limits<T>::is_signed) {
+    negative = true;
+    ++p;
+  }
+  if (p == end)
+    throw std::runtime_error("Invalid integer: '" + std::string(beg, end) + "'");
+
+  // Accumulate the magnitude as an unsigned number, checking for overflow.
+  unsigned long long limit = negative
+    ? static_cast<unsigned long long>(-(std::numeric_limits<T>::min() + 1)) + 1
+    : static_cast<unsigned long long>(std::numeric_limits<T>::max());
+  unsigned long long x = 0;
+  for (; p != end; ++p) {
+    unsigned int d = static_cast<unsigned char>(*p) - '0';
+    if (d > 9 || x > (limit - d) / 10)
+      throw std::runtime_error("Invalid integer: '" + std::string(beg, end) + "'");
+    x = 10*x + d;
+  }
+  return negative ? static_cast<T>(-static_cast<long long>(x - 1) - 1)
+                  : static_cast<T>(x);
+}
+
+namespace detail
+{
+  // Converts the characters [beg, end) of a field to a value of type T. The
+  // integer types use the fast path above; everything else goes through
+  // boost::lexical_cast, which can also read straight from a character range.
+  template<typename T>
+  struct field_converter
+  {
+    static T convert(const char *beg, const char *end) { return boost::lexical_cast<T>(beg, end - beg); }
+  };
+
+  template<> struct field_converter<int>
+  {
+    static int convert(const char *beg, const char *end) { return parse_integer<int>(beg, end); }
+  };
+
+  template<> struct field_converter<long>
+  {
+    static long convert(const char *beg, const char *end) { return parse_integer<long>(beg, end); }
+  };
+
+  template<> struct field_converter<unsigned long>
+  {
+    static unsigned long convert(const char *beg, const char *end) { return parse_integer<unsigned long>(beg, end); }
+  };
+
+  template<> struct field_converter<std::string>
+  {
+    static std::string convert(const char *beg, const char *end) { return std::string(beg, end); }
+  };
+}
+
 template<size_t num_fields, char sep = ','>
 class lazycsv
 {
@@ -32,8 +98,22 @@ public:
   template<typename T>
   inline T at(size_t t) const
   {
-    size_t len = (starts[t+1] - 1) - starts[t]; // "- 1" so as not to include sep char
-    return boost::lexical_cast<T>(line.substr(starts[t], len));
+    return detail::field_converter<T>::convert(begin(t), end(t));
+  }
+
+  // Get pointers to the first character of the t'th field and one past its
+  // last character. These stay valid until the next call to parse_line.
+  inline const char *begin(size_t t) const { return line.data() + starts[t]; }
+  inline const char *end  (size_t t) const { return line.data() + starts[t+1] - 1; } // "- 1" so as not to include sep char
+
+  // Check whether the t'th field is exactly equal to str.
+  inline bool field_equals(size_t t, const char *str) const
+  {
+    const char *b = begin(t), *e = end(t);
+    for (; b != e; ++b, ++str)
+      if (*str == '\0' || *b != *str)
+        return false;
+    return *str == '\0';
   }
 
   void parse_line(const std::string& line_)
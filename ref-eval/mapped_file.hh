@@ -0,0 +1,61 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Maps a file into memory read-only, and unmaps it on destruction. If the file
+// can't be opened or mapped, or is empty, data is NULL and size is 0.
+class mapped_file
+{
+public:
+  mapped_file(const std::string& filename)
+  : data(NULL), size(0)
+  {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+      return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        data = static_cast<const char *>(p);
+        size = st.st_size;
+      }
+    }
+    close(fd);
+  }
+
+  ~mapped_file()
+  {
+    if (data != NULL)
+      munmap(const_cast<char *>(data), size);
+  }
+
+  const char *data;
+  size_t      size;
+
+private:
+  mapped_file(const mapped_file&);
+  mapped_file& operator=(const mapped_file&);
+};
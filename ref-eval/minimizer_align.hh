@@ -0,0 +1,610 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/foreach.hpp>
+#include "alignment_segment.hh"
+#include "mismatch.hh"
+#include "seq_arena.hh"
+#include "tagged_alignment.hh"
+#include "util.hh"
+
+// The built-in aligner used by --alignment-type=builtin, which makes the
+// alignments of the alignment-based scores from the sequences alone. Each
+// sequence of A is aligned to the sequences of B in three steps:
+//
+// - seeding: B is indexed by its minimizers, i.e., by the kmers whose hash is
+//   the smallest within some window of w consecutive kmers, where a kmer and
+//   its reverse complement are treated as the same (canonical) kmer. The
+//   minimizers of the sequence of A are looked up in the index, and each hit
+//   is an anchor: a kmer shared by the two sequences, on one strand or the
+//   other.
+//
+// - chaining: the anchors to the same sequence of B and strand are chained by
+//   dynamic programming, as in minimap, and each chain whose score is high
+//   enough becomes an alignment.
+//
+// - extension: the gaps between consecutive anchors of a chain that are not on
+//   the same diagonal are filled by a banded global alignment of their bases,
+//   and the ends of the chain are extended without gaps. This gives the
+//   ungapped blocks of the alignment.
+//
+// The alignments take the same form as those read_alignments makes from a PSL
+// file: one segment per block, with the coordinates in A descending if the
+// alignment is to the reverse strand, and the mismatches found by
+// find_mismatches. The identity of an alignment is computed as for PSL:
+// matching bases are those in blocks that are not mismatches, and the indels
+// are the bases of either sequence between consecutive blocks.
+
+namespace re {
+namespace align {
+
+struct params
+{
+  size_t k;                 // length of the minimizers' kmers, at most 31
+  size_t w;                 // number of consecutive kmers per window
+  size_t max_occurrences;   // minimizers more frequent in B are not used
+  size_t max_gap;           // longest distance between chained anchors
+  size_t chain_lookback;    // number of earlier anchors each anchor is chained to
+  double min_chain_score;   // roughly, the number of bases covered by anchors
+  size_t max_fill;          // longest gap filled by base-level alignment
+  size_t band;              // extra diagonals of the banded alignment
+  int    x_drop;            // how far the ends' extension may fall below its best score
+
+  params()
+  : k(15),
+    w(10),
+    max_occurrences(200),
+    max_gap(5000),
+    chain_lookback(50),
+    min_chain_score(40),
+    max_fill(2000),
+    band(16),
+    x_drop(20)
+  {}
+};
+
+// A minimizer of a sequence: the hash of its canonical kmer, the position of
+// its first base, and whether the canonical kmer is its reverse complement.
+struct minimizer
+{
+  uint64_t hash;
+  uint32_t seq_idx;
+  uint32_t pos;
+  uint32_t rc;
+
+  bool operator<(const minimizer& other) const
+  {
+    if (hash != other.hash)
+      return hash < other.hash;
+    if (seq_idx != other.seq_idx)
+      return seq_idx < other.seq_idx;
+    return pos < other.pos;
+  }
+};
+
+// An anchor: the kmer at x in the sequence of A, or in its reverse complement
+// if rc, is the kmer at y in the sequence b_idx of B.
+struct anchor
+{
+  uint32_t b_idx, rc;
+  uint32_t x, y;
+
+  bool operator<(const anchor& other) const
+  {
+    if (b_idx != other.b_idx)
+      return b_idx < other.b_idx;
+    if (rc != other.rc)
+      return rc < other.rc;
+    if (x != other.x)
+      return x < other.x;
+    return y < other.y;
+  }
+};
+
+// An ungapped block of an alignment: [x, x + len) in the sequence of A, or in
+// its reverse complement, is aligned to [y, y + len) in the sequence of B.
+struct block
+{
+  size_t x, y, len;
+};
+
+namespace detail
+{
+  // Returns the 2-bit code of the given base, or 4 if it is not one of
+  // ACGTacgt.
+  inline unsigned base_code(char c)
+  {
+    switch (c) {
+      case 'A': case 'a': return 0;
+      case 'C': case 'c': return 1;
+      case 'G': case 'g': return 2;
+      case 'T': case 't': return 3;
+      default:            return 4;
+    }
+  }
+
+  // Whether two bases match, by the same rule as find_mismatches.
+  inline bool bases_match(char a, char b)
+  {
+    unsigned x = base_code(a);
+    return x < 4 && x == base_code(b);
+  }
+
+  // Thomas Wang's invertible integer hash, restricted to the bits in mask, so
+  // that the minimizers are not biased towards poly-A kmers.
+  inline uint64_t hash64(uint64_t key, uint64_t mask)
+  {
+    key = (~key + (key << 21)) & mask;
+    key = key ^ key >> 24;
+    key = ((key + (key << 3)) + (key << 8)) & mask;
+    key = key ^ key >> 14;
+    key = ((key + (key << 2)) + (key << 4)) & mask;
+    key = key ^ key >> 28;
+    key = (key + (key << 31)) & mask;
+    return key;
+  }
+
+  inline double gap_cost(size_t gap, size_t k)
+  {
+    return gap == 0 ? 0.0 : 0.01 * k * gap + 0.5 * std::log(static_cast<double>(gap)) / std::log(2.0);
+  }
+}
+
+// Appends the minimizers of s to out, in order of position. Kmers that contain
+// anything other than ACGTacgt, and kmers that are their own reverse
+// complement, are never minimizers. A sequence with fewer than w kmers has
+// one minimizer, the smallest of its kmers.
+void find_minimizers(std::vector<minimizer>& out, string_ref s, uint32_t seq_idx, const params& p)
+{
+  const size_t k = p.k;
+  if (s.size() < k)
+    return;
+  const uint64_t mask = (1ULL << 2 * k) - 1;
+  const unsigned shift = 2 * (k - 1);
+  const uint64_t invalid = ~0ULL;
+  const size_t n = s.size() - k + 1;
+
+  std::vector<uint64_t> hashes(n, invalid);
+  std::vector<uint32_t> rcs(n, 0);
+  uint64_t fwd = 0, rev = 0;
+  size_t run = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned c = detail::base_code(s[i]);
+    if (c > 3) {
+      run = 0;
+      continue;
+    }
+    fwd = ((fwd << 2) | c) & mask;
+    rev = (rev >> 2) | (static_cast<uint64_t>(3 - c) << shift);
+    if (++run >= k && fwd != rev) {
+      hashes[i + 1 - k] = detail::hash64(std::min(fwd, rev), mask);
+      rcs   [i + 1 - k] = rev < fwd;
+    }
+  }
+
+  // Slide the window along the kmers, keeping in q the positions that may
+  // still become the smallest of a window, the leftmost and smallest first.
+  const size_t win = std::min(p.w, n);
+  std::deque<size_t> q;
+  size_t last = n;
+  for (size_t i = 0; i < n; ++i) {
+    if (hashes[i] != invalid) {
+      while (!q.empty() && hashes[q.back()] > hashes[i])
+        q.pop_back();
+      q.push_back(i);
+    }
+    if (i + 1 < win)
+      continue;
+    while (!q.empty() && q.front() + win <= i)
+      q.pop_front();
+    if (!q.empty() && q.front() != last) {
+      last = q.front();
+      minimizer m = {hashes[last], seq_idx, static_cast<uint32_t>(last), rcs[last]};
+      out.push_back(m);
+    }
+  }
+}
+
+// The minimizers of a set of sequences, sorted by hash.
+class minimizer_index
+{
+public:
+  minimizer_index(const seq_arena& seqs, const params& p)
+  : max_occurrences(p.max_occurrences)
+  {
+    std::vector<std::vector<minimizer> > per_seq(seqs.size());
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < static_cast<int>(seqs.size()); ++i)
+      find_minimizers(per_seq[i], seqs[i], i, p);
+    size_t total = 0;
+    BOOST_FOREACH(const std::vector<minimizer>& v, per_seq)
+      total += v.size();
+    entries.reserve(total);
+    BOOST_FOREACH(const std::vector<minimizer>& v, per_seq)
+      entries.insert(entries.end(), v.begin(), v.end());
+    std::sort(entries.begin(), entries.end());
+  }
+
+  // Sets [begin, end) to the occurrences of the minimizers with the given
+  // hash, or to an empty range if there are more than max_occurrences of them.
+  void find(uint64_t hash, const minimizer *& begin, const minimizer *& end) const
+  {
+    begin = end = NULL;
+    if (entries.empty())
+      return;
+    minimizer key = {hash, 0, 0, 0};
+    begin = &entries[0] + (std::lower_bound(entries.begin(), entries.end(), key) - entries.begin());
+    for (end = begin; end != &entries[0] + entries.size() && end->hash == hash; ++end)
+      ;
+    if (static_cast<size_t>(end - begin) > max_occurrences)
+      end = begin;
+  }
+
+  size_t size() const { return entries.size(); }
+
+private:
+  std::vector<minimizer> entries;
+  size_t max_occurrences;
+};
+
+// Chains the anchors [begin, end), which are to the same sequence and strand
+// and sorted, and appends each chain whose score is at least
+// p.min_chain_score to chains, as the ids of its anchors in increasing order
+// of x and y. Each anchor is in at most one chain; the chains are taken best
+// first, and a chain that runs into an anchor of a better one is cut there.
+void chain_anchors(std::vector<std::vector<size_t> >& chains,
+                   const std::vector<anchor>& anchors,
+                   size_t begin, size_t end,
+                   const params& p)
+{
+  const size_t n = end - begin;
+  std::vector<double> f(n);
+  std::vector<size_t> prev(n, n);
+  for (size_t i = 0; i < n; ++i) {
+    const anchor& ai = anchors[begin + i];
+    f[i] = p.k;
+    size_t lo = i > p.chain_lookback ? i - p.chain_lookback : 0;
+    for (size_t j = i; j-- > lo; ) {
+      const anchor& aj = anchors[begin + j];
+      if (ai.x - aj.x > p.max_gap)
+        break;
+      if (aj.x >= ai.x || aj.y >= ai.y || ai.y - aj.y > p.max_gap)
+        continue;
+      size_t dx = ai.x - aj.x, dy = ai.y - aj.y;
+      size_t gap = dx > dy ? dx - dy : dy - dx;
+      double score = f[j] + std::min(std::min(dx, dy), p.k) - detail::gap_cost(gap, p.k);
+      if (score > f[i]) {
+        f[i] = score;
+        prev[i] = j;
+      }
+    }
+  }
+
+  std::vector<std::pair<double, size_t> > order(n);
+  for (size_t i = 0; i < n; ++i)
+    order[i] = std::make_pair(-f[i], i);
+  std::sort(order.begin(), order.end());
+  std::vector<char> used(n, 0);
+  std::vector<size_t> chain;
+  for (size_t o = 0; o < n && f[order[o].second] >= p.min_chain_score; ++o) {
+    size_t i = order[o].second;
+    if (used[i])
+      continue;
+    chain.clear();
+    size_t j = i;
+    while (j != n && !used[j]) {
+      chain.push_back(begin + j);
+      used[j] = 1;
+      j = prev[j];
+    }
+    if (f[i] - (j == n ? 0.0 : f[j]) >= p.min_chain_score) {
+      std::reverse(chain.begin(), chain.end());
+      chains.push_back(chain);
+    }
+  }
+}
+
+namespace detail
+{
+  // Globally aligns a[0, la) to b[0, lb) with the least cost, where a
+  // mismatch costs 2 and a gap of n bases costs 3 + n, among the paths whose
+  // diagonal stays within band of those between (0, 0) and (la, lb). Appends
+  // the path to ops as 'M' (a base of a aligned to a base of b), 'I' (a base
+  // of a only), and 'D' (a base of b only).
+  //
+  // This is Gotoh's algorithm: for each cell, cost[s] is the least cost of a
+  // path that ends in it with an operation of state s (0 for 'M', 1 for 'I',
+  // 2 for 'D'), and the trace records the state of the previous operation,
+  // two bits per state.
+  void banded_align(std::string& ops, const char *a, size_t la, const char *b, size_t lb, size_t band)
+  {
+    const uint32_t mismatch = 2, gap_open = 3, gap_extend = 1;
+    const long diff = static_cast<long>(lb) - static_cast<long>(la);
+    const long lo = std::min(0L, diff) - static_cast<long>(band);
+    const long hi = std::max(0L, diff) + static_cast<long>(band);
+    const size_t width = hi - lo + 1;
+    const uint32_t inf = ~0U >> 2;
+    std::vector<uint32_t> prev_row(3 * width, inf), row(3 * width, inf);
+    std::vector<unsigned char> trace((la + 1) * width, 0);
+    for (size_t i = 0; i <= la; ++i) {
+      for (size_t di = 0; di < width; ++di) {
+        long j = static_cast<long>(i) + lo + static_cast<long>(di);
+        uint32_t *cost = &row[3 * di];
+        cost[0] = cost[1] = cost[2] = inf;
+        if (j < 0 || j > static_cast<long>(lb))
+          continue;
+        if (i == 0 && j == 0) {
+          cost[0] = 0;
+          continue;
+        }
+        unsigned char tr = 0;
+        if (i > 0 && j > 0) {
+          const uint32_t *from = &prev_row[3 * di];
+          unsigned s = std::min_element(from, from + 3) - from;
+          cost[0] = from[s] + (bases_match(a[i - 1], b[j - 1]) ? 0 : mismatch);
+          tr |= s;
+        }
+        if (i > 0 && di + 1 < width) {
+          const uint32_t *from = &prev_row[3 * (di + 1)];
+          unsigned s = from[0] <= from[2] ? 0 : 2;
+          cost[1] = from[s] + gap_open + gap_extend;
+          if (from[1] + gap_extend < cost[1]) {
+            cost[1] = from[1] + gap_extend;
+            s = 1;
+          }
+          tr |= s << 2;
+        }
+        if (j > 0 && di > 0) {
+          const uint32_t *from = &row[3 * (di - 1)];
+          unsigned s = from[0] <= from[1] ? 0 : 1;
+          cost[2] = from[s] + gap_open + gap_extend;
+          if (from[2] + gap_extend < cost[2]) {
+            cost[2] = from[2] + gap_extend;
+            s = 2;
+          }
+          tr |= s << 4;
+        }
+        trace[i * width + di] = tr;
+      }
+      row.swap(prev_row);
+    }
+
+    size_t start = ops.size();
+    long i = la, j = lb;
+    const uint32_t *last = &prev_row[3 * (j - i - lo)];
+    unsigned s = std::min_element(last, last + 3) - last;
+    while (i > 0 || j > 0) {
+      unsigned prev = (trace[i * width + (j - i - lo)] >> (2 * s)) & 3;
+      ops.push_back("MID"[s]);
+      if (s != 2) --i;
+      if (s != 1) --j;
+      s = prev;
+    }
+    std::reverse(ops.begin() + start, ops.end());
+  }
+
+  // Extends bl without gaps, to the left if left and to the right otherwise,
+  // as far as maximizes its score, which is +1 per match and -3 per mismatch,
+  // and stopping once the score falls more than x_drop below its best.
+  void extend_block(block& bl, string_ref a, string_ref b, bool left, int x_drop)
+  {
+    int score = 0, best = 0;
+    size_t best_n = 0;
+    size_t max_n = left ? std::min(bl.x, bl.y)
+                        : std::min(a.size() - (bl.x + bl.len), b.size() - (bl.y + bl.len));
+    for (size_t n = 1; n <= max_n; ++n) {
+      bool match = left ? bases_match(a[bl.x - n], b[bl.y - n])
+                        : bases_match(a[bl.x + bl.len + n - 1], b[bl.y + bl.len + n - 1]);
+      score += match ? 1 : -3;
+      if (score > best) {
+        best = score;
+        best_n = n;
+      } else if (score < best - x_drop) {
+        break;
+      }
+    }
+    if (left) {
+      bl.x -= best_n;
+      bl.y -= best_n;
+    }
+    bl.len += best_n;
+  }
+}
+
+// Sets blocks to the ungapped blocks of the alignment given by chain, where a
+// is the sequence of A, or its reverse complement, in the orientation of the
+// chain's anchors.
+void chain_to_blocks(std::vector<block>& blocks,
+                     string_ref a, string_ref b,
+                     const std::vector<anchor>& anchors,
+                     const std::vector<size_t>& chain,
+                     const params& p)
+{
+  blocks.clear();
+  const anchor& first = anchors[chain.front()];
+  block cur = {first.x, first.y, p.k};
+  std::string ops;
+  for (size_t c = 1; c < chain.size(); ++c) {
+    const anchor& an = anchors[chain[c]];
+    size_t cx = cur.x + cur.len, cy = cur.y + cur.len;
+    if (an.x - cur.x == an.y - cur.y) {
+      // On the same diagonal: the block just gets longer.
+      cur.len = std::max(cur.len, an.x + p.k - cur.x);
+      continue;
+    }
+    // Drop the part of the anchor that overlaps the current block.
+    size_t skip = std::max(cx > an.x ? cx - an.x : 0, cy > an.y ? cy - an.y : 0);
+    if (skip >= p.k)
+      continue;
+    size_t nx = an.x + skip, ny = an.y + skip;
+    if (nx - cx > p.max_fill || ny - cy > p.max_fill) {
+      blocks.push_back(cur);
+      block next = {nx, ny, p.k - skip};
+      cur = next;
+      continue;
+    }
+    ops.clear();
+    detail::banded_align(ops, a.data() + cx, nx - cx, b.data() + cy, ny - cy, p.band);
+    size_t x = cx, y = cy;
+    BOOST_FOREACH(char op, ops) {
+      if (op == 'M') {
+        if (x == cur.x + cur.len && y == cur.y + cur.len) {
+          ++cur.len;
+        } else {
+          blocks.push_back(cur);
+          block next = {x, y, 1};
+          cur = next;
+        }
+        ++x;
+        ++y;
+      } else if (op == 'I') {
+        ++x;
+      } else {
+        ++y;
+      }
+    }
+    if (nx == cur.x + cur.len && ny == cur.y + cur.len) {
+      cur.len += p.k - skip;
+    } else {
+      blocks.push_back(cur);
+      block next = {nx, ny, p.k - skip};
+      cur = next;
+    }
+  }
+  blocks.push_back(cur);
+  detail::extend_block(blocks.front(), a, b, true,  p.x_drop);
+  detail::extend_block(blocks.back(),  a, b, false, p.x_drop);
+}
+
+// Converts blocks, as made by chain_to_blocks, to the segments and identity
+// of an alignment of a to b, where a is in its original orientation.
+void blocks_to_alignment(re::matched::tagged_alignment& al,
+                         re::matched::alignment_identity& id,
+                         const std::vector<block>& blocks,
+                         string_ref a, string_ref b, bool rc)
+{
+  al.segments.resize(blocks.size());
+  size_t matches = 0, a_insert = 0, b_insert = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const block& bl = blocks[i];
+    alignment_segment& seg = al.segments[i];
+    seg.a_start = rc ? a.size() - 1 - bl.x : bl.x;
+    seg.a_end   = rc ? seg.a_start - (bl.len - 1) : seg.a_start + (bl.len - 1);
+    seg.b_start = bl.y;
+    seg.b_end   = bl.y + (bl.len - 1);
+    seg.a_mismatches.clear();
+    seg.b_mismatches.clear();
+    find_mismatches(a.data(), seg.a_start, rc, b.data(), seg.b_start, bl.len,
+                    seg.a_mismatches, seg.b_mismatches);
+    matches += bl.len - seg.a_mismatches.size();
+    if (i > 0) {
+      a_insert += bl.x - (blocks[i - 1].x + blocks[i - 1].len);
+      b_insert += bl.y - (blocks[i - 1].y + blocks[i - 1].len);
+    }
+  }
+  id.num_identity_wrt_a = matches;
+  id.num_identity_wrt_b = matches;
+  id.frac_indel_wrt_a   = 1.0 * a_insert / a.size();
+  id.frac_indel_wrt_b   = 1.0 * b_insert / b.size();
+}
+
+// Appends the alignments of a (whose index in A is a_idx, and whose reverse
+// complement is a_rc) to the sequences of B to alignments and identities.
+void align_one(std::vector<re::matched::tagged_alignment>& alignments,
+               std::vector<re::matched::alignment_identity>& identities,
+               size_t a_idx, string_ref a, string_ref a_rc,
+               const seq_arena& B, const minimizer_index& index,
+               bool strand_specific, const params& p)
+{
+  std::vector<minimizer> mins;
+  find_minimizers(mins, a, 0, p);
+  std::vector<anchor> anchors;
+  BOOST_FOREACH(const minimizer& m, mins) {
+    const minimizer *begin, *end;
+    index.find(m.hash, begin, end);
+    for (const minimizer *hit = begin; hit != end; ++hit) {
+      uint32_t rc = m.rc != hit->rc;
+      if (rc && strand_specific)
+        continue;
+      anchor an = {hit->seq_idx, rc, rc ? static_cast<uint32_t>(a.size() - (m.pos + p.k)) : m.pos, hit->pos};
+      anchors.push_back(an);
+    }
+  }
+  std::sort(anchors.begin(), anchors.end());
+
+  std::vector<std::vector<size_t> > chains;
+  std::vector<block> blocks;
+  re::matched::tagged_alignment al;
+  re::matched::alignment_identity id;
+  al.a_idx = a_idx;
+  for (size_t begin = 0, end; begin < anchors.size(); begin = end) {
+    for (end = begin + 1; end < anchors.size() &&
+                          anchors[end].b_idx == anchors[begin].b_idx &&
+                          anchors[end].rc    == anchors[begin].rc; ++end)
+      ;
+    chains.clear();
+    chain_anchors(chains, anchors, begin, end, p);
+    bool rc = anchors[begin].rc;
+    string_ref b = B[anchors[begin].b_idx];
+    BOOST_FOREACH(const std::vector<size_t>& chain, chains) {
+      chain_to_blocks(blocks, rc ? a_rc : a, b, anchors, chain, p);
+      al.b_idx = anchors[begin].b_idx;
+      blocks_to_alignment(al, id, blocks, a, b, rc);
+      alignments.push_back(al);
+      identities.push_back(id);
+    }
+  }
+}
+
+// Aligns each sequence of A to the sequences of B, and appends the alignments
+// to set, in order of A's sequences, as read_alignments would append those of
+// an alignment file. If strand_specific, only alignments of A's sequences to
+// the forward strand of B's are made. The sequences of A are aligned in
+// parallel.
+void align(re::matched::alignment_set& set,
+           const seq_arena& A,
+           const seq_arena& B,
+           bool strand_specific,
+           const params& p = params())
+{
+  minimizer_index index(B, p);
+  seq_arena A_rc;
+  if (!strand_specific)
+    reverse_complement(A_rc, A); // throws on invalid nucleotides
+  std::vector<std::vector<re::matched::tagged_alignment> >   alignments(A.size());
+  std::vector<std::vector<re::matched::alignment_identity> > identities(A.size());
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int i = 0; i < static_cast<int>(A.size()); ++i)
+    align_one(alignments[i], identities[i], i, A[i], strand_specific ? string_ref() : A_rc[i],
+              B, index, strand_specific, p);
+  for (size_t i = 0; i < A.size(); ++i) {
+    set.alignments.insert(set.alignments.end(), alignments[i].begin(), alignments[i].end());
+    set.identities.insert(set.identities.end(), identities[i].begin(), identities[i].end());
+  }
+}
+
+} // namespace align
+} // namespace re
@@ -0,0 +1,244 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdexcept>
+#include <vector>
+#include <stdint.h>
+#include "simd.hh"
+#include "util.hh"
+
+// find_mismatches() finds the positions at which the bases of an ungapped
+// alignment block differ. Position j of the block aligns
+//
+//   a[a_start + j]             to b[b_start + j], if !a_is_rc, or
+//   complement(a[a_start - j]) to b[b_start + j], if a_is_rc,
+//
+// and is a mismatch iff the two (possibly complemented) bases differ or
+// either of them is an N. Each mismatch's position in a and b is appended to
+// a_mismatches and b_mismatches, in order of increasing j.
+//
+// The bases are compared 16 at a time with SSE2 (32 at a time with AVX2), and
+// the mismatch positions are extracted from the resulting bitmask. On the
+// reverse strand, a 16- or 32-base chunk of a is reversed and complemented in
+// registers; chunks that contain anything other than ACGTNacgtn (e.g., IUPAC
+// codes) go through the per-base path, as does the tail of each block and
+// everything on targets without SSE2.
+//
+// Whether AVX2 is used is decided by get_simd_level(), see simd.hh.
+
+namespace detail
+{
+  inline void find_mismatches_scalar(const char *a, size_t a_start, bool a_is_rc,
+                                     const char *b, size_t b_start,
+                                     size_t j_begin, size_t j_end,
+                                     std::vector<size_t>& a_mismatches,
+                                     std::vector<size_t>& b_mismatches)
+  {
+    for (size_t j = j_begin; j < j_end; ++j) {
+      size_t a_pos = a_is_rc ? a_start - j : a_start + j;
+      size_t b_pos = b_start + j;
+      char a_char = a_is_rc ? complement(a[a_pos]) : a[a_pos];
+      char b_char = b[b_pos];
+      if (a_char != b_char ||
+          a_char == 'N' || a_char == 'n' ||
+          b_char == 'N' || b_char == 'n') {
+        a_mismatches.push_back(a_pos);
+        b_mismatches.push_back(b_pos);
+      }
+    }
+  }
+
+  // Appends the mismatches whose offsets from position j of the block are the
+  // set bits of bits.
+  inline void push_mismatches(uint32_t bits, size_t j,
+                              size_t a_start, bool a_is_rc, size_t b_start,
+                              std::vector<size_t>& a_mismatches,
+                              std::vector<size_t>& b_mismatches)
+  {
+    while (bits != 0) {
+      size_t k = j + __builtin_ctz(bits);
+      a_mismatches.push_back(a_is_rc ? a_start - k : a_start + k);
+      b_mismatches.push_back(b_start + k);
+      bits &= bits - 1;
+    }
+  }
+
+#ifdef __SSE2__
+  inline __m128i sse2_reverse_bytes(__m128i v)
+  {
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+  }
+
+  // Complements each byte of v that is one of ACGTNacgtn, keeping its case,
+  // and sets valid to all ones in exactly those bytes.
+  inline __m128i sse2_complement(__m128i v, __m128i& valid)
+  {
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    __m128i upper = _mm_andnot_si128(case_bit, v);
+    __m128i is_A = _mm_cmpeq_epi8(upper, _mm_set1_epi8('A'));
+    __m128i is_C = _mm_cmpeq_epi8(upper, _mm_set1_epi8('C'));
+    __m128i is_G = _mm_cmpeq_epi8(upper, _mm_set1_epi8('G'));
+    __m128i is_T = _mm_cmpeq_epi8(upper, _mm_set1_epi8('T'));
+    __m128i is_N = _mm_cmpeq_epi8(upper, _mm_set1_epi8('N'));
+    valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(is_A, is_C), _mm_or_si128(is_G, is_T)), is_N);
+    __m128i c = _mm_or_si128(
+                  _mm_or_si128(_mm_and_si128(is_A, _mm_set1_epi8('T')),
+                               _mm_and_si128(is_T, _mm_set1_epi8('A'))),
+                  _mm_or_si128(_mm_or_si128(_mm_and_si128(is_C, _mm_set1_epi8('G')),
+                                            _mm_and_si128(is_G, _mm_set1_epi8('C'))),
+                               _mm_and_si128(is_N, _mm_set1_epi8('N'))));
+    return _mm_or_si128(c, _mm_and_si128(v, case_bit));
+  }
+
+  inline __m128i sse2_is_N(__m128i v)
+  {
+    return _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('n'));
+  }
+
+  // Handles positions [j, j + 16) of the block. Returns false, having done
+  // nothing, if the per-base path must be used instead.
+  inline bool find_mismatches_sse2(const char *a, size_t a_start, bool a_is_rc,
+                                   const char *b, size_t b_start, size_t j,
+                                   std::vector<size_t>& a_mismatches,
+                                   std::vector<size_t>& b_mismatches)
+  {
+    __m128i a_chars;
+    if (a_is_rc) {
+      __m128i valid;
+      a_chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + a_start - j - 15));
+      a_chars = sse2_complement(sse2_reverse_bytes(a_chars), valid);
+      if (_mm_movemask_epi8(valid) != 0xffff)
+        return false;
+    } else {
+      a_chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + a_start + j));
+    }
+    __m128i b_chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + b_start + j));
+    __m128i same = _mm_andnot_si128(_mm_or_si128(sse2_is_N(a_chars), sse2_is_N(b_chars)),
+                                    _mm_cmpeq_epi8(a_chars, b_chars));
+    uint32_t bits = ~_mm_movemask_epi8(same) & 0xffff;
+    push_mismatches(bits, j, a_start, a_is_rc, b_start, a_mismatches, b_mismatches);
+    return true;
+  }
+#endif
+
+#ifdef REF_EVAL_SIMD_AVX2
+  REF_EVAL_TARGET_AVX2
+  inline __m256i avx2_reverse_bytes(__m256i v)
+  {
+    const __m256i idx = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                         15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    v = _mm256_shuffle_epi8(v, idx);
+    return _mm256_permute2x128_si256(v, v, 1);
+  }
+
+  // The AVX2 counterpart of sse2_complement: the complement of the upper-case
+  // base is looked up by its low nibble, which is distinct for A, C, G, T, N.
+  REF_EVAL_TARGET_AVX2
+  inline __m256i avx2_complement(__m256i v, __m256i& valid)
+  {
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i lut = _mm256_setr_epi8(0, 'T', 0, 'G', 'A', 0, 0, 'C', 0, 0, 0, 0, 0, 0, 'N', 0,
+                                         0, 'T', 0, 'G', 'A', 0, 0, 'C', 0, 0, 0, 0, 0, 0, 'N', 0);
+    __m256i upper = _mm256_andnot_si256(case_bit, v);
+    __m256i c = _mm256_shuffle_epi8(lut, _mm256_and_si256(upper, _mm256_set1_epi8(0x0f)));
+    // upper is a base iff it has a complement and complementing it twice
+    // gives it back.
+    valid = _mm256_andnot_si256(_mm256_cmpeq_epi8(c, _mm256_setzero_si256()),
+                                _mm256_cmpeq_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(c, _mm256_set1_epi8(0x0f))), upper));
+    return _mm256_or_si256(c, _mm256_and_si256(v, case_bit));
+  }
+
+  REF_EVAL_TARGET_AVX2
+  inline __m256i avx2_is_N(__m256i v)
+  {
+    return _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('n'));
+  }
+
+  // Handles positions [j, j + 32) of the block. Returns false, having done
+  // nothing, if the narrower paths must be used instead.
+  REF_EVAL_TARGET_AVX2
+  inline bool find_mismatches_avx2(const char *a, size_t a_start, bool a_is_rc,
+                                   const char *b, size_t b_start, size_t j,
+                                   std::vector<size_t>& a_mismatches,
+                                   std::vector<size_t>& b_mismatches)
+  {
+    __m256i a_chars;
+    if (a_is_rc) {
+      __m256i valid;
+      a_chars = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + a_start - j - 31));
+      a_chars = avx2_complement(avx2_reverse_bytes(a_chars), valid);
+      if (static_cast<uint32_t>(_mm256_movemask_epi8(valid)) != 0xffffffffU)
+        return false;
+    } else {
+      a_chars = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + a_start + j));
+    }
+    __m256i b_chars = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + b_start + j));
+    __m256i same = _mm256_andnot_si256(_mm256_or_si256(avx2_is_N(a_chars), avx2_is_N(b_chars)),
+                                       _mm256_cmpeq_epi8(a_chars, b_chars));
+    uint32_t bits = ~static_cast<uint32_t>(_mm256_movemask_epi8(same));
+    push_mismatches(bits, j, a_start, a_is_rc, b_start, a_mismatches, b_mismatches);
+    return true;
+  }
+
+  // Handles the 32-base chunks of the block, and returns the number of
+  // positions handled.
+  REF_EVAL_TARGET_AVX2
+  inline size_t find_mismatches_avx2_chunks(const char *a, size_t a_start, bool a_is_rc,
+                                            const char *b, size_t b_start, size_t len,
+                                            std::vector<size_t>& a_mismatches,
+                                            std::vector<size_t>& b_mismatches)
+  {
+    size_t j = 0;
+    for (; j + 32 <= len; j += 32) {
+      if (!find_mismatches_avx2(a, a_start, a_is_rc, b, b_start, j, a_mismatches, b_mismatches)) {
+        for (size_t k = j; k < j + 32; k += 16)
+          if (!find_mismatches_sse2(a, a_start, a_is_rc, b, b_start, k, a_mismatches, b_mismatches))
+            find_mismatches_scalar(a, a_start, a_is_rc, b, b_start, k, k + 16, a_mismatches, b_mismatches);
+      }
+    }
+    return j;
+  }
+#endif
+} // namespace detail
+
+inline void find_mismatches(const char *a, size_t a_start, bool a_is_rc,
+                            const char *b, size_t b_start, size_t len,
+                            std::vector<size_t>& a_mismatches,
+                            std::vector<size_t>& b_mismatches)
+{
+  size_t j = 0;
+  simd_level level = detail::current_simd_level();
+#ifdef REF_EVAL_SIMD_AVX2
+  if (level >= simd_avx2)
+    j = detail::find_mismatches_avx2_chunks(a, a_start, a_is_rc, b, b_start, len, a_mismatches, b_mismatches);
+#endif
+#ifdef __SSE2__
+  if (level >= simd_sse2) {
+    for (; j + 16 <= len; j += 16) {
+      if (!detail::find_mismatches_sse2(a, a_start, a_is_rc, b, b_start, j, a_mismatches, b_mismatches))
+        detail::find_mismatches_scalar(a, a_start, a_is_rc, b, b_start, j, j + 16, a_mismatches, b_mismatches);
+    }
+  }
+#endif
+  detail::find_mismatches_scalar(a, a_start, a_is_rc, b, b_start, j, len, a_mismatches, b_mismatches);
+}
@@ -0,0 +1,151 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "city.h"
+#include "string_ref.hh"
+
+// name_index maps sequence names to their indices 0, 1, 2, ..., in the order
+// in which the names were inserted.
+//
+// The names are interned in one contiguous arena, and looked up through an
+// open-addressing hash table (with linear probing) whose slots hold a 32-bit
+// tag from each name's hash and the name's index. Lookups take a string_ref,
+// so a name can be looked up directly in the line it was parsed from. Most
+// probes that do not find the name are rejected by the tag, without touching
+// the arena.
+class name_index
+{
+public:
+  static const size_t npos = static_cast<size_t>(-1);
+
+  name_index()
+  : mask(0)
+  {
+    offsets.push_back(0);
+  }
+
+  // Adds name with index size(). Returns false, and adds nothing, if name is
+  // already present.
+  bool insert(string_ref name)
+  {
+    if (2 * (size() + 1) > slots.size())
+      grow();
+    uint64_t h = hash(name);
+    size_t s = find_slot(name, h);
+    if (slots[s].idx_plus_1 != 0)
+      return false;
+    add(s, h, name);
+    return true;
+  }
+
+  // Returns the index of name, first adding it with index size() if it is not
+  // present.
+  size_t find_or_insert(string_ref name)
+  {
+    if (2 * (size() + 1) > slots.size())
+      grow();
+    uint64_t h = hash(name);
+    size_t s = find_slot(name, h);
+    if (slots[s].idx_plus_1 == 0)
+      add(s, h, name);
+    return slots[s].idx_plus_1 - 1;
+  }
+
+  // Returns the index of name, or npos if it is not present.
+  size_t find(string_ref name) const
+  {
+    if (slots.empty())
+      return npos;
+    size_t s = find_slot(name, hash(name));
+    return slots[s].idx_plus_1 == 0 ? npos : slots[s].idx_plus_1 - 1;
+  }
+
+  size_t count(string_ref name) const { return find(name) == npos ? 0 : 1; }
+
+  size_t size() const { return offsets.size() - 1; }
+
+  // Returns the name with the given index.
+  string_ref name(size_t idx) const
+  {
+    const char *base = arena.empty() ? NULL : &arena[0];
+    return string_ref(base + offsets[idx], base + offsets[idx + 1]);
+  }
+
+private:
+  struct slot
+  {
+    uint32_t tag;
+    uint32_t idx_plus_1; // 0 means the slot is empty
+    slot() : tag(0), idx_plus_1(0) {}
+  };
+
+  std::vector<char>   arena;   // all names, back to back
+  std::vector<size_t> offsets; // name i is arena[offsets[i], offsets[i+1])
+  std::vector<slot>   slots;   // size is a power of 2, at most half full
+  size_t              mask;    // slots.size() - 1
+
+  static uint64_t hash(string_ref name) { return CityHash64(name.beg, name.size()); }
+  static uint32_t tag (uint64_t h)      { return static_cast<uint32_t>(h >> 32); }
+
+  // Returns the slot that holds name, or the empty slot where it would go.
+  size_t find_slot(string_ref name, uint64_t h) const
+  {
+    uint32_t t = tag(h);
+    for (size_t s = h & mask; ; s = (s + 1) & mask) {
+      const slot& x = slots[s];
+      if (x.idx_plus_1 == 0 || (x.tag == t && this->name(x.idx_plus_1 - 1) == name))
+        return s;
+    }
+  }
+
+  // Adds name, whose hash is h, in the empty slot s.
+  void add(size_t s, uint64_t h, string_ref name)
+  {
+    if (size() >= 0xffffffffULL)
+      throw std::runtime_error("Too many sequence names.");
+    slots[s].tag        = tag(h);
+    slots[s].idx_plus_1 = static_cast<uint32_t>(size() + 1);
+    arena.insert(arena.end(), name.beg, name.end);
+    offsets.push_back(arena.size());
+  }
+
+  void grow()
+  {
+    std::vector<slot> old_slots(std::max<size_t>(16, 2 * slots.size()));
+    old_slots.swap(slots);
+    mask = slots.size() - 1;
+    for (size_t i = 0; i < old_slots.size(); ++i) {
+      if (old_slots[i].idx_plus_1 == 0)
+        continue;
+      string_ref n = name(old_slots[i].idx_plus_1 - 1);
+      size_t s = hash(n) & mask;
+      while (slots[s].idx_plus_1 != 0)
+        s = (s + 1) & mask;
+      slots[s] = old_slots[i];
+    }
+  }
+};
+
+const size_t name_index::npos;
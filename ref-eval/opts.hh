@@ -18,6 +18,10 @@
 // along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
 
 struct opts
 {
@@ -47,11 +51,19 @@ struct opts
   // Expression
   std::string A_expr;
   std::string B_expr;
+  // The second and later values of --A-expr and --B-expr, if either is given
+  // several times (see num_expr_profiles).
+  std::vector<std::string> more_A_expr;
+  std::vector<std::string> more_B_expr;
 
   // Alignments
   std::string A_to_B;
   std::string B_to_A;
   std::string alignment_type;
+  bool alignment_cache;
+
+  // Cache of intermediate results
+  std::string cache_dir;
 
   // Strand-specific
   bool strand_specific;
@@ -67,6 +79,9 @@ struct opts
   double min_frac_identity;
   double max_frac_indel;
 
+  // Matching algorithm for contig scores
+  std::string matching_algorithm;
+
   // Minimum segment length
   size_t min_segment_len;
 
@@ -78,6 +93,13 @@ struct opts
   // Trace output
   std::string trace;
 
+  // Profiling
+  bool profile;
+  std::string profile_json;
+
+  // Where the scores are written
+  std::ostream *out;
+
   opts()
   :
     // Scores
@@ -111,6 +133,10 @@ struct opts
     A_to_B(""),
     B_to_A(""),
     alignment_type(""),
+    alignment_cache(false),
+
+    // Cache of intermediate results
+    cache_dir(""),
 
     // Strand-specific
     strand_specific(false),
@@ -126,6 +152,9 @@ struct opts
     min_frac_identity(2.0),
     max_frac_indel(-1.0),
 
+    // Matching algorithm for contig scores
+    matching_algorithm(""),
+
     // Minimum segment length
     min_segment_len(0),
 
@@ -135,7 +164,14 @@ struct opts
     hash_table_fudge_factor(-1.0),
 
     // Trace output
-    trace("")
+    trace(""),
+
+    // Profiling
+    profile(false),
+    profile_json(""),
+
+    // Output
+    out(&std::cout)
   {}
 };
 
@@ -160,14 +196,29 @@ std::ostream& operator<<(std::ostream& os, const opts& o)
   if (o.B_seqs.size()) os << "B_seqs: " << o.B_seqs << "\n";
 
   if (o.A_expr.size()) os << "A_expr: " << o.A_expr << "\n";
+  for (size_t i = 0; i < o.more_A_expr.size(); ++i)
+    os << "A_expr: " << o.more_A_expr[i] << "\n";
   if (o.B_expr.size()) os << "B_expr: " << o.B_expr << "\n";
+  for (size_t i = 0; i < o.more_B_expr.size(); ++i)
+    os << "B_expr: " << o.more_B_expr[i] << "\n";
 
   if (o.A_to_B.size())         os << "A_to_B: "         << o.A_to_B << "\n";
   if (o.B_to_A.size())         os << "B_to_A: "         << o.B_to_A << "\n";
   if (o.alignment_type.size()) os << "alignment_type: " << o.alignment_type << "\n";
+  if (o.alignment_cache)       os << "alignment_cache"                        << "\n";
+  if (o.cache_dir.size())      os << "cache_dir: "      << o.cache_dir      << "\n";
 
   if (o.strand_specific) os << "strand_specific"        << "\n";
   if (o.readlen)         os << "readlen: " << o.readlen << "\n";
 
   return os;
 }
+
+// Returns the number of expression profiles: the kmer and kc scores can be
+// computed for several expression profiles in one pass, by giving --A-expr
+// and --B-expr several times. Profile p uses the p-th value of each, or its
+// only value, if it is given once.
+inline size_t num_expr_profiles(const opts& o)
+{
+  return 1 + std::max(o.more_A_expr.size(), o.more_B_expr.size());
+}
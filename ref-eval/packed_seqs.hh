@@ -0,0 +1,362 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "seq_arena.hh"
+#include "simd.hh"
+#include "util.hh"
+
+// packed_seqs holds a list of nucleotide sequences with 2 bits per base.
+//
+// The uppercase bases A, C, G, and T are packed as 0, 1, 2, and 3, with the
+// bases of all the sequences back to back, 32 to a 64-bit word, and the first
+// base of each word in its least significant bits. Every other character
+// (N, IUPAC ambiguity codes, lowercase bases, ...) is an exception: it is
+// packed as 0, and also recorded, run-length encoded, in a sorted side list.
+// For typical assemblies, where the exceptions are a few runs of N, this takes
+// about a quarter of the memory of the sequences themselves, and no copy is
+// needed for the reverse complement, since reverse-complemented bases and
+// kmers can be computed from the forward strand.
+//
+// A kmer of length k <= 32 that contains no exceptions is represented as a
+// single word, with its first base in the least significant bits, so
+// consecutive kmers can be computed from each other with a shift.
+//
+// Packing a word and finding the next exception each take 16 bases at a time
+// with SSE2 (32 at a time with AVX2), as get_simd_level() allows. The 2-bit
+// code of an uppercase base c is ((c >> 1) ^ (c >> 2)) & 3, which only needs
+// shifts, and the exceptions are the bytes that are none of ACGT.
+namespace detail
+{
+  inline int base_code(char c)
+  {
+    switch (c) {
+      case 'A': return 0;
+      case 'C': return 1;
+      case 'G': return 2;
+      case 'T': return 3;
+      default:  return -1;
+    }
+  }
+
+  // Returns the n <= 32 bases at p packed into a word, with exceptions as 0.
+  inline uint64_t pack_bases_scalar(const char *p, size_t n)
+  {
+    uint64_t x = 0;
+    for (size_t j = 0; j < n; ++j) {
+      int c = base_code(p[j]);
+      if (c > 0)
+        x |= static_cast<uint64_t>(c) << (j * 2);
+    }
+    return x;
+  }
+
+  inline const char *find_exception_scalar(const char *p, const char *end)
+  {
+    for (; p < end; ++p)
+      if (base_code(*p) < 0)
+        return p;
+    return end;
+  }
+
+#ifdef __SSE2__
+  inline __m128i sse2_is_base(__m128i v)
+  {
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('A')), _mm_cmpeq_epi8(v, _mm_set1_epi8('C'))),
+                        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('G')), _mm_cmpeq_epi8(v, _mm_set1_epi8('T'))));
+  }
+
+  // Packs the 16 bases at p into 32 bits.
+  inline uint32_t pack_bases_sse2(const char *p)
+  {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i c = _mm_and_si128(_mm_xor_si128(_mm_srli_epi16(v, 1), _mm_srli_epi16(v, 2)), _mm_set1_epi8(3));
+    c = _mm_and_si128(c, sse2_is_base(v));
+    // Gather the codes of each pair of bytes into 4 bits, then of each
+    // 4 bytes into 8 bits, then gather those bytes.
+    c = _mm_and_si128(_mm_or_si128(c, _mm_srli_epi16(c, 6)), _mm_set1_epi16(0x000f));
+    c = _mm_and_si128(_mm_or_si128(c, _mm_srli_epi32(c, 12)), _mm_set1_epi32(0x00ff));
+    c = _mm_packs_epi32(c, c);
+    c = _mm_packus_epi16(c, c);
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(c));
+  }
+
+  inline const char *find_exception_sse2(const char *p, const char *end)
+  {
+    for (; end - p >= 16; p += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      int bits = ~_mm_movemask_epi8(sse2_is_base(v)) & 0xffff;
+      if (bits != 0)
+        return p + __builtin_ctz(bits);
+    }
+    return find_exception_scalar(p, end);
+  }
+#endif
+
+#ifdef REF_EVAL_SIMD_AVX2
+  REF_EVAL_TARGET_AVX2
+  inline __m256i avx2_is_base(__m256i v)
+  {
+    return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('C'))),
+                           _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('T'))));
+  }
+
+  // Packs the 32 bases at p into a word, as pack_bases_sse2 does for each
+  // 128-bit half.
+  REF_EVAL_TARGET_AVX2
+  inline uint64_t pack_bases_avx2(const char *p)
+  {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i c = _mm256_and_si256(_mm256_xor_si256(_mm256_srli_epi16(v, 1), _mm256_srli_epi16(v, 2)), _mm256_set1_epi8(3));
+    c = _mm256_and_si256(c, avx2_is_base(v));
+    c = _mm256_and_si256(_mm256_or_si256(c, _mm256_srli_epi16(c, 6)), _mm256_set1_epi16(0x000f));
+    c = _mm256_and_si256(_mm256_or_si256(c, _mm256_srli_epi32(c, 12)), _mm256_set1_epi32(0x00ff));
+    c = _mm256_packs_epi32(c, c);
+    c = _mm256_packus_epi16(c, c);
+    uint64_t lo = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_castsi256_si128(c)));
+    uint64_t hi = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_extracti128_si256(c, 1)));
+    return lo | (hi << 32);
+  }
+
+  REF_EVAL_TARGET_AVX2
+  inline const char *find_exception_avx2(const char *p, const char *end)
+  {
+    for (; end - p >= 32; p += 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      uint32_t bits = ~static_cast<uint32_t>(_mm256_movemask_epi8(avx2_is_base(v)));
+      if (bits != 0)
+        return p + __builtin_ctz(bits);
+    }
+    return find_exception_sse2(p, end);
+  }
+#endif
+
+  // Returns the n <= 32 bases at p packed into a word, with exceptions as 0.
+  inline uint64_t pack_bases(const char *p, size_t n)
+  {
+    if (n == 32) {
+      simd_level level = current_simd_level();
+#ifdef REF_EVAL_SIMD_AVX2
+      if (level >= simd_avx2)
+        return pack_bases_avx2(p);
+#endif
+#ifdef __SSE2__
+      if (level >= simd_sse2)
+        return pack_bases_sse2(p) | (static_cast<uint64_t>(pack_bases_sse2(p + 16)) << 32);
+#endif
+      (void)level;
+    }
+    return pack_bases_scalar(p, n);
+  }
+
+  // Returns the first exception in [p, end), or end if there is none.
+  inline const char *find_exception(const char *p, const char *end)
+  {
+    simd_level level = current_simd_level();
+#ifdef REF_EVAL_SIMD_AVX2
+    if (level >= simd_avx2)
+      return find_exception_avx2(p, end);
+#endif
+#ifdef __SSE2__
+    if (level >= simd_sse2)
+      return find_exception_sse2(p, end);
+#endif
+    (void)level;
+    return find_exception_scalar(p, end);
+  }
+} // namespace detail
+
+class packed_seqs
+{
+public:
+  static const size_t max_kmer_word_len = 32;
+
+  // A run of len copies of the character c, starting at the given position
+  // of the concatenated sequences.
+  struct exception_run
+  {
+    uint64_t start;
+    uint32_t len;
+    char     c;
+    uint64_t end() const { return start + len; }
+  };
+
+  packed_seqs() : offsets(1, 0), exception_offsets(1, 0) {}
+
+  explicit packed_seqs(const seq_arena& seqs) { assign(seqs); }
+
+  void assign(const seq_arena& seqs);
+
+  size_t size()             const { return offsets.size() - 1; }
+  size_t length(size_t i)   const { return offsets[i + 1] - offsets[i]; }
+
+  // Returns the j'th character of sequence i, or of its reverse complement.
+  char at   (size_t i, size_t j) const;
+  char rc_at(size_t i, size_t j) const { return complement(at(i, length(i) - 1 - j)); }
+
+  // Returns sequence i, or its reverse complement, unpacked.
+  std::string str   (size_t i) const;
+  std::string rc_str(size_t i) const { return reverse_complement(str(i)); }
+
+  // Returns the 2-bit code of the j'th base of sequence i. This is only
+  // meaningful if the base is not an exception.
+  unsigned base(size_t i, size_t j) const { return base_at(offsets[i] + j); }
+
+  // Returns the k bases of sequence i that start at position j, packed into
+  // one word, for k <= max_kmer_word_len. This is only meaningful if none of
+  // the bases are exceptions.
+  uint64_t kmer(size_t i, size_t j, size_t k) const
+  {
+    assert(k >= 1 && k <= max_kmer_word_len && j + k <= length(i));
+    uint64_t g = offsets[i] + j;
+    size_t   w = g >> 5, s = (g & 31) * 2;
+    uint64_t x = words[w] >> s;
+    if (s != 0)
+      x |= words[w + 1] << (64 - s);
+    return k == 32 ? x : x & ((uint64_t(1) << (2 * k)) - 1);
+  }
+
+  // Returns the reverse complement of the kmer x of length k.
+  static uint64_t reverse_complement_kmer(uint64_t x, size_t k)
+  {
+    x = ~x;
+    // Reverse the order of the 2-bit bases.
+    x = ((x >>  2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) <<  2);
+    x = ((x >>  4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) <<  4);
+    x = ((x >>  8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) <<  8);
+    x = ((x >> 16) & 0x0000FFFF0000FFFFULL) | ((x & 0x0000FFFF0000FFFFULL) << 16);
+    x = (x >> 32) | (x << 32);
+    return x >> (64 - 2 * k);
+  }
+
+  // The exception runs of sequence i, in order. Positions are relative to the
+  // concatenated sequences; subtract offset(i) to get positions within
+  // sequence i.
+  const exception_run *exceptions_begin(size_t i) const { return exception_ptr(exception_offsets[i]); }
+  const exception_run *exceptions_end  (size_t i) const { return exception_ptr(exception_offsets[i + 1]); }
+  uint64_t offset(size_t i) const { return offsets[i]; }
+
+  // Returns true if every exception is an N (or n).
+  bool only_N_exceptions() const
+  {
+    for (size_t r = 0; r < exceptions.size(); ++r)
+      if (exceptions[r].c != 'N' && exceptions[r].c != 'n')
+        return false;
+    return true;
+  }
+
+  // The number of bytes used.
+  size_t memory_usage() const
+  {
+    return words.size() * sizeof(uint64_t) + offsets.size() * sizeof(uint64_t) +
+           exceptions.size() * sizeof(exception_run) + exception_offsets.size() * sizeof(size_t);
+  }
+
+private:
+  unsigned base_at(uint64_t g) const { return (words[g >> 5] >> ((g & 31) * 2)) & 3; }
+
+  const exception_run *exception_ptr(size_t r) const
+  {
+    return exceptions.empty() ? NULL : &exceptions[0] + r;
+  }
+
+  std::vector<uint64_t>      words;   // plus one extra word, so kmer() can always read words[w + 1]
+  std::vector<uint64_t>      offsets; // sequence i is at [offsets[i], offsets[i+1])
+  std::vector<exception_run> exceptions;
+  std::vector<size_t>        exception_offsets; // sequence i's runs are [exception_offsets[i], exception_offsets[i+1])
+};
+
+const size_t packed_seqs::max_kmer_word_len;
+
+void packed_seqs::assign(const seq_arena& seqs)
+{
+  size_t n = seqs.size();
+  offsets.resize(n + 1);
+  for (size_t i = 0; i <= n; ++i)
+    offsets[i] = i == n ? seqs.total_length() : seqs.offset(i);
+
+  // Pack the bases, one word at a time.
+  string_ref all = seqs.all();
+  size_t num_words = (all.size() + 31) / 32;
+  words.assign(num_words + 1, 0);
+  #pragma omp parallel for
+  for (int w = 0; w < static_cast<int>(num_words); ++w) {
+    size_t beg = 32 * static_cast<size_t>(w);
+    size_t end = std::min(beg + 32, all.size());
+    words[w] = detail::pack_bases(all.data() + beg, end - beg);
+  }
+
+  // Record the exceptions. A run never extends past the end of a sequence.
+  exceptions.clear();
+  exception_offsets.resize(n + 1);
+  exception_offsets[0] = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const char *seq_end = all.data() + offsets[i + 1];
+    for (const char *p = all.data() + offsets[i];
+         (p = detail::find_exception(p, seq_end)) != seq_end; ++p) {
+      uint64_t g = p - all.data();
+      if (exceptions.size() > exception_offsets[i] &&
+          exceptions.back().end() == g && exceptions.back().c == all[g] &&
+          exceptions.back().len < 0xffffffffu) {
+        ++exceptions.back().len;
+      } else {
+        exception_run r;
+        r.start = g;
+        r.len   = 1;
+        r.c     = all[g];
+        exceptions.push_back(r);
+      }
+    }
+    exception_offsets[i + 1] = exceptions.size();
+  }
+}
+
+char packed_seqs::at(size_t i, size_t j) const
+{
+  assert(j < length(i));
+  uint64_t g = offsets[i] + j;
+  const exception_run *beg = exceptions_begin(i), *end = exceptions_end(i);
+  // Find the last run that starts at or before g.
+  size_t lo = 0, hi = end - beg;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (beg[mid].start <= g)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo > 0 && g < beg[lo - 1].end())
+    return beg[lo - 1].c;
+  return "ACGT"[base_at(g)];
+}
+
+std::string packed_seqs::str(size_t i) const
+{
+  std::string s(length(i), ' ');
+  for (size_t j = 0; j < s.size(); ++j)
+    s[j] = "ACGT"[base_at(offsets[i] + j)];
+  for (const exception_run *r = exceptions_begin(i); r != exceptions_end(i); ++r)
+    std::fill(s.begin() + (r->start - offsets[i]), s.begin() + (r->end() - offsets[i]), r->c);
+  return s;
+}
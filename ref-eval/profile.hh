@@ -0,0 +1,283 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Per-stage profiling, enabled by --profile and --profile-json.
+//
+// Each stage of a run (reading the sequences, processing the alignments,
+// counting kmers, ...) is timed by a profile_stage object, from its
+// construction until finish() is called or it is destroyed. Stages may be
+// nested. The records are collected by global_profiler(), which prints them
+// at the end of the run. If profiling is not enabled, a profile_stage does
+// nothing.
+//
+// The CPU time is that of the whole process, so it includes all the OpenMP
+// threads; the utilization is the CPU time divided by the wall time and the
+// number of threads, so 100% means that every thread was busy throughout.
+// Since that can hide one busy thread among idle ones, the CPU time of each
+// OpenMP thread is also sampled, in the thread itself, at the start and end
+// of the stage, and the least and most busy threads' fractions of the wall
+// time are reported. (This relies on the OpenMP runtime keeping the same
+// threads from one parallel region to the next, as libgomp and libomp do.)
+// The peak RSS is the process's high-water mark at the end of the stage.
+struct profile_record
+{
+  std::string name;
+  int         depth;
+  double      wall_seconds;
+  double      cpu_seconds;
+  double      min_thread_cpu_seconds;
+  double      max_thread_cpu_seconds;
+  long        peak_rss_kb;
+  size_t      items;
+  std::string item_unit; // empty if the stage has no item count
+
+  double utilization(int threads) const
+  {
+    return wall_seconds > 0 ? cpu_seconds / (wall_seconds * threads) : 0.0;
+  }
+
+  double min_thread_utilization() const
+  {
+    return wall_seconds > 0 ? min_thread_cpu_seconds / wall_seconds : 0.0;
+  }
+
+  double max_thread_utilization() const
+  {
+    return wall_seconds > 0 ? max_thread_cpu_seconds / wall_seconds : 0.0;
+  }
+};
+
+class profiler
+{
+public:
+  profiler()
+  : enabled(false),
+    depth(0)
+  {}
+
+  int num_threads() const
+  {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+
+  void print_table(std::ostream& out) const;
+  void write_json(std::ostream& out) const;
+
+  bool                        enabled;
+  int                         depth;
+  std::vector<profile_record> records;
+};
+
+profiler& global_profiler()
+{
+  static profiler p;
+  return p;
+}
+
+namespace detail {
+
+  inline double wall_time()
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1e-6 * tv.tv_usec;
+  }
+
+  inline double cpu_time()
+  {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + 1e-6 * ru.ru_utime.tv_usec +
+           ru.ru_stime.tv_sec + 1e-6 * ru.ru_stime.tv_usec;
+  }
+
+  // Returns the CPU time of the calling thread.
+  inline double thread_cpu_time()
+  {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+      return 0.0;
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+  }
+
+  // Returns the CPU time of each thread of the OpenMP thread pool, each
+  // measured in the thread itself. Inside a parallel region, only the calling
+  // thread is measured.
+  inline std::vector<double> thread_cpu_times()
+  {
+#ifdef _OPENMP
+    if (!omp_in_parallel()) {
+      std::vector<double> times(omp_get_max_threads());
+      #pragma omp parallel num_threads(static_cast<int>(times.size()))
+      times[omp_get_thread_num()] = thread_cpu_time();
+      return times;
+    }
+#endif
+    return std::vector<double>(1, thread_cpu_time());
+  }
+
+  inline long peak_rss_kb()
+  {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024; // bytes on Mac OS X
+#else
+    return ru.ru_maxrss;
+#endif
+  }
+
+} // namespace detail
+
+class profile_stage
+{
+public:
+  explicit profile_stage(const std::string& name)
+  : active(global_profiler().enabled)
+  {
+    if (!active)
+      return;
+    profiler& p = global_profiler();
+    idx = p.records.size();
+    p.records.push_back(profile_record());
+    profile_record& r = p.records.back();
+    r.name  = name;
+    r.depth = p.depth++;
+    r.items = 0;
+    wall0 = detail::wall_time();
+    cpu0  = detail::cpu_time();
+    thread_cpu0 = detail::thread_cpu_times();
+  }
+
+  ~profile_stage() { finish(); }
+
+  // Records the number of items (alignments, kmers, ...) that the stage
+  // processed, from which the throughput is computed.
+  void set_items(size_t items, const std::string& unit)
+  {
+    if (!active)
+      return;
+    profile_record& r = global_profiler().records[idx];
+    r.items     = items;
+    r.item_unit = unit;
+  }
+
+  void finish()
+  {
+    if (!active)
+      return;
+    active = false;
+    profiler& p = global_profiler();
+    profile_record& r = p.records[idx];
+    r.wall_seconds = detail::wall_time() - wall0;
+    r.cpu_seconds  = detail::cpu_time() - cpu0;
+    std::vector<double> thread_cpu = detail::thread_cpu_times();
+    r.min_thread_cpu_seconds = r.max_thread_cpu_seconds = 0.0;
+    for (size_t t = 0; t < thread_cpu.size() && t < thread_cpu0.size(); ++t) {
+      double x = thread_cpu[t] - thread_cpu0[t];
+      if (t == 0 || x < r.min_thread_cpu_seconds) r.min_thread_cpu_seconds = x;
+      if (t == 0 || x > r.max_thread_cpu_seconds) r.max_thread_cpu_seconds = x;
+    }
+    r.peak_rss_kb  = detail::peak_rss_kb();
+    --p.depth;
+  }
+
+private:
+  profile_stage(const profile_stage&);
+  profile_stage& operator=(const profile_stage&);
+
+  bool   active;
+  size_t idx;
+  double wall0, cpu0;
+  std::vector<double> thread_cpu0;
+};
+
+void profiler::print_table(std::ostream& out) const
+{
+  int threads = num_threads();
+  out << "Profile (" << threads << " thread" << (threads == 1 ? "" : "s") << "):" << std::endl;
+  out << std::left  << std::setw(40) << "stage"
+      << std::right << std::setw(10) << "wall (s)"
+                    << std::setw(10) << "cpu (s)"
+                    << std::setw(7)  << "util"
+                    << std::setw(14) << "thread util"
+                    << std::setw(14) << "peak RSS (MB)"
+      << "  items" << std::endl;
+  for (size_t i = 0; i < records.size(); ++i) {
+    const profile_record& r = records[i];
+    std::ostringstream thread_range;
+    thread_range << std::fixed << std::setprecision(0)
+                 << 100 * r.min_thread_utilization() << "-"
+                 << 100 * r.max_thread_utilization() << "%";
+    std::ostringstream items;
+    if (!r.item_unit.empty()) {
+      items << r.items << " " << r.item_unit;
+      if (r.wall_seconds > 0)
+        items << " (" << static_cast<long>(r.items / r.wall_seconds) << "/s)";
+    }
+    out << std::left  << std::setw(40) << std::string(2 * r.depth, ' ') + r.name
+        << std::right << std::fixed
+        << std::setw(10) << std::setprecision(3) << r.wall_seconds
+        << std::setw(10) << std::setprecision(3) << r.cpu_seconds
+        << std::setw(6)  << std::setprecision(0) << 100 * r.utilization(threads) << "%"
+        << std::setw(14) << thread_range.str()
+        << std::setw(14) << std::setprecision(1) << r.peak_rss_kb / 1024.0
+        << "  " << items.str() << std::endl;
+    out.unsetf(std::ios::fixed);
+  }
+}
+
+void profiler::write_json(std::ostream& out) const
+{
+  int threads = num_threads();
+  out << "{\n  \"threads\": " << threads << ",\n  \"stages\": [";
+  for (size_t i = 0; i < records.size(); ++i) {
+    const profile_record& r = records[i];
+    out << (i == 0 ? "\n" : ",\n")
+        << "    {\"name\": \"" << r.name << "\""
+        << ", \"depth\": " << r.depth
+        << ", \"wall_seconds\": " << r.wall_seconds
+        << ", \"cpu_seconds\": " << r.cpu_seconds
+        << ", \"utilization\": " << r.utilization(threads)
+        << ", \"min_thread_utilization\": " << r.min_thread_utilization()
+        << ", \"max_thread_utilization\": " << r.max_thread_utilization()
+        << ", \"peak_rss_kb\": " << r.peak_rss_kb;
+    if (!r.item_unit.empty())
+      out << ", \"items\": " << r.items << ", \"item_unit\": \"" << r.item_unit << "\"";
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+}
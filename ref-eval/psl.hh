@@ -23,7 +23,10 @@
 #include <boost/iterator.hpp>
 #include "lazycsv.hh"
 #include "line_stream.hh"
+#include "small_vector.hh"
+#include "string_ref.hh"
 #include "alignment_segment.hh"
+#include "mismatch.hh"
 #include "util.hh"
 
 namespace detail
@@ -43,13 +46,19 @@ public:
   // General note: blat uses q for the query and t for the target, whereas our
   // Alignment concept uses a for the query and b for the target.
 
+  // Block lists are stored inline for alignments with few blocks (the vast
+  // majority), so that parsing a line does not allocate.
+  typedef small_vector<int, 16> block_list;
+
   //
   // Realization of the Alignment concept.
   //
 
-  void parse_line(const std::string& line) { lazy_csv.parse_line(line); }
+  void parse_line(const std::string& line) { lazy_csv.parse_line(line); parse_fields(); }
   std::string a_name()              const { return q_name(); }
   std::string b_name()              const { return t_name(); }
+  string_ref  a_name_ref()          const { return string_ref(lazy_csv.begin( 9), lazy_csv.end( 9)); }
+  string_ref  b_name_ref()          const { return string_ref(lazy_csv.begin(13), lazy_csv.end(13)); }
   double      frac_identity_wrt_a() const { return 1.0 * num_identity() / q_size(); }
   double      frac_identity_wrt_b() const { return 1.0 * num_identity() / t_size(); }
   double      num_identity_wrt_a()  const { return       num_identity()           ; }
@@ -60,14 +69,14 @@ public:
   int         num_indel_wrt_b()     const { return       t_base_insert()           ; }
   typedef detail::psl_alignment_input_stream input_stream_type;
   typedef detail::psl_alignment_segments     segments_type;
-  segments_type segments(const std::string& a, const std::string& b) const; // defined below
+  segments_type segments(string_ref a, string_ref b) const; // defined below
 
   inline bool is_on_valid_strand(bool strand_specific) const
   {
     if (!strand_specific)
       return true;
     else
-      return strand() == "+";
+      return strand_char == '+';
   }
 
   //
@@ -77,29 +86,34 @@ public:
   // Notes:
   // - q_size and t_size are the lengths of the query and target, including N's.
   // - match excludes N's, even if the N's line up.
-
-  int                      matches      () const { return lazy_csv.at <int>        ( 0); } // Number of bases that match that aren't repeats
-  int                      mis_matches  () const { return lazy_csv.at <int>        ( 1); } // Number of bases that don't match
-  int                      rep_matches  () const { return lazy_csv.at <int>        ( 2); } // Number of bases that match but are part of repeats
-  int                      n_count      () const { return lazy_csv.at <int>        ( 3); } // Number of 'N' bases
-  int                      q_num_insert () const { return lazy_csv.at <int>        ( 4); } // Number of inserts in query
-  int                      q_base_insert() const { return lazy_csv.at <int>        ( 5); } // Number of bases inserted in query
-  int                      t_num_insert () const { return lazy_csv.at <int>        ( 6); } // Number of inserts in target
-  int                      t_base_insert() const { return lazy_csv.at <int>        ( 7); } // Number of bases inserted in target
+  // - The numeric fields and block lists are parsed once, by parse_line, and
+  //   the accessors below just return the cached values.
+
+  int                      matches      () const { return ints[ 0]; } // Number of bases that match that aren't repeats
+  int                      mis_matches  () const { return ints[ 1]; } // Number of bases that don't match
+  int                      rep_matches  () const { return ints[ 2]; } // Number of bases that match but are part of repeats
+  int                      n_count      () const { return ints[ 3]; } // Number of 'N' bases
+  int                      q_num_insert () const { return ints[ 4]; } // Number of inserts in query
+  int                      q_base_insert() const { return ints[ 5]; } // Number of bases inserted in query
+  int                      t_num_insert () const { return ints[ 6]; } // Number of inserts in target
+  int                      t_base_insert() const { return ints[ 7]; } // Number of bases inserted in target
   std::string              strand       () const { return lazy_csv.at <std::string>( 8); } // '+' or '-' for query strand. For translated 
                                                                                            // alignments, second '+'or '-' is for genomic strand
   std::string              q_name       () const { return lazy_csv.at <std::string>( 9); } // Query sequence name
-  int                      q_size       () const { return lazy_csv.at <int>        (10); } // Query sequence size
-  int                      q_start      () const { return lazy_csv.at <int>        (11); } // Alignment start position in query
-  int                      q_end        () const { return lazy_csv.at <int>        (12); } // Alignment end position in query
+  int                      q_size       () const { return ints[10]; } // Query sequence size
+  int                      q_start      () const { return ints[11]; } // Alignment start position in query
+  int                      q_end        () const { return ints[12]; } // Alignment end position in query
   std::string              t_name       () const { return lazy_csv.at <std::string>(13); } // Target sequence name
-  int                      t_size       () const { return lazy_csv.at <int>        (14); } // Target sequence size
-  int                      t_start      () const { return lazy_csv.at <int>        (15); } // Alignment start position in target
-  int                      t_end        () const { return lazy_csv.at <int>        (16); } // Alignment end position in target
-  int                      block_count  () const { return lazy_csv.at <int>        (17); } // Number of blocks in the alignment (a block contains no gaps)
-  std::vector<int>         block_sizes  () const { return parse_vector<int>        (18); } // Comma-separated list of sizes of each block
-  std::vector<int>         q_starts     () const { return parse_vector<int>        (19); } // Comma-separated list of starting positions of each block in query
-  std::vector<int>         t_starts     () const { return parse_vector<int>        (20); } // Comma-separated list of starting positions of each block in target
+  int                      t_size       () const { return ints[14]; } // Target sequence size
+  int                      t_start      () const { return ints[15]; } // Alignment start position in target
+  int                      t_end        () const { return ints[16]; } // Alignment end position in target
+  int                      block_count  () const { return ints[17]; } // Number of blocks in the alignment (a block contains no gaps)
+  const block_list&        block_sizes  () const { return block_sizes_; } // Comma-separated list of sizes of each block
+  const block_list&        q_starts     () const { return q_starts_;    } // Comma-separated list of starting positions of each block in query
+  const block_list&        t_starts     () const { return t_starts_;    } // Comma-separated list of starting positions of each block in target
+
+  // True if the query is reverse complemented, i.e., if strand() is "-".
+  bool is_rc() const { return strand_char == '-'; }
 
   int num_identity() const { return matches() + rep_matches(); }
 
@@ -109,20 +123,38 @@ public:
 private:
   lazycsv<21, '\t'> lazy_csv;
 
-  template<typename T>
-  inline std::vector<T> parse_vector(size_t col) const
+  // Cached fields. ints[i] holds column i if column i is numeric; the entries
+  // for the string columns (8, 9, and 13) are unused. strand_char is '+' or
+  // '-' if strand() is exactly that string, and '?' otherwise.
+  boost::array<int, 18> ints;
+  char                  strand_char;
+  block_list            block_sizes_, q_starts_, t_starts_;
+
+  void parse_fields()
+  {
+    for (size_t col = 0; col < 18; ++col)
+      if (col != 8 && col != 9 && col != 13)
+        ints[col] = parse_integer<int>(lazy_csv.begin(col), lazy_csv.end(col));
+    strand_char = lazy_csv.field_equals(8, "+") ? '+' :
+                  lazy_csv.field_equals(8, "-") ? '-' : '?';
+    parse_list(block_sizes_, 18);
+    parse_list(q_starts_,    19);
+    parse_list(t_starts_,    20);
+  }
+
+  // Decodes a comma-separated list of integers (with optional trailing comma),
+  // straight from the line buffer.
+  inline void parse_list(block_list& out, size_t col) const
   {
-    std::vector<T> out;
-    std::string str = lazy_csv.at<std::string>(col);
-    std::string::const_iterator i, j;
-    std::string::const_iterator end = str.end();
-    for (i = j = str.begin(); i != end; i = j) {
+    out.clear();
+    const char *i, *j;
+    const char *end = lazy_csv.end(col);
+    for (i = j = lazy_csv.begin(col); i != end; i = j) {
       for (; j != end && *j != ','; ++j) {}
-      out.push_back(boost::lexical_cast<T>(std::string(i, j)));
+      out.push_back(parse_integer<int>(i, j));
       if (j != end)
         ++j; // skip past ',' (including trailing ',')
     }
-    return out;
   }
 };
 
@@ -192,19 +224,19 @@ namespace detail
     : at_end(true)
     {}
 
-    psl_alignment_segment_iterator(const psl_alignment& al_, const std::string& a, const std::string& b)
+    psl_alignment_segment_iterator(const psl_alignment& al_, string_ref a, string_ref b)
     : at_end(false),
       al(&al_),
       i(0),
-      block_sizes(al->block_sizes()),
-      a_starts(al->q_starts()),
-      b_starts(al->t_starts()),
-      a(&a),
-      b(&b),
-      a_is_rc(al->strand() == "-")
+      block_sizes(&al->block_sizes()),
+      a_starts(&al->q_starts()),
+      b_starts(&al->t_starts()),
+      a(a),
+      b(b),
+      a_is_rc(al->is_rc())
     {
-      assert(a_starts.size() == block_sizes.size());
-      assert(b_starts.size() == block_sizes.size());
+      assert(a_starts->size() == block_sizes->size());
+      assert(b_starts->size() == block_sizes->size());
       assert(al->strand() == "-" || al->strand() == "+");
       increment();
     }
@@ -217,44 +249,24 @@ namespace detail
     void increment()
     {
       // check for end
-      if (i == block_sizes.size()) {
+      if (i == block_sizes->size()) {
         at_end = true;
         return;
       }
 
       // segment start and end
-      seg.a_start = a_is_rc ? (a->size() - 1) - a_starts[i] : a_starts[i];
-      seg.a_end   = a_is_rc ? seg.a_start - (block_sizes[i] - 1)
-                            : seg.a_start + (block_sizes[i] - 1);
-      seg.b_start = b_starts[i];
-      seg.b_end   = b_starts[i] + (block_sizes[i] - 1);
+      int block_size = (*block_sizes)[i];
+      seg.a_start = a_is_rc ? (a.size() - 1) - (*a_starts)[i] : (*a_starts)[i];
+      seg.a_end   = a_is_rc ? seg.a_start - (block_size - 1)
+                            : seg.a_start + (block_size - 1);
+      seg.b_start = (*b_starts)[i];
+      seg.b_end   = (*b_starts)[i] + (block_size - 1);
 
       // look for mismatches
       seg.a_mismatches.clear();
       seg.b_mismatches.clear();
-      int a_pos = seg.a_start;
-      int b_pos = seg.b_start;
-      for (int j = 0; j < block_sizes[i]; ++j) {
-        char a_char = a_is_rc ? complement((*a)[a_pos]) : (*a)[a_pos];
-        char b_char = (*b)[b_pos];
-        if (a_char != b_char ||
-            a_char == 'N' || a_char == 'n' ||
-            b_char == 'N' || b_char == 'n') {
-          seg.a_mismatches.push_back(a_pos);
-          seg.b_mismatches.push_back(b_pos);
-        }
-        if (a_is_rc)
-          --a_pos;
-        else
-          ++a_pos;
-        ++b_pos;
-      }
-
-      if (a_is_rc)
-        assert(a_pos == (int)(seg.a_end) - 1);
-      else
-        assert(a_pos == (int)(seg.a_end) + 1);
-      assert(b_pos == (int)(seg.b_end) + 1);
+      find_mismatches(a.data(), seg.a_start, a_is_rc, b.data(), seg.b_start, block_size,
+                      seg.a_mismatches, seg.b_mismatches);
 
       i += 1;
     }
@@ -277,11 +289,13 @@ namespace detail
     const psl_alignment *al;
     alignment_segment seg;
 
+    // The block lists are owned by *al, so they are not copied along with
+    // the iterator.
     size_t i;
-    std::vector<int>         block_sizes;
-    std::vector<int>         a_starts, b_starts;
+    const psl_alignment::block_list *block_sizes;
+    const psl_alignment::block_list *a_starts, *b_starts;
     //std::vector<std::string> a_segs,   b_segs;
-    const std::string        *a,       *b;
+    string_ref               a,        b;
     bool                     a_is_rc;
   };
 
@@ -293,7 +307,7 @@ namespace detail
   class psl_alignment_segments
   {
   public:
-    psl_alignment_segments(const psl_alignment& al, const std::string& a, const std::string& b) : al(al), a(a), b(b) {}
+    psl_alignment_segments(const psl_alignment& al, string_ref a, string_ref b) : al(al), a(a), b(b) {}
     typedef const alignment_segment&       const_reference;
     typedef psl_alignment_segment_iterator const_iterator;
     const_iterator begin() const { return psl_alignment_segment_iterator(al, a, b); }
@@ -301,12 +315,12 @@ namespace detail
 
   private:
     const psl_alignment& al;
-    const std::string& a, b;
+    string_ref a, b;
   };
 
 } // namespace detail
 
-psl_alignment::segments_type psl_alignment::segments(const std::string& a, const std::string& b) const
+psl_alignment::segments_type psl_alignment::segments(string_ref a, string_ref b) const
 {
   return psl_alignment::segments_type(*this, a, b);
 }
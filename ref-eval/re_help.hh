@@ -169,6 +169,10 @@ std::string get_help_string() { return
 "\n"
 "Usage: Input and output specification\n"
 "\n"
+"   Any of the input files may be uncompressed, gzip-compressed, or\n"
+"   BGZF-compressed (e.g., by bgzip). The compression is detected\n"
+"   automatically. BGZF files are decompressed using multiple threads.\n"
+"\n"
 "   --A-seqs arg\n"
 "\n"
 "           The assembly sequences, in FASTA format. Required.\n"
@@ -189,23 +193,103 @@ std::string get_help_string() { return
 "           produced by RSEM in a file called *.isoforms.results.\n"
 "           Required for weighted variants of scores.\n"
 "\n"
+"           For the kmer and kc scores, --A-expr and --B-expr may each\n"
+"           be given several times, to compute the weighted scores for\n"
+"           several expression profiles in one pass over the sequences.\n"
+"           Profile p uses the p-th value of each option, or its only\n"
+"           value, if it is given once, and its scores are named with\n"
+"           the suffix \".p\" (e.g., \"weighted_kmer_recall.2\"). Other\n"
+"           weighted scores accept only one expression profile.\n"
+"\n"
 "   --A-to-B arg\n"
 "\n"
 "           The alignments of the assembly to the reference. The file\n"
 "           format is specified by --alignment-type. Required for\n"
-"           alignment-based scores.\n"
+"           alignment-based scores, except with --alignment-type=builtin.\n"
 "\n"
 "   --B-to-A arg\n"
 "\n"
 "           The alignments of the reference to the assembly. The file\n"
 "           format is specified by --alignment-type. Required for\n"
-"           alignment-based scores.\n"
+"           alignment-based scores, except with --alignment-type=builtin.\n"
 "\n"
 "   --alignment-type arg\n"
 "\n"
-"           The type of alignments used, either blast or psl. Default:\n"
-"           psl. Currently BLAST support is experimental, not well\n"
-"           tested, and not recommended.\n"
+"           The type of alignments used, either blast, psl, sam, bam, or\n"
+"           builtin. Default: psl. Currently BLAST support is\n"
+"           experimental, not well tested, and not recommended. SAM and\n"
+"           BAM files, which may be compressed, are read directly; sam\n"
+"           and bam are interchangeable, since the format is detected\n"
+"           from the file contents. In a SAM or BAM file the query is the\n"
+"           aligned sequence and the reference is the target, as in a PSL\n"
+"           file. Unmapped records are ignored, and the @SQ header lines\n"
+"           must list every reference sequence. Mismatches are taken from\n"
+"           =/X CIGAR operations or the MD tag when present, and\n"
+"           otherwise found by comparing the sequences. Either way, as\n"
+"           with the other formats, a position where either base is an N\n"
+"           counts as a mismatch.\n"
+"\n"
+"           With builtin, no alignment files are given: A and B are\n"
+"           aligned to each other, in both directions, by a built-in\n"
+"           aligner, which indexes the target sequences by their\n"
+"           minimizers (a sample of their kmers), chains the minimizers\n"
+"           each query sequence shares with a target, and aligns the\n"
+"           bases between them. This is much faster than running an\n"
+"           external aligner, and gives scores close to those obtained\n"
+"           from blat alignments, but it is meant for closely related\n"
+"           sequences, such as an assembly and its reference, and it\n"
+"           misses alignments shorter than about 40 bases. The sequences\n"
+"           are aligned on all available threads. With --cache-dir, the\n"
+"           alignments are cached like parsed ones.\n"
+"\n"
+"   --alignment-cache\n"
+"\n"
+"           If this flag is present, the parsed alignments used by the\n"
+"           alignment-based scores are stored in a binary file next to each\n"
+"           alignment file (with .recache appended to its name), and later\n"
+"           runs load them from there instead of re-parsing the alignment\n"
+"           file. A cache file is only used if it was made from the same\n"
+"           alignment file, sequence files, --alignment-type, and\n"
+"           --strand-specific; otherwise it is rewritten. Other options,\n"
+"           such as --min-segment-len and --min-frac-identity, can be\n"
+"           changed freely.\n"
+"\n"
+"   --cache-dir arg\n"
+"\n"
+"           If this option is given, intermediate results are stored in\n"
+"           the given directory, which is created if needed, and later\n"
+"           runs reuse every result whose inputs have not changed. The\n"
+"           cached results are the parsed alignments (as with\n"
+"           --alignment-cache, but stored in the cache directory instead\n"
+"           of next to the alignment files), the nucleotide, pair, and\n"
+"           contig precision and recall, and the kmer counts of the\n"
+"           reference used by the kmer scores (the latter only when\n"
+"           --kmerlen is at most 31 and the sequences contain only A, C,\n"
+"           G, T, and N). Each result is stored under a hash of exactly\n"
+"           the inputs it depends on: the contents of the files and\n"
+"           sequences it was computed from, the expression values, and\n"
+"           the options that affect it. So, e.g., a run that only changes\n"
+"           --B-expr reuses the parsed alignments and the unweighted\n"
+"           nucleotide and pair scores. Cached results\n"
+"           are never invalidated, only left unused, so the directory can\n"
+"           be emptied at any time. Contig results are not cached when\n"
+"           --trace is given.\n"
+"\n"
+"           Moreover, the nucleotide and pair scores are computed\n"
+"           separately for each connected component of the graph formed\n"
+"           by the alignments, and the result for each component is\n"
+"           reused by later runs with the same reference in which the\n"
+"           component is unchanged. So when a new version of an assembly\n"
+"           changes only some of its contigs, only the components that\n"
+"           contain the changed contigs are recomputed. (The weighted\n"
+"           precision depends on the expression of every contig, however,\n"
+"           and is recomputed when it changes.) A component in which two\n"
+"           alignments of the same sequence contribute equally to a score\n"
+"           (e.g., because of redundant contigs, or isoforms that share\n"
+"           exons) is never reused, since which of them is selected\n"
+"           depends on all the alignments, and if there is one, all the\n"
+"           components are recomputed. So the scores are always exactly\n"
+"           those computed without --cache-dir.\n"
 "\n"
 "Usage: Options that modify the score definitions (and hence output)\n"
 "\n"
@@ -274,6 +358,25 @@ std::string get_help_string() { return
 "\n"
 "           Default: 0.01.\n"
 "\n"
+"   --matching-algorithm arg\n"
+"\n"
+"           This option only applies to contig scores. The algorithm used\n"
+"           to find the maximum cardinality and maximum weight matchings,\n"
+"           either bipartite, lemon, or greedy. The bipartite algorithms\n"
+"           (Hopcroft-Karp, and successive shortest paths for weighted\n"
+"           matchings) are specialized to the bipartite graphs used by the\n"
+"           contig scores, and are faster than lemon's general-graph\n"
+"           algorithms, which are kept as a reference. Both find optimal\n"
+"           matchings, so the scores are the same, but when several\n"
+"           matchings are optimal, the one reported by --trace may differ.\n"
+"           The greedy algorithm is approximate, for graphs too large for\n"
+"           the others: it takes edges from heaviest to lightest and then\n"
+"           improves the matching by local search, which gives at least\n"
+"           half of the optimal score. With greedy, upper bounds on the\n"
+"           optimal contig scores are also reported (e.g.,\n"
+"           unweighted_contig_recall_upper_bound), so the optimal scores\n"
+"           lie between the two. Default: bipartite.\n"
+"\n"
 "   --min-segment-len arg\n"
 "\n"
 "           This option only applies to nucleotide and pair scores.\n"
@@ -355,6 +458,80 @@ std::string get_help_string() { return
 "                to a reference sequence $b$, or all \"NA\" values if $a$\n"
 "                was not matched.\n"
 "\n"
+"   --profile\n"
+"\n"
+"           If given, print a table to standard error at the end of the\n"
+"           run, with the wall time, CPU time, thread utilization, peak\n"
+"           memory usage, and item count and throughput of each stage\n"
+"           (reading the sequences, reading the alignments, matching,\n"
+"           counting kmers, etc.). The CPU time includes all threads,\n"
+"           and the utilization is the CPU time divided by the wall time\n"
+"           and the number of threads, so it shows how well the\n"
+"           multithreaded stages use the available cores. The thread\n"
+"           utilization column gives the range, over the threads, of\n"
+"           each thread's own CPU time divided by the wall time (it is\n"
+"           sampled in each thread of the OpenMP thread pool), so it\n"
+"           shows whether the work was evenly spread.\n"
+"\n"
+"   --profile-json arg\n"
+"\n"
+"           If given, write the same information as --profile to this\n"
+"           file, in JSON format, for comparing runs with each other.\n"
+"\n"
+"   --simd arg\n"
+"\n"
+"           The SIMD instruction set used to compare aligned bases when\n"
+"           parsing alignments, to pack the sequences into 2 bits per base,\n"
+"           and to skip kmers that contain N: \"auto\", \"avx2\", \"sse2\", or\n"
+"           \"none\". The default, \"auto\", uses the most capable one that\n"
+"           the CPU supports, as detected when the program starts; the\n"
+"           others are mainly for testing, and \"avx2\" is an error on CPUs\n"
+"           without AVX2. The scores do not depend on this option.\n"
+"\n"
+"           With --serve, give it on the server's command line; it applies\n"
+"           to all of the server's jobs, and can't be given in a job.\n"
+"\n"
+"Usage: Server mode\n"
+"\n"
+"   --serve arg\n"
+"\n"
+"           If given, instead of computing scores, load the references\n"
+"           given by --serve-reference once, and then run evaluation jobs\n"
+"           sent to the Unix domain socket at this path, until killed. Each\n"
+"           job is given by the same options as a normal run, and its\n"
+"           --B-seqs must name one of the served references. The\n"
+"           reference's sequences, its reverse complements, its packed\n"
+"           sequences, and (if the job's --B-expr names the served\n"
+"           expression file) its expression are shared, read-only, by all\n"
+"           the jobs, instead of being read and computed for each one.\n"
+"           Jobs run concurrently, and the available threads are divided\n"
+"           evenly among them. Jobs are sent with --connect.\n"
+"\n"
+"   --serve-reference arg\n"
+"\n"
+"           A reference to serve, given as \"SEQS\" or \"SEQS,EXPR\", where\n"
+"           SEQS is its FASTA file and EXPR its expression file. This\n"
+"           option can be given several times, to serve several references.\n"
+"\n"
+"   --serve-workers arg\n"
+"\n"
+"           The number of jobs to run at once with --serve. Default: 2.\n"
+"\n"
+"   --connect arg\n"
+"\n"
+"           If given, send the rest of the command line as a job to the\n"
+"           ref-eval --serve at the Unix domain socket at this path, wait\n"
+"           for it to finish, and print its scores in the usual format.\n"
+"           Relative paths are resolved against the current directory.\n"
+"           --profile, --profile-json, and --simd can't be used in jobs\n"
+"           (--simd goes on the server's command line instead).\n"
+"\n"
+"           The protocol is simple enough to use from other programs: send\n"
+"           an absolute working directory, then the job's arguments, one per\n"
+"           line, then an empty line. The response is \"ok\" followed by the\n"
+"           scores, or \"error: \" followed by a message, and then the server\n"
+"           closes the connection.\n"
+"\n"
 "Usage: General options\n"
 "\n"
 "   -? [ --help ]\n"
@@ -30,9 +30,12 @@
 #include "expr.hh"
 #include "fasta.hh"
 #include "opts.hh"
+#include "profile.hh"
+#include "reference.hh"
 #include "skip_Ns.hh"
 #include "util.hh"
 #include "kmer_key.hh"
+#include "kmer_profiles.hh"
 
 namespace re {
 namespace kc {
@@ -40,6 +43,7 @@ namespace kc {
 template<typename Number>
 struct kmer_info
 {
+  typedef Number number_type;
   bool is_present_in_A;
   Number weight_in_B;
   kmer_info()
@@ -90,8 +94,8 @@ struct empty_key_initializer<dense_float_kmer_map>
 template<typename Ht>
 void count_kmers_in_A(
     Ht& ht,
-    const std::vector<std::string>& A,
-    const std::vector<std::string>& A_rc,
+    const seq_arena& A,
+    const seq_arena& A_rc,
     size_t kmerlen,
     bool strand_specific)
 {
@@ -103,10 +107,10 @@ void count_kmers_in_A(
     //std::cerr << i << " of " << A.size() << "(" << 100.0*i/A.size()
     //          << " percent)" << std::endl;
     for (size_t which = 0; which < num_strands; ++which) {
-      const std::string& a = which == 0 ? A[i] : A_rc[i];
+      string_ref a = which == 0 ? A[i] : A_rc[i];
       if (a.size() >= kmerlen) {
-        const char *beg = a.c_str();
-        const char *a_end = a.c_str() + a.size() + 1 - kmerlen;
+        const char *beg = a.data();
+        const char *a_end = a.data() + a.size() + 1 - kmerlen;
         beg = skip_Ns(beg, a_end, kmerlen, true);
         for (; beg != a_end; ++beg) {
           beg = skip_Ns(beg, a_end, kmerlen, false);
@@ -122,8 +126,8 @@ void count_kmers_in_A(
 template<typename Ht>
 void count_kmers_in_B(
     Ht& ht,
-    const std::vector<std::string>& B,
-    const std::vector<std::string>& B_rc,
+    const seq_arena& B,
+    const seq_arena& B_rc,
     const std::vector<double>& tau_B,
     size_t kmerlen,
     bool strand_specific)
@@ -136,11 +140,11 @@ void count_kmers_in_B(
     //std::cerr << i << " of " << B.size() << "(" << 100.0*i/B.size()
     //          << " percent)" << std::endl;
     for (size_t which = 0; which < num_strands; ++which) {
-      const std::string& b = which == 0 ? B[i] : B_rc[i];
+      string_ref b = which == 0 ? B[i] : B_rc[i];
       if (b.size() >= kmerlen) {
         double c = tau_B[i];
-        const char *beg = b.c_str();
-        const char *b_end = b.c_str() + b.size() + 1 - kmerlen;
+        const char *beg = b.data();
+        const char *b_end = b.data() + b.size() + 1 - kmerlen;
         beg = skip_Ns(beg, b_end, kmerlen, true);
         for (; beg != b_end; ++beg) {
           beg = skip_Ns(beg, b_end, kmerlen, false);
@@ -154,20 +158,20 @@ void count_kmers_in_B(
 }
 
 size_t estimate_hashtable_size(
-    const std::vector<std::string>& A,
-    const std::vector<std::string>& B,
+    const seq_arena& A,
+    const seq_arena& B,
     size_t kmerlen,
     double hash_table_fudge_factor)
 {
   size_t max_entries = 0;
-  BOOST_FOREACH(const std::string& a, A)
-    if (a.size() >= kmerlen)
+  for (size_t i = 0; i < A.size(); ++i)
+    if (A.length(i) >= kmerlen)
       max_entries += static_cast<size_t>(0.5 +
-        2 * (a.size() + 1 - kmerlen) / hash_table_fudge_factor);
-  BOOST_FOREACH(const std::string& b, B)
-    if (b.size() >= kmerlen)
+        2 * (A.length(i) + 1 - kmerlen) / hash_table_fudge_factor);
+  for (size_t i = 0; i < B.size(); ++i)
+    if (B.length(i) >= kmerlen)
       max_entries += static_cast<size_t>(0.5 +
-        2 * (b.size() + 1 - kmerlen) / hash_table_fudge_factor);
+        2 * (B.length(i) + 1 - kmerlen) / hash_table_fudge_factor);
   return max_entries;
 }
 
@@ -193,17 +197,102 @@ double compute_inverse_compression_rate(
   return 1.0 * num_bases_in_A / (o.num_reads * o.readlen);
 }
 
+// Marks kmer x as present in A, in column 0 of its row.
+template<typename Table>
+struct mark_present_in_A
+{
+  Table& table;
+  explicit mark_present_in_A(Table& table) : table(table) {}
+  void operator()(size_t, const typename Table::key_type& x) { table.row(x)[0] = 1; }
+};
+
+// Like compute_kmer_recall, for every expression profile at once: t's rows
+// hold whether a kmer is present in A, followed by its weight in B under each
+// profile.
+template<typename Table>
+std::vector<double> compute_kmer_recalls(const Table& t)
+{
+  size_t num_profiles = t.width - 1;
+  std::vector<double> numer(num_profiles, 0.0), denom(num_profiles, 0.0);
+  for (size_t id = 0; id < t.size(); ++id) {
+    const typename Table::number_type *row = t.row_at(id);
+    for (size_t p = 0; p < num_profiles; ++p) {
+      if (row[0] > 0)
+        numer[p] += row[1 + p];
+      denom[p] += row[1 + p];
+    }
+  }
+  for (size_t p = 0; p < num_profiles; ++p)
+    numer[p] /= denom[p];
+  return numer;
+}
+
+// Like main_1, but for several expression profiles of B at once (see
+// kmer_profiles.hh). The scores of profile p are named with the suffix "." +
+// (p + 1), except for the inverse compression rate, which does not depend on
+// the expression.
+template<typename Ht>
+void main_1_profiles(
+    const opts& o,
+    const fasta& A,
+    const fasta& B,
+    const seq_arena& A_rc,
+    const seq_arena& B_rc,
+    const std::vector<const expr *>& taus_B)
+{
+  typedef typename id_map_of<Ht>::type Ids;
+  typedef kmer_profile_table<Ids, typename Ht::mapped_type::number_type> Table;
+  size_t max_entries = estimate_hashtable_size(A.seqs, B.seqs, o.kmerlen, o.hash_table_fudge_factor);
+  std::cerr << "Initializing the hash table with space for " << max_entries << " entries..." << std::endl;
+  Ids ids(max_entries, kmer_key_hash(o.kmerlen), kmer_key_equal_to(o.kmerlen));
+  id_map_empty_key_initializer<Ids> eki(ids, o.kmerlen);
+  Table t(ids, 1 + taus_B.size());
+
+  std::cerr << "Populating the hash table for " << taus_B.size() << " expression profiles..." << std::flush;
+  profile_stage count_stage("kc: count kmers");
+  mark_present_in_A<Table> mark(t);
+  add_profile_weights<Table> add_B(t, taus_B, 1);
+  for_each_kmer(A.seqs, A_rc, o.readlen, o.strand_specific, mark);
+  for_each_kmer(B.seqs, B_rc, o.readlen, o.strand_specific, add_B);
+  count_stage.set_items(t.size(), "distinct kmers");
+  count_stage.finish();
+  std::cerr << "done; hash table contains " << t.size() << " entries." << std::endl;
+
+  std::cerr << "Computing kmer recall, inverse compression rate, and kmer compression scores..." << std::endl;
+  profile_stage stats_stage("kc: stats");
+  std::vector<double> wkr = compute_kmer_recalls(t);
+  double icr = compute_inverse_compression_rate(o, A);
+  stats_stage.finish();
+
+  for (size_t p = 0; p < wkr.size(); ++p)
+    *o.out << "weighted_kmer_recall." << p + 1 << "\t" << wkr[p] << std::endl;
+  *o.out << "inverse_compression_rate\t" << icr << std::endl;
+  for (size_t p = 0; p < wkr.size(); ++p)
+    *o.out << "kmer_compression_score." << p + 1 << "\t" << wkr[p] - icr << std::endl;
+}
+
 template<typename Ht>
 void main_1(
     const opts& o,
     const fasta& A,
     const fasta& B,
-    const expr& tau_B)
+    const std::vector<const expr *>& taus_B,
+    const reference *ref)
 {
   std::cerr << "Reverse complementing the sequences..." << std::endl;
-  std::vector<std::string> A_rc, B_rc;
-  transform(A.seqs.begin(), A.seqs.end(), back_inserter(A_rc), reverse_complement);
-  transform(B.seqs.begin(), B.seqs.end(), back_inserter(B_rc), reverse_complement);
+  profile_stage rc_stage("kc: reverse complement");
+  seq_arena A_rc, B_own_rc;
+  reverse_complement(A_rc, A.seqs);
+  if (!ref)
+    reverse_complement(B_own_rc, B.seqs);
+  const seq_arena& B_rc = ref ? ref->B_rc : B_own_rc;
+  rc_stage.finish();
+
+  if (taus_B.size() > 1) {
+    main_1_profiles<Ht>(o, A, B, A_rc, B_rc, taus_B);
+    return;
+  }
+  const expr& tau_B = *taus_B[0];
 
   size_t max_entries = estimate_hashtable_size(A.seqs, B.seqs, o.kmerlen, o.hash_table_fudge_factor);
   std::cerr << "Initializing the hash table with space for " << max_entries << " entries..." << std::endl;
@@ -211,34 +300,44 @@ void main_1(
   empty_key_initializer<Ht> eki(ht, o.kmerlen);
 
   std::cerr << "Populating the hash table..." << std::flush;
+  profile_stage count_stage("kc: count kmers");
   count_kmers_in_A(ht, A.seqs, A_rc,        o.readlen, o.strand_specific);
   count_kmers_in_B(ht, B.seqs, B_rc, tau_B, o.readlen, o.strand_specific);
+  count_stage.set_items(ht.size(), "distinct kmers");
+  count_stage.finish();
   std::cerr << "done; hash table contains " << ht.size() << " entries." << std::endl;
 
   std::cerr << "Computing kmer recall, inverse compression rate, and kmer compression scores..." << std::endl;
+  profile_stage stats_stage("kc: stats");
   double wkr = compute_kmer_recall(ht);
   double icr = compute_inverse_compression_rate(o, A);
+  stats_stage.finish();
 
-  std::cout << "weighted_kmer_recall\t" << wkr << std::endl;
-  std::cout << "inverse_compression_rate\t" << icr << std::endl;
-  std::cout << "kmer_compression_score\t" << wkr - icr << std::endl;
+  *o.out << "weighted_kmer_recall\t" << wkr << std::endl;
+  *o.out << "inverse_compression_rate\t" << icr << std::endl;
+  *o.out << "kmer_compression_score\t" << wkr - icr << std::endl;
 }
 
+// taus_B holds the expression of B under each expression profile (see
+// num_expr_profiles in opts.hh); the weighted scores are computed for each. If
+// ref is given, B is ref->B, and the reverse complements of B are taken from
+// it.
 void main(
     const opts& o,
     const fasta& A,
     const fasta& B,
-    const expr& tau_B)
+    const std::vector<const expr *>& taus_B,
+    const reference *ref = NULL)
 {
   if (o.kc || o.paper) {
     if (o.hash_table_type == "sparse" && o.hash_table_numeric_type == "double")
-      main_1<sparse_double_kmer_map>(o, A, B, tau_B);
+      main_1<sparse_double_kmer_map>(o, A, B, taus_B, ref);
     else if (o.hash_table_type == "sparse" && o.hash_table_numeric_type == "float")
-      main_1<sparse_float_kmer_map>(o, A, B, tau_B);
+      main_1<sparse_float_kmer_map>(o, A, B, taus_B, ref);
     else if (o.hash_table_type == "dense" && o.hash_table_numeric_type == "double")
-      main_1<dense_double_kmer_map>(o, A, B, tau_B);
+      main_1<dense_double_kmer_map>(o, A, B, taus_B, ref);
     else if (o.hash_table_type == "dense" && o.hash_table_numeric_type == "float")
-      main_1<dense_float_kmer_map>(o, A, B, tau_B);
+      main_1<dense_float_kmer_map>(o, A, B, taus_B, ref);
     else
       throw std::runtime_error("Unknown hash map type.");
   }
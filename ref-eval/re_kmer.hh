@@ -25,11 +25,20 @@
 #include <string>
 #include <vector>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 #include <sparsehash/sparse_hash_map>
 #include <sparsehash/dense_hash_map>
+#include "expr.hh"
+#include "fasta.hh"
+#include "opts.hh"
+#include "profile.hh"
+#include "reference.hh"
 #include "skip_Ns.hh"
+#include "stage_cache.hh"
 #include "util.hh"
 #include "kmer_key.hh"
+#include "kmer_profiles.hh"
+#include "packed_seqs.hh"
 
 namespace re {
 namespace kmer {
@@ -37,6 +46,7 @@ namespace kmer {
 template<typename Number>
 struct kmer_info
 {
+  typedef Number number_type;
   Number weights[2]; // sometimes normalized, sometimes not
   kmer_info()
   {
@@ -54,6 +64,15 @@ typedef google::sparse_hash_map<kmer_key, kmer_info<float>, kmer_key_hash, kmer_
 typedef google::dense_hash_map<kmer_key, kmer_info<double>, kmer_key_hash, kmer_key_equal_to> dense_double_kmer_map;
 typedef google::dense_hash_map<kmer_key, kmer_info<float>, kmer_key_hash, kmer_key_equal_to> dense_float_kmer_map;
 
+typedef google::sparse_hash_map<packed_kmer_key, kmer_info<double>, packed_kmer_key_hash> sparse_double_packed_kmer_map;
+typedef google::sparse_hash_map<packed_kmer_key, kmer_info<float>, packed_kmer_key_hash> sparse_float_packed_kmer_map;
+typedef google::dense_hash_map<packed_kmer_key, kmer_info<double>, packed_kmer_key_hash> dense_double_packed_kmer_map;
+typedef google::dense_hash_map<packed_kmer_key, kmer_info<float>, packed_kmer_key_hash> dense_float_packed_kmer_map;
+
+// Packed kmers are only used for kmers shorter than a full word, so that the
+// all-ones word is free to be the empty key of the dense maps.
+const size_t max_packed_kmerlen = packed_seqs::max_kmer_word_len - 1;
+
 template<typename Ht>
 struct empty_key_initializer
 {
@@ -87,12 +106,30 @@ struct empty_key_initializer<dense_float_kmer_map>
   }
 };
 
+template<>
+struct empty_key_initializer<dense_double_packed_kmer_map>
+{
+  empty_key_initializer(dense_double_packed_kmer_map& ht, size_t)
+  {
+    ht.set_empty_key(~packed_kmer_key(0));
+  }
+};
+
+template<>
+struct empty_key_initializer<dense_float_packed_kmer_map>
+{
+  empty_key_initializer(dense_float_packed_kmer_map& ht, size_t)
+  {
+    ht.set_empty_key(~packed_kmer_key(0));
+  }
+};
+
 // A_or_B is 0 if we're counting A's kmers, 1 if B's
 template<typename Ht, size_t A_or_B>
 void count_kmers(
     Ht& ht,
-    const std::vector<std::string>& A,
-    const std::vector<std::string>& A_rc,
+    const seq_arena& A,
+    const seq_arena& A_rc,
     const std::vector<double>& tau_A,
     size_t kmerlen,
     bool strand_specific)
@@ -105,11 +142,11 @@ void count_kmers(
   size_t num_strands = strand_specific ? 1 : 2;
   for (size_t i = 0; i < A.size(); ++i) {
     for (size_t which = 0; which < num_strands; ++which) {
-      const std::string& a = which == 0 ? A[i] : A_rc[i];
+      string_ref a = which == 0 ? A[i] : A_rc[i];
       if (a.size() >= kmerlen) {
         double c = tau_A[i];
-        const char *beg = a.c_str();
-        const char *a_end = a.c_str() + a.size() + 1 - kmerlen;
+        const char *beg = a.data();
+        const char *a_end = a.data() + a.size() + 1 - kmerlen;
         beg = skip_Ns(beg, a_end, kmerlen, true);
         for (; beg != a_end; ++beg) {
           beg = skip_Ns(beg, a_end, kmerlen, false);
@@ -122,6 +159,92 @@ void count_kmers(
   }
 }
 
+// Like count_kmers, but for sequences held in a packed_seqs whose only
+// exceptions are Ns, with kmers of length at most max_packed_kmerlen. Each
+// kmer is computed from the previous one with a shift, and the reverse
+// complement kmers are computed from the forward ones, so no reverse
+// complemented copy of A is needed. The kmers containing an N are skipped,
+// as in count_kmers.
+template<typename Ht, size_t A_or_B>
+void count_packed_kmers(
+    Ht& ht,
+    const packed_seqs& A,
+    const std::vector<double>& tau_A,
+    size_t kmerlen,
+    bool strand_specific)
+{
+  assert(kmerlen >= 1 && kmerlen <= max_packed_kmerlen);
+  size_t shift = 2 * (kmerlen - 1);
+  for (size_t i = 0; i < A.size(); ++i) {
+    double c = tau_A[i];
+    const packed_seqs::exception_run *r = A.exceptions_begin(i), *r_end = A.exceptions_end(i);
+    // Walk over the stretches [p, q) of a between runs of N.
+    for (size_t p = 0; p < A.length(i); ++r) {
+      size_t q = r == r_end ? A.length(i) : r->start - A.offset(i);
+      if (q - p >= kmerlen) {
+        packed_kmer_key x = A.kmer(i, p, kmerlen);
+        for (size_t j = p; ; ++j) {
+          ht[x].weights[A_or_B] += c; // relies on default init to 0
+          if (!strand_specific)
+            ht[packed_seqs::reverse_complement_kmer(x, kmerlen)].weights[A_or_B] += c;
+          if (j + kmerlen == q)
+            break;
+          x = (x >> 2) | (static_cast<packed_kmer_key>(A.base(i, j + kmerlen)) << shift);
+        }
+      }
+      if (r == r_end)
+        break;
+      p = r->end() - A.offset(i);
+    }
+  }
+}
+
+struct cached_kmer
+{
+  packed_kmer_key key;
+  double weight;
+};
+
+// Like count_packed_kmers<Ht, 1>, but with --cache-dir, B's kmer counts are
+// looked up in the "kmers" stage of the cache (see stage_cache.hh) first, and
+// stored there if they are not found. In either case the counts are made in a
+// separate table and added to ht in the order they are stored in, so that the
+// scores do not depend on whether the counts came from the cache.
+template<typename Ht>
+void count_packed_kmers_cached(
+    Ht& ht,
+    const opts& o,
+    const packed_seqs& B,
+    uint64_t B_checksum,
+    const std::vector<double>& tau_B)
+{
+  if (o.cache_dir == "") {
+    count_packed_kmers<Ht, 1>(ht, B, tau_B, o.kmerlen, o.strand_specific);
+    return;
+  }
+
+  stage_key key("kmers");
+  key.add(B_checksum).add(static_cast<uint64_t>(o.kmerlen))
+     .add(static_cast<uint64_t>(o.strand_specific)).add(o.hash_table_numeric_type)
+     .add(tau_B);
+  std::vector<cached_kmer> counts;
+  if (!load_stage(counts, o.cache_dir, key)) {
+    Ht B_ht;
+    empty_key_initializer<Ht> eki(B_ht, o.kmerlen);
+    count_packed_kmers<Ht, 1>(B_ht, B, tau_B, o.kmerlen, o.strand_specific);
+    counts.reserve(B_ht.size());
+    BOOST_FOREACH(const typename Ht::value_type& x, B_ht) {
+      cached_kmer k;
+      k.key    = x.first;
+      k.weight = x.second.weight_in_B();
+      counts.push_back(k);
+    }
+    save_stage_or_warn(counts, o.cache_dir, key);
+  }
+  BOOST_FOREACH(const cached_kmer& k, counts)
+    ht[k.key].weights[1] += k.weight;
+}
+
 template<typename Ht>
 void normalize_kmer_distributions(Ht& ht)
 {
@@ -141,38 +264,41 @@ void normalize_kmer_distributions(Ht& ht)
 }
 
 size_t estimate_hashtable_size(
-    const std::vector<std::string>& A,
-    const std::vector<std::string>& B,
+    const seq_arena& A,
+    const seq_arena& B,
     size_t kmerlen,
     double hash_table_fudge_factor)
 {
   size_t max_entries = 0;
-  BOOST_FOREACH(const std::string& a, A)
-    if (a.size() >= kmerlen)
+  for (size_t i = 0; i < A.size(); ++i)
+    if (A.length(i) >= kmerlen)
       max_entries += static_cast<size_t>(0.5 +
-        2 * (a.size() + 1 - kmerlen) / hash_table_fudge_factor);
-  BOOST_FOREACH(const std::string& b, B)
-    if (b.size() >= kmerlen)
+        2 * (A.length(i) + 1 - kmerlen) / hash_table_fudge_factor);
+  for (size_t i = 0; i < B.size(); ++i)
+    if (B.length(i) >= kmerlen)
       max_entries += static_cast<size_t>(0.5 +
-        2 * (b.size() + 1 - kmerlen) / hash_table_fudge_factor);
+        2 * (B.length(i) + 1 - kmerlen) / hash_table_fudge_factor);
   return max_entries;
 }
 
-template<typename Ht>
-void compute_stats(
-    const Ht& ht,
-    const std::string& prefix)
+// The kmer scores of a pair of normalized distributions, accumulated one kmer
+// at a time.
+struct kmer_stats
 {
-  typedef typename Ht::value_type X;
-  double KL_A_to_M = 0.0;
-  double KL_B_to_M = 0.0;
-  double hellinger = 0.0;
-  double total_var = 0.0;
+  double KL_A_to_M;
+  double KL_B_to_M;
+  double hellinger;
+  double total_var;
 
-  BOOST_FOREACH(const X& x, ht) {
-    double w_A = x.second.weight_in_A();
-    double w_B = x.second.weight_in_B();
+  kmer_stats()
+  : KL_A_to_M(0.0),
+    KL_B_to_M(0.0),
+    hellinger(0.0),
+    total_var(0.0)
+  {}
 
+  void add(double w_A, double w_B)
+  {
     double mean_prob = 0.5*(w_A + w_B);
     KL_A_to_M += w_A == 0 ? 0 : w_A * (log2(w_A) - log2(mean_prob));
     KL_B_to_M += w_B == 0 ? 0 : w_B * (log2(w_B) - log2(mean_prob));
@@ -182,15 +308,76 @@ void compute_stats(
     
     total_var += fabs(w_A - w_B);
   }
-  double JS = 0.5*KL_A_to_M + 0.5*KL_B_to_M;
-  hellinger = sqrt(hellinger)/sqrt(2.0);
-  total_var *= 0.5;
-
-  std::cout << prefix << "_kmer_KL_A_to_M\t"       << KL_A_to_M << std::endl;
-  std::cout << prefix << "_kmer_KL_B_to_M\t"       << KL_B_to_M << std::endl;
-  std::cout << prefix << "_kmer_jensen_shannon\t"  << JS << std::endl;
-  std::cout << prefix << "_kmer_hellinger\t"       << hellinger << std::endl;
-  std::cout << prefix << "_kmer_total_variation\t" << total_var << std::endl;
+
+  // Writes the scores, each named prefix + "_kmer_" + its name + suffix.
+  void print(const std::string& prefix, const std::string& suffix, std::ostream& out) const
+  {
+    double JS = 0.5*KL_A_to_M + 0.5*KL_B_to_M;
+    double h = sqrt(hellinger)/sqrt(2.0);
+    double tv = 0.5*total_var;
+
+    out << prefix << "_kmer_KL_A_to_M"       << suffix << "\t" << KL_A_to_M << std::endl;
+    out << prefix << "_kmer_KL_B_to_M"       << suffix << "\t" << KL_B_to_M << std::endl;
+    out << prefix << "_kmer_jensen_shannon"  << suffix << "\t" << JS << std::endl;
+    out << prefix << "_kmer_hellinger"       << suffix << "\t" << h << std::endl;
+    out << prefix << "_kmer_total_variation" << suffix << "\t" << tv << std::endl;
+  }
+};
+
+template<typename Ht>
+void compute_stats(
+    const Ht& ht,
+    const std::string& prefix,
+    std::ostream& out)
+{
+  typedef typename Ht::value_type X;
+  kmer_stats stats;
+  BOOST_FOREACH(const X& x, ht)
+    stats.add(x.second.weight_in_A(), x.second.weight_in_B());
+  stats.print(prefix, "", out);
+}
+
+// Like normalize_and_compute_stats, but for the weighted scores of every
+// expression profile in t, whose rows hold a kmer's weight in A under each of
+// the num_profiles profiles followed by its weight in B under each. The
+// scores of profile p are named with the suffix "." + (p + 1).
+template<typename Table>
+void normalize_and_compute_profile_stats(const Table& t, size_t num_profiles, std::ostream& out)
+{
+  typedef typename Table::number_type Number;
+  std::cerr << "Normalizing the induced distributions..." << std::endl;
+  profile_stage stage("kmer: stats");
+  std::vector<double> denoms(2 * num_profiles, 0.0);
+  for (size_t id = 0; id < t.size(); ++id)
+    for (size_t c = 0; c < 2 * num_profiles; ++c)
+      denoms[c] += t.row_at(id)[c];
+
+  std::cerr << "Computing kmer Jensen-Shannon, Hellinger, and total variation scores..." << std::endl;
+  std::vector<kmer_stats> stats(num_profiles);
+  for (size_t id = 0; id < t.size(); ++id) {
+    const Number *row = t.row_at(id);
+    for (size_t p = 0; p < num_profiles; ++p) {
+      // Rounded to Number, as normalize_kmer_distributions does.
+      Number w_A = row[p]                / denoms[p];
+      Number w_B = row[num_profiles + p] / denoms[num_profiles + p];
+      stats[p].add(w_A, w_B);
+    }
+  }
+  for (size_t p = 0; p < num_profiles; ++p)
+    stats[p].print("weighted", "." + boost::lexical_cast<std::string>(p + 1), out);
+  stage.set_items(t.size(), "distinct kmers");
+}
+
+template<typename Ht>
+void normalize_and_compute_stats(Ht& ht, const std::string& prefix, std::ostream& out)
+{
+  std::cerr << "Normalizing the induced distributions..." << std::endl;
+  profile_stage stage("kmer: stats");
+  normalize_kmer_distributions(ht);
+
+  std::cerr << "Computing kmer Jensen-Shannon, Hellinger, and total variation scores..." << std::endl;
+  compute_stats(ht, prefix, out);
+  stage.set_items(ht.size(), "distinct kmers");
 }
 
 template<typename Ht>
@@ -198,8 +385,8 @@ void main_2(
     const opts& o,
     const fasta& A,
     const fasta& B,
-    const std::vector<std::string>& A_rc,
-    const std::vector<std::string>& B_rc,
+    const seq_arena& A_rc,
+    const seq_arena& B_rc,
     const expr& tau_A,
     const expr& tau_B,
     const std::string& prefix)
@@ -210,59 +397,238 @@ void main_2(
   empty_key_initializer<Ht> eki(ht, o.kmerlen);
 
   std::cerr << "Populating the hash table..." << std::flush;
+  profile_stage stage("kmer: count kmers");
   count_kmers<Ht, 0>(ht, A.seqs, A_rc, tau_A, o.kmerlen, o.strand_specific);
   count_kmers<Ht, 1>(ht, B.seqs, B_rc, tau_B, o.kmerlen, o.strand_specific);
+  stage.set_items(ht.size(), "distinct kmers");
+  stage.finish();
   std::cerr << "done; hash table contains " << ht.size() << " entries." << std::endl;
 
-  std::cerr << "Normalizing the induced distributions..." << std::endl;
-  normalize_kmer_distributions(ht);
-
-  std::cerr << "Computing kmer Jensen-Shannon, Hellinger, and total variation scores..." << std::endl;
-  compute_stats(ht, prefix);
+  normalize_and_compute_stats(ht, prefix, *o.out);
 }
 
+// Like main_2, but for packed sequences (see count_packed_kmers).
 template<typename Ht>
-void main_1(
+void main_2_packed(
     const opts& o,
     const fasta& A,
     const fasta& B,
+    const packed_seqs& A_packed,
+    const packed_seqs& B_packed,
+    uint64_t B_checksum,
     const expr& tau_A,
     const expr& tau_B,
+    const std::string& prefix)
+{
+  size_t max_entries = estimate_hashtable_size(A.seqs, B.seqs, o.kmerlen, o.hash_table_fudge_factor);
+  std::cerr << "Initializing the hash table with space for " << max_entries << " entries..." << std::endl;
+  Ht ht(max_entries);
+  empty_key_initializer<Ht> eki(ht, o.kmerlen);
+
+  std::cerr << "Populating the hash table..." << std::flush;
+  profile_stage stage("kmer: count kmers");
+  count_packed_kmers<Ht, 0>(ht, A_packed, tau_A, o.kmerlen, o.strand_specific);
+  count_packed_kmers_cached<Ht>(ht, o, B_packed, B_checksum, tau_B);
+  stage.set_items(ht.size(), "distinct kmers");
+  stage.finish();
+  std::cerr << "done; hash table contains " << ht.size() << " entries." << std::endl;
+
+  normalize_and_compute_stats(ht, prefix, *o.out);
+}
+
+// Like main_2 with tau_A = *taus_A[p] and tau_B = *taus_B[p], for every
+// expression profile p at once (see kmer_profiles.hh).
+template<typename Ht>
+void main_2_profiles(
+    const opts& o,
+    const fasta& A,
+    const fasta& B,
+    const seq_arena& A_rc,
+    const seq_arena& B_rc,
+    const std::vector<const expr *>& taus_A,
+    const std::vector<const expr *>& taus_B)
+{
+  typedef typename id_map_of<Ht>::type Ids;
+  typedef kmer_profile_table<Ids, typename Ht::mapped_type::number_type> Table;
+  size_t num_profiles = taus_A.size();
+  size_t max_entries = estimate_hashtable_size(A.seqs, B.seqs, o.kmerlen, o.hash_table_fudge_factor);
+  std::cerr << "Initializing the hash table with space for " << max_entries << " entries..." << std::endl;
+  Ids ids(max_entries, kmer_key_hash(o.kmerlen), kmer_key_equal_to(o.kmerlen));
+  id_map_empty_key_initializer<Ids> eki(ids, o.kmerlen);
+  Table t(ids, 2 * num_profiles);
+
+  std::cerr << "Populating the hash table for " << num_profiles << " expression profiles..." << std::flush;
+  profile_stage stage("kmer: count kmers");
+  add_profile_weights<Table> add_A(t, taus_A, 0), add_B(t, taus_B, num_profiles);
+  for_each_kmer(A.seqs, A_rc, o.kmerlen, o.strand_specific, add_A);
+  for_each_kmer(B.seqs, B_rc, o.kmerlen, o.strand_specific, add_B);
+  stage.set_items(t.size(), "distinct kmers");
+  stage.finish();
+  std::cerr << "done; hash table contains " << t.size() << " entries." << std::endl;
+
+  normalize_and_compute_profile_stats(t, num_profiles, *o.out);
+}
+
+// Like main_2_profiles, but for packed sequences. The counts are not cached.
+template<typename Ht>
+void main_2_packed_profiles(
+    const opts& o,
+    const fasta& A,
+    const fasta& B,
+    const packed_seqs& A_packed,
+    const packed_seqs& B_packed,
+    const std::vector<const expr *>& taus_A,
+    const std::vector<const expr *>& taus_B)
+{
+  typedef typename id_map_of<Ht>::type Ids;
+  typedef kmer_profile_table<Ids, typename Ht::mapped_type::number_type> Table;
+  size_t num_profiles = taus_A.size();
+  size_t max_entries = estimate_hashtable_size(A.seqs, B.seqs, o.kmerlen, o.hash_table_fudge_factor);
+  std::cerr << "Initializing the hash table with space for " << max_entries << " entries..." << std::endl;
+  Ids ids(max_entries);
+  id_map_empty_key_initializer<Ids> eki(ids, o.kmerlen);
+  Table t(ids, 2 * num_profiles);
+
+  std::cerr << "Populating the hash table for " << num_profiles << " expression profiles..." << std::flush;
+  profile_stage stage("kmer: count kmers");
+  add_profile_weights<Table> add_A(t, taus_A, 0), add_B(t, taus_B, num_profiles);
+  for_each_packed_kmer(A_packed, o.kmerlen, o.strand_specific, add_A);
+  for_each_packed_kmer(B_packed, o.kmerlen, o.strand_specific, add_B);
+  stage.set_items(t.size(), "distinct kmers");
+  stage.finish();
+  std::cerr << "done; hash table contains " << t.size() << " entries." << std::endl;
+
+  normalize_and_compute_profile_stats(t, num_profiles, *o.out);
+}
+
+template<typename Ht>
+void main_1(
+    const opts& o,
+    const fasta& A,
+    const fasta& B,
+    const std::vector<const expr *>& taus_A,
+    const std::vector<const expr *>& taus_B,
     const expr& unif_A,
-    const expr& unif_B)
+    const expr& unif_B,
+    const reference *ref)
 {
   std::cerr << "Reverse complementing the sequences..." << std::flush;
-  std::vector<std::string> A_rc, B_rc;
-  transform(A.seqs.begin(), A.seqs.end(), back_inserter(A_rc), reverse_complement);
-  transform(B.seqs.begin(), B.seqs.end(), back_inserter(B_rc), reverse_complement);
+  profile_stage stage("kmer: reverse complement");
+  seq_arena A_rc, B_own_rc;
+  reverse_complement(A_rc, A.seqs);
+  if (!ref)
+    reverse_complement(B_own_rc, B.seqs);
+  const seq_arena& B_rc = ref ? ref->B_rc : B_own_rc;
+  stage.finish();
   std::cerr << "done." << std::endl;
 
-  if (o.weighted)
-    main_2<Ht>(o, A, B, A_rc, B_rc, tau_A, tau_B, "weighted");
+  if (o.weighted && taus_A.size() == 1)
+    main_2<Ht>(o, A, B, A_rc, B_rc, *taus_A[0], *taus_B[0], "weighted");
+  else if (o.weighted)
+    main_2_profiles<Ht>(o, A, B, A_rc, B_rc, taus_A, taus_B);
 
   if (o.unweighted)
     main_2<Ht>(o, A, B, A_rc, B_rc, unif_A, unif_B, "unweighted");
 }
 
-void main(
+template<typename Ht>
+void main_1_packed(
     const opts& o,
     const fasta& A,
     const fasta& B,
-    const expr& tau_A,
-    const expr& tau_B,
+    const packed_seqs& A_packed,
+    const packed_seqs& B_packed,
+    uint64_t B_checksum,
+    const std::vector<const expr *>& taus_A,
+    const std::vector<const expr *>& taus_B,
     const expr& unif_A,
     const expr& unif_B)
+{
+  if (o.weighted && taus_A.size() == 1)
+    main_2_packed<Ht>(o, A, B, A_packed, B_packed, B_checksum, *taus_A[0], *taus_B[0], "weighted");
+  else if (o.weighted)
+    main_2_packed_profiles<Ht>(o, A, B, A_packed, B_packed, taus_A, taus_B);
+
+  if (o.unweighted)
+    main_2_packed<Ht>(o, A, B, A_packed, B_packed, B_checksum, unif_A, unif_B, "unweighted");
+}
+
+// Packs A and B, and returns true if their kmers can be counted as packed
+// kmers, i.e., if the kmers are short enough and the sequences contain no
+// characters other than A, C, G, T, and N. (Other characters, such as
+// lowercase bases, would need to be kept distinct from A, C, G, and T.) If
+// ref is given, B is already packed (in ref->B_packed), and B_packed is left
+// empty.
+bool pack_for_kmers(
+    const opts& o,
+    const fasta& A,
+    const fasta& B,
+    packed_seqs& A_packed,
+    packed_seqs& B_packed,
+    const reference *ref)
+{
+  if (o.kmerlen < 1 || o.kmerlen > max_packed_kmerlen)
+    return false;
+  if (ref && !ref->B_packable)
+    return false;
+  std::cerr << "Packing the sequences..." << std::flush;
+  profile_stage stage("kmer: pack sequences");
+  A_packed.assign(A.seqs);
+  if (!ref)
+    B_packed.assign(B.seqs);
+  stage.finish();
+  bool ok = A_packed.only_N_exceptions() && (ref || B_packed.only_N_exceptions());
+  if (!ok) {
+    A_packed = packed_seqs();
+    B_packed = packed_seqs();
+  }
+  std::cerr << (ok ? "done." : "not used, since the sequences contain characters other than ACGTN.") << std::endl;
+  return ok;
+}
+
+// taus_A and taus_B hold the expression of A and B under each expression
+// profile (see num_expr_profiles in opts.hh); the weighted scores are computed
+// for each. If ref is given, B is ref->B, and the reverse complements and
+// packed sequences of B are taken from it.
+void main(
+    const opts& o,
+    const fasta& A,
+    const fasta& B,
+    const std::vector<const expr *>& taus_A,
+    const std::vector<const expr *>& taus_B,
+    const expr& unif_A,
+    const expr& unif_B,
+    const reference *ref = NULL)
 {
   if (o.kmer) {
 
+    packed_seqs A_packed, B_own_packed;
+    if (pack_for_kmers(o, A, B, A_packed, B_own_packed, ref)) {
+      const packed_seqs& B_packed = ref ? ref->B_packed : B_own_packed;
+      uint64_t B_checksum = 0;
+      if (o.cache_dir != "")
+        B_checksum = ref ? ref->B_checksum : re::matched::checksum_seqs(B.names, B.seqs);
+      if (o.hash_table_type == "sparse" && o.hash_table_numeric_type == "double")
+        main_1_packed<sparse_double_packed_kmer_map>(o, A, B, A_packed, B_packed, B_checksum, taus_A, taus_B, unif_A, unif_B);
+      else if (o.hash_table_type == "sparse" && o.hash_table_numeric_type == "float")
+        main_1_packed<sparse_float_packed_kmer_map>(o, A, B, A_packed, B_packed, B_checksum, taus_A, taus_B, unif_A, unif_B);
+      else if (o.hash_table_type == "dense" && o.hash_table_numeric_type == "double")
+        main_1_packed<dense_double_packed_kmer_map>(o, A, B, A_packed, B_packed, B_checksum, taus_A, taus_B, unif_A, unif_B);
+      else if (o.hash_table_type == "dense" && o.hash_table_numeric_type == "float")
+        main_1_packed<dense_float_packed_kmer_map>(o, A, B, A_packed, B_packed, B_checksum, taus_A, taus_B, unif_A, unif_B);
+      else
+        throw std::runtime_error("Unknown hash map type.");
+      return;
+    }
+
     if (o.hash_table_type == "sparse" && o.hash_table_numeric_type == "double")
-      main_1<sparse_double_kmer_map>(o, A, B, tau_A, tau_B, unif_A, unif_B);
+      main_1<sparse_double_kmer_map>(o, A, B, taus_A, taus_B, unif_A, unif_B, ref);
     else if (o.hash_table_type == "sparse" && o.hash_table_numeric_type == "float")
-      main_1<sparse_float_kmer_map>(o, A, B, tau_A, tau_B, unif_A, unif_B);
+      main_1<sparse_float_kmer_map>(o, A, B, taus_A, taus_B, unif_A, unif_B, ref);
     else if (o.hash_table_type == "dense" && o.hash_table_numeric_type == "double")
-      main_1<dense_double_kmer_map>(o, A, B, tau_A, tau_B, unif_A, unif_B);
+      main_1<dense_double_kmer_map>(o, A, B, taus_A, taus_B, unif_A, unif_B, ref);
     else if (o.hash_table_type == "dense" && o.hash_table_numeric_type == "float")
-      main_1<dense_float_kmer_map>(o, A, B, tau_A, tau_B, unif_A, unif_B);
+      main_1<dense_float_kmer_map>(o, A, B, taus_A, taus_B, unif_A, unif_B, ref);
     else
       throw std::runtime_error("Unknown hash map type.");
 
@@ -18,13 +18,21 @@
 // along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
+#include <algorithm>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <queue>
+#include <set>
+#include <utility>
 #include <vector>
 #include <boost/foreach.hpp>
 #include "expr.hh"
 #include "opts.hh"
 #include "blast.hh"
 #include "psl.hh"
+#include "sam.hh"
 #include "pairset.hh"
 #include "kpairset.hh"
 #include "kmerset.hh"
@@ -32,25 +40,16 @@
 #include "blast.hh"
 #include "psl.hh"
 #include "util.hh"
+#include "profile.hh"
+#include "tagged_alignment.hh"
+#include "alignment_cache.hh"
+#include "stage_cache.hh"
+#include "minimizer_align.hh"
+#include "reference.hh"
 
 namespace re {
 namespace matched {
 
-struct tagged_alignment
-{
-  size_t a_idx, b_idx;
-  std::vector<alignment_segment> segments;
-  double contribution;
-};
-
-struct compare_tagged_alignments
-{
-  bool operator()(const tagged_alignment *l1, const tagged_alignment *l2) const
-  {
-    return l1->contribution < l2->contribution;
-  }
-};
-
 struct pair_helper
 {
   const std::vector<size_t>& B_lengths;
@@ -63,15 +62,15 @@ struct pair_helper
   : B_lengths(B_lengths), tau_B(tau_B), numer(0.0)
   {}
 
-  double compute_contribution(const tagged_alignment& l) const
+  double compute_contribution(size_t b_idx, const std::vector<alignment_segment>& segs) const
   {
-    smart_pairset b_pairset(B_lengths[l.b_idx]);
-    BOOST_FOREACH(const alignment_segment& seg, l.segments)
+    smart_pairset b_pairset(B_lengths[b_idx]);
+    BOOST_FOREACH(const alignment_segment& seg, segs)
       b_pairset.add_square_with_exceptions(seg.b_start, seg.b_end, seg.b_mismatches.begin(), seg.b_mismatches.end());
-    return tau_B[l.b_idx] * b_pairset.size();
+    return tau_B[b_idx] * b_pairset.size();
   }
 
-  void add_contribution_to_recall(const tagged_alignment& l) { numer += l.contribution; }
+  void add_contribution_to_recall(size_t /*b_idx*/, const std::vector<alignment_segment>& /*segs*/, double contribution) { numer += contribution; }
 
   double get_recall()
   {
@@ -95,15 +94,15 @@ struct kpair_helper
   : B_lengths(B_lengths), tau_B(tau_B), k(k), numer(0.0)
   {}
 
-  double compute_contribution(const tagged_alignment& l) const
+  double compute_contribution(size_t b_idx, const std::vector<alignment_segment>& segs) const
   {
-    kpairset b_kpairset(k, B_lengths[l.b_idx]);
-    BOOST_FOREACH(const alignment_segment& seg, l.segments)
+    kpairset b_kpairset(k, B_lengths[b_idx]);
+    BOOST_FOREACH(const alignment_segment& seg, segs)
       b_kpairset.add_kpairs_with_exceptions(seg.b_start, seg.b_end, seg.b_mismatches.begin(), seg.b_mismatches.end());
-    return tau_B[l.b_idx] * b_kpairset.size();
+    return tau_B[b_idx] * b_kpairset.size();
   }
 
-  void add_contribution_to_recall(const tagged_alignment& l) { numer += l.contribution; }
+  void add_contribution_to_recall(size_t /*b_idx*/, const std::vector<alignment_segment>& /*segs*/, double contribution) { numer += contribution; }
 
   double get_recall()
   {
@@ -135,15 +134,15 @@ struct kmer_helper
   : B_lengths(B_lengths), tau_B(tau_B), k(k), numer(0.0)
   {}
 
-  double compute_contribution(const tagged_alignment& l) const
+  double compute_contribution(size_t b_idx, const std::vector<alignment_segment>& segs) const
   {
-    kmerset b_kmerset(k, B_lengths[l.b_idx]);
-    BOOST_FOREACH(const alignment_segment& seg, l.segments)
+    kmerset b_kmerset(k, B_lengths[b_idx]);
+    BOOST_FOREACH(const alignment_segment& seg, segs)
       b_kmerset.add_kmers_with_exceptions(seg.b_start, seg.b_end, seg.b_mismatches.begin(), seg.b_mismatches.end());
-    return tau_B[l.b_idx] * b_kmerset.size();
+    return tau_B[b_idx] * b_kmerset.size();
   }
 
-  void add_contribution_to_recall(const tagged_alignment& l) { numer += l.contribution; }
+  void add_contribution_to_recall(size_t /*b_idx*/, const std::vector<alignment_segment>& /*segs*/, double contribution) { numer += contribution; }
 
   double get_recall()
   {
@@ -174,15 +173,15 @@ struct nucl_helper
   : B_lengths(B_lengths), tau_B(tau_B), numer(0.0)
   {}
 
-  double compute_contribution(const tagged_alignment& l) const
+  double compute_contribution(size_t b_idx, const std::vector<alignment_segment>& segs) const
   {
-    mask b_mask(B_lengths[l.b_idx]);
-    BOOST_FOREACH(const alignment_segment& seg, l.segments)
+    mask b_mask(B_lengths[b_idx]);
+    BOOST_FOREACH(const alignment_segment& seg, segs)
       b_mask.add_interval_with_exceptions(seg.b_start, seg.b_end, seg.b_mismatches.begin(), seg.b_mismatches.end());
-    return tau_B[l.b_idx] * b_mask.num_ones();
+    return tau_B[b_idx] * b_mask.num_ones();
   }
 
-  void add_contribution_to_recall(const tagged_alignment& l) { numer += l.contribution; }
+  void add_contribution_to_recall(size_t /*b_idx*/, const std::vector<alignment_segment>& /*segs*/, double contribution) { numer += contribution; }
 
   double get_recall()
   {
@@ -209,18 +208,18 @@ struct tran_helper
       B_mask.push_back(mask(b_length));
   }
 
-  double compute_contribution(const tagged_alignment& l) const
+  double compute_contribution(size_t b_idx, const std::vector<alignment_segment>& segs) const
   {
-    mask b_mask(B_lengths[l.b_idx]);
-    BOOST_FOREACH(const alignment_segment& seg, l.segments)
+    mask b_mask(B_lengths[b_idx]);
+    BOOST_FOREACH(const alignment_segment& seg, segs)
       b_mask.add_interval_with_exceptions(seg.b_start, seg.b_end, seg.b_mismatches.begin(), seg.b_mismatches.end());
-    return tau_B[l.b_idx] * b_mask.num_ones();
+    return tau_B[b_idx] * b_mask.num_ones();
   }
 
-  void add_contribution_to_recall(const tagged_alignment& l)
+  void add_contribution_to_recall(size_t b_idx, const std::vector<alignment_segment>& segs, double /*contribution*/)
   {
-    mask& m = B_mask[l.b_idx];
-    BOOST_FOREACH(const alignment_segment& seg, l.segments)
+    mask& m = B_mask[b_idx];
+    BOOST_FOREACH(const alignment_segment& seg, segs)
       m.add_interval_with_exceptions(seg.b_start, seg.b_end, seg.b_mismatches.begin(), seg.b_mismatches.end());
   }
 
@@ -248,40 +247,48 @@ inline bool is_good_enough(const std::vector<alignment_segment>& segs, size_t mi
   return len >= min_segment_len;
 }
 
-// Reads alignments, perfoms initial filtering, and converts the alignments to
-// segments. However, does *not* compute the initial contributions.
+// Reads alignments, perfoms the strand filtering, and converts the alignments
+// to segments. However, does *not* perform the other filtering, or compute the
+// initial contributions. If with_segments is false, as when only the contig
+// scores are requested, the segments are left empty, and only the sequence
+// indices and identities of the alignments are recorded.
 template<typename Al>
-void read_alignments(std::vector<tagged_alignment>& alignments,
+void read_alignments(alignment_set& set,
                      const std::string& filename,
-                     const std::vector<std::string>& A,
-                     const std::vector<std::string>& B,
-                     const std::map<std::string, size_t>& A_names_to_idxs,
-                     const std::map<std::string, size_t>& B_names_to_idxs,
+                     const seq_arena& A,
+                     const seq_arena& B,
+                     const name_index& A_names_to_idxs,
+                     const name_index& B_names_to_idxs,
                      bool strand_specific,
-                     size_t min_segment_len)
+                     bool with_segments = true)
 {
   try {
     typename Al::input_stream_type input_stream(open_or_throw(filename));
     Al al;
     tagged_alignment l;
-    std::map<std::string, size_t>::const_iterator it;
+    alignment_identity id;
     while (input_stream >> al) {
       if (al.is_on_valid_strand(strand_specific)) {
         // Extract a_name and look up its idx.
-        it = A_names_to_idxs.find(al.a_name());
-        if (it == A_names_to_idxs.end())
+        l.a_idx = A_names_to_idxs.find(al.a_name_ref());
+        if (l.a_idx == name_index::npos)
           throw std::runtime_error("Sequence name " + al.a_name() + " is not found in the corresponding fasta file.");
-        l.a_idx = it->second;
         // Extract b_name and look up its idx.
-        it = B_names_to_idxs.find(al.b_name());
-        if (it == B_names_to_idxs.end())
+        l.b_idx = B_names_to_idxs.find(al.b_name_ref());
+        if (l.b_idx == name_index::npos)
           throw std::runtime_error("Sequence name " + al.b_name() + " is not found in the corresponding fasta file.");
-        l.b_idx = it->second;
         // Extract the alignment segments.
-        typename Al::segments_type segs = al.segments(A[l.a_idx], B[l.b_idx]);
-        l.segments.assign(segs.begin(), segs.end());
-        if (is_good_enough(l.segments, min_segment_len))
-          alignments.push_back(l);
+        if (with_segments) {
+          typename Al::segments_type segs = al.segments(A[l.a_idx], B[l.b_idx]);
+          l.segments.assign(segs.begin(), segs.end());
+        }
+        set.alignments.push_back(l);
+        // Record the quantities used by the contig scores.
+        id.num_identity_wrt_a = al.num_identity_wrt_a();
+        id.num_identity_wrt_b = al.num_identity_wrt_b();
+        id.frac_indel_wrt_a   = al.frac_indel_wrt_a();
+        id.frac_indel_wrt_b   = al.frac_indel_wrt_b();
+        set.identities.push_back(id);
       }
     }
   } catch (const std::runtime_error& x) {
@@ -289,46 +296,265 @@ void read_alignments(std::vector<tagged_alignment>& alignments,
   }
 }
 
-// Preconditions:
-// - best_from_A should be of size 0
+// Like read_alignments, but goes through the binary cache next to filename
+// (see alignment_cache.hh), or, with --cache-dir, the one in the cache
+// directory (see stage_cache.hh): if the cache is valid for the current inputs
+// the alignments are loaded from it, and otherwise they are parsed and the
+// cache is (re)written. Since the cache always holds the segments, it is not
+// written if with_segments is false.
+template<typename Al>
+void read_alignments_cached(alignment_set& set,
+                            const std::string& filename,
+                            const fasta& A,
+                            const fasta& B,
+                            uint64_t A_checksum,
+                            uint64_t B_checksum,
+                            const opts& o,
+                            bool with_segments = true)
+{
+  alignment_cache_key key = make_alignment_cache_key(o.alignment_type, o.strand_specific, filename, A_checksum, B_checksum);
+  std::string cache_filename;
+  if (o.cache_dir != "") {
+    stage_key skey = alignments_stage_key(key);
+    cache_filename = stage_cache_filename(o.cache_dir, skey);
+    set.cache_key = skey.value();
+  } else {
+    cache_filename = alignment_cache_filename(filename);
+  }
+  if (load_alignment_cache(set, cache_filename, key)) {
+    std::cerr << "Loaded the alignments in " << filename << " from " << cache_filename << "." << std::endl;
+  } else if (!with_segments) {
+    read_alignments<Al>(set, filename, A.seqs, B.seqs, A.names_to_idxs, B.names_to_idxs, o.strand_specific, false);
+  } else {
+    read_alignments<Al>(set, filename, A.seqs, B.seqs, A.names_to_idxs, B.names_to_idxs, o.strand_specific);
+    try {
+      save_alignment_cache(set, cache_filename, key);
+      std::cerr << "Wrote the alignments in " << filename << " to " << cache_filename << "." << std::endl;
+    } catch (const std::runtime_error& x) {
+      std::cerr << "Warning: Can't write alignment cache: " << x.what() << std::endl;
+    }
+  }
+}
+
+template<typename Al>
+void load_alignments_1(const opts& o,
+                       const fasta& A,
+                       const fasta& B,
+                       alignment_set& A_to_B,
+                       alignment_set& B_to_A,
+                       const reference *ref)
+{
+  // The contig scores only need the identities.
+  bool with_segments = o.nucl || o.pair || o.paper;
+  if (o.alignment_cache || o.cache_dir != "") {
+    uint64_t A_checksum = checksum_seqs(A.names, A.seqs);
+    uint64_t B_checksum = ref ? ref->B_checksum : checksum_seqs(B.names, B.seqs);
+    read_alignments_cached<Al>(A_to_B, o.A_to_B, A, B, A_checksum, B_checksum, o, with_segments);
+    read_alignments_cached<Al>(B_to_A, o.B_to_A, B, A, B_checksum, A_checksum, o, with_segments);
+    if (o.cache_dir != "")
+      A_to_B.reference_checksum = B_to_A.reference_checksum = B_checksum;
+  } else {
+    read_alignments<Al>(A_to_B, o.A_to_B, A.seqs, B.seqs, A.names_to_idxs, B.names_to_idxs, o.strand_specific, with_segments);
+    read_alignments<Al>(B_to_A, o.B_to_A, B.seqs, A.seqs, B.names_to_idxs, A.names_to_idxs, o.strand_specific, with_segments);
+  }
+}
+
+// Like load_alignments_1, but makes the alignments with the built-in aligner
+// (see minimizer_align.hh). With --cache-dir, they are cached like parsed
+// alignments, with the aligner's parameters in place of the alignment file.
+void align_builtin(const opts& o,
+                   const fasta& A,
+                   const fasta& B,
+                   alignment_set& A_to_B,
+                   alignment_set& B_to_A,
+                   const reference *ref)
+{
+  re::align::params p;
+  if (o.cache_dir == "") {
+    re::align::align(A_to_B, A.seqs, B.seqs, o.strand_specific, p);
+    re::align::align(B_to_A, B.seqs, A.seqs, o.strand_specific, p);
+    return;
+  }
+  stage_key params_key("builtin");
+  params_key.add(static_cast<uint64_t>(p.k)).add(static_cast<uint64_t>(p.w))
+            .add(static_cast<uint64_t>(p.max_occurrences)).add(static_cast<uint64_t>(p.max_gap))
+            .add(static_cast<uint64_t>(p.chain_lookback)).add(p.min_chain_score)
+            .add(static_cast<uint64_t>(p.max_fill)).add(static_cast<uint64_t>(p.band))
+            .add(static_cast<uint64_t>(p.x_drop));
+  uint64_t A_checksum = checksum_seqs(A.names, A.seqs);
+  uint64_t B_checksum = ref ? ref->B_checksum : checksum_seqs(B.names, B.seqs);
+  for (int dir = 0; dir < 2; ++dir) {
+    alignment_set& set = dir == 0 ? A_to_B : B_to_A;
+    const fasta& X = dir == 0 ? A : B;
+    const fasta& Y = dir == 0 ? B : A;
+    alignment_cache_key key;
+    key.alignment_type      = CityHash64(o.alignment_type.data(), o.alignment_type.size());
+    key.strand_specific     = o.strand_specific;
+    key.alignments_checksum = params_key.value();
+    key.A_checksum          = dir == 0 ? A_checksum : B_checksum;
+    key.B_checksum          = dir == 0 ? B_checksum : A_checksum;
+    stage_key skey = alignments_stage_key(key);
+    std::string cache_filename = stage_cache_filename(o.cache_dir, skey);
+    set.cache_key = skey.value();
+    set.reference_checksum = B_checksum;
+    const char *what = dir == 0 ? "A to B" : "B to A";
+    if (load_alignment_cache(set, cache_filename, key)) {
+      std::cerr << "Loaded the alignments of " << what << " from " << cache_filename << "." << std::endl;
+    } else {
+      re::align::align(set, X.seqs, Y.seqs, o.strand_specific, p);
+      try {
+        save_alignment_cache(set, cache_filename, key);
+        std::cerr << "Wrote the alignments of " << what << " to " << cache_filename << "." << std::endl;
+      } catch (const std::runtime_error& x) {
+        std::cerr << "Warning: Can't write alignment cache: " << x.what() << std::endl;
+      }
+    }
+  }
+}
+
+// Reads both alignment files once (or, with --alignment-type=builtin, makes
+// the alignments), if any alignment-based score is requested. The result is
+// shared, read-only, by re::matched::main and re::oomatched::main, each of
+// which applies its own filters. If ref is given, B is ref->B, and B's
+// checksum is taken from it.
+void load_alignments(const opts& o,
+                     const fasta& A,
+                     const fasta& B,
+                     alignment_set& A_to_B,
+                     alignment_set& B_to_A,
+                     const reference *ref = NULL)
+{
+  if (o.nucl || o.pair || o.contig || o.paper) {
+    if (o.alignment_type == "builtin")
+      std::cerr << "Aligning A and B with the built-in aligner..." << std::endl;
+    else
+      std::cerr << "Reading the alignments and extracting intervals..." << std::endl;
+    profile_stage stage("read alignments");
+    if (o.alignment_type == "builtin")
+      align_builtin(o, A, B, A_to_B, B_to_A, ref);
+    else if (o.alignment_type == "blast")
+      load_alignments_1<blast_alignment>(o, A, B, A_to_B, B_to_A, ref);
+    else if (o.alignment_type == "psl")
+      load_alignments_1<psl_alignment>  (o, A, B, A_to_B, B_to_A, ref);
+    else if (o.alignment_type == "sam" || o.alignment_type == "bam")
+      load_alignments_1<sam_alignment>  (o, A, B, A_to_B, B_to_A, ref);
+    stage.set_items(A_to_B.alignments.size() + B_to_A.alignments.size(), "alignments");
+  }
+}
+
+// The state of process_alignments, which is kept apart from the alignments
+// themselves, since those are shared, read-only, by all the scores. For the
+// alignment with id i, i.e., alignments[i], contribution[i] is its current
+// contribution. Its current segments are its own until another alignment is
+// subtracted from it, and afterwards the copy trimmed[trimmed_idx[i]]; only
+// the alignments that are actually trimmed are copied.
+class selection_state
+{
+public:
+  std::vector<double> contribution;
+
+  explicit selection_state(const std::vector<tagged_alignment>& alignments)
+  : contribution(alignments.size()),
+    alignments(alignments),
+    trimmed_idx(alignments.size(), npos)
+  {}
+
+  const std::vector<alignment_segment>& segments(size_t i) const
+  {
+    return trimmed_idx[i] == npos ? alignments[i].segments : trimmed[trimmed_idx[i]];
+  }
+
+  // Returns the segments of alignment i for modification, copying them first
+  // if they are still the alignment's own.
+  std::vector<alignment_segment>& trimmed_segments(size_t i)
+  {
+    if (trimmed_idx[i] == npos) {
+      trimmed_idx[i] = trimmed.size();
+      trimmed.push_back(alignments[i].segments);
+    }
+    return trimmed[trimmed_idx[i]];
+  }
+
+  // Orders alignment ids by their current contribution.
+  struct compare
+  {
+    const std::vector<double> *contribution;
+    explicit compare(const std::vector<double>& contribution)
+    : contribution(&contribution)
+    {}
+    bool operator()(size_t i, size_t j) const { return (*contribution)[i] < (*contribution)[j]; }
+  };
+
+private:
+  static const size_t npos = static_cast<size_t>(-1);
+  const std::vector<tagged_alignment>& alignments;
+  std::vector<size_t> trimmed_idx;
+  std::deque<std::vector<alignment_segment> > trimmed;
+};
+
+// Returns the ids of the alignments that are good enough (see
+// is_good_enough), in increasing order.
+inline std::vector<size_t> good_enough_ids(const std::vector<tagged_alignment>& alignments, size_t min_segment_len)
+{
+  std::vector<size_t> ids;
+  for (size_t i = 0; i < alignments.size(); ++i)
+    if (is_good_enough(alignments[i].segments, min_segment_len))
+      ids.push_back(i);
+  return ids;
+}
+
+// Selects, greedily, the alignments among those with the given ids (which
+// must be good enough, and in increasing order) that contribute to the score
+// computed by helper, and adds their contributions to helper. The alignments
+// are not modified. If computed is given, each contribution that is computed
+// is appended to it, with the id of its alignment.
 template<typename HelperType>
-void process_alignments(HelperType&                   helper,
-                        std::vector<tagged_alignment> alignments, /* passed by value intentionally */
-                        size_t                        A_card,
-                        size_t                        B_card,
-                        size_t                        min_segment_len)
+void process_alignments(HelperType&                               helper,
+                        const std::vector<tagged_alignment>&      alignments,
+                        const std::vector<size_t>&                ids,
+                        size_t                                    A_card,
+                        size_t                                    B_card,
+                        size_t                                    min_segment_len,
+                        std::vector<std::pair<size_t, double> > *computed)
 {
+  selection_state state(alignments);
+
   // Compute contributions.
   #pragma omp parallel for
-  for (int i = 0; i < static_cast<int>(alignments.size()); ++i) {
-    tagged_alignment& l = alignments[i];
-    l.contribution = helper.compute_contribution(l);
+  for (int j = 0; j < static_cast<int>(ids.size()); ++j) {
+    const tagged_alignment& l = alignments[ids[j]];
+    state.contribution[ids[j]] = helper.compute_contribution(l.b_idx, l.segments);
   }
+  if (computed)
+    BOOST_FOREACH(size_t i, ids)
+      computed->push_back(std::make_pair(i, state.contribution[i]));
 
-  // Init vector of pointers to popped alignments.
-  std::vector<std::vector<tagged_alignment *> > popped_by_A(A_card);
-  std::vector<std::vector<tagged_alignment *> > popped_by_B(B_card);
+  // Init vector of ids of popped alignments.
+  std::vector<std::vector<size_t> > popped_by_A(A_card);
+  std::vector<std::vector<size_t> > popped_by_B(B_card);
 
   // Make priority queue initially filled with all alignments.
-  compare_tagged_alignments comparator;
+  selection_state::compare comparator(state.contribution);
   std::priority_queue<
-    tagged_alignment *,
-    std::vector<tagged_alignment *>,
-    compare_tagged_alignments> Q(comparator);
-  BOOST_FOREACH(tagged_alignment& l1, alignments)
-    Q.push(&l1);
+    size_t,
+    std::vector<size_t>,
+    selection_state::compare> Q(comparator);
+  BOOST_FOREACH(size_t i, ids)
+    Q.push(i);
 
   while (!Q.empty()) {
 
     // Pop l1 from Q.
-    tagged_alignment *l1 = Q.top();
+    size_t l1 = Q.top();
     Q.pop();
+    size_t l1_a_idx = alignments[l1].a_idx;
+    size_t l1_b_idx = alignments[l1].b_idx;
 
     // Subtract all previous alignments from l1.
     bool l1_has_changed = false;
-    typename std::vector<tagged_alignment *>::const_iterator
-        l2_a = popped_by_A[l1->a_idx].begin(), end_a = popped_by_A[l1->a_idx].end(),
-        l2_b = popped_by_B[l1->b_idx].begin(), end_b = popped_by_B[l1->b_idx].end();
+    std::vector<size_t>::const_iterator
+        l2_a = popped_by_A[l1_a_idx].begin(), end_a = popped_by_A[l1_a_idx].end(),
+        l2_b = popped_by_B[l1_b_idx].begin(), end_b = popped_by_B[l1_b_idx].end();
     while (l2_a != end_a || l2_b != end_b) {
 
       bool l2_b_was_popped_first;
@@ -346,14 +572,14 @@ void process_alignments(HelperType&                   helper,
       }
 
       if (l2_b_was_popped_first) {
-        if (intersects<segment_ops_wrt_b>(l1->segments, (*l2_b)->segments)) {
-          subtract_in_place<segment_ops_wrt_b>(l1->segments, (*l2_b)->segments);
+        if (intersects<segment_ops_wrt_b>(state.segments(l1), state.segments(*l2_b))) {
+          subtract_in_place<segment_ops_wrt_b>(state.trimmed_segments(l1), state.segments(*l2_b));
           l1_has_changed = true;
         }
         ++l2_b;
       } else {
-        if (intersects<segment_ops_wrt_a>(l1->segments, (*l2_a)->segments)) {
-          subtract_in_place<segment_ops_wrt_a>(l1->segments, (*l2_a)->segments);
+        if (intersects<segment_ops_wrt_a>(state.segments(l1), state.segments(*l2_a))) {
+          subtract_in_place<segment_ops_wrt_a>(state.trimmed_segments(l1), state.segments(*l2_a));
           l1_has_changed = true;
         }
         ++l2_a;
@@ -364,8 +590,10 @@ void process_alignments(HelperType&                   helper,
     // If the alignment has changed, then put it back in the priority queue.
     if (l1_has_changed) {
 
-      if (is_good_enough(l1->segments, min_segment_len)) {
-        l1->contribution = helper.compute_contribution(*l1);
+      if (is_good_enough(state.segments(l1), min_segment_len)) {
+        state.contribution[l1] = helper.compute_contribution(l1_b_idx, state.segments(l1));
+        if (computed)
+          computed->push_back(std::make_pair(l1, state.contribution[l1]));
         Q.push(l1);
       }
 
@@ -373,17 +601,28 @@ void process_alignments(HelperType&                   helper,
     } else {
 
       // Record l1's contribution.
-      helper.add_contribution_to_recall(*l1);
+      helper.add_contribution_to_recall(l1_b_idx, state.segments(l1), state.contribution[l1]);
 
       // Add l1 to list of popped alignments.
-      popped_by_A[l1->a_idx].push_back(l1);
-      popped_by_B[l1->b_idx].push_back(l1);
+      popped_by_A[l1_a_idx].push_back(l1);
+      popped_by_B[l1_b_idx].push_back(l1);
 
     }
 
   }
 }
 
+// Like the above, for all the alignments that are good enough.
+template<typename HelperType>
+void process_alignments(HelperType&                          helper,
+                        const std::vector<tagged_alignment>& alignments,
+                        size_t                               A_card,
+                        size_t                               B_card,
+                        size_t                               min_segment_len)
+{
+  process_alignments(helper, alignments, good_enough_ids(alignments, min_segment_len), A_card, B_card, min_segment_len, NULL);
+}
+
 template<typename Helper>
 double compute_recall(const std::vector<tagged_alignment>& A_to_B,
                       size_t A_card,
@@ -392,29 +631,369 @@ double compute_recall(const std::vector<tagged_alignment>& A_to_B,
                       const expr& tau_B,
                       size_t min_segment_len)
 {
+  profile_stage stage("process alignments");
   Helper h(B_lengths, tau_B, min_segment_len);
   process_alignments(h, A_to_B, A_card, B_card, min_segment_len);
+  stage.set_items(A_to_B.size(), "alignments");
   return h.get_recall();
 }
 
+// Passes everything on to helper, except that each contribution is appended
+// to the list of the component of its B sequence, rather than added to
+// helper's numerator.
+template<typename Helper>
+struct component_helper
+{
+  const Helper&                      helper;
+  const std::vector<size_t>&         B_component;
+  std::vector<std::vector<double> >& selected;
+
+  component_helper(const Helper& helper,
+                   const std::vector<size_t>& B_component,
+                   std::vector<std::vector<double> >& selected)
+  : helper(helper), B_component(B_component), selected(selected)
+  {}
+
+  double compute_contribution(size_t b_idx, const std::vector<alignment_segment>& segs) const
+  {
+    return helper.compute_contribution(b_idx, segs);
+  }
+
+  void add_contribution_to_recall(size_t b_idx, const std::vector<alignment_segment>& /*segs*/, double contribution)
+  {
+    selected[B_component[b_idx]].push_back(contribution);
+  }
+};
+
+// A component's key and the contribution of one of its selected alignments,
+// as stored in the "components" stage of the cache. The records of a
+// component are adjacent. A component in which two alignments tie has a
+// single record, whose contribution is tied_component.
+struct component_contribution
+{
+  uint64_t key;
+  double   contribution;
+};
+
+const double tied_component = -1.0;
+
+namespace detail {
+
+  inline size_t find_root(std::vector<size_t>& parent, size_t x)
+  {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]]; // path halving
+      x = parent[x];
+    }
+    return x;
+  }
+
+  // Returns the numerator of a helper that has added scale times each of the
+  // given contributions, in the order in which process_alignments selects
+  // them. Since trimming an alignment never increases its contribution, each
+  // selected contribution is at most the one before it, so that order is
+  // decreasing order (and equal contributions can be added in any order).
+  inline double sum_in_selection_order(std::vector<double> contributions, double scale)
+  {
+    std::sort(contributions.begin(), contributions.end(), std::greater<double>());
+    double sum = 0.0;
+    BOOST_FOREACH(double x, contributions)
+      sum += scale * x;
+    return sum;
+  }
+
+  // Sets is_tied[c] if two different alignments of component c that have a
+  // sequence in common had the same nonzero contribution, given the
+  // contributions computed by process_alignments. (Alignments with no
+  // sequence in common are subtracted from neither each other nor the same
+  // alignments, and where process_alignments orders alignments that have been
+  // selected, it compares their contributions, so it does not matter in which
+  // order they are selected. Alignments that contribute nothing are selected
+  // last, and only change alignments that contribute nothing.)
+  inline void find_tied_components(const std::vector<std::pair<size_t, double> >& computed,
+                                   const std::vector<tagged_alignment>& alignments,
+                                   const std::vector<size_t>& B_component,
+                                   std::vector<bool>& is_tied)
+  {
+    typedef std::pair<std::pair<size_t, double>, std::pair<size_t, size_t> > entry;
+    for (int side = 0; side < 2; ++side) {
+      std::vector<entry> x(computed.size());
+      for (size_t j = 0; j < computed.size(); ++j) {
+        const tagged_alignment& l = alignments[computed[j].first];
+        x[j] = entry(std::make_pair(B_component[l.b_idx], computed[j].second),
+                     std::make_pair(side == 0 ? l.a_idx : l.b_idx, computed[j].first));
+      }
+      std::sort(x.begin(), x.end());
+      for (size_t j = 1; j < x.size(); ++j)
+        if (x[j].first.second != 0.0 &&
+            x[j].first == x[j - 1].first && x[j].second.first == x[j - 1].second.first &&
+            x[j].second.second != x[j - 1].second.second)
+          is_tied[x[j].first.first] = true;
+    }
+  }
+
+} // namespace detail
+
+// Like compute_recall, but for a score whose helper only sums contributions
+// (i.e., nucl_helper, pair_helper, kpair_helper, or kmer_helper), and with
+// the work done per component of the graph whose nodes are the sequences of
+// A and B and whose edges are the alignments that are good enough.
+//
+// The selection in process_alignments only ever compares an alignment with
+// others of the same component. So unless two alignments of a component tie
+// (see detail::find_tied_components), the contributions that the component selects are determined by the
+// component alone: by its alignments, in order, with its sequences numbered
+// in order of appearance, and by the lengths and expression of its B
+// sequences. They are stored in the cache under a hash of exactly these, in a
+// table for the score (name) and the reference (reference_key), and are
+// reused, so when a new version of an assembly changes only some of its
+// contigs, only the components that contain changed contigs are processed,
+// whatever the indices of the contigs. Which of two tied alignments is
+// selected first depends on the layout of the priority queue, i.e., on all
+// the alignments, so a component with a tie is never reused, and if there is
+// one, all the alignments are processed together, as by compute_recall.
+// Either way, the contributions are added in the order in which
+// compute_recall adds them, so the result is exactly compute_recall's.
+template<typename Helper>
+double compute_recall_by_component(const opts& o,
+                                   const std::string& name,
+                                   uint64_t reference_key,
+                                   const std::vector<tagged_alignment>& alignments,
+                                   size_t A_card,
+                                   size_t B_card,
+                                   const std::vector<size_t>& B_lengths,
+                                   const expr& tau_B)
+{
+  profile_stage stage("process alignments");
+  std::vector<size_t> ids = good_enough_ids(alignments, o.min_segment_len);
+
+  // Find the components. Node i of A is i, and node j of B is A_card + j.
+  std::vector<size_t> parent(A_card + B_card);
+  for (size_t i = 0; i < parent.size(); ++i)
+    parent[i] = i;
+  BOOST_FOREACH(size_t i, ids) {
+    size_t r1 = detail::find_root(parent, alignments[i].a_idx);
+    size_t r2 = detail::find_root(parent, A_card + alignments[i].b_idx);
+    if (r1 != r2)
+      parent[std::max(r1, r2)] = std::min(r1, r2);
+  }
+  const size_t none = static_cast<size_t>(-1);
+  std::vector<size_t> root_component(parent.size(), none);
+  std::vector<size_t> B_component(B_card, none);
+  std::vector<std::vector<size_t> > component_ids;
+  BOOST_FOREACH(size_t i, ids) {
+    size_t r = detail::find_root(parent, alignments[i].a_idx);
+    if (root_component[r] == none) {
+      root_component[r] = component_ids.size();
+      component_ids.push_back(std::vector<size_t>());
+    }
+    component_ids[root_component[r]].push_back(i);
+    B_component[alignments[i].b_idx] = root_component[r];
+  }
+  size_t num_components = component_ids.size();
+
+  // With uniform expression, as for the unweighted scores, the contributions
+  // are computed with unit expression and scaled when they are added, so that
+  // the components do not depend on the number of sequences in B. (The
+  // contributions are counts times the expression, so scaling them keeps
+  // their order and their ties, and gives exactly compute_recall's.)
+  bool uniform = true;
+  for (size_t b_idx = 1; b_idx < B_card && uniform; ++b_idx)
+    uniform = tau_B[b_idx] == tau_B[0];
+  expr unit;
+  if (uniform && B_card > 0)
+    unit.assign(B_card, 1.0);
+  const expr& tau = unit.empty() ? tau_B : unit;
+
+  // Hash each component.
+  std::vector<uint64_t> keys(num_components);
+  std::vector<size_t> A_local(A_card, none), B_local(B_card, none);
+  for (size_t c = 0; c < num_components; ++c) {
+    stage_key key("component");
+    key.add(name).add(static_cast<uint64_t>(o.min_segment_len));
+    size_t num_A = 0, num_B = 0;
+    BOOST_FOREACH(size_t i, component_ids[c]) {
+      const tagged_alignment& l = alignments[i];
+      if (A_local[l.a_idx] == none)
+        A_local[l.a_idx] = num_A++;
+      if (B_local[l.b_idx] == none) {
+        B_local[l.b_idx] = num_B++;
+        key.add(static_cast<uint64_t>(B_lengths[l.b_idx])).add(tau[l.b_idx]);
+      }
+      key.add(static_cast<uint64_t>(A_local[l.a_idx])).add(static_cast<uint64_t>(B_local[l.b_idx]));
+      key.add(static_cast<uint64_t>(l.segments.size()));
+      BOOST_FOREACH(const alignment_segment& seg, l.segments) {
+        key.add(static_cast<uint64_t>(seg.a_start)).add(static_cast<uint64_t>(seg.a_end))
+           .add(static_cast<uint64_t>(seg.b_start)).add(static_cast<uint64_t>(seg.b_end))
+           .add(seg.a_mismatches).add(seg.b_mismatches);
+      }
+    }
+    BOOST_FOREACH(size_t i, component_ids[c])
+      A_local[alignments[i].a_idx] = B_local[alignments[i].b_idx] = none;
+    keys[c] = key.value();
+  }
+
+  // Look up the components of earlier runs.
+  stage_key table_key("components");
+  table_key.add(name).add(reference_key);
+  std::vector<component_contribution> table;
+  load_stage(table, o.cache_dir, table_key);
+  std::map<uint64_t, std::pair<size_t, size_t> > known; // the range of each key's records
+  for (size_t r = 0, e; r < table.size(); r = e) {
+    for (e = r + 1; e < table.size() && table[e].key == table[r].key; ++e)
+      ;
+    known[table[r].key] = std::make_pair(r, e);
+  }
+  std::vector<std::vector<double> > selected(num_components);
+  std::vector<bool> is_known(num_components, false), is_tied(num_components, false);
+  size_t num_reused = 0;
+  bool any_tied = false;
+  for (size_t c = 0; c < num_components; ++c) {
+    std::map<uint64_t, std::pair<size_t, size_t> >::const_iterator it = known.find(keys[c]);
+    if (it == known.end())
+      continue;
+    if (table[it->second.first].contribution == tied_component) {
+      is_tied[c] = any_tied = true;
+    } else {
+      for (size_t r = it->second.first; r < it->second.second; ++r)
+        selected[c].push_back(table[r].contribution);
+      is_known[c] = true;
+      ++num_reused;
+    }
+  }
+
+  // Process the alignments of the other components together, unless one of
+  // them is known to tie. If none were reused, these are all the alignments,
+  // pushed in the same order as by compute_recall, so the selection is
+  // compute_recall's even if there are ties.
+  Helper h(B_lengths, tau, o.min_segment_len);
+  component_helper<Helper> ch(h, B_component, selected);
+  std::vector<std::pair<size_t, double> > computed;
+  size_t num_processed = 0;
+  bool processed_all = false;
+  if (!any_tied) {
+    std::vector<size_t> todo;
+    BOOST_FOREACH(size_t i, ids)
+      if (!is_known[B_component[alignments[i].b_idx]])
+        todo.push_back(i);
+    process_alignments(ch, alignments, todo, A_card, B_card, o.min_segment_len, &computed);
+    num_processed = todo.size();
+    processed_all = num_reused == 0;
+    detail::find_tied_components(computed, alignments, B_component, is_tied);
+    any_tied = std::find(is_tied.begin(), is_tied.end(), true) != is_tied.end();
+  }
+  if (any_tied && !processed_all) {
+    for (size_t c = 0; c < num_components; ++c) {
+      selected[c].clear();
+      is_tied[c] = false;
+    }
+    computed.clear();
+    process_alignments(ch, alignments, ids, A_card, B_card, o.min_segment_len, &computed);
+    num_processed = ids.size();
+    num_reused = 0;
+    detail::find_tied_components(computed, alignments, B_component, is_tied);
+  }
+
+  // Store the components of this run, followed by those of earlier runs that
+  // are not in this one (at most as many), for other assemblies with the
+  // same reference.
+  std::vector<component_contribution> new_table;
+  std::set<uint64_t> stored;
+  for (size_t c = 0; c < num_components; ++c) {
+    if (!stored.insert(keys[c]).second)
+      continue;
+    component_contribution x;
+    x.key = keys[c];
+    if (is_tied[c]) {
+      x.contribution = tied_component;
+      new_table.push_back(x);
+    } else {
+      BOOST_FOREACH(double y, selected[c]) {
+        x.contribution = y;
+        new_table.push_back(x);
+      }
+    }
+  }
+  size_t num_kept = 0;
+  for (size_t r = 0; r < table.size(); ++r) {
+    if (stored.count(table[r].key))
+      continue;
+    if (r == 0 || table[r].key != table[r - 1].key) {
+      if (num_kept == num_components)
+        break;
+      ++num_kept;
+    }
+    new_table.push_back(table[r]);
+  }
+  save_stage_or_warn(new_table, o.cache_dir, table_key);
+
+  if (any_tied)
+    std::cerr << std::count(is_tied.begin(), is_tied.end(), true) << " of " << num_components
+              << " alignment components for " << name << " have tied contributions,"
+              << " so none were reused." << std::endl;
+  else
+    std::cerr << "Reused " << num_reused << " of " << num_components
+              << " alignment components for " << name << "." << std::endl;
+  stage.set_items(num_processed, "alignments");
+  std::vector<double> contributions;
+  for (size_t c = 0; c < num_components; ++c)
+    contributions.insert(contributions.end(), selected[c].begin(), selected[c].end());
+  Helper result(B_lengths, tau_B, o.min_segment_len);
+  result.numer = detail::sum_in_selection_order(contributions, unit.empty() ? 1.0 : tau_B[0]);
+  return result.get_recall();
+}
+
+// Like compute_recall, but with --cache-dir, the result is looked up in the
+// "matched" stage of the cache (see stage_cache.hh) first, and otherwise
+// computed by compute_recall_by_component and stored there. alignments_key is
+// the cache_key of the alignment_set that holds alignments, reference_key is
+// its reference_checksum, and name distinguishes the helpers.
+template<typename Helper>
+double compute_recall_cached(const opts& o,
+                             const std::string& name,
+                             uint64_t alignments_key,
+                             uint64_t reference_key,
+                             const std::vector<tagged_alignment>& alignments,
+                             size_t A_card,
+                             size_t B_card,
+                             const std::vector<size_t>& B_lengths,
+                             const expr& tau_B)
+{
+  if (o.cache_dir == "" || alignments_key == 0)
+    return compute_recall<Helper>(alignments, A_card, B_card, B_lengths, tau_B, o.min_segment_len);
+
+  stage_key key("matched");
+  key.add(name).add(alignments_key).add(static_cast<uint64_t>(o.min_segment_len))
+     .add(B_lengths).add(tau_B);
+  std::vector<double> cached;
+  if (load_stage(cached, o.cache_dir, key) && cached.size() == 1)
+    return cached[0];
+  double recall = compute_recall_by_component<Helper>(o, name, reference_key, alignments, A_card, B_card, B_lengths, tau_B);
+  save_stage_or_warn(std::vector<double>(1, recall), o.cache_dir, key);
+  return recall;
+}
+
 template<typename Helper>
 void compute(const opts& o,
              const fasta& A,
              const fasta& B,
              const expr& tau_A,
              const expr& tau_B,
-             std::vector<tagged_alignment> A_to_B,
-             std::vector<tagged_alignment> B_to_A,
+             const std::vector<tagged_alignment>& A_to_B,
+             const std::vector<tagged_alignment>& B_to_A,
+             uint64_t A_to_B_key,
+             uint64_t B_to_A_key,
+             uint64_t reference_key,
              const std::string& prefix)
 {
-  double precis = compute_recall<Helper>(B_to_A, B.card, A.card, A.lengths, tau_A, o.min_segment_len);
-  std::cout << prefix << "precision\t" << precis << std::endl;
+  double precis = compute_recall_cached<Helper>(o, prefix + "precision", B_to_A_key, reference_key, B_to_A, B.card, A.card, A.lengths, tau_A);
+  *o.out << prefix << "precision\t" << precis << std::endl;
 
-  double recall = compute_recall<Helper>(A_to_B, A.card, B.card, B.lengths, tau_B, o.min_segment_len);
-  std::cout << prefix << "recall\t" << recall << std::endl;
+  double recall = compute_recall_cached<Helper>(o, prefix + "recall", A_to_B_key, reference_key, A_to_B, A.card, B.card, B.lengths, tau_B);
+  *o.out << prefix << "recall\t" << recall << std::endl;
 
   double F1 = compute_F1(precis, recall);
-  std::cout << prefix << "F1\t" << F1 << std::endl;
+  *o.out << prefix << "F1\t" << F1 << std::endl;
 }
 
 template<typename Helper>
@@ -425,36 +1004,42 @@ void main_2(const opts& o,
             const expr& tau_B,
             const expr& unif_A,
             const expr& unif_B,
-            std::vector<tagged_alignment> A_to_B,
-            std::vector<tagged_alignment> B_to_A,
+            const std::vector<tagged_alignment>& A_to_B,
+            const std::vector<tagged_alignment>& B_to_A,
+            uint64_t A_to_B_key,
+            uint64_t B_to_A_key,
+            uint64_t reference_key,
             const std::string& prefix)
 {
-  if (o.weighted)   compute<Helper>(o, A, B, tau_A,  tau_B,  A_to_B, B_to_A, "weighted_" + prefix);
-  if (o.unweighted) compute<Helper>(o, A, B, unif_A, unif_B, A_to_B, B_to_A, "unweighted_" + prefix);
+  if (o.weighted)   compute<Helper>(o, A, B, tau_A,  tau_B,  A_to_B, B_to_A, A_to_B_key, B_to_A_key, reference_key, "weighted_" + prefix);
+  if (o.unweighted) compute<Helper>(o, A, B, unif_A, unif_B, A_to_B, B_to_A, A_to_B_key, B_to_A_key, reference_key, "unweighted_" + prefix);
 }
 
-template<typename Al>
 void main_1(const opts& o,
             const fasta& A,
             const fasta& B,
             const expr& tau_A,
             const expr& tau_B,
             const expr& unif_A,
-            const expr& unif_B)
+            const expr& unif_B,
+            const alignment_set& A_to_B_set,
+            const alignment_set& B_to_A_set)
 {
-  std::cerr << "Reading the alignments and extracting intervals..." << std::endl;
-  std::vector<tagged_alignment> A_to_B, B_to_A;
-  read_alignments<Al>(A_to_B, o.A_to_B, A.seqs, B.seqs, A.names_to_idxs, B.names_to_idxs, o.strand_specific, o.min_segment_len);
-  read_alignments<Al>(B_to_A, o.B_to_A, B.seqs, A.seqs, B.names_to_idxs, A.names_to_idxs, o.strand_specific, o.min_segment_len);
+  // The alignments are not copied: the --min-segment-len filter is applied by
+  // process_alignments, which keeps its state apart from the alignments.
+  const std::vector<tagged_alignment>& A_to_B = A_to_B_set.alignments;
+  const std::vector<tagged_alignment>& B_to_A = B_to_A_set.alignments;
 
   if (o.nucl) {
     std::cerr << "Computing nucleotide precision, recall, and F1 scores..." << std::endl;
-    main_2<nucl_helper>(o, A, B, tau_A, tau_B, unif_A, unif_B, A_to_B, B_to_A, "nucl_");
+    profile_stage stage("nucl scores");
+    main_2<nucl_helper>(o, A, B, tau_A, tau_B, unif_A, unif_B, A_to_B, B_to_A, A_to_B_set.cache_key, B_to_A_set.cache_key, A_to_B_set.reference_checksum, "nucl_");
   }
 
   if (o.pair) {
     std::cerr << "Computing pair precision, recall, and F1 scores..." << std::endl;
-    main_2<pair_helper>(o, A, B, tau_A, tau_B, unif_A, unif_B, A_to_B, B_to_A, "pair_");
+    profile_stage stage("pair scores");
+    main_2<pair_helper>(o, A, B, tau_A, tau_B, unif_A, unif_B, A_to_B, B_to_A, A_to_B_set.cache_key, B_to_A_set.cache_key, A_to_B_set.reference_checksum, "pair_");
   }
 
   //if (o.kpair) main_2<kpair_helper>(o, A, B, tau_A, tau_B, unif_A, unif_B, A_to_B, B_to_A, "kpair_");
@@ -463,24 +1048,25 @@ void main_1(const opts& o,
 
   if (o.paper) {
     std::cerr << "Computing nucleotide precision, recall, and F1 scores..." << std::endl;
-    compute<nucl_helper>(o, A, B, unif_A, unif_B, A_to_B, B_to_A, "unweighted_nucl_");
+    profile_stage stage("nucl scores");
+    compute<nucl_helper>(o, A, B, unif_A, unif_B, A_to_B, B_to_A, A_to_B_set.cache_key, B_to_A_set.cache_key, A_to_B_set.reference_checksum, "unweighted_nucl_");
   }
 }
 
+// Preconditions:
+// - A_to_B and B_to_A have been filled by load_alignments
 void main(const opts& o,
           const fasta& A,
           const fasta& B,
           const expr& tau_A,
           const expr& tau_B,
           const expr& unif_A,
-          const expr& unif_B)
+          const expr& unif_B,
+          const alignment_set& A_to_B,
+          const alignment_set& B_to_A)
 {
-  if (o.nucl || o.pair || o.paper) {
-    if (o.alignment_type == "blast")
-      main_1<blast_alignment>(o, A, B, tau_A, tau_B, unif_A, unif_B);
-    else if (o.alignment_type == "psl")
-      main_1<psl_alignment>  (o, A, B, tau_A, tau_B, unif_A, unif_B);
-  }
+  if (o.nucl || o.pair || o.paper)
+    main_1(o, A, B, tau_A, tau_B, unif_A, unif_B, A_to_B, B_to_A);
 }
 
 } // namespace matched
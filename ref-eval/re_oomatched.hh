@@ -18,16 +18,22 @@
 // along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <boost/foreach.hpp>
-#include <boost/make_shared.hpp>
 #include <lemon/matching.h>
 #include <lemon/smart_graph.h>
 #include <lemon/concepts/graph.h>
 #include <lemon/concepts/maps.h>
-#include "blast.hh"
-#include "psl.hh"
+#include "bipartite_matching.hh"
+#include "expr.hh"
+#include "opts.hh"
+#include "profile.hh"
+#include "stage_cache.hh"
+#include "tagged_alignment.hh"
 #include "util.hh"
 
 namespace re {
@@ -37,9 +43,15 @@ struct result
 {
   double weighted;
   double unweighted;
+  // Upper bounds on the above, which are only different from them with
+  // --matching-algorithm=greedy.
+  double weighted_upper_bound;
+  double unweighted_upper_bound;
   result()
   : weighted(-1),
-    unweighted(-1)
+    unweighted(-1),
+    weighted_upper_bound(-1),
+    unweighted_upper_bound(-1)
   {}
 };
 
@@ -57,42 +69,342 @@ std::string join(V vec, S sep)
   return oss.str();
 }
 
-template<typename MM>
+// An edge of the bipartite graph between A and B used by the contig scores.
+struct matching_edge
+{
+  size_t a_idx, b_idx;
+  double weight;
+};
+
+namespace detail {
+
+  // Orders edge indices by their endpoints, and then by index.
+  struct compare_edge_endpoints
+  {
+    const std::vector<matching_edge>& edges;
+    compare_edge_endpoints(const std::vector<matching_edge>& edges) : edges(edges) {}
+    bool operator()(size_t i, size_t j) const
+    {
+      if (edges[i].a_idx != edges[j].a_idx) return edges[i].a_idx < edges[j].a_idx;
+      if (edges[i].b_idx != edges[j].b_idx) return edges[i].b_idx < edges[j].b_idx;
+      return i < j;
+    }
+  };
+
+} // namespace detail
+
+// Replaces each group of parallel edges (i.e., edges between the same a_idx
+// and b_idx, which arise from several alignments of the same pair) by a single
+// edge with the largest of their weights. The remaining edges keep the
+// relative order of their first occurrences.
+void collapse_parallel_edges(std::vector<matching_edge>& edges)
+{
+  std::vector<size_t> order(edges.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), detail::compare_edge_endpoints(edges));
+
+  std::vector<bool> keep(edges.size(), false);
+  for (size_t k = 0; k < order.size(); ) {
+    size_t first = order[k];
+    double weight = edges[first].weight;
+    for (++k; k < order.size() &&
+              edges[order[k]].a_idx == edges[first].a_idx &&
+              edges[order[k]].b_idx == edges[first].b_idx; ++k)
+      weight = std::max(weight, edges[order[k]].weight);
+    edges[first].weight = weight;
+    keep[first] = true;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < edges.size(); ++i)
+    if (keep[i])
+      edges[n++] = edges[i];
+  edges.resize(n);
+}
+
+// The connected components of a bipartite graph. The edges of the i'th
+// component are edges[edge_idxs[j]] for j in [offsets[i], offsets[i+1]), in
+// their original order, and its nodes are likewise listed by A_idxs and B_idxs.
+// A_local[a_idx] is the position of node a_idx among the nodes of A in its
+// component (i.e., A_idxs[A_offsets[i] + A_local[a_idx]] == a_idx), and
+// likewise for B_local.
+struct matching_components
+{
+  std::vector<size_t> offsets,   edge_idxs;
+  std::vector<size_t> A_offsets, A_idxs, A_local;
+  std::vector<size_t> B_offsets, B_idxs, B_local;
+  size_t size() const { return offsets.size() - 1; }
+};
+
+namespace detail {
+
+  size_t find_root(std::vector<size_t>& parent, size_t x)
+  {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]]; // path halving
+      x = parent[x];
+    }
+    return x;
+  }
+
+  // Groups the items [0, n) by their component labels in [0, num_comps),
+  // keeping the items of each component in increasing order.
+  void group_by_component(const std::vector<size_t>& labels, size_t num_comps,
+                          std::vector<size_t>& offsets, std::vector<size_t>& idxs)
+  {
+    offsets.assign(num_comps + 1, 0);
+    for (size_t i = 0; i < labels.size(); ++i)
+      if (labels[i] != static_cast<size_t>(-1))
+        ++offsets[labels[i] + 1];
+    for (size_t c = 0; c < num_comps; ++c)
+      offsets[c + 1] += offsets[c];
+    idxs.resize(offsets[num_comps]);
+    std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < labels.size(); ++i)
+      if (labels[i] != static_cast<size_t>(-1))
+        idxs[next[labels[i]]++] = i;
+  }
+
+} // namespace detail
+
+// Splits the graph into its connected components, ignoring isolated nodes,
+// which cannot be matched anyway.
+void find_components(matching_components& comps,
+                     const std::vector<matching_edge>& edges,
+                     size_t A_card,
+                     size_t B_card)
+{
+  // Union the endpoints of each edge. Node i of A is i, and node j of B is
+  // A_card + j.
+  std::vector<size_t> parent(A_card + B_card);
+  for (size_t i = 0; i < parent.size(); ++i)
+    parent[i] = i;
+  BOOST_FOREACH(const matching_edge& e, edges) {
+    size_t r1 = detail::find_root(parent, e.a_idx);
+    size_t r2 = detail::find_root(parent, A_card + e.b_idx);
+    if (r1 != r2)
+      parent[std::max(r1, r2)] = std::min(r1, r2);
+  }
+
+  // Number the components in order of their first edge.
+  const size_t none = static_cast<size_t>(-1);
+  std::vector<size_t> root_label(parent.size(), none);
+  std::vector<size_t> edge_labels(edges.size());
+  size_t num_comps = 0;
+  for (size_t i = 0; i < edges.size(); ++i) {
+    size_t r = detail::find_root(parent, edges[i].a_idx);
+    if (root_label[r] == none)
+      root_label[r] = num_comps++;
+    edge_labels[i] = root_label[r];
+  }
+  std::vector<size_t> A_labels(A_card, none), B_labels(B_card, none);
+  for (size_t i = 0; i < edges.size(); ++i)
+    A_labels[edges[i].a_idx] = B_labels[edges[i].b_idx] = edge_labels[i];
+
+  detail::group_by_component(edge_labels, num_comps, comps.offsets,   comps.edge_idxs);
+  detail::group_by_component(A_labels,    num_comps, comps.A_offsets, comps.A_idxs);
+  detail::group_by_component(B_labels,    num_comps, comps.B_offsets, comps.B_idxs);
+  comps.A_local.assign(A_card, none);
+  comps.B_local.assign(B_card, none);
+  for (size_t c = 0; c < num_comps; ++c) {
+    for (size_t k = comps.A_offsets[c]; k < comps.A_offsets[c+1]; ++k)
+      comps.A_local[comps.A_idxs[k]] = k - comps.A_offsets[c];
+    for (size_t k = comps.B_offsets[c]; k < comps.B_offsets[c+1]; ++k)
+      comps.B_local[comps.B_idxs[k]] = k - comps.B_offsets[c];
+  }
+}
+
+namespace detail {
+
+  // Finds a maximum (weighted) matching of a single component with lemon's
+  // general-graph algorithms.
+  void lemon_matching(const std::vector<matching_edge>& edges,
+                      const matching_components& comps,
+                      size_t c,
+                      bool weighted,
+                      std::vector<size_t>& B_mate_edges)
+  {
+    // Add the nodes in the same order as they would be added to a graph of
+    // the whole problem: all of the nodes of A, then all of the nodes of B.
+    lemon::SmartGraph graph;
+    size_t num_A = comps.A_offsets[c+1] - comps.A_offsets[c];
+    size_t num_B = comps.B_offsets[c+1] - comps.B_offsets[c];
+    graph.reserveNode(num_A + num_B);
+    graph.reserveEdge(comps.offsets[c+1] - comps.offsets[c]);
+    std::vector<lemon::SmartGraph::Node> A_nodes(num_A), B_nodes(num_B);
+    for (size_t i = 0; i < num_A; ++i) A_nodes[i] = graph.addNode();
+    for (size_t j = 0; j < num_B; ++j) B_nodes[j] = graph.addNode();
+    lemon::SmartGraph::EdgeMap<double> wei_map(graph);
+    lemon::SmartGraph::EdgeMap<size_t> idx_map(graph);
+    for (size_t k = comps.offsets[c]; k < comps.offsets[c+1]; ++k) {
+      const matching_edge& e = edges[comps.edge_idxs[k]];
+      lemon::SmartGraph::Edge edge = graph.addEdge(A_nodes[comps.A_local[e.a_idx]],
+                                                   B_nodes[comps.B_local[e.b_idx]]);
+      wei_map[edge] = e.weight;
+      idx_map[edge] = comps.edge_idxs[k];
+    }
+
+    if (weighted) {
+      lemon::MaxWeightedMatching<lemon::SmartGraph, lemon::SmartGraph::EdgeMap<double> > mm(graph, wei_map);
+      mm.run();
+      for (size_t j = 0; j < num_B; ++j)
+        if (mm.matching(B_nodes[j]) != lemon::INVALID)
+          B_mate_edges[comps.B_idxs[comps.B_offsets[c] + j]] = idx_map[mm.matching(B_nodes[j])];
+    } else {
+      lemon::MaxMatching<lemon::SmartGraph> mm(graph);
+      mm.run();
+      for (size_t j = 0; j < num_B; ++j)
+        if (mm.matching(B_nodes[j]) != lemon::INVALID)
+          B_mate_edges[comps.B_idxs[comps.B_offsets[c] + j]] = idx_map[mm.matching(B_nodes[j])];
+    }
+  }
+
+  // Returns the weight (or, if weighted is false, the size) of the matching
+  // of the c'th component.
+  double component_matching_weight(const std::vector<matching_edge>& edges,
+                                   const matching_components& comps,
+                                   size_t c,
+                                   bool weighted,
+                                   const std::vector<size_t>& B_mate_edges)
+  {
+    double weight = 0.0;
+    for (size_t k = comps.B_offsets[c]; k < comps.B_offsets[c+1]; ++k) {
+      size_t e = B_mate_edges[comps.B_idxs[k]];
+      if (e != static_cast<size_t>(-1))
+        weight += weighted ? edges[e].weight : 1.0;
+    }
+    return weight;
+  }
+
+  // Finds a maximum (weighted) matching of a single component with the
+  // bipartite algorithms in bipartite_matching.hh, or an approximate one if
+  // approximate is true. Returns an upper bound on the weight (or size) of a
+  // maximum matching, which for the exact algorithms is the weight of the
+  // matching found.
+  double bipartite_matching(const std::vector<matching_edge>& edges,
+                            const matching_components& comps,
+                            size_t c,
+                            bool weighted,
+                            bool approximate,
+                            std::vector<size_t>& B_mate_edges)
+  {
+    std::vector<bipartite_edge> local_edges;
+    local_edges.reserve(comps.offsets[c+1] - comps.offsets[c]);
+    for (size_t k = comps.offsets[c]; k < comps.offsets[c+1]; ++k) {
+      const matching_edge& e = edges[comps.edge_idxs[k]];
+      bipartite_edge le;
+      le.left   = comps.A_local[e.a_idx];
+      le.right  = comps.B_local[e.b_idx];
+      le.weight = e.weight;
+      local_edges.push_back(le);
+    }
+
+    size_t num_A = comps.A_offsets[c+1] - comps.A_offsets[c];
+    size_t num_B = comps.B_offsets[c+1] - comps.B_offsets[c];
+    std::vector<size_t> right_mate_edges;
+    double upper_bound = -1;
+    if (approximate)
+      upper_bound = greedy_matching(num_A, num_B, local_edges, weighted, right_mate_edges);
+    else if (weighted)
+      max_weight_matching(num_A, num_B, local_edges, right_mate_edges);
+    else
+      hopcroft_karp(num_A, num_B, local_edges, right_mate_edges);
+    for (size_t j = 0; j < num_B; ++j)
+      if (right_mate_edges[j] != bipartite_edge::npos)
+        B_mate_edges[comps.B_idxs[comps.B_offsets[c] + j]] = comps.edge_idxs[comps.offsets[c] + right_mate_edges[j]];
+    return approximate ? upper_bound : component_matching_weight(edges, comps, c, weighted, B_mate_edges);
+  }
+
+} // namespace detail
+
+// Finds a maximum matching of the graph, or a maximum weighted matching if
+// weighted is true, and sets B_mate_edges[j] to the index of the edge that
+// matches the j'th node of B, or to -1 if the node is not matched. Returns an
+// upper bound on the size or weight of a maximum matching, which is only
+// different from that of the matching found if algorithm is "greedy".
+//
+// The matching of each connected component is found independently, in
+// parallel. Components in which every edge shares a node (i.e., stars, which
+// include single edges) are matched directly; the rest are matched by the
+// given algorithm: "bipartite" (see bipartite_matching.hh), "lemon", or
+// "greedy", which is approximate.
+double max_matching(const std::vector<matching_edge>& edges,
+                    const matching_components& comps,
+                    size_t B_card,
+                    bool weighted,
+                    const std::string& algorithm,
+                    std::vector<size_t>& B_mate_edges)
+{
+  B_mate_edges.assign(B_card, static_cast<size_t>(-1));
+  bool use_lemon  = (algorithm == "lemon");
+  bool use_greedy = (algorithm == "greedy");
+  double upper_bound = 0.0;
+
+  #pragma omp parallel for schedule(dynamic) reduction(+:upper_bound)
+  for (int ci = 0; ci < static_cast<int>(comps.size()); ++ci) {
+    size_t c = ci;
+    size_t num_A = comps.A_offsets[c+1] - comps.A_offsets[c];
+    size_t num_B = comps.B_offsets[c+1] - comps.B_offsets[c];
+    if (num_A == 1 || num_B == 1) {
+      // Only one edge can be in the matching, so choose the heaviest one,
+      // leaving the component unmatched if no edge has positive weight.
+      size_t best = static_cast<size_t>(-1);
+      for (size_t k = comps.offsets[c]; k < comps.offsets[c+1]; ++k) {
+        size_t e = comps.edge_idxs[k];
+        if (!weighted) {
+          best = e;
+          break;
+        }
+        if (edges[e].weight > 0 && (best == static_cast<size_t>(-1) || edges[e].weight > edges[best].weight))
+          best = e;
+      }
+      if (best != static_cast<size_t>(-1)) {
+        B_mate_edges[edges[best].b_idx] = best;
+        upper_bound += weighted ? edges[best].weight : 1.0;
+      }
+    } else if (use_lemon) {
+      detail::lemon_matching(edges, comps, c, weighted, B_mate_edges);
+      upper_bound += detail::component_matching_weight(edges, comps, c, weighted, B_mate_edges);
+    } else {
+      upper_bound += detail::bipartite_matching(edges, comps, c, weighted, use_greedy, B_mate_edges);
+    }
+  }
+  return upper_bound;
+}
+
 void output_matching(const std::string& fname,
                      const std::string& pr_string,
                      const fasta& A,
                      const fasta& B,
-                     const std::vector<lemon::SmartGraph::Node>& B_nodes,
-                     std::map<lemon::SmartGraph::Node, size_t>& A_nodes_to_idxs,
-                     const lemon::SmartGraph& graph,
-                     const MM& mm,
-                     const lemon::SmartGraph::EdgeMap<double> *wei_map)
+                     const std::vector<matching_edge>& edges,
+                     const std::vector<size_t>& B_mate_edges,
+                     bool weighted)
 {
+  // List the edges incident to each node of B, most recently added first.
+  std::vector<std::vector<size_t> > B_edges(B.card);
+  for (size_t i = edges.size(); i-- > 0; )
+    B_edges[edges[i].b_idx].push_back(i);
+
   std::ofstream fo(fname.c_str());
   if (pr_string == "recall")
     fo << "b_name\ta_name\tedge_weight\tcandidate_a_names" << std::endl;
   else // for precision, A and B have been interchanged
     fo << "a_name\tb_name\tedge_weight\tcandidate_b_names" << std::endl;
   for (size_t b_idx = 0; b_idx < B.card; ++b_idx) {
-    lemon::SmartGraph::Node b_node = B_nodes[b_idx];
-    lemon::SmartGraph::Node a_node = mm.mate(b_node);
-    lemon::SmartGraph::Edge edge = mm.matching(b_node);
     // Output the first three columns.
-    if (a_node == lemon::INVALID) {
+    size_t e = B_mate_edges[b_idx];
+    if (e == static_cast<size_t>(-1)) {
       fo << B.names[b_idx] << "\tNA\tNA\t";
     } else {
-      size_t a_idx = A_nodes_to_idxs[a_node];
       fo << B.names[b_idx] << "\t"
-         << A.names[a_idx] << "\t"
-         << (wei_map ? (*wei_map)[edge] : 1.0/B.card) << "\t";
+         << A.names[edges[e].a_idx] << "\t"
+         << (weighted ? edges[e].weight : 1.0/B.card) << "\t";
     }
     // Output the last two columns.
     std::vector<std::string> alt_names;
-    for (lemon::SmartGraph::OutArcIt it(graph, b_node); it != lemon::INVALID; ++it) {
-      assert(graph.source(it) == b_node);
-      lemon::SmartGraph::Node alternate = graph.target(it);
-      alt_names.push_back(A.names[A_nodes_to_idxs[alternate]]);
-    }
+    BOOST_FOREACH(size_t i, B_edges[b_idx])
+      alt_names.push_back(A.names[edges[i].a_idx].str());
     if (alt_names.size() == 0)
       fo << "NA";
     else
@@ -101,9 +413,8 @@ void output_matching(const std::string& fname,
   }
 }
 
-template<typename Al>
 result compute_recall(const opts& o,
-                      typename Al::input_stream_type& input_stream,
+                      const re::matched::alignment_set& alignments,
                       const fasta& A,
                       const fasta& B,
                       const std::vector<double>& tau_B,
@@ -111,95 +422,125 @@ result compute_recall(const opts& o,
                       const std::vector<size_t>& num_non_N_in_B,
                       const std::string pr_string)
 {
-  // Create the graph, and add a node for each contig and oracleset element.
-  // Also create a reverse mapping from nodes to indices.
-  lemon::SmartGraph graph;
-  std::vector<lemon::SmartGraph::Node> A_nodes(A.card), B_nodes(B.card);
-  std::map<lemon::SmartGraph::Node, size_t> A_nodes_to_idxs, B_nodes_to_idxs;
-  for (size_t i = 0; i < A.card; ++i) {
-    A_nodes[i] = graph.addNode();
-    A_nodes_to_idxs[A_nodes[i]] = i;
-  }
-  for (size_t i = 0; i < B.card; ++i) {
-    B_nodes[i] = graph.addNode();
-    B_nodes_to_idxs[B_nodes[i]] = i;
-  }
-
-  // Add edges to the graph (and detetermine their weights) based on the given
-  // alignments.
-  lemon::SmartGraph::EdgeMap<double> wei_map(graph);
-  lemon::SmartGraph::EdgeMap<boost::shared_ptr<Al> > al_map(graph);
-  Al al;
-  while (input_stream >> al) {
-    if (al.is_on_valid_strand(o.strand_specific)) {
-        // al.frac_identity_wrt_a() >= o.min_frac_identity && 
-        // al.frac_identity_wrt_b() >= o.min_frac_identity &&
-        // al.frac_indel_wrt_a() <= o.max_frac_indel &&
-        // al.frac_indel_wrt_b() <= o.max_frac_indel)
-      size_t a_idx = A.names_to_idxs.find(al.a_name())->second;
-      size_t b_idx = B.names_to_idxs.find(al.b_name())->second;
-      if (1.0*al.num_identity_wrt_a()/num_non_N_in_A[a_idx] >= o.min_frac_identity && 
-          1.0*al.num_identity_wrt_b()/num_non_N_in_B[b_idx] >= o.min_frac_identity &&
-          1.0*al.frac_indel_wrt_a()/num_non_N_in_A[a_idx] <= o.max_frac_indel &&
-          1.0*al.frac_indel_wrt_b()/num_non_N_in_B[b_idx] <= o.max_frac_indel) {
-        lemon::SmartGraph::Edge edge = graph.addEdge(A_nodes[a_idx], B_nodes[b_idx]);
-        if (o.weighted)
-          wei_map[edge] = tau_B[b_idx];
-        if (al_map[edge] == NULL || al.num_identity() >= al_map[edge]->num_identity())
-          al_map[edge] = boost::make_shared<Al>(al);
-      }
+  // Make the edges of the graph (and detetermine their weights) based on the
+  // given alignments, which have already been filtered by strand.
+  profile_stage graph_stage("build graph");
+  std::vector<matching_edge> edges;
+  edges.reserve(alignments.alignments.size());
+  for (size_t i = 0; i < alignments.alignments.size(); ++i) {
+      // al.frac_identity_wrt_a() >= o.min_frac_identity && 
+      // al.frac_identity_wrt_b() >= o.min_frac_identity &&
+      // al.frac_indel_wrt_a() <= o.max_frac_indel &&
+      // al.frac_indel_wrt_b() <= o.max_frac_indel)
+    const re::matched::alignment_identity& id = alignments.identities[i];
+    size_t a_idx = alignments.alignments[i].a_idx;
+    size_t b_idx = alignments.alignments[i].b_idx;
+    if (1.0*id.num_identity_wrt_a/num_non_N_in_A[a_idx] >= o.min_frac_identity && 
+        1.0*id.num_identity_wrt_b/num_non_N_in_B[b_idx] >= o.min_frac_identity &&
+        1.0*id.frac_indel_wrt_a/num_non_N_in_A[a_idx] <= o.max_frac_indel &&
+        1.0*id.frac_indel_wrt_b/num_non_N_in_B[b_idx] <= o.max_frac_indel) {
+      matching_edge e;
+      e.a_idx  = a_idx;
+      e.b_idx  = b_idx;
+      e.weight = o.weighted ? tau_B[b_idx] : 0.0;
+      edges.push_back(e);
     }
   }
+  collapse_parallel_edges(edges);
+  matching_components comps;
+  find_components(comps, edges, A.card, B.card);
+  graph_stage.set_items(edges.size(), "edges");
+  graph_stage.finish();
 
-  // Run the matching procedure.
-  lemon::MaxWeightedMatching<lemon::SmartGraph, lemon::SmartGraph::EdgeMap<double> > wei_mm(graph, wei_map);
-  lemon::MaxMatching<lemon::SmartGraph> unw_mm(graph);
-  if (o.weighted)              wei_mm.run();
-  if (o.unweighted || o.paper) unw_mm.run();
-
-  // Compute the recall.
+  // Run the matching procedure, and compute the recall.
+  profile_stage matching_stage("matching");
   result recall;
-  if (o.weighted)              recall.weighted   = wei_mm.matchingWeight();
-  if (o.unweighted || o.paper) recall.unweighted = 1.0*unw_mm.matchingSize()/B.card;
+  std::vector<size_t> wei_mates, unw_mates;
+  if (o.weighted) {
+    recall.weighted_upper_bound = max_matching(edges, comps, B.card, true, o.matching_algorithm, wei_mates);
+    recall.weighted = 0.0;
+    BOOST_FOREACH(size_t e, wei_mates)
+      if (e != static_cast<size_t>(-1))
+        recall.weighted += edges[e].weight;
+  }
+  if (o.unweighted || o.paper) {
+    double size_upper_bound = max_matching(edges, comps, B.card, false, o.matching_algorithm, unw_mates);
+    size_t size = 0;
+    BOOST_FOREACH(size_t e, unw_mates)
+      if (e != static_cast<size_t>(-1))
+        ++size;
+    recall.unweighted = 1.0*size/B.card;
+    recall.unweighted_upper_bound = size_upper_bound/B.card;
+  }
+  matching_stage.set_items(comps.size(), "components");
+  matching_stage.finish();
 
   // Output the weighted matching.
   if (o.trace != "" && o.weighted) {
     std::ostringstream fname;
     fname << o.trace << ".weighted_contig_" << pr_string << "_matching";
-    output_matching(fname.str(), pr_string, A, B, B_nodes, A_nodes_to_idxs, graph, wei_mm, &wei_map);
+    output_matching(fname.str(), pr_string, A, B, edges, wei_mates, true);
   }
 
   // Output the unweighted matching.
   if (o.trace != "" && (o.unweighted || o.paper)) {
     std::ostringstream fname;
     fname << o.trace << ".unweighted_contig_" << pr_string << "_matching";
-    output_matching(fname.str(), pr_string, A, B, B_nodes, A_nodes_to_idxs, graph, unw_mm, NULL);
+    output_matching(fname.str(), pr_string, A, B, edges, unw_mates, false);
   }
   return recall;
 }
 
+// Like compute_recall, but with --cache-dir, the result is looked up in the
+// "oomatched" stage of the cache (see stage_cache.hh) first, and stored there
+// if it is not found. The cache is not used with --trace, which needs the
+// matching itself.
+result compute_recall_cached(const opts& o,
+                             const re::matched::alignment_set& alignments,
+                             const fasta& A,
+                             const fasta& B,
+                             const std::vector<double>& tau_B,
+                             const std::vector<size_t>& num_non_N_in_A,
+                             const std::vector<size_t>& num_non_N_in_B,
+                             const std::string pr_string)
+{
+  if (o.cache_dir == "" || alignments.cache_key == 0 || o.trace != "")
+    return compute_recall(o, alignments, A, B, tau_B, num_non_N_in_A, num_non_N_in_B, pr_string);
+
+  // The numbers of non-N bases are determined by the sequences, which are
+  // part of the alignments' key.
+  stage_key key("oomatched");
+  key.add(alignments.cache_key).add(o.min_frac_identity).add(o.max_frac_indel)
+     .add(o.matching_algorithm).add(static_cast<uint64_t>(o.weighted))
+     .add(static_cast<uint64_t>(o.unweighted || o.paper)).add(tau_B);
+  std::vector<result> cached;
+  if (load_stage(cached, o.cache_dir, key) && cached.size() == 1)
+    return cached[0];
+  result recall = compute_recall(o, alignments, A, B, tau_B, num_non_N_in_A, num_non_N_in_B, pr_string);
+  save_stage_or_warn(std::vector<result>(1, recall), o.cache_dir, key);
+  return recall;
+}
+
 void compute_num_non_N(std::vector<size_t>& num_non_N, const fasta& A)
 {
   for (size_t i = 0; i < A.card; ++i) {
     size_t n = 0;
-    const std::string& a = A.seqs[i];
-    for (std::string::const_iterator it = a.begin(); it != a.end(); ++it)
+    string_ref a = A.seqs[i];
+    for (const char *it = a.beg; it != a.end; ++it)
       if (*it != 'N' && *it != 'n')
         ++n;
     num_non_N[i] = n;
   }
 }
 
-template<typename Al>
 void main_1(const opts& o,
             const fasta& A,
             const fasta& B,
             const expr& tau_A,
-            const expr& tau_B)
+            const expr& tau_B,
+            const re::matched::alignment_set& A_to_B,
+            const re::matched::alignment_set& B_to_A)
 {
-  typename Al::input_stream_type A_to_B_is(open_or_throw(o.A_to_B));
-  typename Al::input_stream_type B_to_A_is(open_or_throw(o.B_to_A));
-
   std::cerr << "Computing number of non-N bases..." << std::endl;
   std::vector<size_t> num_non_N_in_A(A.card);
   std::vector<size_t> num_non_N_in_B(B.card);
@@ -207,35 +548,46 @@ void main_1(const opts& o,
   compute_num_non_N(num_non_N_in_B, B);
 
   std::cerr << "Computing contig precision, recall, and F1 scores..." << std::endl;
-  result recall = compute_recall<Al>(o, A_to_B_is, A, B, tau_B, num_non_N_in_A, num_non_N_in_B, "recall");
-  result precis = compute_recall<Al>(o, B_to_A_is, B, A, tau_A, num_non_N_in_B, num_non_N_in_A, "precision");
+  profile_stage stage("contig scores");
+  result recall = compute_recall_cached(o, A_to_B, A, B, tau_B, num_non_N_in_A, num_non_N_in_B, "recall");
+  result precis = compute_recall_cached(o, B_to_A, B, A, tau_A, num_non_N_in_B, num_non_N_in_A, "precision");
+  stage.finish();
 
   if (o.weighted) {
-    std::cout << "weighted_contig_recall\t" << recall.weighted << std::endl;
-    std::cout << "weighted_contig_precision\t" << precis.weighted << std::endl;
-    std::cout << "weighted_contig_F1\t" << compute_F1(precis.weighted, recall.weighted) << std::endl;
+    *o.out << "weighted_contig_recall\t" << recall.weighted << std::endl;
+    *o.out << "weighted_contig_precision\t" << precis.weighted << std::endl;
+    *o.out << "weighted_contig_F1\t" << compute_F1(precis.weighted, recall.weighted) << std::endl;
+    if (o.matching_algorithm == "greedy") {
+      *o.out << "weighted_contig_recall_upper_bound\t" << recall.weighted_upper_bound << std::endl;
+      *o.out << "weighted_contig_precision_upper_bound\t" << precis.weighted_upper_bound << std::endl;
+      *o.out << "weighted_contig_F1_upper_bound\t" << compute_F1(precis.weighted_upper_bound, recall.weighted_upper_bound) << std::endl;
+    }
   }
 
   if (o.unweighted || o.paper) {
-    std::cout << "unweighted_contig_recall\t" << recall.unweighted << std::endl;
-    std::cout << "unweighted_contig_precision\t" << precis.unweighted << std::endl;
-    std::cout << "unweighted_contig_F1\t" << compute_F1(precis.unweighted, recall.unweighted) << std::endl;
+    *o.out << "unweighted_contig_recall\t" << recall.unweighted << std::endl;
+    *o.out << "unweighted_contig_precision\t" << precis.unweighted << std::endl;
+    *o.out << "unweighted_contig_F1\t" << compute_F1(precis.unweighted, recall.unweighted) << std::endl;
+    if (o.matching_algorithm == "greedy") {
+      *o.out << "unweighted_contig_recall_upper_bound\t" << recall.unweighted_upper_bound << std::endl;
+      *o.out << "unweighted_contig_precision_upper_bound\t" << precis.unweighted_upper_bound << std::endl;
+      *o.out << "unweighted_contig_F1_upper_bound\t" << compute_F1(precis.unweighted_upper_bound, recall.unweighted_upper_bound) << std::endl;
+    }
   }
 }
 
+// Preconditions:
+// - A_to_B and B_to_A have been filled by re::matched::load_alignments
 void main(const opts& o,
           const fasta& A,
           const fasta& B,
           const expr& tau_A,
-          const expr& tau_B)
+          const expr& tau_B,
+          const re::matched::alignment_set& A_to_B,
+          const re::matched::alignment_set& B_to_A)
 {
-  if (o.contig || o.paper) {
-    if (o.alignment_type == "blast")
-      main_1<blast_alignment>(o, A, B, tau_A, tau_B);
-      //throw std::runtime_error("tran is not implemented for blast alignments yet.");
-    else if (o.alignment_type == "psl")
-      main_1<psl_alignment>  (o, A, B, tau_A, tau_B);
-  }
+  if (o.contig || o.paper)
+    main_1(o, A, B, tau_A, tau_B, A_to_B, B_to_A);
 }
 
 } // namespace oomatched
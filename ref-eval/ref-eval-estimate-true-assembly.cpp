@@ -20,6 +20,7 @@
 #include <list>
 #include <string>
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 #include <boost/program_options.hpp>
 #include <boost/lexical_cast.hpp>
@@ -27,13 +28,39 @@
 #include <boost/random/discrete_distribution.hpp>
 #include "sam/bam.h"
 #include "fasta.hh"
+#include "name_index.hh"
 #include "util.hh"
 #include "re_eta_help.hh"
 
-struct probs_and_lidxs
+// The alignment records (see alignment_record), grouped by read: the
+// alignments of read i are lidxs[offsets[i]], ..., lidxs[offsets[i + 1] - 1],
+// as indices of the records, and their posterior probabilities are the same
+// range of probs.
+struct alignments_by_read
 {
+  std::vector<size_t> offsets;
   std::vector<size_t> lidxs;
   std::vector<double> probs;
+
+  size_t num_reads() const { return offsets.size() - 1; }
+};
+
+// What is kept of each alignment that passes is_ok() and --min-alignment-prob:
+// just enough to build its ReadStructs, so that the BAM file only has to be
+// read once.
+struct alignment_record
+{
+  // The transcript id, the leftmost position of the read within the
+  // transcript, and the read length.
+  int tid, pos, readlen;
+
+  // In paired-end mode, the leftmost position of the mate within the same
+  // transcript, and the mate's imputed length.
+  int mpos, mreadlen;
+
+  alignment_record(int tid, int pos, int readlen, int mpos, int mreadlen)
+  : tid(tid), pos(pos), readlen(readlen), mpos(mpos), mreadlen(mreadlen)
+  {}
 };
 
 struct ReadStruct
@@ -192,22 +219,63 @@ double compute_prob(const bam1_t *rec)
   return prob;
 }
 
-size_t extract_alignment_probs(std::map<std::string, probs_and_lidxs>& read_to_probs_and_lidxs,
-                               const std::string& bam_fname,
-                               double min_alignment_prob,
-                               bool paired)
+// Sets groups to the alignment records grouped by read, given the read and
+// the posterior probability of each record. The records of each read stay in
+// the order of the BAM file.
+void group_by_read(alignments_by_read& groups,
+                   size_t num_reads,
+                   const std::vector<uint32_t>& read_of,
+                   const std::vector<double>& prob_of)
+{
+  // Count the alignments of each read, and turn the counts into offsets.
+  groups.offsets.assign(num_reads + 1, 0);
+  for (size_t lidx = 0; lidx < read_of.size(); ++lidx)
+    ++groups.offsets[read_of[lidx] + 1];
+  for (size_t i = 0; i < num_reads; ++i)
+    groups.offsets[i + 1] += groups.offsets[i];
+
+  // Put each record in the next free place of its read's range.
+  std::vector<size_t> next(groups.offsets.begin(), groups.offsets.end() - 1);
+  groups.lidxs.resize(read_of.size());
+  groups.probs.resize(read_of.size());
+  for (size_t lidx = 0; lidx < read_of.size(); ++lidx) {
+    size_t j = next[read_of[lidx]]++;
+    groups.lidxs[j] = lidx;
+    groups.probs[j] = prob_of[lidx];
+  }
+}
+
+// Reads the BAM file once. For each alignment that passes is_ok() and
+// --min-alignment-prob, appends an alignment_record to records. Then sets
+// groups to the records grouped by read. Also sets target_names to the names
+// of the transcripts, in the order of the BAM file's tids.
+//
+// The reads are told apart by name, through a name_index, which interns each
+// name once; for each record, only the index of its read is kept until the
+// records are grouped.
+void read_alignments(alignments_by_read& groups,
+                     std::vector<alignment_record>& records,
+                     std::vector<std::string>& target_names,
+                     const std::string& bam_fname,
+                     double min_alignment_prob,
+                     bool paired)
 {
   // Open BAM file and read header.
   bamFile fi = bam_open(bam_fname.c_str(), "r");
   if (!fi)
     throw std::runtime_error("Cannot open BAM file: " + bam_fname);
   bam_header_t *header = bam_header_read(fi);
+  target_names.assign(header->target_name, header->target_name + header->n_targets);
+
+  // The read of each record, and the record's posterior probability.
+  name_index read_names;
+  std::vector<uint32_t> read_of;
+  std::vector<double> prob_of;
 
   // Iterate over lines of the bamfile.
   bam1_t *rec = bam_init1();
-  size_t lidx;
-  for (lidx = 0;; ++lidx) { // alignment idx
-    
+  for (;;) {
+
     // Read next record. If no more records, we're done.
     if (bam_read1(fi, rec) < 0)
       break;
@@ -224,64 +292,89 @@ size_t extract_alignment_probs(std::map<std::string, probs_and_lidxs>& read_to_p
     if (prob < min_alignment_prob)
       continue;
 
+    // Extract the transcript idx, the leftmost position of the read, and
+    // the read length.
+    int tid = rec->core.tid;
+    int pos = rec->core.pos;
+    int readlen = rec->core.l_qseq;
+
+    // In the paired-end case, extract the leftmost position of the mate, and
+    // the mate's length.
+    int mpos = -1, mreadlen = -1;
+    if (paired) {
+      int mtid = rec->core.mtid;
+      mpos = rec->core.mpos;
+      mreadlen = mate_len(rec);
+
+      // Check that the read and its mate align to the same transcript.
+      if (mtid != tid) {
+        std::ostringstream ss;
+        ss << "Read " << bam1_qname(rec) << " is aligned to transcript " << tid
+           << " but its mate is aligned to transcript " << mtid
+           << ". Were your alignments produced by RSEM?";
+        throw std::runtime_error(ss.str());
+      }
+
+      // Check that the read and its mate have the same length. This doesn't
+      // necessarily need to be the case, but it should be the case in our
+      // initial experiment.
+      if (mreadlen != readlen) {
+        std::cerr << "Warning: Read " << bam1_qname(rec)  << " has length " 
+                  << readlen << ", but its mate has imputed length "
+                  << mreadlen << ". You might want to check that this is "
+                  << "correct." << std::endl;
+      }
+    }
+
     // Actually add the alignment.
     const char *read_name = bam1_qname(rec);
-    probs_and_lidxs& pal = read_to_probs_and_lidxs[read_name];
-    pal.probs.push_back(prob);
-    pal.lidxs.push_back(lidx);
+    size_t read = read_names.find_or_insert(string_ref(read_name, read_name + rec->core.l_qname - 1));
+    read_of.push_back(static_cast<uint32_t>(read));
+    prob_of.push_back(prob);
+    records.push_back(alignment_record(tid, pos, readlen, mpos, mreadlen));
 
   }
 
   // Clean up.
   bam_destroy1(rec);
   bam_header_destroy(header);
+  bam_close(fi);
 
-  // Return the number of alignments.
-  return lidx;
+  group_by_read(groups, read_names.size(), read_of, prob_of);
 }
 
 void choose_alignments(std::vector<bool>& is_lidx_chosen,
                        boost::random::mt19937& rng,
-                       const std::map<std::string, probs_and_lidxs>& read_to_probs_and_lidxs,
+                       const alignments_by_read& groups,
                        const std::string& alignment_policy)
 {
-  std::map<std::string, probs_and_lidxs>::const_iterator it;
+  size_t num_reads = groups.num_reads();
 
   if (alignment_policy == "sample") {
-    for (it = read_to_probs_and_lidxs.begin();
-         it != read_to_probs_and_lidxs.end();
-         ++it) {
-      boost::random::discrete_distribution<> dd(it->second.probs);
-      size_t i = dd(rng);
-      size_t chosen_lidx = it->second.lidxs[i];
+    for (size_t i = 0; i < num_reads; ++i) {
+      size_t beg = groups.offsets[i], end = groups.offsets[i + 1];
+      boost::random::discrete_distribution<> dd(groups.probs.begin() + beg,
+                                                groups.probs.begin() + end);
+      size_t chosen_lidx = groups.lidxs[beg + dd(rng)];
       is_lidx_chosen[chosen_lidx] = true;
     }
   }
 
   else if (alignment_policy == "best") {
-    for (it = read_to_probs_and_lidxs.begin();
-         it != read_to_probs_and_lidxs.end();
-         ++it) {
-      size_t num_alignments = it->second.probs.size();
-      size_t best = 0;
-      if (num_alignments > 1) {
-        for (size_t i = 1; i < num_alignments; ++i)
-          if (it->second.probs[i] > it->second.probs[best])
-            best = i;
-      }
-      size_t chosen_lidx = it->second.lidxs[best];
+    for (size_t i = 0; i < num_reads; ++i) {
+      size_t beg = groups.offsets[i], end = groups.offsets[i + 1];
+      size_t best = beg;
+      for (size_t j = beg + 1; j < end; ++j)
+        if (groups.probs[j] > groups.probs[best])
+          best = j;
+      size_t chosen_lidx = groups.lidxs[best];
       is_lidx_chosen[chosen_lidx] = true;
     }
   }
 
   else if (alignment_policy == "all") {
-    for (it = read_to_probs_and_lidxs.begin();
-         it != read_to_probs_and_lidxs.end();
-         ++it) {
-      size_t num_alignments = it->second.probs.size();
-      for (size_t i = 0; i < num_alignments; ++i)
-        is_lidx_chosen[it->second.lidxs[i]] = true;
-    }
+    for (size_t j = 0; j < groups.lidxs.size(); ++j)
+      is_lidx_chosen[groups.lidxs[j]] = true;
   }
 
   else {
@@ -289,83 +382,40 @@ void choose_alignments(std::vector<bool>& is_lidx_chosen,
   }
 }
 
+// Builds the ReadStructs of the chosen alignment records (two per record, in
+// paired-end mode).
 void extract_reads(std::vector<ReadStruct>& reads,
                    const std::vector<bool>& is_lidx_chosen,
-                   const std::string& bam_fname,
+                   const std::vector<alignment_record>& records,
                    bool paired)
 {
-  // Open BAM file and read header.
-  bamFile fi = bam_open(bam_fname.c_str(), "r");
-  if (!fi)
-    throw std::runtime_error("Cannot open BAM file: " + bam_fname);
-  bam_header_t *header = bam_header_read(fi);
-
-  // Iterate over lines of the bamfile.
-  bam1_t *rec = bam_init1();
-  for (size_t lidx = 0;; ++lidx) { // alignment idx
-
-    // Read next record. If no more records, we're done.
-    if (bam_read1(fi, rec) < 0)
-      break;
+  int rid = 0;
+  for (size_t lidx = 0; lidx < records.size(); ++lidx) {
 
     // Check that this alignment has been chosen.
     if (!is_lidx_chosen[lidx])
       continue;
 
-    // Extract the transcript idx, the leftmost position of the read, and
-    // the read length.
-    int tid = rec->core.tid;
-    int pos = rec->core.pos;
-    int readlen = rec->core.l_qseq;
-
-    // Record the above info about this read. This is the main info that will
-    // be relevant for making the contigs later on.
+    // Record the info about this read. This is the main info that will be
+    // relevant for making the contigs later on.
     //
-    // We use the alignment idx (lidx) as the read id because the purpose of
-    // the read id is simply to associate the read and its mate. Note that if
-    // all alignments are used (--alignment-policy=all), then a read might
-    // occur more than once, but for the purposes of assembly, each alignment
-    // of the read should be added with a different read id, since otherwise we
-    // would try to scaffold between the various alignments of the same read,
-    // which doesn't make sense.
-    reads.push_back(ReadStruct(lidx, tid, pos, readlen));
-
-    // In the paired-end case, extract info about the mate read, and add it to
-    // the list of reads, too.
-    if (paired) {
-      // Extract the mate's transcript idx, the leftmost position of the mate,
-      // and the mate's length.
-      int mtid = rec->core.mtid;
-      int mpos = rec->core.mpos;
-      int mreadlen = mate_len(rec);
-
-      // Check that the read and its mate align to the same transcript.
-      if (mtid != tid) {
-        std::ostringstream ss;
-        ss << "Read " << bam1_qname(rec) << " is aligned to transcript " << tid
-           << " but its mate is aligned to transcript " << mtid
-           << ". Were your alignments produced by RSEM?";
-        throw std::runtime_error(ss.str());
-      }
-
-      // Check that the read and its mate have the same length. This doesn't
-      // necessarily need to be the case, but it should be the case in our
-      // initial experiment.
-      if (mreadlen != readlen) {
-        std::cerr << "Warning: Read " << bam1_qname(rec)  << " has length " 
-                  << readlen << ", but its mate has imputed length "
-                  << mreadlen << ". You might want to check that this is "
-                  << "correct." << std::endl;
-      }
-
-      reads.push_back(ReadStruct(lidx, mtid, mpos, mreadlen));
-    }
+    // We number the chosen alignments, and use the number as the read id,
+    // because the purpose of the read id is simply to associate the read and
+    // its mate. Note that if all alignments are used
+    // (--alignment-policy=all), then a read might occur more than once, but
+    // for the purposes of assembly, each alignment of the read should be
+    // added with a different read id, since otherwise we would try to
+    // scaffold between the various alignments of the same read, which
+    // doesn't make sense.
+    const alignment_record& r = records[lidx];
+    reads.push_back(ReadStruct(rid, r.tid, r.pos, r.readlen));
+
+    // In the paired-end case, add the mate read to the list of reads, too.
+    if (paired)
+      reads.push_back(ReadStruct(rid, r.tid, r.mpos, r.mreadlen));
 
+    ++rid;
   }
-
-  // Clean up.
-  bam_destroy1(rec);
-  bam_header_destroy(header);
 }
 
 // Returns the root of the scaffold involving u.
@@ -485,15 +535,9 @@ void assemble(std::vector<ContigStruct>& contigs,
 void output(const std::string& output_fname,
             const std::vector<ContigStruct>& contigs,
             const fasta& ref_fa,
-            const std::string& bam_fname,
+            const std::vector<std::string>& target_names,
             bool paired)
 {
-  // Open BAM file and read header.
-  bamFile fi = bam_open(bam_fname.c_str(), "r");
-  if (!fi)
-    throw std::runtime_error("Cannot open BAM file: " + bam_fname);
-  bam_header_t *header = bam_header_read(fi);
-
   // Open file to write output.
   std::ofstream out(output_fname.c_str());
   if (!out)
@@ -515,21 +559,19 @@ void output(const std::string& output_fname,
     // file. However, the transcript sequences are stored in the FASTA file,
     // and the order here could be different. Thus, here, we will figure out
     // the idx of the transcript relative to the order in the FASTA file.
-    std::string tname(header->target_name[contigs[i].tid]);
-    std::map<std::string, size_t>::const_iterator it;
-    it = ref_fa.names_to_idxs.find(tname);
-    if (it == ref_fa.names_to_idxs.end()) {
+    const std::string& tname = target_names[contigs[i].tid];
+    size_t tidx = ref_fa.names_to_idxs.find(tname);
+    if (tidx == name_index::npos) {
       throw std::runtime_error("The following transcript name does not "
           "correspond to a reference sequence: " + tname);
     }
-    size_t tidx = it->second;
     if (static_cast<int>(tidx) != contigs[i].tid) {
       throw std::runtime_error("tidx and tid don't match");
     }
 
     // Get the transcript sequence and extract the contig. (In the paired-end
     // case, this is the first contig of the scaffold.)
-    const std::string& refseq = ref_fa.seqs[contigs[i].tid];
+    string_ref refseq = ref_fa.seqs[contigs[i].tid];
     if (contigs[i].pos + contigs[i].len > static_cast<int>(refseq.length())) {
       std::ostringstream ss;
       ss << "Contig extends past end of the transcript sequence. "
@@ -644,9 +686,6 @@ void output(const std::string& output_fname,
     }
 
   }
-
-  // Clean up.
-  bam_header_destroy(header);
 }
 
 void print_help()
@@ -764,26 +803,30 @@ int main(int argc, const char **argv)
     read_fasta(ref_fa, ref_fname);
     std::cerr << "done." << std::endl;
 
-    // Read alignments and extract the posterior probability of each alignment.
-    std::cerr << curtime() << "Reading the alignments and extracting the posterior probability of each alignment..." << std::flush;
-    std::map<std::string, probs_and_lidxs> read_to_probs_and_lidxs;
+    // Read the alignments once, and keep the posterior probability of each
+    // alignment, and the info about its read location that is needed later.
+    std::cerr << curtime() << "Reading the alignments..." << std::flush;
+    alignments_by_read groups;
+    std::vector<alignment_record> records;
+    std::vector<std::string> target_names;
     std::string bam_fname = o.expression + ".transcript.sorted.bam";
-    size_t num_alignments = extract_alignment_probs(read_to_probs_and_lidxs, bam_fname, o.min_alignment_prob, o.paired);
-    std::cerr << "done." << std::endl;
+    read_alignments(groups, records, target_names, bam_fname, o.min_alignment_prob, o.paired);
+    std::cerr << "done; kept " << records.size() << " alignments of "
+              << groups.num_reads() << " reads." << std::endl;
 
     // Select a subset of alignments (currently: by sampling one alignment for
     // each read, according to the posterior probability of each alignment).
     std::cerr << curtime() << "Selecting a subset of alignments..." << std::flush;
-    std::vector<bool> is_lidx_chosen(num_alignments);
+    std::vector<bool> is_lidx_chosen(records.size());
     boost::random::mt19937 rng(time(0));
-    choose_alignments(is_lidx_chosen, rng, read_to_probs_and_lidxs, o.alignment_policy);
+    choose_alignments(is_lidx_chosen, rng, groups, o.alignment_policy);
     std::cerr << "done." << std::endl;
 
-    // Read the alignments again and, for the reads chosen above, extract info
-    // about the read locations relative to the reference transcripts.
-    std::cerr << curtime() << "Reading the alignments and extracting info about read locations..." << std::flush;
+    // For the alignments chosen above, extract info about the read locations
+    // relative to the reference transcripts.
+    std::cerr << curtime() << "Extracting info about read locations..." << std::flush;
     std::vector<ReadStruct> reads;
-    extract_reads(reads, is_lidx_chosen, bam_fname, o.paired);
+    extract_reads(reads, is_lidx_chosen, records, o.paired);
     std::cerr << "done." << std::endl;
 
     // Sort the read by the location they align to.
@@ -802,7 +845,7 @@ int main(int argc, const char **argv)
       std::ostringstream ss;
       ss << o.assembly << "_" << mo << ".fa";
       std::cerr << "writing " << contigs.size() << " contigs..." << std::flush;
-      output(ss.str(), contigs, ref_fa, bam_fname, o.paired);
+      output(ss.str(), contigs, ref_fa, target_names, o.paired);
       std::cerr << "done." << std::endl;
     }
 
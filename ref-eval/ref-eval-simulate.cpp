@@ -0,0 +1,218 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Synthesizes a scale-test workload for REF-EVAL; see simulate.hh.
+
+#include <fstream>
+#include <boost/program_options.hpp>
+#include "simulate.hh"
+
+void print_help()
+{
+  std::cout <<
+    "Usage: ref-eval-simulate --out-prefix PREFIX [options]\n"
+    "\n"
+    "Synthesizes a reference transcriptome with gene families and isoforms, its\n"
+    "expression, an assembly derived from it (with fragmentation, chimeras,\n"
+    "redundancy, substitution and indel errors, and runs of N's), the assembly's\n"
+    "expression, and PSL alignments of the assembly to the reference and vice\n"
+    "versa. The output is determined by the options, including --seed. It is\n"
+    "written to\n"
+    "\n"
+    "  PREFIX.B.fa, PREFIX.B.expr          the reference and its expression\n"
+    "  PREFIX.A.fa, PREFIX.A.expr          the assembly and its expression\n"
+    "  PREFIX.A_to_B.psl, PREFIX.B_to_A.psl  the alignments\n"
+    "\n"
+    "in the formats that ref-eval's --B-seqs, --B-expr, --A-seqs, --A-expr,\n"
+    "--A-to-B, and --B-to-A options expect.\n"
+    "\n"
+    "Options (defaults in brackets):\n"
+    "  --seed N                    random seed [1]\n"
+    "  --num-families N            number of gene families; the main size knob [1000]\n"
+    "  --max-genes-per-family N    [3]\n"
+    "  --max-isoforms-per-gene N   [3]\n"
+    "  --max-exons N               [8]\n"
+    "  --mean-exon-length N        [200]\n"
+    "  --paralog-divergence X      fraction of bases that differ between paralogs [0.05]\n"
+    "  --expression-sigma X        sigma of the log-normal expression [2]\n"
+    "  --frac-unexpressed X        fraction of transcripts with no expression [0.1]\n"
+    "  --assembly-depth X          higher values assemble more of the transcripts [5]\n"
+    "  --mean-fragment-length N    mean length of the fragments a transcript is cut into [1000]\n"
+    "  --min-contig-length N       shorter fragments are dropped [200]\n"
+    "  --chimera-rate X            fraction of contigs that are chimeras [0.02]\n"
+    "  --redundancy-rate X         fraction of fragments assembled twice [0.1]\n"
+    "  --substitution-rate X       per-base substitution rate of the contigs [0.005]\n"
+    "  --indel-rate X              per-base indel rate of the contigs [0.001]\n"
+    "  --n-run-rate X              per-base rate at which runs of N's start [0.0005]\n"
+    "  --mean-n-run-length N       [10]\n"
+    "  --min-alignment-length N    shorter alignments are not output [40]\n"
+    << std::endl;
+}
+
+boost::program_options::options_description describe_options()
+{
+  namespace po = boost::program_options;
+  po::options_description desc;
+  desc.add_options()
+    ("help,?", "Display this information.")
+    ("out-prefix",            po::value<std::string>())
+    ("seed",                  po::value<unsigned>())
+    ("num-families",          po::value<size_t>())
+    ("max-genes-per-family",  po::value<size_t>())
+    ("max-isoforms-per-gene", po::value<size_t>())
+    ("max-exons",             po::value<size_t>())
+    ("mean-exon-length",      po::value<size_t>())
+    ("paralog-divergence",    po::value<double>())
+    ("expression-sigma",      po::value<double>())
+    ("frac-unexpressed",      po::value<double>())
+    ("assembly-depth",        po::value<double>())
+    ("mean-fragment-length",  po::value<size_t>())
+    ("min-contig-length",     po::value<size_t>())
+    ("chimera-rate",          po::value<double>())
+    ("redundancy-rate",       po::value<double>())
+    ("substitution-rate",     po::value<double>())
+    ("indel-rate",            po::value<double>())
+    ("n-run-rate",            po::value<double>())
+    ("mean-n-run-length",     po::value<size_t>())
+    ("min-alignment-length",  po::value<size_t>())
+    ;
+  return desc;
+}
+
+template<typename T>
+void get_option(T& x, const boost::program_options::variables_map& vm, const std::string& name)
+{
+  if (vm.count(name))
+    x = vm[name].as<T>();
+}
+
+void get_rate(double& x, const boost::program_options::variables_map& vm, const std::string& name)
+{
+  get_option(x, vm, name);
+  if (x < 0.0 || x > 1.0)
+    throw boost::program_options::error("Invalid value for --" + name + ": it should be between 0 and 1.");
+}
+
+void get_positive(size_t& x, const boost::program_options::variables_map& vm, const std::string& name)
+{
+  get_option(x, vm, name);
+  if (x == 0)
+    throw boost::program_options::error("Invalid value for --" + name + ": it should be positive.");
+}
+
+void parse_options(std::string& out_prefix, sim::params& p, const boost::program_options::variables_map& vm)
+{
+  namespace po = boost::program_options;
+
+  if (!vm.count("out-prefix"))
+    throw po::error("--out-prefix is required.");
+  out_prefix = vm["out-prefix"].as<std::string>();
+
+  get_option  (p.seed,                  vm, "seed");
+  get_positive(p.num_families,          vm, "num-families");
+  get_positive(p.max_genes_per_family,  vm, "max-genes-per-family");
+  get_positive(p.max_isoforms_per_gene, vm, "max-isoforms-per-gene");
+  get_positive(p.max_exons,             vm, "max-exons");
+  get_positive(p.mean_exon_length,      vm, "mean-exon-length");
+  get_rate    (p.paralog_divergence,    vm, "paralog-divergence");
+  get_option  (p.expression_sigma,      vm, "expression-sigma");
+  get_rate    (p.frac_unexpressed,      vm, "frac-unexpressed");
+  get_option  (p.assembly_depth,        vm, "assembly-depth");
+  get_positive(p.mean_fragment_length,  vm, "mean-fragment-length");
+  get_positive(p.min_contig_length,     vm, "min-contig-length");
+  get_rate    (p.chimera_rate,          vm, "chimera-rate");
+  get_rate    (p.redundancy_rate,       vm, "redundancy-rate");
+  get_rate    (p.substitution_rate,     vm, "substitution-rate");
+  get_rate    (p.indel_rate,            vm, "indel-rate");
+  get_rate    (p.n_run_rate,            vm, "n-run-rate");
+  get_positive(p.mean_n_run_length,     vm, "mean-n-run-length");
+  get_positive(p.min_alignment_length,  vm, "min-alignment-length");
+  if (p.expression_sigma < 0.0)
+    throw po::error("Invalid value for --expression-sigma: it should be nonnegative.");
+  if (p.assembly_depth < 0.0)
+    throw po::error("Invalid value for --assembly-depth: it should be nonnegative.");
+}
+
+// Opens filename for writing, with a large buffer.
+void open_for_writing(std::ofstream& ofs, std::vector<char>& buf, const std::string& filename)
+{
+  buf.resize(1 << 20);
+  ofs.rdbuf()->pubsetbuf(&buf[0], buf.size());
+  ofs.open(filename.c_str());
+  if (!ofs)
+    throw std::runtime_error("Can't open " + filename + " for writing.");
+}
+
+int main(int argc, const char **argv)
+{
+  namespace po = boost::program_options;
+
+  try {
+
+    po::options_description desc = describe_options();
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+
+    if (argc == 1 || vm.count("help")) {
+      print_help();
+      exit(0);
+    }
+
+    std::string out_prefix;
+    sim::params p;
+    parse_options(out_prefix, p, vm);
+    notify(vm);
+
+    const char *suffixes[] = { ".B.fa", ".B.expr", ".A.fa", ".A.expr", ".A_to_B.psl", ".B_to_A.psl" };
+    std::ofstream ofs[6];
+    std::vector<char> bufs[6];
+    for (size_t i = 0; i < 6; ++i)
+      open_for_writing(ofs[i], bufs[i], out_prefix + suffixes[i]);
+
+    std::cerr << curtime() << "Synthesizing the workload..." << std::flush;
+    sim::stats st = sim::simulate(p, ofs[0], ofs[1], ofs[2], ofs[3], ofs[4], ofs[5]);
+    for (size_t i = 0; i < 6; ++i) {
+      ofs[i].close();
+      if (!ofs[i])
+        throw std::runtime_error("Can't write " + out_prefix + suffixes[i] + ".");
+    }
+    std::cerr << "done." << std::endl;
+
+    std::cerr << "Reference: " << st.num_transcripts << " transcripts, " << st.reference_length << " bases." << std::endl;
+    std::cerr << "Assembly:  " << st.num_contigs << " contigs, " << st.assembly_length << " bases, "
+              << st.num_chimeras << " chimeras, " << st.num_redundant << " redundant." << std::endl;
+    std::cerr << "Alignments: " << st.num_A_to_B << " A to B, " << st.num_B_to_A << " B to A." << std::endl;
+    return 0;
+
+  } catch (const boost::program_options::error& x) {
+
+    std::cerr << std::endl;
+    std::cerr << argv[0] << ": Error: " << x.what() << std::endl;
+    std::cerr << "Check " << argv[0] << " --help for more information." << std::endl;
+    return 1;
+
+  } catch (const std::exception& x) {
+
+    std::cerr << std::endl;
+    std::cerr << argv[0] << ": Error: " << x.what() << std::endl;
+    return 1;
+
+  }
+}
@@ -19,6 +19,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <unistd.h>
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
 #include "opts.hh"
@@ -30,6 +31,11 @@
 #include "re_kmer.hh"
 #include "re_kc.hh"
 #include "re_help.hh"
+#include "profile.hh"
+#include "mismatch.hh"
+#include "reference.hh"
+#include "stage_cache.hh"
+#include "serve.hh"
 
 boost::program_options::options_description describe_options()
 {
@@ -42,26 +48,44 @@ boost::program_options::options_description describe_options()
     ("paper", "Flag")
     ("A-seqs", po::value<std::string>())
     ("B-seqs", po::value<std::string>())
-    ("A-expr", po::value<std::string>())
-    ("B-expr", po::value<std::string>())
+    ("A-expr", po::value<std::vector<std::string> >()->composing())
+    ("B-expr", po::value<std::vector<std::string> >()->composing())
     ("A-to-B", po::value<std::string>())
     ("B-to-A", po::value<std::string>())
     ("alignment-type", po::value<std::string>())
+    ("alignment-cache", "Flag")
+    ("cache-dir", po::value<std::string>())
     ("strand-specific", "Flag")
     ("readlen", po::value<size_t>())
     ("num-reads", po::value<size_t>())
     ("kmerlen", po::value<size_t>())
     ("min-frac-identity", po::value<double>())
     ("max-frac-indel", po::value<double>())
+    ("matching-algorithm", po::value<std::string>())
     ("min-segment-len", po::value<size_t>())
     ("hash-table-type", po::value<std::string>())
     ("hash-table-numeric-type", po::value<std::string>())
     ("hash-table-fudge-factor", po::value<double>())
     ("trace", po::value<std::string>())
+    ("profile", "Flag")
+    ("profile-json", po::value<std::string>())
+    ("simd", po::value<std::string>())
+    ("serve", po::value<std::string>())
+    ("serve-reference", po::value<std::vector<std::string> >()->composing())
+    ("serve-workers", po::value<size_t>())
+    ("connect", po::value<std::string>())
   ;
   return desc;
 }
 
+// Sets expr to the first of the values of --A-expr or --B-expr, and more to
+// the rest.
+void parse_expr(std::string& expr, std::vector<std::string>& more, const std::vector<std::string>& values)
+{
+  expr = values[0];
+  more.assign(values.begin() + 1, values.end());
+}
+
 void parse_options(opts& o, boost::program_options::variables_map& vm)
 {
   namespace po = boost::program_options;
@@ -130,15 +154,15 @@ void parse_options(opts& o, boost::program_options::variables_map& vm)
       throw po::error("--A-expr is required for weighted variants of scores.");
     if (!vm.count("B-expr"))
       throw po::error("--B-expr is required for weighted variants of scores.");
-    o.A_expr = vm["A-expr"].as<std::string>();
-    o.B_expr = vm["B-expr"].as<std::string>();
+    parse_expr(o.A_expr, o.more_A_expr, vm["A-expr"].as<std::vector<std::string> >());
+    parse_expr(o.B_expr, o.more_B_expr, vm["B-expr"].as<std::vector<std::string> >());
   }
   else if (o.kc || o.paper) {
     if (vm.count("A-expr"))
       throw po::error("--A-expr is not needed except for weighted variants of scores.");
     if (!vm.count("B-expr"))
       throw po::error("--B-expr is required for for the kc score.");
-    o.B_expr = vm["B-expr"].as<std::string>();
+    parse_expr(o.B_expr, o.more_B_expr, vm["B-expr"].as<std::vector<std::string> >());
   }
   else {
     if (vm.count("A-expr"))
@@ -146,24 +170,44 @@ void parse_options(opts& o, boost::program_options::variables_map& vm)
     if (vm.count("B-expr"))
       throw po::error("--B-expr is not needed except for weighted variants of scores and the kc score.");
   }
+  if (num_expr_profiles(o) > 1) {
+    if (o.paper || (o.weighted && o.alignment_based))
+      throw po::error("--A-expr and --B-expr can only be given several times for the kmer and kc scores.");
+    if ((!o.more_A_expr.empty() && o.more_A_expr.size() + 1 != num_expr_profiles(o)) ||
+        (!o.more_B_expr.empty() && o.more_B_expr.size() + 1 != num_expr_profiles(o)))
+      throw po::error("--A-expr and --B-expr must each be given either once or as many times as the other.");
+  }
 
   // Parse alignments.
   if (o.alignment_based) {
-    if (!vm.count("A-to-B"))
-      throw po::error("--A-to-B is required for alignment-based scores.");
-    if (!vm.count("B-to-A"))
-      throw po::error("--B-to-A is required for alignment-based scores.");
-    o.A_to_B = vm["A-to-B"].as<std::string>();
-    o.B_to_A = vm["B-to-A"].as<std::string>();
     if (!vm.count("alignment-type"))
       o.alignment_type = "psl";
     else {
       o.alignment_type = vm["alignment-type"].as<std::string>();
-      if (o.alignment_type != "blast" && o.alignment_type != "psl")
+      if (o.alignment_type != "blast" && o.alignment_type != "psl" &&
+          o.alignment_type != "sam"   && o.alignment_type != "bam"  &&
+          o.alignment_type != "builtin")
         throw po::error("Invalid value for --alignment-type: " + o.alignment_type);
       if (o.alignment_type == "blast")
         std::cerr << "Warning: Support for --alignment-type=blast is experimental and has not been thoroughly tested yet." << std::endl;
     }
+    if (o.alignment_type == "builtin") {
+      if (vm.count("A-to-B"))
+        throw po::error("--A-to-B is not needed with --alignment-type=builtin.");
+      if (vm.count("B-to-A"))
+        throw po::error("--B-to-A is not needed with --alignment-type=builtin.");
+      if (vm.count("alignment-cache"))
+        throw po::error("--alignment-cache can't be used with --alignment-type=builtin; use --cache-dir instead.");
+    } else {
+      if (!vm.count("A-to-B"))
+        throw po::error("--A-to-B is required for alignment-based scores.");
+      if (!vm.count("B-to-A"))
+        throw po::error("--B-to-A is required for alignment-based scores.");
+      o.A_to_B = vm["A-to-B"].as<std::string>();
+      o.B_to_A = vm["B-to-A"].as<std::string>();
+    }
+    if (vm.count("alignment-cache"))
+      o.alignment_cache = true;
   } else {
     if (vm.count("A-to-B"))
       throw po::error("--A-to-B is not needed except for alignment-based scores.");
@@ -171,6 +215,17 @@ void parse_options(opts& o, boost::program_options::variables_map& vm)
       throw po::error("--B-to-A is not needed except for alignment-based scores.");
     if (vm.count("alignment-type"))
       throw po::error("--alignment-type is not needed except for alignment-based scores.");
+    if (vm.count("alignment-cache"))
+      throw po::error("--alignment-cache is not needed except for alignment-based scores.");
+  }
+
+  // Parse cache-dir.
+  if (vm.count("cache-dir")) {
+    if (!o.alignment_based && !o.kmer)
+      throw po::error("--cache-dir is not needed except for alignment-based and kmer scores.");
+    o.cache_dir = vm["cache-dir"].as<std::string>();
+    if (o.cache_dir == "")
+      throw po::error("Invalid value for --cache-dir: the directory name is empty.");
   }
 
   // Parse strand-specific.
@@ -219,6 +274,21 @@ void parse_options(opts& o, boost::program_options::variables_map& vm)
   else
     o.max_frac_indel = 0.01;
 
+  // Parse matching-algorithm.
+  if (o.contig || o.paper) {
+    if (vm.count("matching-algorithm")) {
+      o.matching_algorithm = vm["matching-algorithm"].as<std::string>();
+      if (o.matching_algorithm != "bipartite" && o.matching_algorithm != "lemon" &&
+          o.matching_algorithm != "greedy")
+        throw po::error("Invalid value for --matching-algorithm: " + o.matching_algorithm);
+    } else {
+      o.matching_algorithm = "bipartite";
+    }
+  } else {
+    if (vm.count("matching-algorithm"))
+      throw po::error("--matching-algorithm is not needed except for contig scores.");
+  }
+
   // Parse min segment length.
   if (vm.count("min-segment-len"))
     o.min_segment_len = vm["min-segment-len"].as<size_t>();
@@ -272,6 +342,12 @@ void parse_options(opts& o, boost::program_options::variables_map& vm)
   if (vm.count("trace")) {
     o.trace = vm["trace"].as<std::string>();
   }
+
+  // Parse profile and profile-json.
+  if (vm.count("profile"))
+    o.profile = true;
+  if (vm.count("profile-json"))
+    o.profile_json = vm["profile-json"].as<std::string>();
 }
 
 void print_help()
@@ -279,6 +355,206 @@ void print_help()
   std::cout << get_help_string() << std::endl;
 }
 
+// Computes the scores that o asks for, and writes them to *o.out. If ref is
+// given, it is the reference named by o.B_seqs, already loaded; B's
+// expression is also taken from it if it was read from o.B_expr.
+void evaluate(const opts& o, const reference *ref)
+{
+  if (o.cache_dir != "")
+    re::make_stage_cache_dir(o.cache_dir);
+
+  std::cerr << "Reading the sequences..." << std::endl;
+  fasta A, B_own;
+  {
+    profile_stage stage("read sequences");
+    read_fasta(A, o.A_seqs);
+    if (!ref)
+      read_fasta(B_own, o.B_seqs);
+    stage.set_items(A.seqs.total_length() + B_own.seqs.total_length(), "bases");
+  }
+  const fasta& B = ref ? ref->B : B_own;
+
+  bool need_tau_B = o.weighted || o.kc || o.paper;
+  bool served_tau_B = need_tau_B && ref && ref->expr_filename != "" &&
+                      canonical_path(o.B_expr) == ref->expr_filename;
+  expr tau_A, B_own_tau;
+  if (o.weighted) {
+    std::cerr << "Reading the expression..." << std::endl;
+    profile_stage stage("read expression");
+    tau_A.resize(A.card);
+    read_rsem_expr(tau_A, o.A_expr, A);
+    if (!served_tau_B) {
+      B_own_tau.resize(B.card);
+      read_rsem_expr(B_own_tau, o.B_expr, B);
+    }
+    stage.set_items(A.card + B.card, "sequences");
+  } else if ((o.kc || o.paper) && !served_tau_B) {
+    std::cerr << "Reading the expression..." << std::endl;
+    profile_stage stage("read expression");
+    B_own_tau.resize(B.card);
+    read_rsem_expr(B_own_tau, o.B_expr, B);
+    stage.set_items(B.card, "sequences");
+  }
+  const expr& tau_B = served_tau_B ? ref->tau_B : B_own_tau;
+
+  // The expression under each expression profile, for the kmer and kc scores;
+  // profile 0 is tau_A and tau_B.
+  size_t num_profiles = num_expr_profiles(o);
+  std::vector<expr> more_tau_A(o.more_A_expr.size()), more_tau_B(o.more_B_expr.size());
+  std::vector<const expr *> taus_A(num_profiles, &tau_A), taus_B(num_profiles, &tau_B);
+  if (num_profiles > 1) {
+    std::cerr << "Reading the expression of the other " << num_profiles - 1 << " profiles..." << std::endl;
+    profile_stage stage("read expression");
+    for (size_t i = 0; i < more_tau_A.size(); ++i) {
+      more_tau_A[i].resize(A.card);
+      read_rsem_expr(more_tau_A[i], o.more_A_expr[i], A);
+      taus_A[i + 1] = &more_tau_A[i];
+    }
+    for (size_t i = 0; i < more_tau_B.size(); ++i) {
+      more_tau_B[i].resize(B.card);
+      read_rsem_expr(more_tau_B[i], o.more_B_expr[i], B);
+      taus_B[i + 1] = &more_tau_B[i];
+    }
+    stage.set_items(more_tau_A.size() * A.card + more_tau_B.size() * B.card, "sequences");
+  }
+
+  expr unif_A, unif_B;
+  if (o.unweighted || o.paper) {
+    unif_A.assign(A.card, 1.0/A.card);
+    unif_B.assign(B.card, 1.0/B.card);
+  }
+
+  re::matched::alignment_set A_to_B, B_to_A;
+  re::matched::load_alignments(o, A, B, A_to_B, B_to_A, ref);
+
+  re::matched  ::main(o, A, B, tau_A, tau_B, unif_A, unif_B, A_to_B, B_to_A);
+  re::oomatched::main(o, A, B, tau_A, tau_B,                 A_to_B, B_to_A);
+  re::kc       ::main(o, A, B,         taus_B,                                ref);
+  re::kmer     ::main(o, A, B, taus_A, taus_B, unif_A, unif_B,                ref);
+}
+
+// Makes a relative path in a job absolute, by resolving it against the
+// client's working directory, dir.
+void resolve_path(std::string& path, const std::string& dir)
+{
+  if (path != "" && path[0] != '/')
+    path = dir + "/" + path;
+}
+
+// Runs the jobs sent to ref-eval --serve. Each job is given by the same
+// arguments as a plain ref-eval run, except that its --B-seqs must name one
+// of the served references.
+struct job_runner
+{
+  const std::vector<reference>& refs;
+
+  job_runner(const std::vector<reference>& refs) : refs(refs) {}
+
+  void operator()(const std::vector<std::string>& args, const std::string& dir, std::ostream& out) const
+  {
+    namespace po = boost::program_options;
+    po::variables_map vm;
+    po::store(po::command_line_parser(args).options(describe_options()).run(), vm);
+
+    const char *server_only[] = { "help", "serve", "serve-reference", "serve-workers", "connect", "profile", "profile-json", "simd" };
+    BOOST_FOREACH(const char *name, server_only)
+      if (vm.count(name))
+        throw po::error(std::string("--") + name + " can't be used in a job sent to ref-eval --serve.");
+
+    opts o;
+    parse_options(o, vm);
+    notify(vm);
+    resolve_path(o.A_seqs, dir);
+    resolve_path(o.B_seqs, dir);
+    resolve_path(o.A_expr, dir);
+    resolve_path(o.B_expr, dir);
+    BOOST_FOREACH(std::string& path, o.more_A_expr)
+      resolve_path(path, dir);
+    BOOST_FOREACH(std::string& path, o.more_B_expr)
+      resolve_path(path, dir);
+    resolve_path(o.A_to_B, dir);
+    resolve_path(o.B_to_A, dir);
+    resolve_path(o.trace,  dir);
+    resolve_path(o.cache_dir, dir);
+
+    std::string B_seqs = canonical_path(o.B_seqs);
+    const reference *ref = NULL;
+    BOOST_FOREACH(const reference& r, refs)
+      if (B_seqs != "" && r.seqs_filename == B_seqs)
+        ref = &r;
+    if (!ref)
+      throw std::runtime_error("--B-seqs " + o.B_seqs + " is not one of the references being served.");
+
+    o.out = &out;
+    evaluate(o, ref);
+  }
+};
+
+// Loads the references given by --serve-reference and serves jobs for them on
+// the socket given by --serve.
+void serve_main(const boost::program_options::variables_map& vm)
+{
+  namespace po = boost::program_options;
+
+  for (po::variables_map::const_iterator it = vm.begin(); it != vm.end(); ++it)
+    if (it->first != "serve" && it->first != "serve-reference" && it->first != "serve-workers" &&
+        it->first != "simd")
+      throw po::error("--" + it->first + " can't be used with --serve. Give it with each job instead.");
+  if (!vm.count("serve-reference"))
+    throw po::error("--serve-reference is required with --serve.");
+  std::string socket_path = vm["serve"].as<std::string>();
+  size_t num_workers = 2;
+  if (vm.count("serve-workers")) {
+    num_workers = vm["serve-workers"].as<size_t>();
+    if (num_workers == 0)
+      throw po::error("Invalid value for --serve-workers: it should be positive.");
+  }
+
+  const std::vector<std::string>& specs = vm["serve-reference"].as<std::vector<std::string> >();
+  std::vector<reference> refs(specs.size());
+  for (size_t i = 0; i < specs.size(); ++i) {
+    size_t comma = specs[i].find(',');
+    if (comma == std::string::npos)
+      load_reference(refs[i], specs[i], "");
+    else
+      load_reference(refs[i], specs[i].substr(0, comma), specs[i].substr(comma + 1));
+  }
+
+  int fd = serve::listen_on(socket_path);
+  std::cerr << curtime() << "Serving " << refs.size() << " reference(s) on " << socket_path
+            << " with " << num_workers << " worker(s)." << std::endl;
+  job_runner runner(refs);
+  serve::run(fd, num_workers, runner);
+}
+
+// Sends the rest of the command line to the server given by --connect as a
+// job, and prints the result.
+int connect_main(const std::string& socket_path, int argc, const char **argv)
+{
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--connect")
+      ++i;
+    else if (arg.compare(0, 10, "--connect=") != 0)
+      args.push_back(arg);
+  }
+
+  char *cwd = getcwd(NULL, 0);
+  if (cwd == NULL)
+    throw std::runtime_error("Can't get the current directory.");
+  std::string dir(cwd);
+  free(cwd);
+
+  std::string output;
+  if (!serve::request(output, socket_path, dir, args)) {
+    std::cerr << argv[0] << ": Error: " << output << std::endl;
+    return 1;
+  }
+  std::cout << output << std::flush;
+  return 0;
+}
+
 int main(int argc, const char **argv)
 {
   try {
@@ -295,41 +571,45 @@ int main(int argc, const char **argv)
       exit(0);
     }
 
+    if (vm.count("connect"))
+      return connect_main(vm["connect"].as<std::string>(), argc, argv);
+
+    // Parse simd. It applies to the whole process, so it is handled here
+    // rather than in parse_options, and a server takes it from its own
+    // command line rather than from its jobs.
+    if (vm.count("simd")) {
+      std::string name = vm["simd"].as<std::string>();
+      if (name != "auto" && name != "avx2" && name != "sse2" && name != "none")
+        throw po::error("Invalid value for --simd: " + name);
+      set_simd_level(parse_simd_level(name));
+    }
+
+    if (vm.count("serve")) {
+      serve_main(vm);
+      return 0;
+    }
+
     opts o;
     parse_options(o, vm);
     notify(vm);
 
-    std::cerr << "Reading the sequences..." << std::endl;
-    fasta A, B;
-    read_fasta(A, o.A_seqs);
-    read_fasta(B, o.B_seqs);
-
-    expr tau_A, tau_B;
-    if (o.weighted) {
-      std::cerr << "Reading the expression..." << std::endl;
-      tau_A.resize(A.card);
-      tau_B.resize(B.card);
-      read_rsem_expr(tau_A, o.A_expr, A);
-      read_rsem_expr(tau_B, o.B_expr, B);
-    } else if (o.kc || o.paper) {
-      std::cerr << "Reading the expression..." << std::endl;
-      tau_B.resize(B.card);
-      read_rsem_expr(tau_B, o.B_expr, B);
-    }
+    global_profiler().enabled = o.profile || o.profile_json != "";
+    profile_stage total_stage("total");
 
-    expr unif_A, unif_B;
-    if (o.unweighted || o.paper) {
-      unif_A.assign(A.card, 1.0/A.card);
-      unif_B.assign(B.card, 1.0/B.card);
-    }
-
-    re::matched  ::main(o, A, B, tau_A, tau_B, unif_A, unif_B);
-    re::oomatched::main(o, A, B, tau_A, tau_B);
-    re::kc       ::main(o, A, B,        tau_B);
-    re::kmer     ::main(o, A, B, tau_A, tau_B, unif_A, unif_B);
+    evaluate(o, NULL);
 
     std::cerr << "Done computing all scores." << std::endl;
 
+    total_stage.finish();
+    if (o.profile)
+      global_profiler().print_table(std::cerr);
+    if (o.profile_json != "") {
+      std::ofstream ofs(o.profile_json.c_str());
+      global_profiler().write_json(ofs);
+      if (!ofs)
+        throw std::runtime_error("Can't write " + o.profile_json + ".");
+    }
+
   } catch (const boost::program_options::error& x) {
 
     std::cerr << std::endl;
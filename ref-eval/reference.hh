@@ -0,0 +1,96 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <stdint.h>
+#include "alignment_cache.hh"
+#include "expr.hh"
+#include "fasta.hh"
+#include "packed_seqs.hh"
+#include "util.hh"
+
+// A reference (the B side of an evaluation), together with everything that
+// the scores derive from it alone: the reverse complements of its sequences
+// (used by the kmer and kc scores), its packed sequences (used by the kmer
+// scores), and its checksum (used by the alignment cache).
+//
+// A plain ref-eval run doesn't build one, and each score derives what it
+// needs from B by itself. ref-eval --serve builds one per served reference
+// when it starts, and shares it, read-only, among all the jobs that use that
+// reference; the scores take the derived data from it instead.
+struct reference
+{
+  // Canonical paths (see canonical_path) of the files the reference was read
+  // from. expr_filename is empty if no expression was read.
+  std::string seqs_filename;
+  std::string expr_filename;
+
+  fasta B;
+  expr tau_B;
+  seq_arena B_rc;
+  packed_seqs B_packed;  // empty unless B_packable
+  bool B_packable;       // whether B contains only ACGTN
+  uint64_t B_checksum;
+
+  reference() : B_packable(false), B_checksum(0) {}
+};
+
+// Returns the absolute path of filename with all symbolic links, "." and
+// ".." components resolved, or the empty string if filename doesn't exist.
+std::string canonical_path(const std::string& filename)
+{
+  char *p = realpath(filename.c_str(), NULL);
+  if (p == NULL)
+    return "";
+  std::string path(p);
+  free(p);
+  return path;
+}
+
+// Reads the reference from seqs_filename (and its expression from
+// expr_filename, unless that is empty), and derives the rest.
+void load_reference(reference& ref,
+                    const std::string& seqs_filename,
+                    const std::string& expr_filename)
+{
+  std::cerr << curtime() << "Reading the reference " << seqs_filename << "..." << std::endl;
+  ref.seqs_filename = canonical_path(seqs_filename);
+  if (ref.seqs_filename == "")
+    throw std::runtime_error("Can't open " + seqs_filename + ".");
+  read_fasta(ref.B, seqs_filename);
+
+  if (expr_filename != "") {
+    ref.expr_filename = canonical_path(expr_filename);
+    if (ref.expr_filename == "")
+      throw std::runtime_error("Can't open " + expr_filename + ".");
+    ref.tau_B.resize(ref.B.card);
+    read_rsem_expr(ref.tau_B, expr_filename, ref.B);
+  }
+
+  reverse_complement(ref.B_rc, ref.B.seqs);
+  ref.B_packed.assign(ref.B.seqs);
+  ref.B_packable = ref.B_packed.only_N_exceptions();
+  if (!ref.B_packable)
+    ref.B_packed = packed_seqs();
+  ref.B_checksum = re::matched::checksum_seqs(ref.B.names, ref.B.seqs);
+}
@@ -0,0 +1,657 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include "lazycsv.hh"
+#include "small_vector.hh"
+#include "string_ref.hh"
+#include "name_index.hh"
+#include "alignment_segment.hh"
+#include "mismatch.hh"
+
+namespace detail
+{
+  class sam_alignment_input_stream;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// sam_alignment represents a single SAM or BAM alignment record. It realizes
+// the Alignment concept. The query (QNAME) is a and the reference (RNAME) is
+// b, so for --A-to-B the contigs should be the reads and the reference
+// transcripts the reference sequences.
+////////////////////////////////////////////////////////////////////////////
+
+class sam_alignment
+{
+public:
+  // CIGAR operations are stored as in BAM files: the length in the upper 28
+  // bits and the index of the operation in "MIDNSHP=X" in the lower 4 bits.
+  typedef small_vector<uint32_t, 16> cigar_list;
+  enum { CIGAR_M = 0, CIGAR_I, CIGAR_D, CIGAR_N, CIGAR_S, CIGAR_H, CIGAR_P, CIGAR_EQ, CIGAR_X };
+
+  //
+  // Realization of the Alignment concept.
+  //
+
+  void parse_line(const std::string& line); // defined below
+  std::string a_name()              const { return qname_; }
+  std::string b_name()              const { return rname_; }
+  string_ref  a_name_ref()          const { return qname_; }
+  string_ref  b_name_ref()          const { return rname_; }
+  double      frac_identity_wrt_a() const { return 1.0 * num_identity() / q_size(); }
+  double      frac_identity_wrt_b() const { return 1.0 * num_identity() / t_size(); }
+  double      num_identity_wrt_a()  const { return       num_identity()           ; }
+  double      num_identity_wrt_b()  const { return       num_identity()           ; }
+  double      frac_indel_wrt_a()    const { return 1.0 * q_base_insert() / q_size(); }
+  double      frac_indel_wrt_b()    const { return 1.0 * t_base_insert() / t_size(); }
+  int         num_indel_wrt_a()     const { return       q_base_insert()           ; }
+  int         num_indel_wrt_b()     const { return       t_base_insert()           ; }
+  typedef detail::sam_alignment_input_stream input_stream_type;
+  typedef std::vector<alignment_segment>     segments_type;
+  segments_type segments(string_ref a, string_ref b) const; // defined below
+
+  inline bool is_on_valid_strand(bool strand_specific) const
+  {
+    return !strand_specific || !is_rc();
+  }
+
+  //
+  // Not part of the Alignment concept, but rather for use by sam-specific
+  // algorithms.
+  //
+
+  // Notes:
+  // - pos is 0-based, unlike the POS column of a SAM file.
+  // - q_size is the length of the query implied by the CIGAR string,
+  //   including clipped bases; t_size is the length of the reference, from
+  //   the header, and is only known for records read by an input stream.
+  // - md is empty and nm is -1 if the record has no MD or NM tag.
+  // - The number of mismatches is taken from the X operations if the CIGAR
+  //   string uses =/X, else from the MD tag, else from the NM tag (minus the
+  //   indels), and is 0 if the record has none of these.
+
+  int               flag         () const { return flag_; }
+  int               pos          () const { return pos_; }
+  const cigar_list& cigar        () const { return cigar_; }
+  const std::string& md          () const { return md_; }
+  int               nm           () const { return nm_; }
+  int               q_size       () const { return q_size_; }
+  int               t_size       () const { return t_size_; }
+  int               q_base_insert() const { return q_base_insert_; } // I bases
+  int               t_base_insert() const { return t_base_insert_; } // D and N bases
+  int               num_aligned  () const { return num_aligned_; }   // M, =, and X bases
+  int               num_identity () const { return num_aligned_ - num_mismatches_; }
+
+  bool is_rc      () const { return (flag_ & 0x10) != 0; }
+  bool is_unmapped() const { return (flag_ & 0x4) != 0 || cigar_.empty(); }
+
+  static inline int cigar_op (uint32_t c) { return c & 0xf; }
+  static inline int cigar_len(uint32_t c) { return c >> 4; }
+
+  // Parses a BAM alignment record (everything after its block_size field).
+  void parse_bam_record(const char *data, size_t size,
+                        const std::vector<std::string>& ref_names,
+                        const std::vector<int>& ref_lengths); // defined below
+
+private:
+  friend class detail::sam_alignment_input_stream;
+
+  std::string qname_, rname_, md_;
+  int         flag_, pos_, nm_, t_size_;
+  cigar_list  cigar_;
+
+  // Summaries of the CIGAR string and tags, computed by summarize().
+  int q_size_, q_base_insert_, t_base_insert_, num_aligned_, num_mismatches_;
+  bool has_eqx_;
+
+  void summarize(); // defined below
+  void parse_cigar(const char *beg, const char *end);
+  void md_mismatches(std::vector<size_t>& b_positions) const;
+};
+
+namespace detail
+{
+  inline bool is_n(char c) { return c == 'N' || c == 'n'; }
+
+  // Returns whether the len bases from s include an N, which find_mismatches()
+  // counts as a mismatch whatever it is aligned to.
+  inline bool contains_n(const char *s, size_t len)
+  {
+    return std::memchr(s, 'N', len) != NULL || std::memchr(s, 'n', len) != NULL;
+  }
+
+  inline int32_t bam_int32(const char *p)
+  {
+    int32_t x;
+    std::memcpy(&x, p, sizeof(x)); // BAM is little endian, as is every host we build on
+    return x;
+  }
+
+  inline uint16_t bam_uint16(const char *p)
+  {
+    uint16_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return x;
+  }
+
+  // Returns the size of one value of the given BAM tag type, or 0 if the type
+  // is not fixed-size.
+  inline size_t bam_tag_value_size(char type)
+  {
+    switch (type) {
+      case 'A': case 'c': case 'C': return 1;
+      case 's': case 'S':           return 2;
+      case 'i': case 'I': case 'f': return 4;
+      default:                      return 0;
+    }
+  }
+
+  // Reads a BAM integer tag value of the given type.
+  inline int bam_tag_int(char type, const char *p)
+  {
+    switch (type) {
+      case 'c': return static_cast<int8_t>(*p);
+      case 'C': return static_cast<uint8_t>(*p);
+      case 's': { int16_t x; std::memcpy(&x, p, 2); return x; }
+      case 'S': return bam_uint16(p);
+      case 'i': return bam_int32(p);
+      case 'I': { uint32_t x; std::memcpy(&x, p, 4); return static_cast<int>(x); }
+      default:  throw std::runtime_error(std::string("Invalid type for integer BAM tag: ") + type);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////////
+  // sam_alignment_input_stream is an input stream that produces sam_alignment
+  // objects, one per mapped record of a SAM or BAM file. Whether the input is
+  // SAM or BAM is detected from its (decompressed) contents, so BAM files,
+  // which are BGZF-compressed, are decoded by the multi-threaded BGZF reader
+  // behind open_or_throw. Unmapped records are skipped.
+  ////////////////////////////////////////////////////////////////////////////
+
+  class sam_alignment_input_stream
+  {
+  public:
+    sam_alignment_input_stream(boost::shared_ptr<std::istream> is)
+    : is(is), is_bam(false), good(true)
+    {
+      read_header();
+    }
+
+    sam_alignment_input_stream& operator>>(sam_alignment& al)
+    {
+      do {
+        if (!(is_bam ? read_bam_record(al) : read_sam_record(al))) {
+          good = false;
+          return *this;
+        }
+      } while (al.is_unmapped());
+      return *this;
+    }
+
+    inline operator bool() { return good; }
+
+  private:
+    boost::shared_ptr<std::istream> is;
+    bool                            is_bam;
+    bool                            good;
+    std::string                     line;         // SAM: the current line
+    bool                            have_line;    // SAM: line holds a line not yet parsed
+    std::vector<char>               buf;          // BAM: the current record
+    std::vector<std::string>        ref_names;
+    std::vector<int>                ref_lengths;
+    name_index                      ref_idxs;     // SAM: maps ref_names to their indices
+
+    void read_header()
+    {
+      // A BAM file starts with "BAM\1". A SAM file starts with a header line,
+      // which starts with '@', or with a record, whose first line has at least
+      // eleven fields, so if the first four bytes are not "BAM\1", they are
+      // the start of the first line.
+      if (is->peek() == 'B') {
+        char magic[4];
+        is->read(magic, 4);
+        std::string prefix(magic, is->gcount());
+        if (prefix == std::string("BAM\1", 4)) {
+          is_bam = true;
+          read_bam_header();
+          return;
+        }
+        if (prefix.find('\n') != std::string::npos)
+          throw std::runtime_error("Invalid SAM file.");
+        have_line = getline(*is, line) || !prefix.empty();
+        line.insert(0, prefix);
+      } else {
+        have_line = static_cast<bool>(getline(*is, line));
+      }
+      read_sam_header();
+    }
+
+    bool next_line()
+    {
+      return static_cast<bool>(getline(*is, line));
+    }
+
+    void read_sam_header()
+    {
+      while (have_line && !line.empty() && line[0] == '@') {
+        if (line.compare(0, 4, "@SQ\t") == 0) {
+          std::string name;
+          int length = -1;
+          std::istringstream iss(line.substr(4));
+          std::string field;
+          while (getline(iss, field, '\t')) {
+            if (field.compare(0, 3, "SN:") == 0)
+              name = field.substr(3);
+            else if (field.compare(0, 3, "LN:") == 0)
+              length = parse_integer<int>(field.data() + 3, field.data() + field.size());
+          }
+          if (name.empty() || length < 0)
+            throw std::runtime_error("Invalid @SQ header line: '" + line + "'");
+          add_ref(name, length);
+        }
+        have_line = next_line();
+      }
+    }
+
+    bool read_sam_record(sam_alignment& al)
+    {
+      while (have_line && line.empty())
+        have_line = next_line();
+      if (!have_line)
+        return false;
+      al.parse_line(line);
+      have_line = next_line();
+      if (!al.is_unmapped()) {
+        size_t idx = ref_idxs.find(al.rname_);
+        if (idx == name_index::npos)
+          throw std::runtime_error("Reference sequence " + al.rname_ + " is not in the SAM header.");
+        al.t_size_ = ref_lengths[idx];
+      }
+      return true;
+    }
+
+    void add_ref(const std::string& name, int length)
+    {
+      if (!ref_idxs.insert(name))
+        throw std::runtime_error("Duplicate reference sequence " + name + " in the header.");
+      ref_names.push_back(name);
+      ref_lengths.push_back(length);
+    }
+
+    void read_bytes(char *p, size_t n)
+    {
+      is->read(p, n);
+      if (static_cast<size_t>(is->gcount()) != n)
+        throw std::runtime_error("Truncated BAM file.");
+    }
+
+    int32_t read_int32()
+    {
+      char p[4];
+      read_bytes(p, 4);
+      return bam_int32(p);
+    }
+
+    void read_bam_header()
+    {
+      int32_t l_text = read_int32();
+      if (l_text < 0)
+        throw std::runtime_error("Invalid BAM header.");
+      buf.resize(l_text + 1);
+      read_bytes(&buf[0], l_text);
+      int32_t n_ref = read_int32();
+      if (n_ref < 0)
+        throw std::runtime_error("Invalid BAM header.");
+      for (int32_t i = 0; i < n_ref; ++i) {
+        int32_t l_name = read_int32();
+        if (l_name <= 0)
+          throw std::runtime_error("Invalid BAM header.");
+        buf.resize(l_name);
+        read_bytes(&buf[0], l_name);
+        std::string name(&buf[0], l_name - 1); // excluding the trailing NUL
+        add_ref(name, read_int32());
+      }
+    }
+
+    bool read_bam_record(sam_alignment& al)
+    {
+      char p[4];
+      is->read(p, 4);
+      if (is->gcount() == 0)
+        return false;
+      if (is->gcount() != 4)
+        throw std::runtime_error("Truncated BAM file.");
+      int32_t block_size = bam_int32(p);
+      if (block_size < 32)
+        throw std::runtime_error("Invalid BAM record.");
+      buf.resize(block_size);
+      read_bytes(&buf[0], block_size);
+      al.parse_bam_record(&buf[0], block_size, ref_names, ref_lengths);
+      return true;
+    }
+  };
+} // namespace detail
+
+void sam_alignment::parse_cigar(const char *beg, const char *end)
+{
+  static const char ops[] = "MIDNSHP=X";
+  cigar_.clear();
+  if (end - beg == 1 && *beg == '*')
+    return;
+  const char *i = beg;
+  while (i != end) {
+    const char *j = i;
+    for (; j != end && *j >= '0' && *j <= '9'; ++j) {}
+    const char *op = (j == end) ? NULL : static_cast<const char *>(std::memchr(ops, *j, 9));
+    if (j == i || op == NULL)
+      throw std::runtime_error("Invalid CIGAR string: '" + std::string(beg, end) + "'");
+    uint32_t len = parse_integer<uint32_t>(i, j);
+    cigar_.push_back(len << 4 | static_cast<uint32_t>(op - ops));
+    i = j + 1;
+  }
+}
+
+void sam_alignment::parse_line(const std::string& line)
+{
+  // Split the line into fields.
+  small_vector<const char *, 16> starts;
+  const char *beg = line.data(), *end = line.data() + line.size();
+  starts.push_back(beg);
+  for (const char *p = beg; p != end; ++p)
+    if (*p == '\t')
+      starts.push_back(p + 1);
+  starts.push_back(end + 1); // to imitate a trailing tab
+  size_t num_fields = starts.size() - 1;
+  if (num_fields < 11)
+    throw std::runtime_error("Invalid number of fields in line: '" + line + "'");
+  #define SAM_FIELD(i) starts[i], starts[(i)+1] - 1
+
+  qname_.assign(SAM_FIELD(0));
+  flag_ = parse_integer<int>(SAM_FIELD(1));
+  rname_.assign(SAM_FIELD(2));
+  pos_ = parse_integer<int>(SAM_FIELD(3)) - 1;
+  parse_cigar(SAM_FIELD(5));
+
+  // Look for the MD and NM tags.
+  md_.clear();
+  nm_ = -1;
+  for (size_t i = 11; i < num_fields; ++i) {
+    const char *b = starts[i], *e = starts[i+1] - 1;
+    if (e - b >= 5 && std::memcmp(b, "MD:Z:", 5) == 0)
+      md_.assign(b + 5, e);
+    else if (e - b >= 5 && std::memcmp(b, "NM:i:", 5) == 0)
+      nm_ = parse_integer<int>(b + 5, e);
+  }
+  #undef SAM_FIELD
+
+  t_size_ = 0;
+  summarize();
+}
+
+void sam_alignment::parse_bam_record(const char *data, size_t size,
+                                     const std::vector<std::string>& ref_names,
+                                     const std::vector<int>& ref_lengths)
+{
+  using namespace detail;
+  const char *end = data + size;
+  int32_t  ref_id      = bam_int32 (data +  0);
+  int32_t  pos         = bam_int32 (data +  4);
+  uint8_t  l_read_name = static_cast<uint8_t>(data[8]);
+  uint16_t n_cigar_op  = bam_uint16(data + 12);
+  uint16_t flag        = bam_uint16(data + 14);
+  int32_t  l_seq       = bam_int32 (data + 16);
+  const char *p = data + 32;
+  if (l_read_name == 0 || l_seq < 0 ||
+      static_cast<size_t>(end - p) < l_read_name + 4ul * n_cigar_op + (l_seq + 1) / 2 + l_seq)
+    throw std::runtime_error("Invalid BAM record.");
+
+  qname_.assign(p, l_read_name - 1); // excluding the trailing NUL
+  p += l_read_name;
+  flag_ = flag;
+  pos_  = pos;
+  cigar_.clear();
+  for (uint16_t i = 0; i < n_cigar_op; ++i, p += 4) {
+    uint32_t c;
+    std::memcpy(&c, p, 4);
+    cigar_.push_back(c);
+  }
+  p += (l_seq + 1) / 2 + l_seq; // skip seq and qual
+
+  if (ref_id >= 0) {
+    if (static_cast<size_t>(ref_id) >= ref_names.size())
+      throw std::runtime_error("Invalid reference id in BAM record.");
+    rname_.assign(ref_names[ref_id]);
+    t_size_ = ref_lengths[ref_id];
+  } else {
+    rname_ = "*";
+    t_size_ = 0;
+    cigar_.clear(); // unmapped
+  }
+
+  // Look for the MD and NM tags.
+  md_.clear();
+  nm_ = -1;
+  while (end - p >= 3) {
+    char tag0 = p[0], tag1 = p[1], type = p[2];
+    p += 3;
+    if (type == 'Z' || type == 'H') {
+      const char *nul = static_cast<const char *>(std::memchr(p, '\0', end - p));
+      if (nul == NULL)
+        throw std::runtime_error("Invalid BAM record.");
+      if (tag0 == 'M' && tag1 == 'D' && type == 'Z')
+        md_.assign(p, nul);
+      p = nul + 1;
+    } else if (type == 'B') {
+      if (end - p < 5)
+        throw std::runtime_error("Invalid BAM record.");
+      size_t value_size = bam_tag_value_size(p[0]);
+      int32_t count = bam_int32(p + 1);
+      if (value_size == 0 || count < 0 ||
+          static_cast<size_t>(count) > static_cast<size_t>(end - p - 5) / value_size)
+        throw std::runtime_error("Invalid BAM record.");
+      p += 5 + value_size * count;
+    } else {
+      size_t n = bam_tag_value_size(type);
+      if (n == 0 || static_cast<size_t>(end - p) < n)
+        throw std::runtime_error("Invalid BAM record.");
+      if (tag0 == 'N' && tag1 == 'M' && type != 'A' && type != 'f')
+        nm_ = bam_tag_int(type, p);
+      p += n;
+    }
+  }
+
+  summarize();
+}
+
+void sam_alignment::summarize()
+{
+  q_size_ = q_base_insert_ = t_base_insert_ = num_aligned_ = 0;
+  has_eqx_ = false;
+  int num_x = 0, num_d = 0;
+  for (const uint32_t *c = cigar_.begin(); c != cigar_.end(); ++c) {
+    int len = cigar_len(*c);
+    switch (cigar_op(*c)) {
+      case CIGAR_M:                    q_size_ += len; num_aligned_ += len; break;
+      case CIGAR_EQ: has_eqx_ = true;  q_size_ += len; num_aligned_ += len; break;
+      case CIGAR_X:  has_eqx_ = true;  q_size_ += len; num_aligned_ += len; num_x += len; break;
+      case CIGAR_I:                    q_size_ += len; q_base_insert_ += len; break;
+      case CIGAR_S: case CIGAR_H:      q_size_ += len; break;
+      case CIGAR_D:                    t_base_insert_ += len; num_d += len; break;
+      case CIGAR_N:                    t_base_insert_ += len; break;
+      default:                         break;
+    }
+  }
+
+  if (has_eqx_) {
+    num_mismatches_ = num_x;
+  } else if (!md_.empty()) {
+    // Count the mismatched bases, i.e., the letters not preceded by '^'.
+    num_mismatches_ = 0;
+    bool in_deletion = false;
+    for (std::string::const_iterator it = md_.begin(); it != md_.end(); ++it) {
+      if (*it == '^')
+        in_deletion = true;
+      else if (*it >= '0' && *it <= '9')
+        in_deletion = false;
+      else if (!in_deletion)
+        ++num_mismatches_;
+    }
+  } else if (nm_ >= 0) {
+    num_mismatches_ = std::max(0, nm_ - q_base_insert_ - num_d);
+  } else {
+    num_mismatches_ = 0;
+  }
+}
+
+// Appends to b_positions, in increasing order, the reference positions of the
+// mismatches recorded in the MD tag.
+void sam_alignment::md_mismatches(std::vector<size_t>& b_positions) const
+{
+  // The MD tag walks over the reference positions of the M, =, X, and D
+  // operations, in order. To map an offset k into that walk to a reference
+  // position, we advance through the CIGAR string, keeping the offset (md_base)
+  // and reference position (b_base) at which the current operation starts.
+  const uint32_t *c = cigar_.begin(), *c_end = cigar_.end();
+  size_t md_base = 0, b_base = pos_, k = 0;
+  const char *p = md_.data(), *end = md_.data() + md_.size();
+  while (p != end) {
+    if (*p >= '0' && *p <= '9') {
+      const char *q = p;
+      for (; q != end && *q >= '0' && *q <= '9'; ++q) {}
+      k += parse_integer<size_t>(p, q);
+      p = q;
+    } else if (*p == '^') {
+      for (++p; p != end && !(*p >= '0' && *p <= '9'); ++p)
+        ++k;
+    } else {
+      // A mismatch at offset k.
+      for (;;) {
+        if (c == c_end)
+          throw std::runtime_error("MD tag " + md_ + " does not match the CIGAR string.");
+        int op = cigar_op(*c), len = cigar_len(*c);
+        bool in_md = (op == CIGAR_M || op == CIGAR_EQ || op == CIGAR_X || op == CIGAR_D);
+        if (in_md && k < md_base + len) {
+          if (op == CIGAR_D)
+            throw std::runtime_error("MD tag " + md_ + " does not match the CIGAR string.");
+          break;
+        }
+        if (in_md)
+          md_base += len;
+        if (in_md || op == CIGAR_N)
+          b_base += len;
+        ++c;
+      }
+      b_positions.push_back(b_base + (k - md_base));
+      ++k;
+      ++p;
+    }
+  }
+}
+
+sam_alignment::segments_type sam_alignment::segments(string_ref a, string_ref b) const
+{
+  if (static_cast<size_t>(q_size_) != a.size()) {
+    std::ostringstream oss;
+    oss << "The CIGAR string of " << qname_ << " implies a length of " << q_size_
+        << ", but the sequence has length " << a.size() << ".";
+    throw std::runtime_error(oss.str());
+  }
+
+  std::vector<size_t> md_positions;
+  bool use_md = !has_eqx_ && !md_.empty();
+  if (use_md)
+    md_mismatches(md_positions);
+  std::vector<size_t>::const_iterator md_it = md_positions.begin();
+
+  segments_type segs;
+  bool rc = is_rc();
+  size_t q = 0, t = pos_; // position in the (possibly reverse complemented) query, and in b
+  bool in_segment = false;
+  for (const uint32_t *c = cigar_.begin(); c != cigar_.end(); ++c) {
+    int op = cigar_op(*c);
+    size_t len = cigar_len(*c);
+    if (op == CIGAR_M || op == CIGAR_EQ || op == CIGAR_X) {
+      if (t + len > b.size()) {
+        std::ostringstream oss;
+        oss << "The alignment of " << qname_ << " extends past the end of " << rname_ << ".";
+        throw std::runtime_error(oss.str());
+      }
+      // Adjacent M, =, and X operations make up one segment.
+      size_t a_pos = rc ? (a.size() - 1) - q : q;
+      if (!in_segment) {
+        segs.push_back(alignment_segment());
+        segs.back().a_start = a_pos;
+        segs.back().b_start = t;
+        in_segment = true;
+      }
+      alignment_segment& seg = segs.back();
+      seg.a_end = rc ? a_pos - (len - 1) : a_pos + (len - 1);
+      seg.b_end = t + (len - 1);
+      if (op == CIGAR_X) {
+        for (size_t j = 0; j < len; ++j) {
+          seg.a_mismatches.push_back(rc ? a_pos - j : a_pos + j);
+          seg.b_mismatches.push_back(t + j);
+        }
+      } else if (op == CIGAR_EQ || (op == CIGAR_M && use_md)) {
+        // The mismatches recorded by the aligner, plus the positions where
+        // either base is an N, which find_mismatches() also counts, so that
+        // every alignment format gives the same mismatches.
+        const char *a_first = a.data() + (rc ? a_pos - (len - 1) : a_pos);
+        bool any_n = detail::contains_n(a_first, len) || detail::contains_n(b.data() + t, len);
+        for (size_t j = 0; ; ++j) {
+          size_t next_md = len;
+          if (op == CIGAR_M && md_it != md_positions.end() && *md_it < t + len)
+            next_md = *md_it - t;
+          for (; any_n && j < next_md; ++j) {
+            size_t a_j = rc ? a_pos - j : a_pos + j;
+            if (detail::is_n(a[a_j]) || detail::is_n(b[t + j])) {
+              seg.a_mismatches.push_back(a_j);
+              seg.b_mismatches.push_back(t + j);
+            }
+          }
+          if (next_md == len)
+            break;
+          j = next_md;
+          seg.a_mismatches.push_back(rc ? a_pos - j : a_pos + j);
+          seg.b_mismatches.push_back(t + j);
+          ++md_it;
+        }
+      } else if (op == CIGAR_M) {
+        find_mismatches(a.data(), a_pos, rc, b.data(), t, len, seg.a_mismatches, seg.b_mismatches);
+      }
+      q += len;
+      t += len;
+    } else {
+      in_segment = false;
+      if (op == CIGAR_I || op == CIGAR_S || op == CIGAR_H)
+        q += len;
+      else if (op == CIGAR_D || op == CIGAR_N)
+        t += len;
+    }
+  }
+  return segs;
+}
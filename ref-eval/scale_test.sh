@@ -0,0 +1,47 @@
+#!/bin/bash
+# Runs ref-eval over synthetic workloads of increasing size, made by
+# ref-eval-simulate, and saves ref-eval's --profile-json report (per-stage
+# wall and CPU time, and peak memory) for each size. Run by "make scale".
+#
+# Usage: ./scale_test.sh [NUM_FAMILIES...]
+#
+# The environment variables OUT_DIR (default: scale_test), SEED (default: 1),
+# and SCORES (default: nucl,pair,contig,kmer,kc) can be set to change what is
+# run.
+set -o nounset
+set -o pipefail
+set -o errexit
+
+sizes=${@:-"500 1000 2000 4000 8000"}
+out_dir=${OUT_DIR:-scale_test}
+seed=${SEED:-1}
+scores=${SCORES:-nucl,pair,contig,kmer,kc}
+
+# ref-eval rejects options that the chosen scores don't use.
+uses_alignments=no; uses_kmers=no; uses_reads=no
+case ,$scores, in *,nucl,*|*,pair,*|*,contig,*) uses_alignments=yes;; esac
+case ,$scores, in *,kmer,*|*,kc,*) uses_kmers=yes;; esac
+case ,$scores, in *,kc,*) uses_reads=yes;; esac
+
+mkdir -p $out_dir
+for n in $sizes; do
+  prefix=$out_dir/sim_$n
+  echo "=== $n families ==="
+  ./ref-eval-simulate --out-prefix $prefix --num-families $n --seed $seed
+  opts="--A-seqs $prefix.A.fa --B-seqs $prefix.B.fa --B-expr $prefix.B.expr"
+  if [ $scores != kc ]; then
+    opts="$opts --weighted=both --A-expr $prefix.A.expr"
+  fi
+  if [ $uses_alignments = yes ]; then
+    opts="$opts --A-to-B $prefix.A_to_B.psl --B-to-A $prefix.B_to_A.psl --min-frac-identity 0.9"
+  fi
+  if [ $uses_kmers = yes ]; then
+    opts="$opts --kmerlen 31"
+  fi
+  if [ $uses_reads = yes ]; then
+    opts="$opts --readlen 76 --num-reads 1000000"
+  fi
+  ./ref-eval --scores=$scores $opts \
+                  --profile-json $out_dir/profile_$n.json > $out_dir/scores_$n.txt
+done
+echo "Profiles are in $out_dir/profile_*.json"
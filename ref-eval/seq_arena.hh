@@ -0,0 +1,89 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cassert>
+#include <vector>
+#include "string_ref.hh"
+
+// A list of strings stored back to back in a single buffer, e.g., the
+// sequences or names of a FASTA file. Compared with a vector of std::strings,
+// this needs one allocation instead of one per string, and the strings of
+// neighbouring records are adjacent in memory.
+//
+// The strings can be filled in one at a time with push_back, or in bulk
+// (possibly in parallel) by calling allocate with their lengths and then
+// writing each one through data(i).
+class seq_arena
+{
+public:
+  seq_arena() : offsets(1, 0) {}
+
+  size_t size() const { return offsets.size() - 1; }
+  bool empty() const { return size() == 0; }
+
+  string_ref operator[](size_t i) const
+  {
+    assert(i < size());
+    return string_ref(base() + offsets[i], base() + offsets[i + 1]);
+  }
+
+  size_t length(size_t i) const { return offsets[i + 1] - offsets[i]; }
+
+  // The sum of the lengths of the strings.
+  size_t total_length() const { return offsets.back(); }
+
+  // All of the strings, one after another.
+  string_ref all() const { return string_ref(base(), base() + bytes.size()); }
+
+  // The offset of string i within all().
+  size_t offset(size_t i) const { return offsets[i]; }
+
+  void push_back(string_ref s)
+  {
+    bytes.insert(bytes.end(), s.beg, s.end);
+    offsets.push_back(bytes.size());
+  }
+
+  // Replaces the contents with lengths.size() strings of the given lengths,
+  // whose characters are left uninitialized until written through data(i).
+  void allocate(const std::vector<size_t>& lengths)
+  {
+    offsets.resize(lengths.size() + 1);
+    offsets[0] = 0;
+    for (size_t i = 0; i < lengths.size(); ++i)
+      offsets[i + 1] = offsets[i] + lengths[i];
+    bytes.resize(offsets.back());
+  }
+
+  char *data(size_t i) { return base() + offsets[i]; }
+
+  void clear()
+  {
+    bytes.clear();
+    offsets.assign(1, 0);
+  }
+
+private:
+  const char *base() const { return bytes.empty() ? NULL : &bytes[0]; }
+  char       *base()       { return bytes.empty() ? NULL : &bytes[0]; }
+
+  std::vector<char>   bytes;
+  std::vector<size_t> offsets; // string i is bytes[offsets[i], offsets[i+1])
+};
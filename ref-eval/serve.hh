@@ -0,0 +1,343 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <boost/foreach.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "util.hh"
+
+// A server that runs jobs sent to it over a Unix domain socket, on a pool of
+// worker threads, and the matching client. This is what ref-eval --serve and
+// --connect are built on; the jobs themselves are run by a handler, so that
+// this file knows nothing about ref-eval's options.
+//
+// The protocol is line-based. A request is the client's working directory,
+// followed by the job's arguments, one per line, followed by an empty line.
+// The response is "ok" followed by the job's output, or "error: " followed by
+// a one-line message; the server then closes the connection.
+
+namespace serve
+{
+  namespace detail
+  {
+    inline std::string errno_string()
+    {
+      return std::strerror(errno);
+    }
+
+    void write_all(int fd, const std::string& s)
+    {
+      const char *p = s.data();
+      size_t n = s.size();
+      while (n > 0) {
+        ssize_t k = write(fd, p, n);
+        if (k < 0 && errno == EINTR)
+          continue;
+        if (k <= 0)
+          throw std::runtime_error("Can't write to socket: " + errno_string());
+        p += k;
+        n -= k;
+      }
+    }
+
+    // Reads from fd until the end of the request (an empty line) or of the
+    // stream.
+    std::string read_request(int fd)
+    {
+      std::string s;
+      char buf[4096];
+      while (s.size() < 2 || s.compare(s.size() - 2, 2, "\n\n") != 0) {
+        ssize_t k = read(fd, buf, sizeof(buf));
+        if (k < 0 && errno == EINTR)
+          continue;
+        if (k < 0)
+          throw std::runtime_error("Can't read from socket: " + errno_string());
+        if (k == 0)
+          break;
+        s.append(buf, k);
+      }
+      return s;
+    }
+
+    std::string read_all(int fd)
+    {
+      std::string s;
+      char buf[65536];
+      for (;;) {
+        ssize_t k = read(fd, buf, sizeof(buf));
+        if (k < 0 && errno == EINTR)
+          continue;
+        if (k < 0)
+          throw std::runtime_error("Can't read from socket: " + errno_string());
+        if (k == 0)
+          return s;
+        s.append(buf, k);
+      }
+    }
+
+    void make_address(sockaddr_un& addr, const std::string& socket_path)
+    {
+      std::memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if (socket_path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Socket path " + socket_path + " is too long.");
+      std::strcpy(addr.sun_path, socket_path.c_str());
+    }
+
+  } // namespace detail
+
+  std::string format_request(const std::string& dir, const std::vector<std::string>& args)
+  {
+    std::string s = dir + "\n";
+    BOOST_FOREACH(const std::string& arg, args) {
+      if (arg.find('\n') != std::string::npos || arg.empty())
+        throw std::runtime_error("Arguments sent to the server can't be empty or contain newlines.");
+      s += arg + "\n";
+    }
+    return s + "\n";
+  }
+
+  // Splits a request into the working directory and the arguments.
+  void parse_request(std::string& dir, std::vector<std::string>& args, const std::string& request)
+  {
+    if (request.size() < 2 || request.compare(request.size() - 2, 2, "\n\n") != 0)
+      throw std::runtime_error("Incomplete request.");
+    std::istringstream ss(request);
+    std::string line;
+    getline(ss, dir);
+    if (dir.empty() || dir[0] != '/')
+      throw std::runtime_error("The request doesn't start with an absolute working directory.");
+    args.clear();
+    while (getline(ss, line) && !line.empty())
+      args.push_back(line);
+  }
+
+  // Creates a Unix domain socket at socket_path and starts listening on it.
+  // An existing socket at socket_path (e.g., left over from a server that was
+  // killed) is replaced; anything else there is an error.
+  int listen_on(const std::string& socket_path)
+  {
+    sockaddr_un addr;
+    detail::make_address(addr, socket_path);
+
+    struct stat st;
+    if (lstat(socket_path.c_str(), &st) == 0) {
+      if (!S_ISSOCK(st.st_mode))
+        throw std::runtime_error("Can't create socket " + socket_path + ": a file by that name exists.");
+      unlink(socket_path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      throw std::runtime_error("Can't create socket: " + detail::errno_string());
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+      std::string msg = detail::errno_string();
+      close(fd);
+      throw std::runtime_error("Can't listen on " + socket_path + ": " + msg);
+    }
+    return fd;
+  }
+
+  namespace detail
+  {
+    template<typename Handler>
+    struct worker_pool
+    {
+      Handler *handler;
+      size_t num_threads_per_job;
+      pthread_mutex_t mutex;
+      pthread_cond_t cond;
+      std::deque<std::pair<int, size_t> > queue; // (connection, job number)
+      bool done;
+    };
+
+    // Runs one job, and sends the response.
+    template<typename Handler>
+    void handle_connection(Handler& handler, int fd, size_t job)
+    {
+      std::string response;
+      std::string summary;
+      try {
+        std::string dir;
+        std::vector<std::string> args;
+        parse_request(dir, args, read_request(fd));
+        std::ostringstream out;
+        handler(args, dir, out);
+        response = "ok\n" + out.str();
+        summary = "done.";
+      } catch (const std::exception& x) {
+        std::string msg = x.what();
+        std::replace(msg.begin(), msg.end(), '\n', ' ');
+        response = "error: " + msg + "\n";
+        summary = "failed: " + msg;
+      }
+      try {
+        write_all(fd, response);
+      } catch (const std::exception& x) {
+        summary += std::string(" (") + x.what() + ")";
+      }
+      close(fd);
+      std::ostringstream log;
+      log << curtime() << "Job " << job << " " << summary << "\n";
+      std::cerr << log.str() << std::flush;
+    }
+
+    template<typename Handler>
+    void *worker_main(void *arg)
+    {
+      worker_pool<Handler>& pool = *static_cast<worker_pool<Handler> *>(arg);
+#ifdef _OPENMP
+      omp_set_num_threads(pool.num_threads_per_job);
+#endif
+      for (;;) {
+        pthread_mutex_lock(&pool.mutex);
+        while (pool.queue.empty() && !pool.done)
+          pthread_cond_wait(&pool.cond, &pool.mutex);
+        if (pool.queue.empty()) {
+          pthread_mutex_unlock(&pool.mutex);
+          return NULL;
+        }
+        std::pair<int, size_t> conn = pool.queue.front();
+        pool.queue.pop_front();
+        pthread_mutex_unlock(&pool.mutex);
+        handle_connection(*pool.handler, conn.first, conn.second);
+      }
+    }
+
+  } // namespace detail
+
+  // Accepts connections on listen_fd, and runs each one's job on one of
+  // num_workers threads, by calling
+  //
+  //   handler(args, dir, out)
+  //
+  // where args are the job's arguments, dir is the client's working
+  // directory, and out is where the job's output goes. handler reports
+  // errors by throwing, and must be safe to call from several threads at
+  // once. The OpenMP threads are split evenly between the workers. If
+  // max_jobs is nonzero, the server stops accepting connections after that
+  // many, and returns once their jobs are done; otherwise it runs until it
+  // is killed.
+  template<typename Handler>
+  void run(int listen_fd, size_t num_workers, Handler& handler, size_t max_jobs = 0)
+  {
+    // A client that goes away mid-response shouldn't take the server down.
+    signal(SIGPIPE, SIG_IGN);
+
+    detail::worker_pool<Handler> pool;
+    pool.handler = &handler;
+    pool.num_threads_per_job = 1;
+#ifdef _OPENMP
+    pool.num_threads_per_job = std::max<size_t>(1, omp_get_max_threads() / num_workers);
+#endif
+    pool.done = false;
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    std::vector<pthread_t> threads(num_workers);
+    for (size_t i = 0; i < num_workers; ++i)
+      if (pthread_create(&threads[i], NULL, detail::worker_main<Handler>, &pool) != 0)
+        throw std::runtime_error("Can't start worker thread.");
+
+    size_t job = 0;
+    while (max_jobs == 0 || job < max_jobs) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd < 0) {
+        if (errno != EINTR && errno != ECONNABORTED) {
+          std::cerr << curtime() << "Warning: Can't accept connection: " << detail::errno_string() << std::endl;
+          sleep(1);
+        }
+        continue;
+      }
+      ++job;
+      pthread_mutex_lock(&pool.mutex);
+      pool.queue.push_back(std::make_pair(fd, job));
+      pthread_cond_signal(&pool.cond);
+      pthread_mutex_unlock(&pool.mutex);
+    }
+
+    pthread_mutex_lock(&pool.mutex);
+    pool.done = true;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.mutex);
+    for (size_t i = 0; i < num_workers; ++i)
+      pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.mutex);
+  }
+
+  // Sends a job to the server listening on socket_path and waits for it to
+  // finish. Returns true and sets output to the job's output if the job
+  // succeeded, and returns false and sets output to the error message if it
+  // failed. Throws if the server can't be reached.
+  bool request(std::string& output,
+               const std::string& socket_path,
+               const std::string& dir,
+               const std::vector<std::string>& args)
+  {
+    sockaddr_un addr;
+    detail::make_address(addr, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      throw std::runtime_error("Can't create socket: " + detail::errno_string());
+    std::string response;
+    try {
+      if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        throw std::runtime_error("Can't connect to " + socket_path + ": " + detail::errno_string());
+      detail::write_all(fd, format_request(dir, args));
+      shutdown(fd, SHUT_WR);
+      response = detail::read_all(fd);
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+
+    if (response.compare(0, 3, "ok\n") == 0) {
+      output = response.substr(3);
+      return true;
+    }
+    if (response.compare(0, 7, "error: ") == 0) {
+      output = response.substr(7);
+      if (!output.empty() && output[output.size() - 1] == '\n')
+        output.resize(output.size() - 1);
+      return false;
+    }
+    throw std::runtime_error("Invalid response from " + socket_path + ".");
+  }
+
+} // namespace serve
@@ -0,0 +1,113 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdexcept>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+// The AVX2 kernels are compiled in if the compiler targets AVX2, or if it can
+// compile single functions for AVX2 (GCC and Clang on x86), in which case they
+// are only used if the CPU turns out to support AVX2. Either way, they fall
+// back on the SSE2 kernels for what they can't handle, so not on targets
+// without SSE2.
+#if defined(__SSE2__) && \
+    (defined(__AVX2__) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))))
+#define REF_EVAL_SIMD_AVX2
+#define REF_EVAL_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+// The kernels that have SIMD variants -- find_mismatches() in mismatch.hh,
+// the N scan of skip_Ns() in skip_Ns.hh, and the 2-bit packing of
+// packed_seqs::assign() in packed_seqs.hh -- all dispatch on one process-wide
+// instruction set. It is decided when the program starts, from what the CPU
+// supports, so that one build runs at full speed on CPUs with and without
+// AVX2. set_simd_level() can lower the choice, e.g., to test each path on the
+// same machine; every level gives the same results.
+
+// The instruction sets, from least to most capable.
+enum simd_level
+{
+  simd_none,
+  simd_sse2,
+  simd_avx2
+};
+
+namespace detail
+{
+  inline simd_level detect_simd_level()
+  {
+#if defined(__AVX2__)
+    return simd_avx2;
+#else
+#if defined(REF_EVAL_SIMD_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return simd_avx2;
+#endif
+#if defined(__SSE2__)
+    return simd_sse2;
+#else
+    return simd_none;
+#endif
+#endif
+  }
+
+  inline simd_level& current_simd_level()
+  {
+    static simd_level level = detect_simd_level();
+    return level;
+  }
+} // namespace detail
+
+// Returns the most capable instruction set that both the CPU and the build
+// support.
+inline simd_level max_simd_level()
+{
+  static const simd_level level = detail::detect_simd_level();
+  return level;
+}
+
+// Returns the instruction set that the kernels use.
+inline simd_level get_simd_level()
+{
+  return detail::current_simd_level();
+}
+
+// Makes the kernels use the given instruction set. Not thread-safe: it is
+// meant to be called before any sequences or alignments are read.
+inline void set_simd_level(simd_level level)
+{
+  if (level > max_simd_level())
+    throw std::runtime_error("This CPU or build does not support the requested SIMD instruction set.");
+  detail::current_simd_level() = level;
+}
+
+// Parses "auto", "avx2", "sse2", or "none", where "auto" is max_simd_level().
+inline simd_level parse_simd_level(const std::string& name)
+{
+  if (name == "auto") return max_simd_level();
+  if (name == "avx2") return simd_avx2;
+  if (name == "sse2") return simd_sse2;
+  if (name == "none") return simd_none;
+  throw std::runtime_error("Unknown SIMD instruction set: " + name);
+}
+
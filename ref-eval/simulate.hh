@@ -0,0 +1,519 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/foreach.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include "util.hh"
+
+// Synthesizes a REF-EVAL workload: a reference transcriptome (B), its
+// expression, an "assembly" (A) derived from it with the usual kinds of
+// assembly errors, the assembly's expression, and PSL alignments of A to B and
+// of B to A that are consistent with how A was made. Everything is determined
+// by the params, including the random seed, so a workload can be rebuilt
+// anywhere without shipping data or running blat.
+//
+// The reference is made of gene families. Each family has a random exonic
+// sequence, split into exons; each gene in the family is a copy of that
+// sequence with paralog_divergence of its bases substituted; and each
+// isoform of a gene is a subset of its exons (the first isoform has all of
+// them, the others skip some of the internal ones). Since all the
+// transcripts of a family share the family's exonic coordinates, the
+// alignments of a contig to every transcript of its family (its source, the
+// other isoforms, and the paralogs) can be read off from those coordinates.
+//
+// Each transcript is assembled with a probability that increases with its
+// expression. An assembled transcript is cut into fragments, each of which
+// becomes a contig, with substitutions, indels, and runs of N's, in a random
+// orientation. Some contigs are chimeras, with a piece of a random other
+// transcript appended, and some fragments are assembled twice (redundancy).
+
+namespace sim
+{
+  typedef boost::random::mt19937 rng_type;
+
+  struct params
+  {
+    unsigned seed;
+
+    // Size and shape of the reference.
+    size_t num_families;
+    size_t max_genes_per_family;
+    size_t max_isoforms_per_gene;
+    size_t max_exons;
+    size_t mean_exon_length;
+    double paralog_divergence;
+
+    // Expression: log-normal, with some transcripts not expressed at all.
+    double expression_sigma;
+    double frac_unexpressed;
+
+    // The assembly.
+    double assembly_depth;
+    size_t mean_fragment_length;
+    size_t min_contig_length;
+    double chimera_rate;
+    double redundancy_rate;
+    double substitution_rate;
+    double indel_rate;
+    double n_run_rate;
+    size_t mean_n_run_length;
+
+    // Alignments with fewer aligned bases than this are not output.
+    size_t min_alignment_length;
+
+    params()
+    : seed(1),
+      num_families(1000),
+      max_genes_per_family(3),
+      max_isoforms_per_gene(3),
+      max_exons(8),
+      mean_exon_length(200),
+      paralog_divergence(0.05),
+      expression_sigma(2.0),
+      frac_unexpressed(0.1),
+      assembly_depth(5.0),
+      mean_fragment_length(1000),
+      min_contig_length(200),
+      chimera_rate(0.02),
+      redundancy_rate(0.1),
+      substitution_rate(0.005),
+      indel_rate(0.001),
+      n_run_rate(0.0005),
+      mean_n_run_length(10),
+      min_alignment_length(40)
+    {}
+  };
+
+  struct stats
+  {
+    size_t num_transcripts, reference_length;
+    size_t num_contigs, assembly_length;
+    size_t num_chimeras, num_redundant;
+    size_t num_A_to_B, num_B_to_A;
+
+    stats()
+    : num_transcripts(0), reference_length(0),
+      num_contigs(0), assembly_length(0),
+      num_chimeras(0), num_redundant(0),
+      num_A_to_B(0), num_B_to_A(0)
+    {}
+  };
+
+  struct transcript
+  {
+    std::string name, gene_name;
+    size_t family;
+    std::string seq;
+    std::vector<int> family_pos;     // family coordinate of each base
+    std::vector<int> transcript_pos; // position of each family coordinate, or -1
+    double tau;
+  };
+
+  struct reference
+  {
+    std::vector<transcript> transcripts;
+    std::vector<std::vector<size_t> > family_transcripts;
+  };
+
+  // A piece of a contig, copied (with errors) from one transcript.
+  struct contig_piece
+  {
+    size_t transcript;
+    bool is_rc;              // whether the piece is reverse complemented
+    size_t start;            // offset of the piece within the contig
+    std::vector<int> origin; // family coordinate of each base, or -1 if inserted
+  };
+
+  struct contig
+  {
+    std::string seq;
+    std::vector<contig_piece> pieces;
+  };
+
+  namespace detail
+  {
+    // Uniform on (0, 1).
+    inline double uniform(rng_type& rng)
+    {
+      return (rng() + 0.5) / 4294967296.0;
+    }
+
+    // Uniform on [lo, hi].
+    inline size_t uniform_int(rng_type& rng, size_t lo, size_t hi)
+    {
+      boost::random::uniform_int_distribution<size_t> dist(lo, hi);
+      return dist(rng);
+    }
+
+    // Standard normal, by the Box-Muller transform.
+    inline double normal(rng_type& rng)
+    {
+      double u = uniform(rng), v = uniform(rng);
+      return std::sqrt(-2.0 * std::log(u)) * std::cos(2.0 * 3.14159265358979323846 * v);
+    }
+
+    // Geometric on {1, 2, ...} with the given mean.
+    inline size_t geometric(rng_type& rng, double mean)
+    {
+      if (mean <= 1.0)
+        return 1;
+      return 1 + static_cast<size_t>(std::log(uniform(rng)) / std::log(1.0 - 1.0 / mean));
+    }
+
+    inline char random_base(rng_type& rng)
+    {
+      return "ACGT"[rng() & 3];
+    }
+
+    // A random base other than c.
+    inline char substitute(rng_type& rng, char c)
+    {
+      char d;
+      while ((d = random_base(rng)) == c) {}
+      return d;
+    }
+
+    inline void write_fasta_record(std::ostream& os, const std::string& name, const std::string& seq)
+    {
+      os << '>' << name << '\n';
+      for (size_t i = 0; i < seq.size(); i += 60)
+        os << seq.substr(i, 60) << '\n';
+    }
+
+    inline void write_rsem_header(std::ostream& os)
+    {
+      os << "transcript_id\tgene_id\tlength\teffective_length\texpected_count\tTPM\tFPKM\tIsoPct\n";
+    }
+
+    inline void write_rsem_line(std::ostream& os, const std::string& name, const std::string& gene_name,
+                                size_t length, double tau)
+    {
+      double tpm = tau * 1000000.0;
+      os << name << '\t' << gene_name << '\t' << length << '\t' << length << '\t'
+         << tpm * length / 1000.0 << '\t' << tpm << '\t' << tpm << '\t' << "100.00\n";
+    }
+
+    inline void write_psl_header(std::ostream& os)
+    {
+      os << "psLayout version 3\n"
+         << "\n"
+         << "match\tmis- \trep. \tN's\tQ gap\tQ gap\tT gap\tT gap\tstrand\tQ        \tQ   \tQ    \tQ  \tT        \tT   \tT    \tT  \tblock\tblockSizes \tqStarts\t tStarts\n"
+         << "     \tmatch\tmatch\t   \tcount\tbases\tcount\tbases\t      \tname     \tsize\tstart\tend\tname     \tsize\tstart\tend\tcount\n"
+         << "---------------------------------------------------------------------------------------------------------------------------------------------------------------\n";
+    }
+
+    // Writes the PSL line for an alignment given by its aligned pairs of
+    // query and target positions, qt, in order of increasing target
+    // position. The query positions increase too, unless is_rc, in which
+    // case they decrease. As in blat's output, the query starts of the blocks
+    // are on the reverse strand of the query if is_rc.
+    void write_psl_line(std::ostream& os, const std::vector<std::pair<size_t, size_t> >& qt, bool is_rc,
+                        const std::string& q_name, const std::string& q_seq,
+                        const std::string& t_name, const std::string& t_seq)
+    {
+      size_t q_size = q_seq.size();
+      size_t matches = 0, mis_matches = 0, n_count = 0;
+      size_t q_num_insert = 0, q_base_insert = 0, t_num_insert = 0, t_base_insert = 0;
+      std::vector<size_t> block_sizes, q_starts, t_starts;
+      size_t q_min = q_size, q_max = 0;
+      for (size_t i = 0; i < qt.size(); ++i) {
+        size_t q = qt[i].first, t = qt[i].second;
+        size_t qs = is_rc ? q_size - 1 - q : q; // position on the aligned strand of the query
+        if (i == 0 || qs != q_starts.back() + block_sizes.back() || t != t_starts.back() + block_sizes.back()) {
+          if (i != 0) {
+            size_t q_gap = qs - (q_starts.back() + block_sizes.back());
+            size_t t_gap = t  - (t_starts.back() + block_sizes.back());
+            q_num_insert += q_gap > 0; q_base_insert += q_gap;
+            t_num_insert += t_gap > 0; t_base_insert += t_gap;
+          }
+          block_sizes.push_back(0);
+          q_starts.push_back(qs);
+          t_starts.push_back(t);
+        }
+        ++block_sizes.back();
+
+        char q_char = is_rc ? complement(q_seq[q]) : q_seq[q];
+        char t_char = t_seq[t];
+        if (q_char == 'N' || t_char == 'N')
+          ++n_count;
+        else if (q_char == t_char)
+          ++matches;
+        else
+          ++mis_matches;
+        q_min = std::min(q_min, q);
+        q_max = std::max(q_max, q);
+      }
+
+      os << matches << '\t' << mis_matches << "\t0\t" << n_count << '\t'
+         << q_num_insert << '\t' << q_base_insert << '\t' << t_num_insert << '\t' << t_base_insert << '\t'
+         << (is_rc ? '-' : '+') << '\t'
+         << q_name << '\t' << q_size << '\t' << q_min << '\t' << q_max + 1 << '\t'
+         << t_name << '\t' << t_seq.size() << '\t' << qt.front().second << '\t' << qt.back().second + 1 << '\t'
+         << block_sizes.size() << '\t';
+      BOOST_FOREACH(size_t x, block_sizes) os << x << ',';
+      os << '\t';
+      BOOST_FOREACH(size_t x, q_starts) os << x << ',';
+      os << '\t';
+      BOOST_FOREACH(size_t x, t_starts) os << x << ',';
+      os << '\n';
+    }
+
+  } // namespace detail
+
+  void make_reference(reference& ref, const params& p, rng_type& rng)
+  {
+    using namespace detail;
+    ref.transcripts.clear();
+    ref.family_transcripts.assign(p.num_families, std::vector<size_t>());
+
+    for (size_t f = 0; f < p.num_families; ++f) {
+      // The exons, as offsets into the family's exonic sequence.
+      size_t num_exons = uniform_int(rng, 1, p.max_exons);
+      std::vector<size_t> exon_starts(1, 0);
+      for (size_t e = 0; e < num_exons; ++e) {
+        double len = p.mean_exon_length * std::exp(0.5 * normal(rng) - 0.125);
+        exon_starts.push_back(exon_starts.back() + std::max<size_t>(30, static_cast<size_t>(len)));
+      }
+      std::string family_seq(exon_starts.back(), 'N');
+      BOOST_FOREACH(char& c, family_seq)
+        c = random_base(rng);
+
+      size_t num_genes = uniform_int(rng, 1, p.max_genes_per_family);
+      for (size_t g = 0; g < num_genes; ++g) {
+        std::string gene_seq = family_seq;
+        if (g != 0)
+          BOOST_FOREACH(char& c, gene_seq)
+            if (uniform(rng) < p.paralog_divergence)
+              c = substitute(rng, c);
+
+        std::ostringstream gene_name;
+        gene_name << "f" << f << "_g" << g;
+
+        size_t num_isoforms = uniform_int(rng, 1, p.max_isoforms_per_gene);
+        std::vector<std::vector<bool> > isoform_exons;
+        for (size_t i = 0; i < num_isoforms; ++i) {
+          std::vector<bool> exons(num_exons, true);
+          if (i != 0)
+            for (size_t e = 1; e + 1 < num_exons; ++e)
+              exons[e] = uniform(rng) < 0.5;
+          if (std::find(isoform_exons.begin(), isoform_exons.end(), exons) != isoform_exons.end())
+            continue;
+          isoform_exons.push_back(exons);
+
+          transcript t;
+          std::ostringstream name;
+          name << gene_name.str() << "_t" << isoform_exons.size() - 1;
+          t.name = name.str();
+          t.gene_name = gene_name.str();
+          t.family = f;
+          t.transcript_pos.assign(family_seq.size(), -1);
+          for (size_t e = 0; e < num_exons; ++e) {
+            if (!exons[e])
+              continue;
+            for (size_t j = exon_starts[e]; j < exon_starts[e + 1]; ++j) {
+              t.transcript_pos[j] = t.seq.size();
+              t.family_pos.push_back(j);
+              t.seq += gene_seq[j];
+            }
+          }
+          t.tau = uniform(rng) < p.frac_unexpressed ? 0.0 : std::exp(p.expression_sigma * normal(rng));
+          ref.family_transcripts[f].push_back(ref.transcripts.size());
+          ref.transcripts.push_back(t);
+        }
+      }
+    }
+
+    double total = 0.0;
+    BOOST_FOREACH(const transcript& t, ref.transcripts)
+      total += t.tau;
+    if (total > 0.0)
+      BOOST_FOREACH(transcript& t, ref.transcripts)
+        t.tau /= total;
+  }
+
+  // Appends to c a copy of transcript t's bases [begin, end), with
+  // substitution and indel errors, reverse complemented if is_rc.
+  void add_piece(contig& c, const reference& ref, size_t t, size_t begin, size_t end, bool is_rc,
+                 const params& p, rng_type& rng)
+  {
+    using namespace detail;
+    const transcript& tr = ref.transcripts[t];
+    contig_piece piece;
+    piece.transcript = t;
+    piece.is_rc = is_rc;
+    piece.start = c.seq.size();
+    std::string seq;
+    for (size_t i = begin; i < end; ++i) {
+      double r = uniform(rng);
+      if (r < p.indel_rate / 2)
+        continue; // deletion
+      if (r < p.indel_rate) {
+        seq += random_base(rng); // insertion
+        piece.origin.push_back(-1);
+      }
+      seq += uniform(rng) < p.substitution_rate ? substitute(rng, tr.seq[i]) : tr.seq[i];
+      piece.origin.push_back(tr.family_pos[i]);
+    }
+    if (is_rc) {
+      seq = reverse_complement(seq);
+      std::reverse(piece.origin.begin(), piece.origin.end());
+    }
+    c.seq += seq;
+    c.pieces.push_back(piece);
+  }
+
+  void add_n_runs(contig& c, const params& p, rng_type& rng)
+  {
+    using namespace detail;
+    for (size_t i = 0; i < c.seq.size(); ++i)
+      if (uniform(rng) < p.n_run_rate)
+        for (size_t n = geometric(rng, p.mean_n_run_length); n > 0 && i < c.seq.size(); --n, ++i)
+          c.seq[i] = 'N';
+  }
+
+  // Writes the alignments of each piece of c to each transcript in the
+  // piece's family, in both directions.
+  void write_alignments(const contig& c, const std::string& c_name, const reference& ref,
+                        std::ostream& A_to_B, std::ostream& B_to_A, stats& st, const params& p)
+  {
+    std::vector<std::pair<size_t, size_t> > ct, tc;
+    BOOST_FOREACH(const contig_piece& piece, c.pieces) {
+      BOOST_FOREACH(size_t t, ref.family_transcripts[ref.transcripts[piece.transcript].family]) {
+        const transcript& tr = ref.transcripts[t];
+        ct.clear();
+        for (size_t j = 0; j < piece.origin.size(); ++j)
+          if (piece.origin[j] != -1 && tr.transcript_pos[piece.origin[j]] != -1)
+            ct.push_back(std::make_pair(piece.start + j, static_cast<size_t>(tr.transcript_pos[piece.origin[j]])));
+        if (ct.size() < p.min_alignment_length)
+          continue;
+
+        // ct is in order of contig position, so it is ready for B_to_A, after
+        // swapping; for A_to_B it needs to be in order of transcript position.
+        tc.clear();
+        for (size_t i = 0; i < ct.size(); ++i)
+          tc.push_back(std::make_pair(ct[i].second, ct[i].first));
+        if (piece.is_rc)
+          std::reverse(ct.begin(), ct.end());
+        detail::write_psl_line(A_to_B, ct, piece.is_rc, c_name, c.seq, tr.name, tr.seq);
+        detail::write_psl_line(B_to_A, tc, piece.is_rc, tr.name, tr.seq, c_name, c.seq);
+        ++st.num_A_to_B;
+        ++st.num_B_to_A;
+      }
+    }
+  }
+
+  stats simulate(const params& p,
+                 std::ostream& B_fa, std::ostream& B_expr,
+                 std::ostream& A_fa, std::ostream& A_expr,
+                 std::ostream& A_to_B, std::ostream& B_to_A)
+  {
+    using namespace detail;
+    rng_type rng(p.seed);
+    stats st;
+
+    reference ref;
+    make_reference(ref, p, rng);
+    size_t num_transcripts = ref.transcripts.size();
+    write_rsem_header(B_expr);
+    BOOST_FOREACH(const transcript& t, ref.transcripts) {
+      write_fasta_record(B_fa, t.name, t.seq);
+      write_rsem_line(B_expr, t.name, t.gene_name, t.seq.size(), t.tau);
+      st.reference_length += t.seq.size();
+    }
+    st.num_transcripts = num_transcripts;
+
+    write_psl_header(A_to_B);
+    write_psl_header(B_to_A);
+    std::vector<std::string> names;
+    std::vector<size_t> lengths;
+    std::vector<double> taus;
+    for (size_t t = 0; t < num_transcripts; ++t) {
+      const transcript& tr = ref.transcripts[t];
+      double coverage = tr.tau * num_transcripts * p.assembly_depth;
+      if (uniform(rng) >= 1.0 - std::exp(-coverage))
+        continue;
+
+      // Cut the transcript into fragments, with small gaps between them.
+      typedef std::pair<size_t, size_t> extent;
+      std::vector<extent> frags;
+      for (size_t pos = 0; pos < tr.seq.size(); ) {
+        size_t end = std::min(tr.seq.size(), pos + geometric(rng, p.mean_fragment_length));
+        if (end - pos >= p.min_contig_length)
+          frags.push_back(std::make_pair(pos, end));
+        pos = end + uniform_int(rng, 0, 50);
+      }
+
+      BOOST_FOREACH(const extent& frag, frags) {
+        size_t copies = uniform(rng) < p.redundancy_rate ? 2 : 1;
+        for (size_t k = 0; k < copies; ++k) {
+          contig c;
+          size_t begin = frag.first, end = frag.second;
+          if (k != 0) {
+            // Redundant copies are trimmed a bit, independently at each end.
+            size_t max_trim = (end - begin) / 10;
+            begin += uniform_int(rng, 0, max_trim);
+            end   -= uniform_int(rng, 0, max_trim);
+            ++st.num_redundant;
+          }
+          add_piece(c, ref, t, begin, end, uniform(rng) < 0.5, p, rng);
+
+          if (uniform(rng) < p.chimera_rate) {
+            size_t t2 = uniform_int(rng, 0, num_transcripts - 1);
+            const std::string& seq2 = ref.transcripts[t2].seq;
+            size_t len2 = std::min(seq2.size(), p.min_contig_length / 2 + geometric(rng, p.mean_fragment_length / 2.0));
+            size_t begin2 = uniform_int(rng, 0, seq2.size() - len2);
+            add_piece(c, ref, t2, begin2, begin2 + len2, uniform(rng) < 0.5, p, rng);
+            ++st.num_chimeras;
+          }
+          add_n_runs(c, p, rng);
+
+          std::ostringstream name;
+          name << "contig_" << names.size();
+          names.push_back(name.str());
+          lengths.push_back(c.seq.size());
+          taus.push_back(tr.tau / copies);
+          write_fasta_record(A_fa, name.str(), c.seq);
+          write_alignments(c, name.str(), ref, A_to_B, B_to_A, st, p);
+          st.assembly_length += c.seq.size();
+        }
+      }
+    }
+    st.num_contigs = names.size();
+
+    double total = 0.0;
+    BOOST_FOREACH(double tau, taus)
+      total += tau;
+    write_rsem_header(A_expr);
+    for (size_t i = 0; i < names.size(); ++i)
+      write_rsem_line(A_expr, names[i], names[i], lengths[i], total > 0.0 ? taus[i] / total : 0.0);
+
+    return st;
+  }
+
+} // namespace sim
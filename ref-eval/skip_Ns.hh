@@ -18,12 +18,72 @@
 // along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
+#include <stdint.h>
+#include "simd.hh"
 
 inline bool is_N(char c)
 {
   return c == 'N' || c == 'n';
 }
 
+// find_N() returns the first N (or n) in [p, end), or end if there is none.
+// It compares 16 bytes at a time with SSE2 (32 at a time with AVX2) when
+// get_simd_level() allows, and finds the N from the resulting bitmask.
+namespace detail
+{
+  inline const char *find_N_scalar(const char *p, const char *end)
+  {
+    for (; p < end; ++p)
+      if (is_N(*p))
+        return p;
+    return end;
+  }
+
+#ifdef __SSE2__
+  inline const char *find_N_sse2(const char *p, const char *end)
+  {
+    const __m128i case_bit = _mm_set1_epi8(0x20), n = _mm_set1_epi8('n');
+    for (; end - p >= 16; p += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(v, case_bit), n));
+      if (bits != 0)
+        return p + __builtin_ctz(bits);
+    }
+    return find_N_scalar(p, end);
+  }
+#endif
+
+#ifdef REF_EVAL_SIMD_AVX2
+  REF_EVAL_TARGET_AVX2
+  inline const char *find_N_avx2(const char *p, const char *end)
+  {
+    const __m256i case_bit = _mm256_set1_epi8(0x20), n = _mm256_set1_epi8('n');
+    for (; end - p >= 32; p += 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_or_si256(v, case_bit), n));
+      if (bits != 0)
+        return p + __builtin_ctz(bits);
+    }
+    return find_N_sse2(p, end);
+  }
+#endif
+} // namespace detail
+
+inline const char *find_N(const char *p, const char *end)
+{
+  simd_level level = detail::current_simd_level();
+#ifdef REF_EVAL_SIMD_AVX2
+  if (level >= simd_avx2)
+    return detail::find_N_avx2(p, end);
+#endif
+#ifdef __SSE2__
+  if (level >= simd_sse2)
+    return detail::find_N_sse2(p, end);
+#endif
+  (void)level;
+  return detail::find_N_scalar(p, end);
+}
+
 // Precondition: If at_beginning is true, then there are no preconditions. If
 // at_beginning is false, then we assume that start[0:(k-2)] are all non-N,
 // where k is the kmer length. In other words, in the initial kmer starting at
@@ -74,11 +134,12 @@ const char *skip_Ns(const char *start, const char *end, size_t kmerlen,
     return end;
 
   // We cannot assume that the kmer starting at ret contains non-Ns at any of
-  // its positions. So, check whether each position contains an N. If so, jump
-  // past the N and try again.
-  for (size_t l = 0; l < kmerlen; ++l) {
-    if (is_N(ret[l])) {
-      ret = ret + l + 1;
+  // its positions. So, look for an N among its positions. If there is one,
+  // jump past it and try again.
+  {
+    const char *n = find_N(ret, ret + kmerlen);
+    if (n != ret + kmerlen) {
+      ret = n + 1;
       goto check_that_the_kmer_starting_at_ret_is_valid;
     }
   }
@@ -0,0 +1,67 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include <vector>
+
+// small_vector is a minimal vector-like container that stores up to N
+// elements inline, and only falls back to the heap when it grows past that.
+// It is meant for short lists that are rebuilt many times, such as the block
+// lists of a psl alignment: once the heap fallback has been used, clear()
+// keeps its capacity, so reusing the same object for many records does not
+// allocate.
+template<typename T, size_t N>
+class small_vector
+{
+public:
+  typedef T        value_type;
+  typedef const T *const_iterator;
+
+  small_vector() : sz(0) {}
+
+  void clear()
+  {
+    sz = 0;
+    heap.clear();
+  }
+
+  void push_back(const T& x)
+  {
+    if (sz < N) {
+      inline_data[sz] = x;
+    } else {
+      if (sz == N) // move the inline elements to the heap
+        heap.assign(inline_data, inline_data + N);
+      heap.push_back(x);
+    }
+    ++sz;
+  }
+
+  inline size_t   size()                const { return sz; }
+  inline bool     empty()               const { return sz == 0; }
+  inline const T *begin()               const { return sz <= N ? inline_data : &heap[0]; }
+  inline const T *end()                 const { return begin() + sz; }
+  inline const T& operator[](size_t i)  const { return begin()[i]; }
+
+private:
+  T inline_data[N];
+  std::vector<T> heap;
+  size_t sz;
+};
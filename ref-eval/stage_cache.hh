@@ -0,0 +1,229 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "city.h"
+#include "mapped_file.hh"
+#include "alignment_cache.hh"
+
+// Content-addressed cache of intermediate results (see --cache-dir).
+//
+// Each cached result is stored in its own file in the cache directory, named
+// after the stage that produced it and a hash of everything the result
+// depends on: the checksums of the input files and sequences, the expression
+// values, and the options that affect it (see stage_key). A later run that
+// would compute a result from exactly the same inputs finds the file under the
+// same name and loads it instead. A change to any input gives a different
+// name, so files are never invalidated, only left unused, and the directory
+// can be emptied at any time.
+//
+// The cached stages are:
+//
+// - "alignments": the parsed alignment sets, in the format described in
+//   alignment_cache.hh;
+//
+// - "matched": each nucl and pair precision and recall, i.e., the result of
+//   the alignment selection in re_matched.hh;
+//
+// - "components": for each nucl and pair precision and recall, the
+//   contributions selected in each component of the alignment graph in the
+//   latest runs (see compute_recall_by_component in re_matched.hh). Unlike
+//   the other stages, this one is found under a key that depends only on the
+//   score and the reference, so that a run with a changed assembly can reuse
+//   the unchanged components;
+//
+// - "oomatched": each contig precision and recall, i.e., the result of the
+//   matching in re_oomatched.hh;
+//
+// - "kmers": the kmer counts of B used by the kmer scores, when the kmers are
+//   packed (see re_kmer.hh).
+//
+// Apart from the alignments, each file holds a header (magic, version, key,
+// record size, and number of records, all uint64_t), followed by the records,
+// which are plain structs, in native byte order.
+
+namespace re {
+
+// Incrementally hashes the inputs of a stage. Values are added with add(), in
+// a fixed order; integers and bools should be cast to uint64_t first.
+class stage_key
+{
+public:
+  explicit stage_key(const std::string& stage)
+  : stage_(stage),
+    h_(CityHash64(stage.data(), stage.size()))
+  {}
+
+  stage_key& add(uint64_t x)
+  {
+    h_ = CityHash64WithSeed(reinterpret_cast<const char *>(&x), sizeof(x), h_);
+    return *this;
+  }
+
+  stage_key& add(double x)
+  {
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return add(bits);
+  }
+
+  stage_key& add(const std::string& s)
+  {
+    h_ = CityHash64WithSeeds(s.data(), s.size(), h_, s.size());
+    return *this;
+  }
+
+  template<typename T>
+  stage_key& add(const std::vector<T>& v)
+  {
+    add(static_cast<uint64_t>(v.size()));
+    if (!v.empty())
+      h_ = CityHash64WithSeed(reinterpret_cast<const char *>(&v[0]), v.size() * sizeof(T), h_);
+    return *this;
+  }
+
+  const std::string& stage() const { return stage_; }
+  uint64_t value() const { return h_; }
+
+private:
+  std::string stage_;
+  uint64_t h_;
+};
+
+namespace detail
+{
+  const uint64_t stage_cache_magic   = 0x6567617473616552ULL; // "Reastage"
+  const uint64_t stage_cache_version = 1;
+
+  struct stage_cache_header
+  {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t key;
+    uint64_t record_size;
+    uint64_t num_records;
+  };
+} // namespace detail
+
+// Creates the cache directory, if it does not exist yet.
+void make_stage_cache_dir(const std::string& dir)
+{
+  if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+    throw std::runtime_error("Can't create cache directory " + dir + ": " + std::strerror(errno));
+  struct stat st;
+  if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    throw std::runtime_error("Cache directory " + dir + " is not a directory.");
+}
+
+std::string stage_cache_filename(const std::string& dir, const stage_key& key)
+{
+  char hex[17];
+  std::sprintf(hex, "%016llx", static_cast<unsigned long long>(key.value()));
+  return dir + "/" + key.stage() + "-" + hex;
+}
+
+// Returns the key of the "alignments" stage for an alignment file with the
+// given alignment cache key.
+stage_key alignments_stage_key(const re::matched::alignment_cache_key& key)
+{
+  stage_key k("alignments");
+  k.add(key.alignment_type).add(key.strand_specific).add(key.alignments_checksum)
+   .add(key.A_checksum).add(key.B_checksum);
+  return k;
+}
+
+// Loads the records cached under key in dir into records. Returns false,
+// leaving records empty, if there are none or the file is malformed.
+template<typename T>
+bool load_stage(std::vector<T>& records, const std::string& dir, const stage_key& key)
+{
+  records.clear();
+  mapped_file f(stage_cache_filename(dir, key));
+  if (f.data == NULL || f.size < sizeof(detail::stage_cache_header))
+    return false;
+  detail::stage_cache_header header;
+  std::memcpy(&header, f.data, sizeof(header));
+  if (header.magic       != detail::stage_cache_magic   ||
+      header.version     != detail::stage_cache_version ||
+      header.key         != key.value()                 ||
+      header.record_size != sizeof(T)                   ||
+      header.num_records != (f.size - sizeof(header)) / sizeof(T) ||
+      f.size != sizeof(header) + header.num_records * sizeof(T))
+    return false;
+  records.resize(header.num_records);
+  if (!records.empty())
+    std::memcpy(&records[0], f.data + sizeof(header), records.size() * sizeof(T));
+  return true;
+}
+
+// Stores records under key in dir. Throws std::runtime_error on failure.
+template<typename T>
+void save_stage(const std::vector<T>& records, const std::string& dir, const stage_key& key)
+{
+  detail::stage_cache_header header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic       = detail::stage_cache_magic;
+  header.version     = detail::stage_cache_version;
+  header.key         = key.value();
+  header.record_size = sizeof(T);
+  header.num_records = records.size();
+
+  std::string filename = stage_cache_filename(dir, key);
+  std::string tmp_filename = re::matched::detail::make_temp_file(filename);
+  {
+    std::ofstream ofs(tmp_filename.c_str(), std::ios::binary | std::ios::trunc);
+    if (ofs) {
+      ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      if (!records.empty())
+        ofs.write(reinterpret_cast<const char *>(&records[0]), records.size() * sizeof(T));
+      ofs.close();
+    }
+    if (!ofs) {
+      std::remove(tmp_filename.c_str());
+      throw std::runtime_error("Error writing " + tmp_filename + ".");
+    }
+  }
+  re::matched::detail::rename_temp_file(tmp_filename, filename);
+}
+
+// Like save_stage, but only warns on failure, since the cache is an
+// optimization.
+template<typename T>
+void save_stage_or_warn(const std::vector<T>& records, const std::string& dir, const stage_key& key)
+{
+  try {
+    save_stage(records, dir, key);
+  } catch (const std::runtime_error& x) {
+    std::cerr << "Warning: Can't write to the cache: " << x.what() << std::endl;
+  }
+}
+
+} // namespace re
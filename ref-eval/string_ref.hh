@@ -0,0 +1,55 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstring>
+#include <string>
+#include <ostream>
+
+// A non-owning reference to a range of characters, such as a field of a line
+// held by lazycsv, used to look strings up without first copying them into an
+// std::string. (This is a small subset of C++17's std::string_view.)
+struct string_ref
+{
+  const char *beg, *end;
+
+  string_ref() : beg(NULL), end(NULL) {}
+  string_ref(const char *beg, const char *end) : beg(beg), end(end) {}
+  string_ref(const char *str) : beg(str), end(str + std::strlen(str)) {}
+  string_ref(const std::string& str) : beg(str.data()), end(str.data() + str.size()) {}
+
+  size_t size() const { return end - beg; }
+  size_t length() const { return end - beg; }
+  bool empty() const { return beg == end; }
+  const char *data() const { return beg; }
+  const char& operator[](size_t i) const { return beg[i]; }
+  std::string str() const { return std::string(beg, end); }
+  std::string substr(size_t pos, size_t n) const { return std::string(beg + pos, beg + pos + n); }
+
+  bool operator==(const string_ref& other) const
+  {
+    return size() == other.size() && std::memcmp(beg, other.beg, size()) == 0;
+  }
+  bool operator!=(const string_ref& other) const { return !(*this == other); }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const string_ref& s)
+{
+  return out.write(s.beg, s.size());
+}
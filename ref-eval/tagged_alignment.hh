@@ -0,0 +1,62 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "alignment_segment.hh"
+
+namespace re {
+namespace matched {
+
+struct tagged_alignment
+{
+  size_t a_idx, b_idx;
+  std::vector<alignment_segment> segments;
+};
+
+// The quantities that the contig scores use to decide whether an alignment is
+// good enough to make an edge between its two sequences.
+struct alignment_identity
+{
+  double num_identity_wrt_a, num_identity_wrt_b;
+  double frac_indel_wrt_a, frac_indel_wrt_b;
+};
+
+// The parsed alignments of one alignment file, shared by the nucleotide, pair,
+// and contig scores. identities[i] belongs to alignments[i].
+struct alignment_set
+{
+  std::vector<tagged_alignment>   alignments;
+  std::vector<alignment_identity> identities;
+  // The key under which the set is held by the stage cache (see
+  // stage_cache.hh), or 0 if --cache-dir is not used.
+  uint64_t                        cache_key;
+  // The checksum of the reference, i.e., of B for both A_to_B and B_to_A,
+  // under which the stage cache keeps what can be reused across assemblies,
+  // or 0 if --cache-dir is not used.
+  uint64_t                        reference_checksum;
+
+  alignment_set()
+  : cache_key(0), reference_checksum(0)
+  {}
+};
+
+} // namespace matched
+} // namespace re
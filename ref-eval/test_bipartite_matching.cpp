@@ -0,0 +1,184 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <string>
+#include <iostream>
+#include <random>
+#define BOOST_TEST_MODULE test_bipartite_matching
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+#include <lemon/matching.h>
+#include <lemon/smart_graph.h>
+#include "bipartite_matching.hh"
+
+namespace {
+
+bipartite_edge make_edge(size_t left, size_t right, double weight)
+{
+  bipartite_edge e;
+  e.left   = left;
+  e.right  = right;
+  e.weight = weight;
+  return e;
+}
+
+// Checks that right_mate_edges is a matching, and returns its size and weight.
+void check_matching(size_t num_left, size_t num_right, const std::vector<bipartite_edge>& edges,
+                    const std::vector<size_t>& right_mate_edges, size_t& size, double& weight)
+{
+  BOOST_REQUIRE_EQUAL(right_mate_edges.size(), num_right);
+  std::vector<bool> left_matched(num_left, false);
+  size = 0;
+  weight = 0;
+  for (size_t v = 0; v < num_right; ++v) {
+    size_t e = right_mate_edges[v];
+    if (e == bipartite_edge::npos)
+      continue;
+    BOOST_REQUIRE(e < edges.size());
+    BOOST_CHECK_EQUAL(edges[e].right, v);
+    BOOST_CHECK(!left_matched[edges[e].left]);
+    left_matched[edges[e].left] = true;
+    ++size;
+    weight += edges[e].weight;
+  }
+}
+
+// Returns the size of a maximum cardinality matching and the weight of a
+// maximum weight matching, as found by lemon.
+void lemon_matching(size_t num_left, size_t num_right, const std::vector<bipartite_edge>& edges,
+                    size_t& size, double& weight)
+{
+  lemon::SmartGraph graph;
+  std::vector<lemon::SmartGraph::Node> left(num_left), right(num_right);
+  for (size_t u = 0; u < num_left;  ++u) left[u]  = graph.addNode();
+  for (size_t v = 0; v < num_right; ++v) right[v] = graph.addNode();
+  lemon::SmartGraph::EdgeMap<double> wei_map(graph);
+  BOOST_FOREACH(const bipartite_edge& e, edges)
+    wei_map[graph.addEdge(left[e.left], right[e.right])] = e.weight;
+  lemon::MaxMatching<lemon::SmartGraph> unw_mm(graph);
+  unw_mm.run();
+  size = unw_mm.matchingSize();
+  lemon::MaxWeightedMatching<lemon::SmartGraph, lemon::SmartGraph::EdgeMap<double> > wei_mm(graph, wei_map);
+  wei_mm.run();
+  weight = wei_mm.matchingWeight();
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(small_examples)
+{
+  // A path u0-v0-u1-v1: the maximum matching needs both ends.
+  std::vector<bipartite_edge> edges;
+  edges.push_back(make_edge(0, 0, 1));
+  edges.push_back(make_edge(1, 0, 1));
+  edges.push_back(make_edge(1, 1, 1));
+  std::vector<size_t> mates;
+  hopcroft_karp(2, 2, edges, mates);
+  BOOST_CHECK_EQUAL(mates[0], 0ul);
+  BOOST_CHECK_EQUAL(mates[1], 2ul);
+
+  // With these weights, the single middle edge is best.
+  edges[1].weight = 5;
+  max_weight_matching(2, 2, edges, mates);
+  BOOST_CHECK_EQUAL(mates[0], 1ul);
+  BOOST_CHECK_EQUAL(mates[1], bipartite_edge::npos);
+
+  // Edges with nonpositive weight are not used.
+  edges.clear();
+  edges.push_back(make_edge(0, 0, 0));
+  edges.push_back(make_edge(1, 1, -1));
+  max_weight_matching(2, 2, edges, mates);
+  BOOST_CHECK_EQUAL(mates[0], bipartite_edge::npos);
+  BOOST_CHECK_EQUAL(mates[1], bipartite_edge::npos);
+
+  // The greedy matching takes the heaviest edge, u1-v0, and then local search
+  // moves u1 to v1, so that v0 can take u0.
+  edges.clear();
+  edges.push_back(make_edge(0, 0, 2));
+  edges.push_back(make_edge(1, 0, 3));
+  edges.push_back(make_edge(1, 1, 2));
+  double bound = greedy_matching(2, 2, edges, true, mates);
+  BOOST_CHECK_EQUAL(mates[0], 0ul);
+  BOOST_CHECK_EQUAL(mates[1], 2ul);
+  BOOST_CHECK_EQUAL(bound, 5.0);
+  bound = greedy_matching(2, 2, edges, true, mates, 0); // without local search
+  BOOST_CHECK_EQUAL(mates[0], 1ul);
+  BOOST_CHECK_EQUAL(mates[1], bipartite_edge::npos);
+  BOOST_CHECK_EQUAL(bound, 5.0);
+
+  // No edges at all.
+  edges.clear();
+  hopcroft_karp(3, 2, edges, mates);
+  BOOST_CHECK_EQUAL(mates.size(), 2ul);
+  BOOST_CHECK_EQUAL(mates[0], bipartite_edge::npos);
+}
+
+BOOST_AUTO_TEST_CASE(matches_lemon)
+{
+  // Random graphs of varying density, with real weights (including ties,
+  // zeros, and negative weights) and with parallel edges. In a third of the
+  // graphs, the weight of each edge depends only on its right node.
+  std::mt19937 rng(2718);
+  for (int trial = 0; trial < 500; ++trial) {
+    size_t num_left = 1 + rng() % 30, num_right = 1 + rng() % 30;
+    size_t num_edges = rng() % (1 + num_left * num_right / (1 + rng() % 4));
+    std::vector<double> right_weights(num_right);
+    BOOST_FOREACH(double& w, right_weights)
+      w = (rng() % 5) / 4.0;
+    std::vector<bipartite_edge> edges;
+    for (size_t k = 0; k < num_edges; ++k) {
+      size_t left = rng() % num_left, right = rng() % num_right;
+      double weight;
+      switch (trial % 3) {
+        case 0:  weight = rng() % 5;                       break; // many ties
+        case 1:  weight = (rng() % 100000) / 1000.0 - 5;   break;
+        default: weight = right_weights[right];            break; // as for the contig scores
+      }
+      edges.push_back(make_edge(left, right, weight));
+    }
+
+    size_t expected_size;
+    double expected_weight;
+    lemon_matching(num_left, num_right, edges, expected_size, expected_weight);
+
+    std::vector<size_t> mates;
+    size_t size;
+    double weight;
+    hopcroft_karp(num_left, num_right, edges, mates);
+    check_matching(num_left, num_right, edges, mates, size, weight);
+    BOOST_CHECK_EQUAL(size, expected_size);
+    max_weight_matching(num_left, num_right, edges, mates);
+    check_matching(num_left, num_right, edges, mates, size, weight);
+    BOOST_CHECK_SMALL(weight - expected_weight, 1e-6);
+
+    // The greedy matching is at least half of the maximum, and the upper
+    // bound is at least the maximum.
+    double bound = greedy_matching(num_left, num_right, edges, false, mates);
+    check_matching(num_left, num_right, edges, mates, size, weight);
+    BOOST_CHECK(2 * size >= expected_size);
+    BOOST_CHECK(size <= expected_size);
+    BOOST_CHECK(bound >= expected_size);
+    bound = greedy_matching(num_left, num_right, edges, true, mates);
+    check_matching(num_left, num_right, edges, mates, size, weight);
+    BOOST_CHECK(2 * weight >= expected_weight - 1e-6);
+    BOOST_CHECK(weight <= expected_weight + 1e-6);
+    BOOST_CHECK(bound >= expected_weight - 1e-6);
+  }
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#define BOOST_TEST_MODULE test_compressed_stream
+#include <boost/test/unit_test.hpp>
+#include "sam/bgzf.h"
+#include "compressed_stream.hh"
+#include "line_stream.hh"
+#include "fasta.hh"
+
+using namespace std;
+
+// Some test content, large enough to span more than one batch of BGZF blocks.
+string make_content(size_t num_lines)
+{
+  ostringstream oss;
+  for (size_t i = 0; i < num_lines; ++i)
+    oss << "line " << i << "\tACGTACGTACGTTTGACCA\t" << i * 7919 % 10007 << "\n";
+  return oss.str();
+}
+
+void write_plain(const string& fname, const string& content)
+{
+  ofstream ofs(fname.c_str());
+  ofs << content;
+}
+
+void write_gzip(const string& fname, const string& content)
+{
+  gzFile gz = gzopen(fname.c_str(), "wb");
+  gzwrite(gz, content.data(), content.size());
+  gzclose(gz);
+}
+
+void write_bgzf(const string& fname, const string& content)
+{
+  BGZF *fp = bgzf_open(fname.c_str(), "w");
+  for (size_t i = 0; i < content.size(); i += 1000000)
+    bgzf_write(fp, content.data() + i, min(content.size() - i, size_t(1000000)));
+  bgzf_close(fp);
+}
+
+string read_all_lines(const string& fname)
+{
+  line_stream ls(open_compressed_or_throw(fname));
+  string line, out;
+  while (ls >> line)
+    out += line + "\n";
+  return out;
+}
+
+BOOST_AUTO_TEST_CASE(detect_and_read)
+{
+  string content = make_content(500000);
+  write_plain("test_compressed_stream.txt",    content);
+  write_gzip ("test_compressed_stream.txt.gz", content);
+  write_bgzf ("test_compressed_stream.txt.bgz", content);
+
+  BOOST_CHECK_EQUAL(detect_compression("test_compressed_stream.txt"),     "none");
+  BOOST_CHECK_EQUAL(detect_compression("test_compressed_stream.txt.gz"),  "gzip");
+  BOOST_CHECK_EQUAL(detect_compression("test_compressed_stream.txt.bgz"), "bgzf");
+
+  BOOST_CHECK(read_all_lines("test_compressed_stream.txt")     == content);
+  BOOST_CHECK(read_all_lines("test_compressed_stream.txt.gz")  == content);
+  BOOST_CHECK(read_all_lines("test_compressed_stream.txt.bgz") == content);
+
+  remove("test_compressed_stream.txt");
+  remove("test_compressed_stream.txt.gz");
+  remove("test_compressed_stream.txt.bgz");
+}
+
+BOOST_AUTO_TEST_CASE(empty_files)
+{
+  write_plain("test_compressed_stream.txt",    "");
+  write_gzip ("test_compressed_stream.txt.gz", "");
+  write_bgzf ("test_compressed_stream.txt.bgz", "");
+  BOOST_CHECK_EQUAL(read_all_lines("test_compressed_stream.txt"),     "");
+  BOOST_CHECK_EQUAL(read_all_lines("test_compressed_stream.txt.gz"),  "");
+  BOOST_CHECK_EQUAL(read_all_lines("test_compressed_stream.txt.bgz"), "");
+  remove("test_compressed_stream.txt");
+  remove("test_compressed_stream.txt.gz");
+  remove("test_compressed_stream.txt.bgz");
+}
+
+BOOST_AUTO_TEST_CASE(truncated_bgzf)
+{
+  string content = make_content(10000);
+  write_bgzf("test_compressed_stream.txt.bgz", content);
+  string compressed;
+  {
+    ifstream ifs("test_compressed_stream.txt.bgz", ios::binary);
+    compressed.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+  }
+  write_plain("test_compressed_stream.txt.bgz", compressed.substr(0, compressed.size() / 2));
+  BOOST_CHECK_THROW(read_all_lines("test_compressed_stream.txt.bgz"), std::runtime_error);
+  remove("test_compressed_stream.txt.bgz");
+}
+
+BOOST_AUTO_TEST_CASE(compressed_fasta)
+{
+  write_bgzf("test_compressed_stream.fa.gz", ">a\nACGT\nAC\n>b\nGGG\n");
+  fasta fa;
+  read_fasta(fa, "test_compressed_stream.fa.gz");
+  BOOST_CHECK_EQUAL(fa.card, 2ul);
+  BOOST_CHECK_EQUAL(fa.seqs[0], "ACGTAC");
+  BOOST_CHECK_EQUAL(fa.names[1], "b");
+  remove("test_compressed_stream.fa.gz");
+}
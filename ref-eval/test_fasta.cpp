@@ -0,0 +1,135 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#define BOOST_TEST_MODULE test_fasta
+#include <boost/test/unit_test.hpp>
+#include "fasta.hh"
+
+using namespace std;
+
+void write_plain(const string& fname, const string& content)
+{
+  ofstream ofs(fname.c_str());
+  ofs << content;
+}
+
+// Reads fname with the deweylab FASTA reader, which read_fasta replaced, and
+// checks that read_fasta gives the same names and sequences.
+void check_same_as_deweylab(const string& content)
+{
+  write_plain("test_fasta.fa", content);
+
+  vector<string> names, seqs;
+  {
+    ifstream ifs("test_fasta.fa");
+    deweylab::bio::formats::fasta::InputStream is(ifs);
+    deweylab::bio::formats::fasta::Record rec;
+    while (is >> rec) {
+      names.push_back(rec.id);
+      seqs.push_back(rec.sequence);
+    }
+  }
+
+  fasta fa;
+  read_fasta(fa, "test_fasta.fa");
+  BOOST_REQUIRE_EQUAL(fa.card, names.size());
+  BOOST_REQUIRE_EQUAL(fa.seqs.size(), names.size());
+  for (size_t i = 0; i < fa.card; ++i) {
+    BOOST_CHECK_EQUAL(fa.names[i], names[i]);
+    BOOST_CHECK_EQUAL(fa.seqs[i], seqs[i]);
+    BOOST_CHECK_EQUAL(fa.lengths[i], seqs[i].size());
+    BOOST_CHECK_EQUAL(fa.names_to_idxs.find(names[i]), i);
+  }
+  remove("test_fasta.fa");
+}
+
+BOOST_AUTO_TEST_CASE(same_as_deweylab)
+{
+  check_same_as_deweylab(">a\nACGT\nAC\n>b\nGGG\n");
+  check_same_as_deweylab(">a description here\nacgtN\n\n>b\tmore\r\nGG G\r\nTT\n");
+  check_same_as_deweylab("junk before\nthe first record\n>a\nAC>b\nGT\n");
+  check_same_as_deweylab(">a > not a record\nACGT\n>b\n");
+  check_same_as_deweylab(">a\n>b\nA\n>c\n");
+  check_same_as_deweylab("");
+  check_same_as_deweylab("ACGT\n");
+}
+
+// The deweylab reader runs past the end of its buffer if the file ends in the
+// middle of a title line, so this case is checked separately.
+BOOST_AUTO_TEST_CASE(no_final_newline)
+{
+  write_plain("test_fasta.fa", ">a\nAC\nGT>b desc");
+  fasta fa;
+  read_fasta(fa, "test_fasta.fa");
+  BOOST_REQUIRE_EQUAL(fa.card, 2ul);
+  BOOST_CHECK_EQUAL(fa.names[0], "a");
+  BOOST_CHECK_EQUAL(fa.seqs[0], "ACGT");
+  BOOST_CHECK_EQUAL(fa.names[1], "b");
+  BOOST_CHECK_EQUAL(fa.seqs[1], "");
+  remove("test_fasta.fa");
+}
+
+BOOST_AUTO_TEST_CASE(many_records)
+{
+  ostringstream oss;
+  for (size_t i = 0; i < 40000; ++i) { // several chunks of find_fasta_records
+    oss << ">seq" << i << " len=" << i % 97 << "\n";
+    for (size_t j = 0; j < i % 97; ++j)
+      oss << "ACGTN"[(i + j) % 5] << (j % 60 == 59 ? "\n" : "");
+    oss << "\n";
+  }
+  check_same_as_deweylab(oss.str());
+}
+
+BOOST_AUTO_TEST_CASE(duplicate_names)
+{
+  write_plain("test_fasta.fa", ">a\nACGT\n>b\nAC\n>a\nGG\n");
+  fasta fa;
+  BOOST_CHECK_THROW(read_fasta(fa, "test_fasta.fa"), std::runtime_error);
+  remove("test_fasta.fa");
+}
+
+BOOST_AUTO_TEST_CASE(missing_file)
+{
+  fasta fa;
+  BOOST_CHECK_THROW(read_fasta(fa, "test_fasta_does_not_exist.fa"), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(reverse_complement_arena)
+{
+  seq_arena x, rc;
+  x.push_back("ACGTN");
+  x.push_back("");
+  x.push_back("aacg");
+  reverse_complement(rc, x);
+  BOOST_REQUIRE_EQUAL(rc.size(), 3ul);
+  BOOST_CHECK_EQUAL(rc[0], "NACGT");
+  BOOST_CHECK_EQUAL(rc[1], "");
+  BOOST_CHECK_EQUAL(rc[2], "cgtt");
+  BOOST_CHECK_EQUAL(rc.total_length(), 9ul);
+
+  x.push_back("ACQ");
+  BOOST_CHECK_THROW(reverse_complement(rc, x), std::runtime_error);
+}
@@ -18,6 +18,7 @@
 // along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <string>
+#include <cstring>
 #define BOOST_TEST_MODULE test_lazycsv
 #include <boost/test/unit_test.hpp>
 #include "lazycsv.hh"
@@ -97,3 +98,28 @@ BOOST_AUTO_TEST_CASE(basic_comma)
   BOOST_CHECK_EQUAL(l.at<string>(2), string("three"));
   BOOST_CHECK_EQUAL(l.at<string>(3), string("four"));
 }
+
+BOOST_AUTO_TEST_CASE(field_ranges)
+{
+  string s = "one\t\t-42";
+  lazycsv<3,'\t'> l(s);
+  BOOST_CHECK_EQUAL(string(l.begin(0), l.end(0)), string("one"));
+  BOOST_CHECK(l.begin(1) == l.end(1));
+  BOOST_CHECK_EQUAL(parse_integer<int>(l.begin(2), l.end(2)), -42);
+  BOOST_CHECK(l.field_equals(0, "one"));
+  BOOST_CHECK(!l.field_equals(0, "on"));
+  BOOST_CHECK(!l.field_equals(0, "ones"));
+  BOOST_CHECK(l.field_equals(1, ""));
+}
+
+BOOST_AUTO_TEST_CASE(parse_integer_errors)
+{
+  const char *x[] = { "", "-", "1a", " 1", "+1", "2147483648", "-2147483649" };
+  for (size_t i = 0; i < sizeof(x)/sizeof(x[0]); ++i)
+    BOOST_CHECK_THROW(parse_integer<int>(x[i], x[i] + strlen(x[i])), std::runtime_error);
+  const char *max = "2147483647", *min = "-2147483648";
+  BOOST_CHECK_EQUAL(parse_integer<int>(max, max + strlen(max)), 2147483647);
+  BOOST_CHECK_EQUAL(parse_integer<int>(min, min + strlen(min)), -2147483647 - 1);
+  const char *neg = "-1";
+  BOOST_CHECK_THROW(parse_integer<size_t>(neg, neg + 2), std::runtime_error);
+}
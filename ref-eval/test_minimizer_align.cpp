@@ -0,0 +1,224 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#define BOOST_TEST_MODULE test_minimizer_align
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include "minimizer_align.hh"
+#include "fasta.hh"
+#include "psl.hh"
+#include "simulate.hh"
+
+using namespace std;
+using namespace re::matched;
+using namespace re::align;
+
+string random_seq(size_t len)
+{
+  string s(len, 'A');
+  for (size_t i = 0; i < len; ++i)
+    s[i] = "ACGT"[rand() % 4];
+  return s;
+}
+
+seq_arena make_arena(const string& s)
+{
+  seq_arena x;
+  x.push_back(s);
+  return x;
+}
+
+char other_base(char c)
+{
+  return c == 'A' ? 'C' : 'A';
+}
+
+BOOST_AUTO_TEST_CASE(minimizers_are_strand_symmetric)
+{
+  srand(1);
+  params p;
+  string s = random_seq(1000);
+  vector<minimizer> fwd, rev;
+  find_minimizers(fwd, s, 0, p);
+  find_minimizers(rev, reverse_complement(s), 0, p);
+  BOOST_CHECK_GT(fwd.size(), 1000 / p.w);
+  BOOST_REQUIRE_EQUAL(fwd.size(), rev.size());
+  for (size_t i = 0; i < fwd.size(); ++i) {
+    const minimizer& r = rev[rev.size() - 1 - i];
+    BOOST_CHECK_EQUAL(fwd[i].hash, r.hash);
+    BOOST_CHECK_EQUAL(fwd[i].pos, s.size() - (r.pos + p.k));
+    BOOST_CHECK_NE(fwd[i].rc, r.rc);
+  }
+
+  // No minimizer spans an N.
+  s[500] = 'N';
+  fwd.clear();
+  find_minimizers(fwd, s, 0, p);
+  BOOST_FOREACH(const minimizer& m, fwd)
+    BOOST_CHECK(m.pos + p.k <= 500 || m.pos > 500);
+}
+
+BOOST_AUTO_TEST_CASE(substring_with_substitutions)
+{
+  srand(2);
+  string b = random_seq(1000);
+  string a = b.substr(200, 500);
+  a[100] = other_base(a[100]);
+  a[300] = other_base(a[300]);
+  alignment_set set;
+  align(set, make_arena(a), make_arena(b), false);
+  BOOST_REQUIRE_EQUAL(set.alignments.size(), 1ul);
+  const tagged_alignment& al = set.alignments[0];
+  BOOST_CHECK_EQUAL(al.a_idx, 0ul);
+  BOOST_CHECK_EQUAL(al.b_idx, 0ul);
+  BOOST_REQUIRE_EQUAL(al.segments.size(), 1ul);
+  const alignment_segment& seg = al.segments[0];
+  BOOST_CHECK_EQUAL(seg.a_start, 0ul);
+  BOOST_CHECK_EQUAL(seg.a_end, 499ul);
+  BOOST_CHECK_EQUAL(seg.b_start, 200ul);
+  BOOST_CHECK_EQUAL(seg.b_end, 699ul);
+  BOOST_REQUIRE_EQUAL(seg.a_mismatches.size(), 2ul);
+  BOOST_CHECK_EQUAL(seg.a_mismatches[0], 100ul);
+  BOOST_CHECK_EQUAL(seg.a_mismatches[1], 300ul);
+  BOOST_CHECK_EQUAL(seg.b_mismatches[0], 300ul);
+  BOOST_CHECK_EQUAL(seg.b_mismatches[1], 500ul);
+  BOOST_CHECK_EQUAL(set.identities[0].num_identity_wrt_a, 498);
+  BOOST_CHECK_EQUAL(set.identities[0].frac_indel_wrt_a, 0);
+}
+
+BOOST_AUTO_TEST_CASE(reverse_strand)
+{
+  srand(3);
+  string b = random_seq(1000);
+  string a = reverse_complement(b.substr(100, 600));
+  a[10] = other_base(a[10]);
+  alignment_set set;
+  align(set, make_arena(a), make_arena(b), false);
+  BOOST_REQUIRE_EQUAL(set.alignments.size(), 1ul);
+  BOOST_REQUIRE_EQUAL(set.alignments[0].segments.size(), 1ul);
+  const alignment_segment& seg = set.alignments[0].segments[0];
+  BOOST_CHECK_EQUAL(seg.a_start, 599ul);
+  BOOST_CHECK_EQUAL(seg.a_end, 0ul);
+  BOOST_CHECK_EQUAL(seg.b_start, 100ul);
+  BOOST_CHECK_EQUAL(seg.b_end, 699ul);
+  BOOST_REQUIRE_EQUAL(seg.a_mismatches.size(), 1ul);
+  BOOST_CHECK_EQUAL(seg.a_mismatches[0], 10ul);
+  BOOST_CHECK_EQUAL(seg.b_mismatches[0], 100ul + 599 - 10);
+
+  // With --strand-specific, only the forward strand is aligned.
+  alignment_set ss;
+  align(ss, make_arena(a), make_arena(b), true);
+  BOOST_CHECK_EQUAL(ss.alignments.size(), 0ul);
+}
+
+BOOST_AUTO_TEST_CASE(indels_split_the_blocks)
+{
+  srand(4);
+  string b = random_seq(1000);
+  // a lacks b[400, 403), and has 5 extra bases after b[700].
+  string a = b.substr(0, 400) + b.substr(403, 298) + "GATTC" + b.substr(701);
+  alignment_set set;
+  align(set, make_arena(a), make_arena(b), false);
+  BOOST_REQUIRE_EQUAL(set.alignments.size(), 1ul);
+  const vector<alignment_segment>& segs = set.alignments[0].segments;
+  BOOST_REQUIRE_EQUAL(segs.size(), 3ul);
+  size_t a_len = 0, b_len = 0, mismatches = 0;
+  BOOST_FOREACH(const alignment_segment& seg, segs) {
+    BOOST_CHECK_EQUAL(seg.a_end - seg.a_start, seg.b_end - seg.b_start);
+    a_len += seg.a_end - seg.a_start + 1;
+    b_len += seg.b_end - seg.b_start + 1;
+    mismatches += seg.a_mismatches.size();
+  }
+  BOOST_CHECK_EQUAL(segs[0].a_start, 0ul);
+  BOOST_CHECK_EQUAL(segs[0].b_start, 0ul);
+  BOOST_CHECK_EQUAL(segs[2].a_end, a.size() - 1);
+  BOOST_CHECK_EQUAL(segs[2].b_end, b.size() - 1);
+  BOOST_CHECK_EQUAL(a_len, a.size() - 5);
+  BOOST_CHECK_EQUAL(b_len, b.size() - 3);
+  BOOST_CHECK_EQUAL(mismatches, 0ul);
+  BOOST_CHECK_EQUAL(set.identities[0].frac_indel_wrt_a, 5.0 / a.size());
+  BOOST_CHECK_EQUAL(set.identities[0].frac_indel_wrt_b, 3.0 / b.size());
+}
+
+BOOST_AUTO_TEST_CASE(unrelated_sequences_do_not_align)
+{
+  srand(5);
+  alignment_set set;
+  align(set, make_arena(random_seq(1000)), make_arena(random_seq(1000)), false);
+  BOOST_CHECK_EQUAL(set.alignments.size(), 0ul);
+}
+
+// The simulator's alignments (see simulate.hh) are exact, so nearly every pair
+// of sequences they align should also be aligned by the built-in aligner,
+// covering about as many bases.
+BOOST_AUTO_TEST_CASE(finds_the_simulated_alignments)
+{
+  sim::params sp;
+  sp.seed = 7;
+  sp.num_families = 50;
+  sp.chimera_rate = 0.2;
+  sp.substitution_rate = 0.01;
+  sp.indel_rate = 0.005;
+  sp.n_run_rate = 0.002;
+  ostringstream B_fa, B_expr, A_fa, A_expr, A_to_B, B_to_A;
+  sim::simulate(sp, B_fa, B_expr, A_fa, A_expr, A_to_B, B_to_A);
+  ofstream("test_minimizer_align.A.fa") << A_fa.str();
+  ofstream("test_minimizer_align.B.fa") << B_fa.str();
+  fasta A, B;
+  read_fasta(A, "test_minimizer_align.A.fa");
+  read_fasta(B, "test_minimizer_align.B.fa");
+
+  alignment_set set;
+  align(set, A.seqs, B.seqs, false);
+  map<pair<size_t, size_t>, size_t> aligned;
+  for (size_t i = 0; i < set.alignments.size(); ++i) {
+    const tagged_alignment& al = set.alignments[i];
+    size_t n = 0;
+    BOOST_FOREACH(const alignment_segment& seg, al.segments)
+      n += seg.b_end - seg.b_start + 1;
+    size_t& best = aligned[make_pair(al.a_idx, al.b_idx)];
+    best = max(best, n);
+  }
+
+  ::detail::psl_alignment_input_stream is(boost::make_shared<istringstream>(A_to_B.str()));
+  psl_alignment psl;
+  size_t num = 0, num_found = 0, truth_bases = 0, found_bases = 0;
+  while (is >> psl) {
+    size_t a_idx = A.names_to_idxs.find(psl.a_name_ref());
+    size_t b_idx = B.names_to_idxs.find(psl.b_name_ref());
+    ++num;
+    map<pair<size_t, size_t>, size_t>::const_iterator it = aligned.find(make_pair(a_idx, b_idx));
+    if (it != aligned.end()) {
+      ++num_found;
+      truth_bases += psl.matches() + psl.mis_matches() + psl.n_count();
+      found_bases += it->second;
+    }
+  }
+  BOOST_CHECK_GT(num, 50ul);
+  BOOST_CHECK_GE(num_found, 0.95 * num);
+  BOOST_CHECK_GE(found_bases, 0.95 * truth_bases);
+  BOOST_CHECK_LE(found_bases, 1.05 * truth_bases);
+}
@@ -0,0 +1,143 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#define BOOST_TEST_MODULE test_mismatch
+#include <boost/test/unit_test.hpp>
+#include "mismatch.hh"
+
+// Returns a random sequence over the given alphabet, in which each base
+// equals the corresponding base of like with probability 3/4.
+std::string random_seq(size_t len, const std::string& alphabet, const std::string& like = "")
+{
+  std::string s(len, 'A');
+  for (size_t i = 0; i < len; ++i) {
+    if (i < like.size() && rand() % 4 != 0)
+      s[i] = like[i];
+    else
+      s[i] = alphabet[rand() % alphabet.size()];
+  }
+  return s;
+}
+
+void check_against_scalar(const std::string& a, size_t a_start, bool a_is_rc,
+                          const std::string& b, size_t b_start, size_t len)
+{
+  std::vector<size_t> a_mm, b_mm, a_expected, b_expected;
+  find_mismatches(a.data(), a_start, a_is_rc, b.data(), b_start, len, a_mm, b_mm);
+  detail::find_mismatches_scalar(a.data(), a_start, a_is_rc, b.data(), b_start, 0, len, a_expected, b_expected);
+  BOOST_CHECK(a_mm == a_expected);
+  BOOST_CHECK(b_mm == b_expected);
+}
+
+BOOST_AUTO_TEST_CASE(simple)
+{
+  std::vector<size_t> a_mm, b_mm;
+
+  // Forward strand: one substitution and one N.
+  std::string a = "ACGTACGTACGTACGTACGTACGTACGTACGTACGTACGT";
+  std::string b = "ACGTACGTACTTACGTACGTACGTACGTACGTACGTNCGT";
+  find_mismatches(a.data(), 0, false, b.data(), 0, a.size(), a_mm, b_mm);
+  BOOST_REQUIRE_EQUAL(a_mm.size(), 2);
+  BOOST_CHECK_EQUAL(a_mm[0], 10); BOOST_CHECK_EQUAL(b_mm[0], 10);
+  BOOST_CHECK_EQUAL(a_mm[1], 36); BOOST_CHECK_EQUAL(b_mm[1], 36);
+
+  // Reverse strand: a is the reverse complement of b, except at b's N.
+  std::string rc = reverse_complement(a);
+  a_mm.clear(); b_mm.clear();
+  find_mismatches(rc.data(), rc.size() - 1, true, a.data(), 0, a.size(), a_mm, b_mm);
+  BOOST_CHECK(a_mm.empty());
+  find_mismatches(rc.data(), rc.size() - 1, true, b.data(), 0, b.size(), a_mm, b_mm);
+  BOOST_REQUIRE_EQUAL(a_mm.size(), 2);
+  BOOST_CHECK_EQUAL(a_mm[0], rc.size() - 1 - 10); BOOST_CHECK_EQUAL(b_mm[0], 10);
+  BOOST_CHECK_EQUAL(a_mm[1], rc.size() - 1 - 36); BOOST_CHECK_EQUAL(b_mm[1], 36);
+
+  // Case matters, and N never matches, not even N.
+  a = std::string(20, 'a') + std::string(20, 'N');
+  b = std::string(20, 'A') + std::string(20, 'N');
+  a_mm.clear(); b_mm.clear();
+  find_mismatches(a.data(), 0, false, b.data(), 0, a.size(), a_mm, b_mm);
+  BOOST_CHECK_EQUAL(a_mm.size(), 40);
+}
+
+BOOST_AUTO_TEST_CASE(random_blocks)
+{
+  srand(1);
+  const std::string alphabets[] = { "ACGT", "ACGTN", "ACGTNacgtn", "ACGTRYSWacgt" };
+  for (size_t trial = 0; trial < 2000; ++trial) {
+    const std::string& alphabet = alphabets[trial % 4];
+    size_t len = rand() % 150;
+    size_t a_offset = rand() % 20, b_offset = rand() % 20;
+    std::string b = random_seq(len + b_offset + rand() % 20, alphabet);
+    std::string b_block = b.substr(b_offset, len);
+
+    // Forward strand.
+    std::string a = random_seq(a_offset, alphabet) + random_seq(len, alphabet, b_block) + random_seq(rand() % 20, alphabet);
+    check_against_scalar(a, a_offset, false, b, b_offset, len);
+
+    // Reverse strand.
+    std::string a_rc = reverse_complement(a);
+    check_against_scalar(a_rc, a_rc.size() - 1 - a_offset, true, b, b_offset, len);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(invalid_base)
+{
+  // Complementing an invalid base throws, as it did before vectorization,
+  // wherever in the block the base is.
+  for (size_t i = 0; i < 40; ++i) {
+    std::string a(40, 'A'), b(40, 'T');
+    a[i] = 'X';
+    std::vector<size_t> a_mm, b_mm;
+    BOOST_CHECK_THROW(find_mismatches(a.data(), a.size() - 1, true, b.data(), 0, b.size(), a_mm, b_mm), std::runtime_error);
+    a_mm.clear(); b_mm.clear();
+    find_mismatches(a.data(), 0, false, b.data(), 0, b.size(), a_mm, b_mm);
+    BOOST_CHECK_EQUAL(a_mm.size(), 40);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(simd_levels)
+{
+  // Every instruction set up to the most capable one the CPU supports gives
+  // the same mismatches as the per-base path.
+  BOOST_CHECK_EQUAL(get_simd_level(), max_simd_level());
+  BOOST_CHECK_EQUAL(parse_simd_level("auto"), max_simd_level());
+  BOOST_CHECK_THROW(parse_simd_level("sse9"), std::runtime_error);
+  if (max_simd_level() < simd_avx2)
+    BOOST_CHECK_THROW(set_simd_level(simd_avx2), std::runtime_error);
+
+  srand(2);
+  const char *names[] = { "none", "sse2", "avx2" };
+  for (int level = simd_none; level <= max_simd_level(); ++level) {
+    set_simd_level(parse_simd_level(names[level]));
+    BOOST_CHECK_EQUAL(get_simd_level(), level);
+    for (size_t trial = 0; trial < 500; ++trial) {
+      size_t len = rand() % 150;
+      std::string b = random_seq(len, "ACGTNacgtn");
+      std::string a = random_seq(len + 1, "ACGTNacgtn", b);
+      check_against_scalar(a, 1, false, b, 0, len);
+      std::string a_rc = reverse_complement(a);
+      check_against_scalar(a_rc, a_rc.size() - 2, true, b, 0, len);
+    }
+  }
+  set_simd_level(max_simd_level());
+}
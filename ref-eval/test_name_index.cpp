@@ -0,0 +1,107 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <sstream>
+#include <string>
+#include <vector>
+#define BOOST_TEST_MODULE test_name_index
+#include <boost/test/unit_test.hpp>
+#include "name_index.hh"
+
+BOOST_AUTO_TEST_CASE(simple)
+{
+  name_index idx;
+  BOOST_CHECK_EQUAL(idx.size(), 0);
+  BOOST_CHECK_EQUAL(idx.find("contig_1"), name_index::npos);
+
+  BOOST_CHECK(idx.insert("contig_1"));
+  BOOST_CHECK(idx.insert("contig_2"));
+  BOOST_CHECK(idx.insert(""));
+  BOOST_CHECK(!idx.insert("contig_1"));
+  BOOST_CHECK_EQUAL(idx.size(), 3);
+
+  BOOST_CHECK_EQUAL(idx.find("contig_1"), 0);
+  BOOST_CHECK_EQUAL(idx.find("contig_2"), 1);
+  BOOST_CHECK_EQUAL(idx.find(""), 2);
+  BOOST_CHECK_EQUAL(idx.find("contig_"), name_index::npos);
+  BOOST_CHECK_EQUAL(idx.find("contig_10"), name_index::npos);
+  BOOST_CHECK_EQUAL(idx.count("contig_2"), 1);
+  BOOST_CHECK_EQUAL(idx.count("contig_3"), 0);
+  BOOST_CHECK_EQUAL(idx.name(1).str(), "contig_2");
+  BOOST_CHECK_EQUAL(idx.name(2).str(), "");
+}
+
+BOOST_AUTO_TEST_CASE(lookup_by_ref)
+{
+  // Names can be looked up by a range inside a larger string, such as a
+  // field of an alignment line.
+  name_index idx;
+  idx.insert(std::string("tx4"));
+  std::string line = "518\t2\ttx4\t1481";
+  const char *beg = line.data() + 6;
+  BOOST_CHECK_EQUAL(idx.find(string_ref(beg, beg + 3)), 0);
+  BOOST_CHECK_EQUAL(idx.find(string_ref(beg, beg + 2)), name_index::npos);
+  BOOST_CHECK_EQUAL(idx.find(string_ref(beg, beg + 4)), name_index::npos);
+}
+
+BOOST_AUTO_TEST_CASE(many_names)
+{
+  // Enough names to make the table grow several times.
+  name_index idx;
+  const size_t n = 200000;
+  for (size_t i = 0; i < n; ++i) {
+    std::ostringstream oss;
+    oss << "TRINITY_DN" << i << "_c0_g1_i1";
+    BOOST_REQUIRE(idx.insert(oss.str()));
+  }
+  BOOST_CHECK_EQUAL(idx.size(), n);
+  for (size_t i = 0; i < n; ++i) {
+    std::ostringstream oss;
+    oss << "TRINITY_DN" << i << "_c0_g1_i1";
+    BOOST_REQUIRE_EQUAL(idx.find(oss.str()), i);
+    BOOST_REQUIRE_EQUAL(idx.name(i).str(), oss.str());
+    BOOST_REQUIRE(!idx.insert(oss.str()));
+  }
+  for (size_t i = n; i < n + 1000; ++i) {
+    std::ostringstream oss;
+    oss << "TRINITY_DN" << i << "_c0_g1_i1";
+    BOOST_REQUIRE_EQUAL(idx.find(oss.str()), name_index::npos);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(find_or_insert)
+{
+  // Read names, as when grouping the alignments of a BAM file by read: each
+  // name gets the index of its first occurrence.
+  name_index idx;
+  const char *names[] = { "r7", "r2", "r7", "r9", "r2", "r7" };
+  const size_t expected[] = { 0, 1, 0, 2, 1, 0 };
+  for (size_t i = 0; i < 6; ++i)
+    BOOST_CHECK_EQUAL(idx.find_or_insert(names[i]), expected[i]);
+  BOOST_CHECK_EQUAL(idx.size(), 3);
+  BOOST_CHECK_EQUAL(idx.name(2).str(), "r9");
+
+  for (size_t i = 0; i < 100000; ++i) {
+    std::ostringstream oss;
+    oss << "read" << i % 30000;
+    BOOST_REQUIRE_EQUAL(idx.find_or_insert(oss.str()), 3 + i % 30000);
+  }
+  BOOST_CHECK_EQUAL(idx.size(), 30003);
+}
@@ -0,0 +1,279 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#define BOOST_TEST_MODULE test_packed_seqs
+#include <boost/test/unit_test.hpp>
+#include "re_kmer.hh"
+
+using namespace std;
+using namespace re::kmer;
+
+string random_seq(mt19937& rng, size_t len, const string& alphabet)
+{
+  uniform_int_distribution<size_t> dist(0, alphabet.size() - 1);
+  string s(len, ' ');
+  for (size_t j = 0; j < len; ++j)
+    s[j] = alphabet[dist(rng)];
+  return s;
+}
+
+// Returns the packed word of the kmer s, as computed by hand.
+uint64_t encode(const string& s)
+{
+  uint64_t x = 0;
+  for (size_t j = 0; j < s.size(); ++j)
+    x |= static_cast<uint64_t>(string("ACGT").find(s[j])) << (2 * j);
+  return x;
+}
+
+BOOST_AUTO_TEST_CASE(unpack)
+{
+  mt19937 rng(1);
+  seq_arena seqs;
+  seqs.push_back("");
+  seqs.push_back("NNNN");
+  seqs.push_back("ACGTNNacgtRYA");
+  for (size_t i = 0; i < 50; ++i)
+    seqs.push_back(random_seq(rng, i * 7, "ACGTACGTACGTNnaR"));
+  packed_seqs p(seqs);
+
+  BOOST_REQUIRE_EQUAL(p.size(), seqs.size());
+  for (size_t i = 0; i < seqs.size(); ++i) {
+    string s = seqs[i].str();
+    string rc = reverse_complement(s);
+    BOOST_REQUIRE_EQUAL(p.length(i), s.size());
+    BOOST_CHECK_EQUAL(p.str(i), s);
+    BOOST_CHECK_EQUAL(p.rc_str(i), rc);
+    for (size_t j = 0; j < s.size(); ++j) {
+      BOOST_CHECK_EQUAL(p.at(i, j), s[j]);
+      BOOST_CHECK_EQUAL(p.rc_at(i, j), rc[j]);
+    }
+  }
+  BOOST_CHECK(!p.only_N_exceptions());
+  BOOST_CHECK_EQUAL(p.exceptions_end(1) - p.exceptions_begin(1), 1);
+  BOOST_CHECK_EQUAL(p.exceptions_begin(1)->len, 4u);
+}
+
+BOOST_AUTO_TEST_CASE(kmers)
+{
+  mt19937 rng(2);
+  seq_arena seqs;
+  for (size_t i = 0; i < 20; ++i)
+    seqs.push_back(random_seq(rng, 40 + i * 13, "ACGT"));
+  packed_seqs p(seqs);
+  BOOST_CHECK(p.only_N_exceptions());
+
+  for (size_t k = 1; k <= packed_seqs::max_kmer_word_len; ++k) {
+    for (size_t i = 0; i < seqs.size(); ++i) {
+      string s = seqs[i].str();
+      for (size_t j = 0; j + k <= s.size(); ++j) {
+        string kmer = s.substr(j, k);
+        uint64_t x = p.kmer(i, j, k);
+        BOOST_REQUIRE_EQUAL(x, encode(kmer));
+        BOOST_REQUIRE_EQUAL(packed_seqs::reverse_complement_kmer(x, k), encode(reverse_complement(kmer)));
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(simd_levels)
+{
+  // Every instruction set packs the bases and finds the exceptions and Ns
+  // exactly as the per-base path does.
+  mt19937 rng(4);
+  seq_arena seqs;
+  for (size_t i = 0; i < 60; ++i)
+    seqs.push_back(random_seq(rng, i * 11, i % 3 == 0 ? "ACGT" : "ACGTACGTACGTACGTNnacgtRY-"));
+  set_simd_level(simd_none);
+  packed_seqs expected(seqs);
+
+  for (int level = simd_sse2; level <= max_simd_level(); ++level) {
+    set_simd_level(static_cast<simd_level>(level));
+    packed_seqs p(seqs);
+    for (size_t i = 0; i < seqs.size(); ++i) {
+      BOOST_REQUIRE_EQUAL(p.str(i), seqs[i].str());
+      for (size_t j = 0; j < p.length(i); ++j)
+        BOOST_REQUIRE_EQUAL(p.base(i, j), expected.base(i, j));
+      BOOST_REQUIRE_EQUAL(p.exceptions_end(i) - p.exceptions_begin(i),
+                          expected.exceptions_end(i) - expected.exceptions_begin(i));
+      for (const packed_seqs::exception_run *r = p.exceptions_begin(i), *e = expected.exceptions_begin(i);
+           r != p.exceptions_end(i); ++r, ++e) {
+        BOOST_CHECK_EQUAL(r->start, e->start);
+        BOOST_CHECK_EQUAL(r->len, e->len);
+        BOOST_CHECK_EQUAL(r->c, e->c);
+      }
+
+      string s = seqs[i].str();
+      const char *beg = s.data(), *end = s.data() + s.size();
+      for (const char *q = beg; q <= end; ++q)
+        BOOST_REQUIRE_EQUAL(find_N(q, end) - beg, detail::find_N_scalar(q, end) - beg);
+      // The kmer starts that survive skip_Ns(), walked as re_kc.hh does.
+      auto kmer_starts = [&](size_t k) {
+        vector<size_t> starts;
+        const char *q = beg, *kmer_end = end + 1 - k;
+        q = skip_Ns(q, kmer_end, k, true);
+        for (; q != kmer_end; ++q) {
+          q = skip_Ns(q, kmer_end, k, false);
+          if (q == kmer_end)
+            break;
+          starts.push_back(q - beg);
+        }
+        return starts;
+      };
+      for (size_t k = 1; k <= 40 && k <= s.size(); k += 13) {
+        vector<size_t> starts = kmer_starts(k);
+        set_simd_level(simd_none);
+        vector<size_t> expected_starts = kmer_starts(k);
+        set_simd_level(static_cast<simd_level>(level));
+        BOOST_CHECK(starts == expected_starts);
+      }
+    }
+  }
+  set_simd_level(max_simd_level());
+}
+
+// Decodes the packed keys of ht, to compare them with the keys of a
+// kmer_key-based table.
+template<typename Ht>
+map<string, double> decode(const Ht& ht, size_t k, size_t A_or_B)
+{
+  map<string, double> m;
+  for (typename Ht::const_iterator it = ht.begin(); it != ht.end(); ++it) {
+    string s(k, ' ');
+    for (size_t j = 0; j < k; ++j)
+      s[j] = "ACGT"[(it->first >> (2 * j)) & 3];
+    m[s] = it->second.weights[A_or_B];
+  }
+  return m;
+}
+
+BOOST_AUTO_TEST_CASE(count_packed_kmers_matches_count_kmers)
+{
+  mt19937 rng(3);
+  seq_arena seqs, rc;
+  vector<double> tau;
+  for (size_t i = 0; i < 30; ++i) {
+    seqs.push_back(random_seq(rng, i * 5, "ACGTACGTACGTACGTNn"));
+    tau.push_back(1.0 / (i + 1));
+  }
+  seqs.push_back("NNNNACGTACGTNNNNNNNNGGCCAATT");
+  tau.push_back(0.5);
+  reverse_complement(rc, seqs);
+  packed_seqs p(seqs);
+  BOOST_REQUIRE(p.only_N_exceptions());
+
+  for (size_t k = 1; k <= max_packed_kmerlen; k += 3) {
+    for (int strand_specific = 0; strand_specific < 2; ++strand_specific) {
+      sparse_double_kmer_map expected_ht(0, kmer_key_hash(k), kmer_key_equal_to(k));
+      count_kmers<sparse_double_kmer_map, 1>(expected_ht, seqs, rc, tau, k, strand_specific);
+      map<string, double> expected;
+      for (sparse_double_kmer_map::const_iterator it = expected_ht.begin(); it != expected_ht.end(); ++it)
+        expected[string(it->first, k)] = it->second.weight_in_B();
+
+      dense_double_packed_kmer_map ht;
+      empty_key_initializer<dense_double_packed_kmer_map> eki(ht, k);
+      count_packed_kmers<dense_double_packed_kmer_map, 1>(ht, p, tau, k, strand_specific);
+      BOOST_CHECK(decode(ht, k, 1) == expected);
+    }
+  }
+}
+
+fasta make_fasta(const seq_arena& seqs)
+{
+  fasta fa;
+  fa.card = seqs.size();
+  fa.seqs = seqs;
+  for (size_t i = 0; i < seqs.size(); ++i)
+    fa.lengths.push_back(seqs.length(i));
+  return fa;
+}
+
+// Returns the scores written by re::kmer::main, by name.
+map<string, double> kmer_scores(const opts& o, const fasta& A, const fasta& B,
+                                const vector<const expr *>& taus_A,
+                                const vector<const expr *>& taus_B)
+{
+  ostringstream out;
+  opts o2 = o;
+  o2.out = &out;
+  re::kmer::main(o2, A, B, taus_A, taus_B, expr(), expr());
+  map<string, double> scores;
+  istringstream in(out.str());
+  string name;
+  double value;
+  while (in >> name >> value)
+    scores[name] = value;
+  return scores;
+}
+
+// Scoring several expression profiles in one pass gives the same scores as
+// scoring each on its own, for packed and unpacked sequences (the latter
+// because of the lowercase bases) and both kinds of hash table.
+BOOST_AUTO_TEST_CASE(kmer_profiles_match_single_profiles)
+{
+  mt19937 rng(4);
+  uniform_real_distribution<double> unif(0.0, 1.0);
+  for (int packed = 0; packed < 2; ++packed) {
+    string alphabet = packed ? "ACGTACGTACGTN" : "ACGTACGTacgtN";
+    seq_arena A_seqs, B_seqs;
+    for (size_t i = 0; i < 20; ++i) {
+      B_seqs.push_back(random_seq(rng, 50 + i * 10, alphabet));
+      A_seqs.push_back(string(B_seqs[i].str(), 0, 40 + i * 5));
+    }
+    fasta A = make_fasta(A_seqs), B = make_fasta(B_seqs);
+    vector<expr> taus_A(2, expr(A.card)), taus_B(3, expr(B.card));
+    for (size_t p = 0; p < 2; ++p)
+      for (size_t i = 0; i < A.card; ++i)
+        taus_A[p][i] = unif(rng);
+    for (size_t p = 0; p < 3; ++p)
+      for (size_t i = 0; i < B.card; ++i)
+        taus_B[p][i] = unif(rng);
+
+    const char *types[] = {"sparse", "dense"};
+    for (size_t t = 0; t < 2; ++t) {
+      opts o;
+      o.kmer = o.weighted = true;
+      o.kmerlen = 7;
+      o.hash_table_type = types[t];
+      o.hash_table_numeric_type = "double";
+      o.hash_table_fudge_factor = 1.0;
+      // Profiles (A0, B0), (A1, B1), and (A1, B2).
+      vector<const expr *> As, Bs;
+      As.push_back(&taus_A[0]); As.push_back(&taus_A[1]); As.push_back(&taus_A[1]);
+      Bs.push_back(&taus_B[0]); Bs.push_back(&taus_B[1]); Bs.push_back(&taus_B[2]);
+      map<string, double> all = kmer_scores(o, A, B, As, Bs);
+      BOOST_CHECK_EQUAL(all.size(), 15ul);
+      for (size_t p = 0; p < 3; ++p) {
+        map<string, double> one = kmer_scores(o, A, B, vector<const expr *>(1, As[p]), vector<const expr *>(1, Bs[p]));
+        BOOST_REQUIRE_EQUAL(one.size(), 5ul);
+        for (map<string, double>::const_iterator it = one.begin(); it != one.end(); ++it) {
+          string name = it->first + "." + to_string(p + 1);
+          BOOST_REQUIRE(all.count(name));
+          BOOST_CHECK_CLOSE(all[name], it->second, 1e-3);
+        }
+      }
+    }
+  }
+}
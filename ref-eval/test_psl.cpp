@@ -268,3 +268,32 @@ BOOST_AUTO_TEST_CASE(iterator_equality)
   BOOST_CHECK(it1 != it2);
   BOOST_CHECK(it1 == end);
 }
+
+BOOST_AUTO_TEST_CASE(cached_fields)
+{
+  psl_alignment al;
+  std::string line = "79	0	0	0	3	10	2	7	-	Locus_1_Transcript_1/48_Confidence_0.136_Length_1158	1158	268	357	Locus_1_Transcript_25/41_Confidence_0.222_Length_1952	1952	1866	1952	4	17,47,6,9,	268,286,335,348,	1866,1883,1931,1943,";
+  al.parse_line(line);
+  BOOST_CHECK_EQUAL(al.q_start(), 268);
+  BOOST_CHECK_EQUAL(al.t_size(), 1952);
+  BOOST_CHECK_EQUAL(al.block_count(), 4);
+  BOOST_CHECK(al.is_rc());
+  int block_sizes[] = {17,47,6,9};
+  int t_starts[] = {1866,1883,1931,1943};
+  BOOST_CHECK_EQUAL_COLLECTIONS(al.block_sizes().begin(), al.block_sizes().end(), block_sizes, block_sizes + 4);
+  BOOST_CHECK_EQUAL_COLLECTIONS(al.t_starts().begin(), al.t_starts().end(), t_starts, t_starts + 4);
+
+  // Reuse the same object for a line with more blocks than fit inline.
+  std::ostringstream sizes, starts;
+  for (int i = 0; i < 20; ++i) {
+    sizes << 1 << ",";
+    starts << 2*i << ",";
+  }
+  line = "20	0	0	0	19	19	19	19	+	a	40	0	39	b	40	0	39	20	" + sizes.str() + "	" + starts.str() + "	" + starts.str();
+  al.parse_line(line);
+  BOOST_CHECK(!al.is_rc());
+  BOOST_CHECK_EQUAL(al.block_sizes().size(), 20ul);
+  BOOST_CHECK_EQUAL(al.q_starts()[19], 38);
+
+  BOOST_CHECK_THROW(al.parse_line("x	0	0	0	0	0	0	0	+	a	1	0	1	b	1	0	1	1	1,	0,	0,"), std::runtime_error);
+}
@@ -19,6 +19,9 @@
 
 #define BOOST_TEST_MODULE test_re_kc
 #include <boost/test/unit_test.hpp>
+#include <map>
+#include <sstream>
+#include <boost/lexical_cast.hpp>
 #include "re_kc.hh"
 
 using namespace re::kc;
@@ -113,3 +116,71 @@ BOOST_AUTO_TEST_CASE(example_from_oases_mouse_chr1_cc_0_reverse_complemented)
   for (size_t i = 0; i + k - 1 < len; ++i)
     BOOST_CHECK_EQUAL(skip_Ns(seq + i, end, k, false), seq + i);
 }
+
+static std::map<std::string, double> kc_scores(
+    const opts& o,
+    const fasta& A,
+    const fasta& B,
+    const std::vector<const expr *>& taus_B)
+{
+  std::ostringstream out;
+  opts o2 = o;
+  o2.out = &out;
+  re::kc::main(o2, A, B, taus_B);
+  std::istringstream in(out.str());
+  std::map<std::string, double> scores;
+  std::string name;
+  double value;
+  while (in >> name >> value)
+    scores[name] = value;
+  return scores;
+}
+
+// Scoring several expression profiles of B in one pass gives the same scores
+// as scoring each on its own.
+BOOST_AUTO_TEST_CASE(kc_profiles_match_single_profiles)
+{
+  const char *seqs[] = {
+    "ACGTTGCAAGGCTTACGATCGATCGGCTAGCTAGGATCCGATNGCTAGCT",
+    "TTGACCGATGCATGCAAGCTTGCATGGCCATAGGCTAGCAAGCTTAGGCA",
+    "GGGCCCATATATGCGCGCTTAAGGCCTTAGACGATCAGCTAGCATCGACT",
+    "ACGTTGCAAGGCTTACGATCGATCGG",
+    "TGCCTAAGCTTGCTAGCCTATGGCCATGCAAGC"};
+  fasta A, B;
+  for (size_t i = 0; i < 5; ++i) {
+    fasta& f = i < 3 ? B : A;
+    f.seqs.push_back(seqs[i]);
+    f.lengths.push_back(f.seqs.length(f.lengths.size()));
+  }
+  A.card = A.lengths.size();
+  B.card = B.lengths.size();
+
+  double values[3][3] = {{0.2, 0.3, 0.5}, {0.7, 0.1, 0.2}, {0.0, 0.0, 1.0}};
+  std::vector<expr> taus(3, expr(3));
+  std::vector<const expr *> all;
+  for (size_t p = 0; p < 3; ++p) {
+    std::copy(values[p], values[p] + 3, taus[p].begin());
+    all.push_back(&taus[p]);
+  }
+
+  const char *types[] = {"sparse", "dense"};
+  for (size_t t = 0; t < 2; ++t) {
+    opts o;
+    o.kc = true;
+    o.readlen = o.kmerlen = 10;
+    o.num_reads = 20;
+    o.hash_table_type = types[t];
+    o.hash_table_numeric_type = "double";
+    o.hash_table_fudge_factor = 1.0;
+    std::map<std::string, double> scores = kc_scores(o, A, B, all);
+    BOOST_CHECK_EQUAL(scores.size(), 7ul);
+    for (size_t p = 0; p < 3; ++p) {
+      std::map<std::string, double> one = kc_scores(o, A, B, std::vector<const expr *>(1, all[p]));
+      BOOST_REQUIRE_EQUAL(one.size(), 3ul);
+      std::string suffix = "." + boost::lexical_cast<std::string>(p + 1);
+      BOOST_CHECK_CLOSE(scores["weighted_kmer_recall" + suffix], one["weighted_kmer_recall"], 1e-6);
+      BOOST_CHECK_CLOSE(scores["kmer_compression_score" + suffix], one["kmer_compression_score"], 1e-6);
+      BOOST_CHECK_CLOSE(scores["inverse_compression_rate"], one["inverse_compression_rate"], 1e-6);
+    }
+  }
+}
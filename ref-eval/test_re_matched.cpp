@@ -21,12 +21,18 @@
 #include <iostream>
 #include <random>       // std::default_random_engine
 #include <chrono>       // std::chrono::system_clock
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <dirent.h>
+#include <unistd.h>
 #define BOOST_TEST_MODULE test_summarize_matched_meat
 #include <boost/test/floating_point_comparison.hpp>
 #include <boost/test/unit_test.hpp>
 #include <boost/foreach.hpp>
 #include "re_matched.hh"
 
+using namespace re;
 using namespace re::matched;
 
 #define CHECK_CLOSE(x, y) \
@@ -67,7 +73,7 @@ double nucl_denom(Lens lens, Taus taus)
 // one perfect alignment from a0 -> b0, where these are the only seqs present
 BOOST_AUTO_TEST_CASE(sanity)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 99, 0, 99, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 99, 0, 99, {}, {}} } };
   size_t A_card = 1, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1}, A_card, B_card, Lens{100}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1}, A_card, B_card, Lens{100}, Taus{1.0}, 0);
@@ -95,8 +101,8 @@ BOOST_AUTO_TEST_CASE(sanity_2)
 //  b: ----------
 BOOST_AUTO_TEST_CASE(perfect_two_to_one)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 499,   0, 499, {}, {}} }, nan("") };
-  tagged_alignment al2{ 1, 0, Segs{ {0, 499, 500, 999, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 499,   0, 499, {}, {}} } };
+  tagged_alignment al2{ 1, 0, Segs{ {0, 499, 500, 999, {}, {}} } };
   size_t A_card = 2, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 0);
@@ -112,8 +118,8 @@ BOOST_AUTO_TEST_CASE(perfect_two_to_one)
 //  b: ----------
 BOOST_AUTO_TEST_CASE(covered_two_to_one)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 999,   0, 999, {}, {}} }, nan("") };
-  tagged_alignment al2{ 1, 0, Segs{ {0, 499, 500, 999, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 999,   0, 999, {}, {}} } };
+  tagged_alignment al2{ 1, 0, Segs{ {0, 499, 500, 999, {}, {}} } };
   size_t A_card = 2, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 0);
@@ -130,8 +136,8 @@ BOOST_AUTO_TEST_CASE(covered_two_to_one)
 //  b: ----------
 BOOST_AUTO_TEST_CASE(mostly_covered_two_to_one)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 989,   0, 989, {}, {}} }, nan("") };
-  tagged_alignment al2{ 1, 0, Segs{ {0, 499, 500, 999, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 989,   0, 989, {}, {}} } };
+  tagged_alignment al2{ 1, 0, Segs{ {0, 499, 500, 999, {}, {}} } };
   size_t A_card = 2, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 20);
   double nucl_recall = compute_recall<nucl_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 20);
@@ -147,8 +153,8 @@ BOOST_AUTO_TEST_CASE(mostly_covered_two_to_one)
 //  b: ----------
 BOOST_AUTO_TEST_CASE(overlapping_two_to_one)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 599,   0, 599, {}, {}} }, nan("") };
-  tagged_alignment al2{ 1, 0, Segs{ {0, 599, 400, 999, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 599,   0, 599, {}, {}} } };
+  tagged_alignment al2{ 1, 0, Segs{ {0, 599, 400, 999, {}, {}} } };
   size_t A_card = 2, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 0);
@@ -166,8 +172,8 @@ BOOST_AUTO_TEST_CASE(overlapping_two_to_one)
 //  b: ----------
 BOOST_AUTO_TEST_CASE(two_to_one_partial_coverage)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {1, 490,   1, 490, {}, {}} }, nan("") };
-  tagged_alignment al2{ 1, 0, Segs{ {1, 480, 501, 980, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {1, 490,   1, 490, {}, {}} } };
+  tagged_alignment al2{ 1, 0, Segs{ {1, 480, 501, 980, {}, {}} } };
   size_t A_card = 2, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1, al2}, A_card, B_card, Lens{1000}, Taus{1.0}, 0);
@@ -184,9 +190,9 @@ BOOST_AUTO_TEST_CASE(two_to_one_partial_coverage)
 //  b: ----------------------------
 BOOST_AUTO_TEST_CASE(two_to_one_split_alignment)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {  0, 299,    0,  299, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {  0, 299,    0,  299, {}, {}} } };
   tagged_alignment al2{ 1, 0, Segs{ {  0,  49,  100,  149, {}, {}},
-                                    {100, 999, 1000, 1899, {}, {}} }, nan("") };
+                                    {100, 999, 1000, 1899, {}, {}} } };
   size_t A_card = 2, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1, al2}, A_card, B_card, Lens{2000}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1, al2}, A_card, B_card, Lens{2000}, Taus{1.0}, 0);
@@ -206,8 +212,8 @@ BOOST_AUTO_TEST_CASE(two_to_one_split_alignment)
 //        111      with very high expression
 BOOST_AUTO_TEST_CASE(one_to_two_split_alignment)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {  0, 499, 0, 499, {}, {}} }, nan("") };
-  tagged_alignment al2{ 0, 1, Segs{ {200, 299, 0,  99, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {  0, 499, 0, 499, {}, {}} } };
+  tagged_alignment al2{ 0, 1, Segs{ {200, 299, 0,  99, {}, {}} } };
   size_t A_card = 1, B_card = 2;
   Lens lens{500, 100};
   Taus taus{0.01, 0.99};
@@ -223,7 +229,7 @@ BOOST_AUTO_TEST_CASE(one_to_two_split_alignment)
 //  b0: -------
 BOOST_AUTO_TEST_CASE(one_mismatch)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {1000, 1099, 0, 99, {1050}, {50}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {1000, 1099, 0, 99, {1050}, {50}} } };
   size_t A_card = 1, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1}, A_card, B_card, Lens{100}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1}, A_card, B_card, Lens{100}, Taus{1.0}, 0);
@@ -237,7 +243,7 @@ BOOST_AUTO_TEST_CASE(one_mismatch)
 //  b0: -------
 BOOST_AUTO_TEST_CASE(two_mismatches)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {1000, 1099, 0, 99, {1048, 1050}, {48, 50}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {1000, 1099, 0, 99, {1048, 1050}, {48, 50}} } };
   size_t A_card = 1, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1}, A_card, B_card, Lens{100}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1}, A_card, B_card, Lens{100}, Taus{1.0}, 0);
@@ -252,8 +258,8 @@ BOOST_AUTO_TEST_CASE(two_mismatches)
 //  b0: -------
 BOOST_AUTO_TEST_CASE(disjoint_mismatches)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 99, 0, 99, {48, 50}, {48, 50}} }, nan("") };
-  tagged_alignment al2{ 0, 0, Segs{ {0, 99, 0, 99, {    52}, {    52}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 99, 0, 99, {48, 50}, {48, 50}} } };
+  tagged_alignment al2{ 0, 0, Segs{ {0, 99, 0, 99, {    52}, {    52}} } };
   size_t A_card = 2, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1, al2}, A_card, B_card, Lens{100}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1, al2}, A_card, B_card, Lens{100}, Taus{1.0}, 0);
@@ -268,8 +274,8 @@ BOOST_AUTO_TEST_CASE(disjoint_mismatches)
 //  b0: -------------
 BOOST_AUTO_TEST_CASE(more_complicated_mismatches)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 99,   0,  99, {50, 80, 81}, {50, 80, 81}} }, nan("") };
-  tagged_alignment al2{ 1, 0, Segs{ {0, 74,  75, 149, {81-75     }, {81        }} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 99,   0,  99, {50, 80, 81}, {50, 80, 81}} } };
+  tagged_alignment al2{ 1, 0, Segs{ {0, 74,  75, 149, {81-75     }, {81        }} } };
   size_t A_card = 2, B_card = 1;
   double pair_recall = compute_recall<pair_helper>({al1, al2}, A_card, B_card, Lens{150}, Taus{1.0}, 0);
   double nucl_recall = compute_recall<nucl_helper>({al1, al2}, A_card, B_card, Lens{150}, Taus{1.0}, 0);
@@ -283,9 +289,9 @@ BOOST_AUTO_TEST_CASE(more_complicated_mismatches)
 // B: 000000000  1111  2222222222
 BOOST_AUTO_TEST_CASE(several_B_elements)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 99, 0, 99, {}, {}} }, nan("") };
-  tagged_alignment al2{ 2, 1, Segs{ {0, 49, 0, 49, {}, {}} }, nan("") };
-  tagged_alignment al3{ 1, 2, Segs{ {0, 99, 0, 99, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 99, 0, 99, {}, {}} } };
+  tagged_alignment al2{ 2, 1, Segs{ {0, 49, 0, 49, {}, {}} } };
+  tagged_alignment al3{ 1, 2, Segs{ {0, 99, 0, 99, {}, {}} } };
   size_t A_card = 3, B_card = 3;
   Lens lens{110, 50, 120};
   Taus taus{0.1, 0.3, 0.6};
@@ -302,9 +308,9 @@ BOOST_AUTO_TEST_CASE(several_B_elements)
 // B: 000000000    1111         2222222222
 BOOST_AUTO_TEST_CASE(several_B_elements_from_one_A_element)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 89, 0, 89, {}, {}} }, nan("") };
-  tagged_alignment al2{ 0, 1, Segs{ {0, 49, 0, 49, {}, {}} }, nan("") };
-  tagged_alignment al3{ 0, 2, Segs{ {0, 99, 0, 99, {}, {}} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 89, 0, 89, {}, {}} } };
+  tagged_alignment al2{ 0, 1, Segs{ {0, 49, 0, 49, {}, {}} } };
+  tagged_alignment al3{ 0, 2, Segs{ {0, 99, 0, 99, {}, {}} } };
   size_t A_card = 1, B_card = 3;
   Lens lens{ 90,  50, 100};
   Taus taus{0.1, 0.3, 0.6};
@@ -321,9 +327,9 @@ BOOST_AUTO_TEST_CASE(several_B_elements_from_one_A_element)
 // B: 0000000000   0000000000   0000000000
 BOOST_AUTO_TEST_CASE(several_A_elements_from_one_B_element)
 {
-  tagged_alignment al1{ 0, 0, Segs{ {0, 89, 0, 89, {60, 62}, {60, 62}} }, nan("") };
-  tagged_alignment al2{ 1, 0, Segs{ {0, 49, 0, 49, {30    }, {30    }} }, nan("") };
-  tagged_alignment al3{ 2, 0, Segs{ {0, 99, 0, 99, {      }, {      }} }, nan("") };
+  tagged_alignment al1{ 0, 0, Segs{ {0, 89, 0, 89, {60, 62}, {60, 62}} } };
+  tagged_alignment al2{ 1, 0, Segs{ {0, 49, 0, 49, {30    }, {30    }} } };
+  tagged_alignment al3{ 2, 0, Segs{ {0, 99, 0, 99, {      }, {      }} } };
   size_t A_card = 3, B_card = 1;
   Lens lens{100};
   Taus taus{1.0};
@@ -379,10 +385,10 @@ BOOST_AUTO_TEST_CASE(several_A_elements_from_one_B_element)
 //        ...
 BOOST_AUTO_TEST_CASE(complicated_ordering_1)
 {
-  tagged_alignment x{ 0, 0, Segs{ {  0, 499, 200, 699, {}, {}} }, nan("") }; // #id = 500
-  tagged_alignment y{ 1, 0, Segs{ {150, 549, 500, 899, {}, {}} }, nan("") }; // #id = 400
-  tagged_alignment z{ 1, 1, Segs{ {300, 599,   0, 299, {}, {}} }, nan("") }; // #id = 300
-  tagged_alignment w{ 2, 1, Segs{ {  0, 249, 150, 399, {}, {}} }, nan("") }; // #id = 250
+  tagged_alignment x{ 0, 0, Segs{ {  0, 499, 200, 699, {}, {}} } }; // #id = 500
+  tagged_alignment y{ 1, 0, Segs{ {150, 549, 500, 899, {}, {}} } }; // #id = 400
+  tagged_alignment z{ 1, 1, Segs{ {300, 599,   0, 299, {}, {}} } }; // #id = 300
+  tagged_alignment w{ 2, 1, Segs{ {  0, 249, 150, 399, {}, {}} } }; // #id = 250
   // Note:
   // * y - x is [irrelevant] -> [700, 899], #id = 200
   // * y - x is [350, 549] -> [700, 899] which is contained within z, wrt A, when the difference is taken wrt B.
@@ -457,10 +463,10 @@ BOOST_AUTO_TEST_CASE(complicated_ordering_1)
 //        ...                              
 BOOST_AUTO_TEST_CASE(complicated_ordering_2)
 {
-  tagged_alignment x{ 0, 0, Segs{ {  0, 499, 200, 699, {}, {}} }, nan("") }; // #id = 500
-  tagged_alignment y{ 1, 0, Segs{ {150, 549, 500, 899, {}, {}} }, nan("") }; // #id = 400
-  tagged_alignment z{ 1, 1, Segs{ {300, 549,   0, 249, {}, {}} }, nan("") }; // #id = 250
-  tagged_alignment w{ 2, 1, Segs{ {  0, 299, 100, 399, {}, {}} }, nan("") }; // #id = 300
+  tagged_alignment x{ 0, 0, Segs{ {  0, 499, 200, 699, {}, {}} } }; // #id = 500
+  tagged_alignment y{ 1, 0, Segs{ {150, 549, 500, 899, {}, {}} } }; // #id = 400
+  tagged_alignment z{ 1, 1, Segs{ {300, 549,   0, 249, {}, {}} } }; // #id = 250
+  tagged_alignment w{ 2, 1, Segs{ {  0, 299, 100, 399, {}, {}} } }; // #id = 300
   // Note:
   // * y - x is [350, 549] -> [700, 899], #id = 200, which is contained within z, wrt A, when the difference is taken wrt B.
   // * z - w is [300, 399] -> [0, 99], #id = 100
@@ -573,7 +579,7 @@ BOOST_AUTO_TEST_CASE(allpairs)
         std::vector<size_t> mis;
         for (size_t k = 0; k < E[i][j]; ++k)
           mis.push_back(k);
-        alignments.push_back(tagged_alignment { i, j, Segs{ {  0, len-1, 0, len-1, mis, mis} }, nan("") });
+        alignments.push_back(tagged_alignment { i, j, Segs{ {  0, len-1, 0, len-1, mis, mis} } });
       }
     }
     size_t A_card = n, B_card = n;
@@ -590,3 +596,375 @@ BOOST_AUTO_TEST_CASE(allpairs)
 
   } // loop over trials
 }
+
+bool same_alignments(const alignment_set& x, const alignment_set& y)
+{
+  if (x.alignments.size() != y.alignments.size() || x.identities.size() != y.identities.size())
+    return false;
+  for (size_t i = 0; i < x.alignments.size(); ++i) {
+    const tagged_alignment& l1 = x.alignments[i];
+    const tagged_alignment& l2 = y.alignments[i];
+    if (l1.a_idx != l2.a_idx || l1.b_idx != l2.b_idx || l1.segments != l2.segments)
+      return false;
+  }
+  for (size_t i = 0; i < x.identities.size(); ++i) {
+    const alignment_identity& id1 = x.identities[i];
+    const alignment_identity& id2 = y.identities[i];
+    if (id1.num_identity_wrt_a != id2.num_identity_wrt_a ||
+        id1.num_identity_wrt_b != id2.num_identity_wrt_b ||
+        id1.frac_indel_wrt_a   != id2.frac_indel_wrt_a   ||
+        id1.frac_indel_wrt_b   != id2.frac_indel_wrt_b)
+      return false;
+  }
+  return true;
+}
+
+// Writes the sequences and alignments that the cache test cases read, and
+// removes them, their alignment cache, and the cache directory afterwards, so
+// that each test case can be run alone and leaves nothing behind.
+struct cache_files
+{
+  static const char *cache_dir() { return "test_re_matched_cache"; }
+
+  cache_files()
+  {
+    std::ofstream fa("test_re_matched_A.fa");
+    fa << ">a0\nACGTACGTAC\n>a1\nTTTTGGGGCC\n";
+    std::ofstream fb("test_re_matched_B.fa");
+    fb << ">b0\nACGAACGTAC\n>b1\nGGCCCCAAAA\n";
+    std::ofstream psl("test_re_matched.psl");
+    psl << "psLayout version 3\n"
+        << "\n"
+        << "match\tmis- \trep. \tN's\tQ gap\tQ gap\tT gap\tT gap\tstrand\tQ        \tQ   \tQ    \tQ  \tT        \tT   \tT    \tT  \tblock\tblockSizes \tqStarts\t tStarts\n"
+        << "     \tmatch\tmatch\t   \tcount\tbases\tcount\tbases\t      \tname     \tsize\tstart\tend\tname     \tsize\tstart\tend\tcount\n"
+        << "---------------------------------------------------------------------------------------------------------------------------------------------------------------\n"
+        << "9\t1\t0\t0\t0\t0\t0\t0\t+\ta0\t10\t0\t10\tb0\t10\t0\t10\t1\t10,\t0,\t0,\n"
+        << "10\t0\t0\t0\t0\t0\t0\t0\t-\ta1\t10\t0\t10\tb1\t10\t0\t10\t1\t10,\t0,\t0,\n"
+        << "1\t3\t0\t0\t0\t0\t0\t0\t+\ta1\t10\t4\t8\tb0\t10\t0\t4\t1\t4,\t4,\t0,\n";
+  }
+
+  ~cache_files()
+  {
+    std::remove("test_re_matched_A.fa");
+    std::remove("test_re_matched_B.fa");
+    std::remove("test_re_matched.psl");
+    std::remove(alignment_cache_filename("test_re_matched.psl").c_str());
+    if (DIR *d = opendir(cache_dir())) {
+      while (struct dirent *e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name != "." && name != "..")
+          std::remove((std::string(cache_dir()) + "/" + name).c_str());
+      }
+      closedir(d);
+      rmdir(cache_dir());
+    }
+  }
+};
+
+BOOST_FIXTURE_TEST_CASE(alignment_cache, cache_files)
+{
+  fasta A, B;
+  read_fasta(A, "test_re_matched_A.fa");
+  read_fasta(B, "test_re_matched_B.fa");
+  std::string cache_filename = alignment_cache_filename("test_re_matched.psl");
+  std::remove(cache_filename.c_str());
+
+  opts o;
+  o.alignment_type  = "psl";
+  o.alignment_cache = true;
+  uint64_t A_checksum = checksum_seqs(A.names, A.seqs);
+  uint64_t B_checksum = checksum_seqs(B.names, B.seqs);
+
+  alignment_set expected, x;
+  read_alignments<psl_alignment>(expected, "test_re_matched.psl", A.seqs, B.seqs, A.names_to_idxs, B.names_to_idxs, false);
+  BOOST_CHECK_EQUAL(expected.alignments.size(), 3);
+  BOOST_CHECK_EQUAL(expected.identities.size(), 3);
+  BOOST_CHECK_EQUAL(expected.alignments[0].segments[0].b_mismatches.size(), 1);
+  BOOST_CHECK_EQUAL(expected.identities[2].num_identity_wrt_a, 1);
+
+  // The first run writes the cache, and the second run reads it.
+  read_alignments_cached<psl_alignment>(x, "test_re_matched.psl", A, B, A_checksum, B_checksum, o);
+  BOOST_CHECK(same_alignments(x, expected));
+  read_alignments_cached<psl_alignment>(x, "test_re_matched.psl", A, B, A_checksum, B_checksum, o);
+  BOOST_CHECK(same_alignments(x, expected));
+
+  // The cache holds the alignments before the --min-segment-len filter.
+  alignment_cache_key key = make_alignment_cache_key("psl", false, "test_re_matched.psl", A_checksum, B_checksum);
+  BOOST_CHECK(load_alignment_cache(x, cache_filename, key));
+  BOOST_CHECK(same_alignments(x, expected));
+  size_t num_good_enough = 0;
+  BOOST_FOREACH(const tagged_alignment& l, x.alignments)
+    if (is_good_enough(l.segments, 5))
+      ++num_good_enough;
+  BOOST_CHECK_EQUAL(num_good_enough, 2);
+
+  // A cache made from different inputs is not used.
+  alignment_cache_key other = key;
+  other.strand_specific = true;
+  BOOST_CHECK(!load_alignment_cache(x, cache_filename, other));
+  BOOST_CHECK(x.alignments.empty());
+  BOOST_CHECK(x.identities.empty());
+  other = key;
+  other.B_checksum = A_checksum;
+  BOOST_CHECK(!load_alignment_cache(x, cache_filename, other));
+  other = key;
+  other.alignments_checksum = checksum_file("test_re_matched_A.fa");
+  BOOST_CHECK(!load_alignment_cache(x, cache_filename, other));
+
+  // Nor is a truncated cache.
+  {
+    std::ifstream ifs(cache_filename.c_str(), std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::ofstream ofs(cache_filename.c_str(), std::ios::binary);
+    ofs.write(contents.data(), contents.size() - 4);
+  }
+  BOOST_CHECK(!load_alignment_cache(x, cache_filename, key));
+  read_alignments_cached<psl_alignment>(x, "test_re_matched.psl", A, B, A_checksum, B_checksum, o);
+  BOOST_CHECK(same_alignments(x, expected));
+  BOOST_CHECK(load_alignment_cache(x, cache_filename, key));
+
+  // Without segments, as for the contig scores alone, the indices and
+  // identities are the same, and the cache is read but never written.
+  alignment_set y;
+  read_alignments_cached<psl_alignment>(y, "test_re_matched.psl", A, B, A_checksum, B_checksum, o, false);
+  BOOST_CHECK(same_alignments(y, expected));
+  std::remove(cache_filename.c_str());
+  read_alignments_cached<psl_alignment>(y, "test_re_matched.psl", A, B, A_checksum, B_checksum, o, false);
+  BOOST_REQUIRE_EQUAL(y.alignments.size(), expected.alignments.size());
+  for (size_t i = 0; i < y.alignments.size(); ++i) {
+    BOOST_CHECK_EQUAL(y.alignments[i].a_idx, expected.alignments[i].a_idx);
+    BOOST_CHECK_EQUAL(y.alignments[i].b_idx, expected.alignments[i].b_idx);
+    BOOST_CHECK(y.alignments[i].segments.empty());
+    BOOST_CHECK_EQUAL(y.identities[i].num_identity_wrt_a, expected.identities[i].num_identity_wrt_a);
+    BOOST_CHECK_EQUAL(y.identities[i].frac_indel_wrt_b, expected.identities[i].frac_indel_wrt_b);
+  }
+  BOOST_CHECK(!load_alignment_cache(x, cache_filename, key));
+}
+
+BOOST_FIXTURE_TEST_CASE(stage_cache, cache_files)
+{
+  std::string dir = cache_dir();
+  make_stage_cache_dir(dir);
+  make_stage_cache_dir(dir); // an existing directory is fine
+
+  // Keys depend on the stage, the values added, and their order.
+  std::vector<double> taus{0.25, 0.75};
+  stage_key k1("x"), k2("x"), k3("y"), k4("x"), k5("x");
+  k1.add(static_cast<uint64_t>(1)).add(taus);
+  k2.add(static_cast<uint64_t>(1)).add(taus);
+  k3.add(static_cast<uint64_t>(1)).add(taus);
+  k4.add(taus).add(static_cast<uint64_t>(1));
+  taus[1] = 0.5;
+  k5.add(static_cast<uint64_t>(1)).add(taus);
+  BOOST_CHECK_EQUAL(k1.value(), k2.value());
+  BOOST_CHECK(k1.value() != k3.value());
+  BOOST_CHECK(k1.value() != k4.value());
+  BOOST_CHECK(k1.value() != k5.value());
+
+  // Records round trip, and are only found under their own key and type.
+  std::vector<double> x{1.5, -2.0, 3.0}, y;
+  std::remove(stage_cache_filename(dir, k1).c_str());
+  BOOST_CHECK(!load_stage(y, dir, k1));
+  save_stage(x, dir, k1);
+  BOOST_CHECK(load_stage(y, dir, k1));
+  BOOST_CHECK(x == y);
+  BOOST_CHECK(!load_stage(y, dir, k3));
+  BOOST_CHECK(y.empty());
+  std::vector<float> z;
+  BOOST_CHECK(!load_stage(z, dir, k1));
+
+  // A truncated file is not used.
+  {
+    std::string filename = stage_cache_filename(dir, k1);
+    std::ifstream ifs(filename.c_str(), std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    ofs.write(contents.data(), contents.size() - 4);
+  }
+  BOOST_CHECK(!load_stage(y, dir, k1));
+}
+
+BOOST_FIXTURE_TEST_CASE(stage_cache_alignments_and_recall, cache_files)
+{
+  fasta A, B;
+  read_fasta(A, "test_re_matched_A.fa");
+  read_fasta(B, "test_re_matched_B.fa");
+  opts o;
+  o.alignment_type = "psl";
+  o.cache_dir      = cache_dir();
+  make_stage_cache_dir(o.cache_dir);
+  uint64_t A_checksum = checksum_seqs(A.names, A.seqs);
+  uint64_t B_checksum = checksum_seqs(B.names, B.seqs);
+
+  // With a cache directory, the alignments are cached there, under the key
+  // recorded in the set.
+  alignment_set expected, x;
+  read_alignments<psl_alignment>(expected, "test_re_matched.psl", A.seqs, B.seqs, A.names_to_idxs, B.names_to_idxs, false);
+  alignment_cache_key key = make_alignment_cache_key("psl", false, "test_re_matched.psl", A_checksum, B_checksum);
+  std::string cache_filename = stage_cache_filename(o.cache_dir, alignments_stage_key(key));
+  std::remove(cache_filename.c_str());
+  read_alignments_cached<psl_alignment>(x, "test_re_matched.psl", A, B, A_checksum, B_checksum, o);
+  BOOST_CHECK(same_alignments(x, expected));
+  BOOST_CHECK_EQUAL(x.cache_key, alignments_stage_key(key).value());
+  BOOST_CHECK(load_alignment_cache(x, cache_filename, key));
+  BOOST_CHECK(same_alignments(x, expected));
+
+  // The recall is computed once, and then taken from the cache; changing the
+  // expression gives a different key.
+  expr tau_B{0.5, 0.5}, other_tau_B{0.9, 0.1};
+  double recall = compute_recall<nucl_helper>(expected.alignments, A.card, B.card, B.lengths, tau_B, 0);
+  stage_key recall_key("matched");
+  recall_key.add(std::string("nucl_recall")).add(x.cache_key).add(static_cast<uint64_t>(0))
+            .add(B.lengths).add(tau_B);
+  std::remove(stage_cache_filename(o.cache_dir, recall_key).c_str());
+  CHECK_CLOSE(compute_recall_cached<nucl_helper>(o, "nucl_recall", x.cache_key, B_checksum, expected.alignments, A.card, B.card, B.lengths, tau_B), recall);
+  std::vector<double> cached;
+  BOOST_CHECK(load_stage(cached, o.cache_dir, recall_key));
+  BOOST_CHECK_EQUAL(cached.size(), 1);
+  CHECK_CLOSE(cached[0], recall);
+  save_stage(std::vector<double>(1, 12345.0), o.cache_dir, recall_key);
+  CHECK_CLOSE(compute_recall_cached<nucl_helper>(o, "nucl_recall", x.cache_key, B_checksum, expected.alignments, A.card, B.card, B.lengths, tau_B), 12345.0);
+  double other_recall = compute_recall<nucl_helper>(expected.alignments, A.card, B.card, B.lengths, other_tau_B, 0);
+  CHECK_CLOSE(compute_recall_cached<nucl_helper>(o, "nucl_recall", x.cache_key, B_checksum, expected.alignments, A.card, B.card, B.lengths, other_tau_B), other_recall);
+}
+
+BOOST_FIXTURE_TEST_CASE(recall_by_component, cache_files)
+{
+  opts o;
+  o.cache_dir = cache_dir();
+  make_stage_cache_dir(o.cache_dir);
+  const uint64_t ref_key = 42;
+  stage_key table_key("components");
+  table_key.add(std::string("test_nucl_recall")).add(ref_key);
+  std::remove(stage_cache_filename(o.cache_dir, table_key).c_str());
+
+  // Two components: {a0, a1, b0} and {a2, b1}.
+  std::vector<tagged_alignment> als1{
+    tagged_alignment{ 0, 0, Segs{ {0, 499,   0, 499, {}, {}} } },
+    tagged_alignment{ 1, 0, Segs{ {0, 599, 300, 899, {}, {}} } },
+    tagged_alignment{ 2, 1, Segs{ {0, 399, 100, 499, {}, {}} } } };
+  Lens lens{1000, 1000};
+  Taus taus{0.25, 0.75};
+  double r1 = compute_recall_by_component<nucl_helper>(o, "test_nucl_recall", ref_key, als1, 3, 2, lens, taus);
+  BOOST_CHECK_EQUAL(r1, compute_recall<nucl_helper>(als1, 3, 2, lens, taus, 0));
+  CHECK_CLOSE(r1, (0.25*900 + 0.75*400) / 1000);
+
+  // The table holds the selected contributions of each component: a1 and
+  // then a0, trimmed, and a2.
+  std::vector<component_contribution> table;
+  BOOST_CHECK(load_stage(table, o.cache_dir, table_key));
+  BOOST_REQUIRE_EQUAL(table.size(), 3);
+  BOOST_CHECK_EQUAL(table[0].key, table[1].key);
+  BOOST_CHECK_EQUAL(table[0].contribution, 0.25*600);
+  BOOST_CHECK_EQUAL(table[1].contribution, 0.25*300);
+  BOOST_CHECK_EQUAL(table[2].contribution, 0.75*400);
+
+  // A new version of the assembly, with a new contig a0 that changes the
+  // component of b1; the contigs of the component of b0 are renumbered but
+  // otherwise unchanged.
+  std::vector<tagged_alignment> als2{
+    tagged_alignment{ 1, 0, Segs{ {0, 499,   0, 499, {}, {}} } },
+    tagged_alignment{ 2, 0, Segs{ {0, 599, 300, 899, {}, {}} } },
+    tagged_alignment{ 3, 1, Segs{ {0, 399, 100, 499, {}, {}} } },
+    tagged_alignment{ 0, 1, Segs{ {0, 299, 400, 699, {}, {}} } } };
+  double r2 = compute_recall_by_component<nucl_helper>(o, "test_nucl_recall", ref_key, als2, 4, 2, lens, taus);
+  BOOST_CHECK_EQUAL(r2, compute_recall<nucl_helper>(als2, 4, 2, lens, taus, 0));
+  CHECK_CLOSE(r2, (0.25*900 + 0.75*600) / 1000);
+
+  // The component of b0 is taken from the cache: if its stored contributions
+  // are changed, so is the recall. The component of b1 in the first version
+  // is kept after those of this run.
+  BOOST_CHECK(load_stage(table, o.cache_dir, table_key));
+  BOOST_REQUIRE_EQUAL(table.size(), 5);
+  table[0].contribution = table[1].contribution = 0.0;
+  save_stage(table, o.cache_dir, table_key);
+  double r3 = compute_recall_by_component<nucl_helper>(o, "test_nucl_recall", ref_key, als2, 4, 2, lens, taus);
+  CHECK_CLOSE(r3, 0.75*600 / 1000);
+
+  // The table is kept per reference.
+  double r4 = compute_recall_by_component<nucl_helper>(o, "test_nucl_recall", ref_key + 1, als2, 4, 2, lens, taus);
+  BOOST_CHECK_EQUAL(r4, r2);
+  stage_key other_table_key("components");
+  other_table_key.add(std::string("test_nucl_recall")).add(ref_key + 1);
+  BOOST_CHECK(load_stage(table, o.cache_dir, other_table_key));
+  BOOST_CHECK_EQUAL(table.size(), 4);
+  std::remove(stage_cache_filename(o.cache_dir, other_table_key).c_str());
+
+  // With uniform expression, the components do not depend on its value.
+  Taus unif2{0.5, 0.5}, unif3{1.0/3, 1.0/3, 1.0/3};
+  Lens lens3{1000, 1000, 1000};
+  double r5 = compute_recall_by_component<nucl_helper>(o, "test_nucl_recall", ref_key, als2, 4, 2, lens, unif2);
+  BOOST_CHECK_EQUAL(r5, compute_recall<nucl_helper>(als2, 4, 2, lens, unif2, 0));
+  BOOST_CHECK(load_stage(table, o.cache_dir, table_key));
+  table[0].contribution = table[1].contribution = 0.0;
+  save_stage(table, o.cache_dir, table_key);
+  double r6 = compute_recall_by_component<nucl_helper>(o, "test_nucl_recall", ref_key, als2, 4, 3, lens3, unif3);
+  CHECK_CLOSE(r6, (1.0/3)*600 / 1000);
+
+  // Two contigs that align equally well to b0 tie: which one is selected
+  // first depends on the priority queue, so the component is never reused,
+  // and all the alignments are processed, as by compute_recall.
+  std::vector<tagged_alignment> als3{
+    tagged_alignment{ 0, 0, Segs{ {0, 499,   0, 499, {}, {}} } },
+    tagged_alignment{ 1, 0, Segs{ {0, 499, 200, 699, {}, {}} } },
+    tagged_alignment{ 2, 1, Segs{ {0, 399, 100, 499, {}, {}} } } };
+  double r7 = compute_recall_by_component<nucl_helper>(o, "test_nucl_recall", ref_key, als3, 3, 2, lens, taus);
+  BOOST_CHECK_EQUAL(r7, compute_recall<nucl_helper>(als3, 3, 2, lens, taus, 0));
+  BOOST_CHECK(load_stage(table, o.cache_dir, table_key));
+  BOOST_REQUIRE(table.size() >= 2);
+  BOOST_CHECK_EQUAL(table[0].contribution, tied_component);
+  BOOST_CHECK(table[1].key != table[0].key);
+  table[1].contribution = 0.0; // the component of b1, which is not reused either
+  save_stage(table, o.cache_dir, table_key);
+  double r8 = compute_recall_by_component<nucl_helper>(o, "test_nucl_recall", ref_key, als3, 3, 2, lens, taus);
+  BOOST_CHECK_EQUAL(r8, r7);
+}
+
+BOOST_FIXTURE_TEST_CASE(recall_by_component_is_exact, cache_files)
+{
+  // On random alignments, and again after some of them are removed (so that
+  // the other components are reused), the recall is exactly compute_recall's,
+  // whether or not some components tie.
+  opts o;
+  o.cache_dir = cache_dir();
+  make_stage_cache_dir(o.cache_dir);
+  std::default_random_engine rng(1);
+  for (size_t trial = 0; trial < 40; ++trial) {
+    size_t A_card = 40, B_card = 30;
+    Lens lens(B_card);
+    Taus taus(B_card), unif(B_card, 1.0 / B_card);
+    for (size_t j = 0; j < B_card; ++j) {
+      lens[j] = 500 + rng() % 1500;
+      taus[j] = (1 + rng() % 1000) / 1000.0;
+    }
+    std::vector<tagged_alignment> als;
+    for (size_t k = 0; k < 60; ++k) {
+      size_t a_idx = rng() % A_card, b_idx = rng() % B_card;
+      size_t len = 50 + rng() % 400, b_start = rng() % (lens[b_idx] - len), a_start = rng() % 1000;
+      std::vector<size_t> a_mis, b_mis;
+      for (size_t x = rng() % (len / 20); x < len; x += 1 + rng() % 100) {
+        a_mis.push_back(a_start + x);
+        b_mis.push_back(b_start + x);
+      }
+      als.push_back(tagged_alignment{ a_idx, b_idx, Segs{ {a_start, a_start + len - 1, b_start, b_start + len - 1, a_mis, b_mis} } });
+    }
+    const Taus *exprs[] = { &taus, &unif };
+    for (size_t e = 0; e < 2; ++e) {
+      std::vector<stage_key> table_keys(2, stage_key("components"));
+      table_keys[0].add(std::string("test_random_nucl")).add(static_cast<uint64_t>(trial));
+      table_keys[1].add(std::string("test_random_pair")).add(static_cast<uint64_t>(trial));
+      BOOST_FOREACH(const stage_key& k, table_keys)
+        std::remove(stage_cache_filename(o.cache_dir, k).c_str());
+      std::vector<tagged_alignment> x = als;
+      for (int run = 0; run < 3; ++run) {
+        double r = compute_recall_by_component<nucl_helper>(o, "test_random_nucl", trial, x, A_card, B_card, lens, *exprs[e]);
+        BOOST_CHECK_EQUAL(r, compute_recall<nucl_helper>(x, A_card, B_card, lens, *exprs[e], 0));
+        r = compute_recall_by_component<pair_helper>(o, "test_random_pair", trial, x, A_card, B_card, lens, *exprs[e]);
+        BOOST_CHECK_EQUAL(r, compute_recall<pair_helper>(x, A_card, B_card, lens, *exprs[e], 0));
+        x.erase(x.begin() + rng() % x.size());
+      }
+      BOOST_FOREACH(const stage_key& k, table_keys)
+        std::remove(stage_cache_filename(o.cache_dir, k).c_str());
+    }
+  }
+}
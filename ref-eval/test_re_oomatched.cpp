@@ -0,0 +1,187 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <string>
+#include <iostream>
+#include <random>
+#define BOOST_TEST_MODULE test_re_oomatched
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+#include "re_oomatched.hh"
+
+using namespace re::oomatched;
+
+namespace {
+
+matching_edge make_edge(size_t a_idx, size_t b_idx, double weight)
+{
+  matching_edge e;
+  e.a_idx  = a_idx;
+  e.b_idx  = b_idx;
+  e.weight = weight;
+  return e;
+}
+
+// Returns the size and weight of a maximum (weighted) matching of the whole
+// graph, found by lemon without splitting the graph into components.
+void global_matching(const std::vector<matching_edge>& edges, size_t A_card, size_t B_card,
+                     bool weighted, size_t& size, double& weight)
+{
+  lemon::SmartGraph graph;
+  std::vector<lemon::SmartGraph::Node> A_nodes(A_card), B_nodes(B_card);
+  for (size_t i = 0; i < A_card; ++i) A_nodes[i] = graph.addNode();
+  for (size_t j = 0; j < B_card; ++j) B_nodes[j] = graph.addNode();
+  lemon::SmartGraph::EdgeMap<double> wei_map(graph);
+  BOOST_FOREACH(const matching_edge& e, edges)
+    wei_map[graph.addEdge(A_nodes[e.a_idx], B_nodes[e.b_idx])] = e.weight;
+  if (weighted) {
+    lemon::MaxWeightedMatching<lemon::SmartGraph, lemon::SmartGraph::EdgeMap<double> > mm(graph, wei_map);
+    mm.run();
+    size = mm.matchingSize();
+    weight = mm.matchingWeight();
+  } else {
+    lemon::MaxMatching<lemon::SmartGraph> mm(graph);
+    mm.run();
+    size = mm.matchingSize();
+    weight = 0;
+  }
+}
+
+// Checks that B_mate_edges is a matching, and returns its size and weight.
+void check_matching(const std::vector<matching_edge>& edges, size_t A_card, size_t B_card,
+                    const std::vector<size_t>& B_mate_edges, size_t& size, double& weight)
+{
+  BOOST_REQUIRE_EQUAL(B_mate_edges.size(), B_card);
+  std::vector<bool> A_matched(A_card, false);
+  size = 0;
+  weight = 0;
+  for (size_t j = 0; j < B_card; ++j) {
+    size_t e = B_mate_edges[j];
+    if (e == static_cast<size_t>(-1))
+      continue;
+    BOOST_REQUIRE(e < edges.size());
+    BOOST_CHECK_EQUAL(edges[e].b_idx, j);
+    BOOST_CHECK(!A_matched[edges[e].a_idx]);
+    A_matched[edges[e].a_idx] = true;
+    ++size;
+    weight += edges[e].weight;
+  }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(parallel_edges)
+{
+  std::vector<matching_edge> edges;
+  edges.push_back(make_edge(2, 1, 0.5));
+  edges.push_back(make_edge(0, 0, 1));
+  edges.push_back(make_edge(2, 1, 0.75));
+  edges.push_back(make_edge(1, 1, 1));
+  edges.push_back(make_edge(0, 0, 0.25));
+  edges.push_back(make_edge(2, 1, 0.25));
+  collapse_parallel_edges(edges);
+
+  BOOST_REQUIRE_EQUAL(edges.size(), 3ul);
+  BOOST_CHECK_EQUAL(edges[0].a_idx, 2ul);
+  BOOST_CHECK_EQUAL(edges[0].b_idx, 1ul);
+  BOOST_CHECK_EQUAL(edges[0].weight, 0.75);
+  BOOST_CHECK_EQUAL(edges[1].a_idx, 0ul);
+  BOOST_CHECK_EQUAL(edges[1].b_idx, 0ul);
+  BOOST_CHECK_EQUAL(edges[1].weight, 1.0);
+  BOOST_CHECK_EQUAL(edges[2].a_idx, 1ul);
+  BOOST_CHECK_EQUAL(edges[2].b_idx, 1ul);
+  BOOST_CHECK_EQUAL(edges[2].weight, 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(components)
+{
+  // A0-B0, A1-B1, A2-B1, A3 and B2 isolated, A4-B3, A4-B4, A5-B4
+  std::vector<matching_edge> edges;
+  edges.push_back(make_edge(4, 3, 1));
+  edges.push_back(make_edge(0, 0, 1));
+  edges.push_back(make_edge(1, 1, 1));
+  edges.push_back(make_edge(4, 4, 1));
+  edges.push_back(make_edge(2, 1, 1));
+  edges.push_back(make_edge(5, 4, 1));
+  matching_components comps;
+  find_components(comps, edges, 6, 5);
+
+  BOOST_REQUIRE_EQUAL(comps.size(), 3ul);
+  size_t offsets[] = {0, 3, 4, 6}, edge_idxs[] = {0, 3, 5, 1, 2, 4};
+  size_t A_offsets[] = {0, 2, 3, 5}, A_idxs[] = {4, 5, 0, 1, 2};
+  size_t B_offsets[] = {0, 2, 3, 4}, B_idxs[] = {3, 4, 0, 1};
+  BOOST_CHECK(comps.offsets   == std::vector<size_t>(offsets,   offsets   + 4));
+  BOOST_CHECK(comps.edge_idxs == std::vector<size_t>(edge_idxs, edge_idxs + 6));
+  BOOST_CHECK(comps.A_offsets == std::vector<size_t>(A_offsets, A_offsets + 4));
+  BOOST_CHECK(comps.A_idxs    == std::vector<size_t>(A_idxs,    A_idxs    + 5));
+  BOOST_CHECK(comps.B_offsets == std::vector<size_t>(B_offsets, B_offsets + 4));
+  BOOST_CHECK(comps.B_idxs    == std::vector<size_t>(B_idxs,    B_idxs    + 4));
+}
+
+BOOST_AUTO_TEST_CASE(matches_global_lemon_matching)
+{
+  // Random sparse graphs, with many small components and some larger ones,
+  // and weights that include ties and zeros.
+  std::mt19937 rng(12345);
+  for (int trial = 0; trial < 300; ++trial) {
+    size_t A_card = 1 + rng() % 40, B_card = 1 + rng() % 40;
+    size_t num_edges = rng() % (2 * (A_card + B_card));
+    std::vector<double> tau_B(B_card);
+    BOOST_FOREACH(double& w, tau_B)
+      w = (rng() % 5) / 4.0;
+    std::vector<matching_edge> edges;
+    for (size_t k = 0; k < num_edges; ++k) {
+      size_t b_idx = rng() % B_card;
+      edges.push_back(make_edge(rng() % A_card, b_idx, tau_B[b_idx]));
+    }
+    matching_components comps;
+    find_components(comps, edges, A_card, B_card);
+
+    const char *algorithms[] = {"bipartite", "lemon"};
+    for (int weighted = 0; weighted < 2; ++weighted) {
+      size_t expected_size;
+      double expected_weight;
+      global_matching(edges, A_card, B_card, weighted, expected_size, expected_weight);
+      BOOST_FOREACH(const char *algorithm, algorithms) {
+        std::vector<size_t> B_mate_edges;
+        max_matching(edges, comps, B_card, weighted, algorithm, B_mate_edges);
+        size_t size;
+        double weight;
+        check_matching(edges, A_card, B_card, B_mate_edges, size, weight);
+        if (weighted)
+          BOOST_CHECK_CLOSE(weight, expected_weight, 1e-9);
+        else
+          BOOST_CHECK_EQUAL(size, expected_size);
+      }
+
+      // The approximate matching is between half the maximum and the
+      // maximum, and the maximum is at most the upper bound.
+      std::vector<size_t> B_mate_edges;
+      double bound = max_matching(edges, comps, B_card, weighted, "greedy", B_mate_edges);
+      size_t size;
+      double weight;
+      check_matching(edges, A_card, B_card, B_mate_edges, size, weight);
+      double value = weighted ? weight : size, expected = weighted ? expected_weight : expected_size;
+      BOOST_CHECK(2 * value >= expected - 1e-9);
+      BOOST_CHECK(value <= expected + 1e-9);
+      BOOST_CHECK(bound >= expected - 1e-9);
+    }
+  }
+}
@@ -0,0 +1,273 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <iostream>
+#define BOOST_TEST_MODULE test_sam
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+#include "sam/sam.h"
+#include "sam.hh"
+#include "util.hh"
+
+namespace {
+
+// The reference and query sequences used by the records below.
+//
+//   ref1 = ACGTACGTACGTACGTACGT
+//
+// - r1 aligns TT|GTCCG|A|TAC|--|ACTT to ref1[2..15] with two soft-clipped
+//   bases, a mismatch at ref1[4], an insertion, a deletion of ref1[10..11], and
+//   a mismatch at ref1[14].
+// - r2 aligns, on the reverse strand, to ref1[4..9] with a mismatch at ref1[6].
+// - r3 aligns to ref1[0..5] using =/X operations, with a mismatch at ref1[3].
+const std::string ref1 = "ACGTACGTACGTACGTACGT";
+const std::string r1   = "TTGTCCGATACACTT";
+const std::string r2   = "GTAAGT";
+const std::string r3   = "ACGGAC";
+
+const std::string sam_text =
+  "@HD\tVN:1.0\n"
+  "@SQ\tSN:ref1\tLN:20\n"
+  "r1\t0\tref1\t3\t60\t2S5M1I3M2D4M\t*\t0\t0\tTTGTCCGATACACTT\t*\tNM:i:5\tMD:Z:2A5^GT2G1\n"
+  "r2\t16\tref1\t5\t60\t6M\t*\t0\t0\tACTTAC\t*\tNM:i:1\n"
+  "u1\t4\t*\t0\t0\t*\t*\t0\t0\tACGT\t*\n"
+  "r3\t0\tref1\t1\t60\t3=1X2=\t*\t0\t0\tACGGAC\t*\n";
+
+void write_file(const std::string& filename, const std::string& contents)
+{
+  std::ofstream out(filename.c_str(), std::ios::binary);
+  out << contents;
+}
+
+std::vector<sam_alignment> read_all(const std::string& filename)
+{
+  std::vector<sam_alignment> als;
+  sam_alignment::input_stream_type is(open_or_throw(filename));
+  sam_alignment al;
+  while (is >> al)
+    als.push_back(al);
+  return als;
+}
+
+alignment_segment make_segment(size_t a_start, size_t a_end, size_t b_start, size_t b_end)
+{
+  alignment_segment seg;
+  seg.a_start = a_start;
+  seg.a_end   = a_end;
+  seg.b_start = b_start;
+  seg.b_end   = b_end;
+  return seg;
+}
+
+// Returns the little-endian bytes of x.
+std::string int32_bytes(int32_t x)
+{
+  char buf[4];
+  std::memcpy(buf, &x, 4);
+  return std::string(buf, 4);
+}
+
+// Returns a BAM record (everything after its block_size field) of an unmapped
+// read named r, with no sequence, followed by the given tags.
+std::string bam_record(const std::string& tags)
+{
+  std::string rec;
+  rec += int32_bytes(-1);                        // ref_id
+  rec += int32_bytes(-1);                        // pos
+  rec += std::string("\x02\x00\x48\x12", 4);    // l_read_name, mapq, bin
+  rec += std::string("\x00\x00\x04\x00", 4);    // n_cigar_op, flag
+  rec += int32_bytes(0);                         // l_seq
+  rec += int32_bytes(-1) + int32_bytes(-1) + int32_bytes(0); // mate, tlen
+  rec += std::string("r\0", 2);
+  return rec + tags;
+}
+
+void check_records(const std::vector<sam_alignment>& als)
+{
+  BOOST_REQUIRE_EQUAL(als.size(), 3ul);
+
+  // r1
+  BOOST_CHECK_EQUAL(als[0].a_name(), "r1");
+  BOOST_CHECK_EQUAL(als[0].b_name(), "ref1");
+  BOOST_CHECK_EQUAL(als[0].num_identity_wrt_a(), 10);
+  BOOST_CHECK_EQUAL(als[0].frac_identity_wrt_a(), 10.0/15);
+  BOOST_CHECK_EQUAL(als[0].frac_identity_wrt_b(), 10.0/20);
+  BOOST_CHECK_EQUAL(als[0].frac_indel_wrt_a(), 1.0/15);
+  BOOST_CHECK_EQUAL(als[0].frac_indel_wrt_b(), 2.0/20);
+  BOOST_CHECK(als[0].is_on_valid_strand(true));
+  std::vector<alignment_segment> segs = als[0].segments(r1, ref1);
+  BOOST_REQUIRE_EQUAL(segs.size(), 3ul);
+  alignment_segment seg = make_segment(2, 6, 2, 6);
+  seg.a_mismatches.push_back(4);
+  seg.b_mismatches.push_back(4);
+  BOOST_CHECK_EQUAL(segs[0], seg);
+  BOOST_CHECK_EQUAL(segs[1], make_segment(8, 10, 7, 9));
+  seg = make_segment(11, 14, 12, 15);
+  seg.a_mismatches.push_back(13);
+  seg.b_mismatches.push_back(14);
+  BOOST_CHECK_EQUAL(segs[2], seg);
+
+  // r2: no MD tag, so the mismatches come from comparing the sequences.
+  BOOST_CHECK_EQUAL(als[1].a_name(), "r2");
+  BOOST_CHECK_EQUAL(als[1].num_identity_wrt_b(), 5);
+  BOOST_CHECK(!als[1].is_on_valid_strand(true));
+  BOOST_CHECK(als[1].is_on_valid_strand(false));
+  segs = als[1].segments(r2, ref1);
+  BOOST_REQUIRE_EQUAL(segs.size(), 1ul);
+  seg = make_segment(5, 0, 4, 9);
+  seg.a_mismatches.push_back(3);
+  seg.b_mismatches.push_back(6);
+  BOOST_CHECK_EQUAL(segs[0], seg);
+
+  // r3
+  BOOST_CHECK_EQUAL(als[2].a_name(), "r3");
+  BOOST_CHECK_EQUAL(als[2].num_identity_wrt_a(), 5);
+  segs = als[2].segments(r3, ref1);
+  BOOST_REQUIRE_EQUAL(segs.size(), 1ul);
+  seg = make_segment(0, 5, 0, 5);
+  seg.a_mismatches.push_back(3);
+  seg.b_mismatches.push_back(3);
+  BOOST_CHECK_EQUAL(segs[0], seg);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(sam_input)
+{
+  write_file("test_sam.sam", sam_text);
+  check_records(read_all("test_sam.sam"));
+  std::remove("test_sam.sam");
+}
+
+BOOST_AUTO_TEST_CASE(bam_input)
+{
+  // Convert the SAM text to BAM with samtools, then read it back.
+  write_file("test_sam.sam", sam_text);
+  samfile_t *in = samopen("test_sam.sam", "r", NULL);
+  BOOST_REQUIRE(in != NULL);
+  samfile_t *out = samopen("test_sam.bam", "wb", in->header);
+  BOOST_REQUIRE(out != NULL);
+  bam1_t *b = bam_init1();
+  while (samread(in, b) >= 0)
+    samwrite(out, b);
+  bam_destroy1(b);
+  samclose(out);
+  samclose(in);
+
+  check_records(read_all("test_sam.bam"));
+  std::remove("test_sam.sam");
+  std::remove("test_sam.bam");
+}
+
+BOOST_AUTO_TEST_CASE(md_matches_sequence_comparison)
+{
+  // The mismatches found from the MD tag should be those found by comparing
+  // the sequences.
+  sam_alignment with_md, without_md;
+  with_md.parse_line   ("r1\t0\tref1\t3\t60\t2S5M1I3M2D4M\t*\t0\t0\t*\t*\tMD:Z:2A5^GT2G1");
+  without_md.parse_line("r1\t0\tref1\t3\t60\t2S5M1I3M2D4M\t*\t0\t0\t*\t*");
+  BOOST_CHECK(with_md.segments(r1, ref1) == without_md.segments(r1, ref1));
+}
+
+BOOST_AUTO_TEST_CASE(md_and_eqx_count_ns_as_mismatches)
+{
+  // As when comparing the sequences, a position where either base is an N is a
+  // mismatch, whatever the MD tag or the =/X operations say.
+  const std::string ref1n = "ACGTACGTACGTANGTACGT";
+  const std::string r1n   = "TTGTCNGATACACTT";
+  sam_alignment with_md, without_md;
+  with_md.parse_line   ("r1\t0\tref1\t3\t60\t2S5M1I3M2D4M\t*\t0\t0\t*\t*\tMD:Z:2A5^GT2G1");
+  without_md.parse_line("r1\t0\tref1\t3\t60\t2S5M1I3M2D4M\t*\t0\t0\t*\t*");
+  std::vector<alignment_segment> segs = with_md.segments(r1n, ref1n);
+  BOOST_CHECK(segs == without_md.segments(r1n, ref1n));
+  BOOST_REQUIRE_EQUAL(segs.size(), 3ul);
+  BOOST_CHECK_EQUAL(segs[0].b_mismatches.size(), 2ul);
+  BOOST_CHECK_EQUAL(segs[2].b_mismatches.size(), 2ul);
+
+  // On the reverse strand.
+  const std::string r2n = "NTAAGT";
+  with_md.parse_line   ("r2\t16\tref1\t5\t60\t6M\t*\t0\t0\t*\t*\tMD:Z:2G3");
+  without_md.parse_line("r2\t16\tref1\t5\t60\t6M\t*\t0\t0\t*\t*");
+  BOOST_CHECK(with_md.segments(r2n, ref1) == without_md.segments(r2n, ref1));
+  BOOST_CHECK_EQUAL(with_md.segments(r2n, ref1)[0].b_mismatches.size(), 2ul);
+
+  // With =/X operations.
+  const std::string ref3n = "ANGTACGTACGTACGTACGT";
+  sam_alignment eqx, m;
+  eqx.parse_line("r3\t0\tref1\t1\t60\t3=1X2=\t*\t0\t0\t*\t*");
+  m.parse_line  ("r3\t0\tref1\t1\t60\t6M\t*\t0\t0\t*\t*");
+  BOOST_CHECK(eqx.segments(r3, ref3n) == m.segments(r3, ref3n));
+  BOOST_CHECK_EQUAL(eqx.segments(r3, ref3n)[0].b_mismatches.size(), 2ul);
+}
+
+BOOST_AUTO_TEST_CASE(bam_array_tags)
+{
+  std::vector<std::string> ref_names;
+  std::vector<int> ref_lengths;
+  sam_alignment al;
+
+  // A B-array tag is skipped, and the tags after it are read.
+  std::string rec = bam_record("XBBc" + int32_bytes(2) + "ab" + "NMi" + int32_bytes(3));
+  al.parse_bam_record(rec.data(), rec.size(), ref_names, ref_lengths);
+  BOOST_CHECK_EQUAL(al.nm(), 3);
+
+  // The array runs past the end of the record.
+  rec = bam_record("XBBc" + int32_bytes(3) + "ab");
+  BOOST_CHECK_THROW(al.parse_bam_record(rec.data(), rec.size(), ref_names, ref_lengths),
+                    std::runtime_error);
+  rec = bam_record("XBBi" + int32_bytes(0x40000001) + "abcd");
+  BOOST_CHECK_THROW(al.parse_bam_record(rec.data(), rec.size(), ref_names, ref_lengths),
+                    std::runtime_error);
+
+  // A negative count.
+  rec = bam_record("XBBc" + int32_bytes(-1) + "ab");
+  BOOST_CHECK_THROW(al.parse_bam_record(rec.data(), rec.size(), ref_names, ref_lengths),
+                    std::runtime_error);
+
+  // An unknown element type.
+  rec = bam_record("XBBz" + int32_bytes(1) + "ab");
+  BOOST_CHECK_THROW(al.parse_bam_record(rec.data(), rec.size(), ref_names, ref_lengths),
+                    std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(invalid_input)
+{
+  sam_alignment al;
+  BOOST_CHECK_THROW(al.parse_line("r1\t0\tref1\t3\t60\t2S5Q\t*\t0\t0\t*\t*"), std::runtime_error);
+  BOOST_CHECK_THROW(al.parse_line("r1\t0\tref1\t3\t60\t5M"), std::runtime_error);
+
+  // The CIGAR string does not match the length of the sequence.
+  al.parse_line("r1\t0\tref1\t3\t60\t5M\t*\t0\t0\t*\t*");
+  BOOST_CHECK_THROW(al.segments(r1, ref1), std::runtime_error);
+
+  // The alignment runs past the end of the reference.
+  al.parse_line("r3\t0\tref1\t18\t60\t6M\t*\t0\t0\t*\t*");
+  BOOST_CHECK_THROW(al.segments(r3, ref1), std::runtime_error);
+
+  // The reference is not in the header.
+  write_file("test_sam.sam", "@SQ\tSN:ref1\tLN:20\nr3\t0\tref2\t1\t60\t6M\t*\t0\t0\t*\t*\n");
+  BOOST_CHECK_THROW(read_all("test_sam.sam"), std::runtime_error);
+  std::remove("test_sam.sam");
+}
@@ -0,0 +1,132 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#define BOOST_TEST_MODULE test_serve
+#include <boost/test/unit_test.hpp>
+#include "serve.hh"
+
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(request_round_trip)
+{
+  vector<string> args, args2;
+  args.push_back("--A-seqs");
+  args.push_back("my assembly.fa");
+  args.push_back("--scores=nucl");
+  string dir;
+  serve::parse_request(dir, args2, serve::format_request("/some/dir", args));
+  BOOST_CHECK_EQUAL(dir, "/some/dir");
+  BOOST_CHECK(args2 == args);
+
+  args.push_back("two\nlines");
+  BOOST_CHECK_THROW(serve::format_request("/some/dir", args), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(bad_requests)
+{
+  string dir;
+  vector<string> args;
+  BOOST_CHECK_THROW(serve::parse_request(dir, args, "/some/dir\n--A-seqs\n"), std::runtime_error);
+  BOOST_CHECK_THROW(serve::parse_request(dir, args, "some/dir\n--A-seqs\n\n"), std::runtime_error);
+  BOOST_CHECK_THROW(serve::parse_request(dir, args, ""), std::runtime_error);
+}
+
+// Echoes the job back, or fails if the first argument is "fail".
+struct echo_handler
+{
+  void operator()(const vector<string>& args, const string& dir, ostream& out) const
+  {
+    if (!args.empty() && args[0] == "fail")
+      throw std::runtime_error("failed\nas asked");
+    out << dir << "\n";
+    for (size_t i = 0; i < args.size(); ++i)
+      out << args[i] << "\n";
+  }
+};
+
+struct server_args
+{
+  int fd;
+  size_t max_jobs;
+};
+
+void *run_server(void *arg)
+{
+  server_args *sa = static_cast<server_args *>(arg);
+  echo_handler handler;
+  serve::run(sa->fd, 2, handler, sa->max_jobs);
+  return NULL;
+}
+
+struct client_args
+{
+  vector<string> args;
+  string output;
+  bool ok;
+};
+
+void *run_client(void *arg)
+{
+  client_args *ca = static_cast<client_args *>(arg);
+  ca->ok = serve::request(ca->output, "test_serve.sock", "/client/dir", ca->args);
+  return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(serve_jobs)
+{
+  const size_t num_jobs = 6;
+  server_args sa;
+  sa.fd = serve::listen_on("test_serve.sock");
+  sa.max_jobs = num_jobs;
+  pthread_t server;
+  BOOST_REQUIRE_EQUAL(pthread_create(&server, NULL, run_server, &sa), 0);
+
+  vector<client_args> clients(num_jobs);
+  vector<pthread_t> threads(num_jobs);
+  for (size_t i = 0; i < num_jobs; ++i) {
+    clients[i].args.push_back(i == 3 ? "fail" : "job");
+    clients[i].args.push_back(string(1, 'a' + i));
+    BOOST_REQUIRE_EQUAL(pthread_create(&threads[i], NULL, run_client, &clients[i]), 0);
+  }
+  for (size_t i = 0; i < num_jobs; ++i)
+    pthread_join(threads[i], NULL);
+  pthread_join(server, NULL);
+  close(sa.fd);
+
+  for (size_t i = 0; i < num_jobs; ++i) {
+    if (i == 3) {
+      BOOST_CHECK(!clients[i].ok);
+      BOOST_CHECK_EQUAL(clients[i].output, "failed as asked");
+    } else {
+      BOOST_CHECK(clients[i].ok);
+      BOOST_CHECK_EQUAL(clients[i].output, "/client/dir\njob\n" + string(1, 'a' + i) + "\n");
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(no_server)
+{
+  string output;
+  vector<string> args(1, "job");
+  BOOST_CHECK_THROW(serve::request(output, "test_serve_missing.sock", "/client/dir", args), std::runtime_error);
+}
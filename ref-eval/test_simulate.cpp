@@ -0,0 +1,159 @@
+// Copyright (c) 2013
+// Nathanael Fillmore (University of Wisconsin-Madison)
+// nathanae@cs.wisc.edu
+//
+// This file is part of REF-EVAL.
+//
+// REF-EVAL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// REF-EVAL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with REF-EVAL.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#define BOOST_TEST_MODULE test_simulate
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include "simulate.hh"
+#include "fasta.hh"
+#include "expr.hh"
+#include "psl.hh"
+
+using namespace std;
+
+struct workload
+{
+  ostringstream B_fa, B_expr, A_fa, A_expr, A_to_B, B_to_A;
+  sim::stats st;
+
+  workload(const sim::params& p) { st = sim::simulate(p, B_fa, B_expr, A_fa, A_expr, A_to_B, B_to_A); }
+
+  void save(const string& prefix) const
+  {
+    ofstream((prefix + ".B.fa"  ).c_str()) << B_fa.str();
+    ofstream((prefix + ".B.expr").c_str()) << B_expr.str();
+    ofstream((prefix + ".A.fa"  ).c_str()) << A_fa.str();
+    ofstream((prefix + ".A.expr").c_str()) << A_expr.str();
+  }
+
+  static void remove_files(const string& prefix)
+  {
+    remove((prefix + ".B.fa"  ).c_str());
+    remove((prefix + ".B.expr").c_str());
+    remove((prefix + ".A.fa"  ).c_str());
+    remove((prefix + ".A.expr").c_str());
+  }
+};
+
+sim::params small_params(unsigned seed)
+{
+  sim::params p;
+  p.seed = seed;
+  p.num_families = 50;
+  p.chimera_rate = 0.2;
+  p.redundancy_rate = 0.2;
+  p.substitution_rate = 0.01;
+  p.indel_rate = 0.005;
+  p.n_run_rate = 0.002;
+  return p;
+}
+
+BOOST_AUTO_TEST_CASE(same_seed_same_workload)
+{
+  workload w1(small_params(1)), w2(small_params(1)), w3(small_params(2));
+  BOOST_CHECK(w1.B_fa.str()   == w2.B_fa.str());
+  BOOST_CHECK(w1.A_fa.str()   == w2.A_fa.str());
+  BOOST_CHECK(w1.A_to_B.str() == w2.A_to_B.str());
+  BOOST_CHECK(w1.B_to_A.str() == w2.B_to_A.str());
+  BOOST_CHECK(w1.B_fa.str()   != w3.B_fa.str());
+  BOOST_CHECK(w1.A_fa.str()   != w3.A_fa.str());
+}
+
+BOOST_AUTO_TEST_CASE(workload_has_all_the_features)
+{
+  workload w(small_params(1));
+  BOOST_CHECK_GT(w.st.num_transcripts, 50ul);
+  BOOST_CHECK_GT(w.st.num_contigs, 20ul);
+  BOOST_CHECK_GT(w.st.num_chimeras, 0ul);
+  BOOST_CHECK_GT(w.st.num_redundant, 0ul);
+  BOOST_CHECK_GT(w.st.num_A_to_B, w.st.num_contigs);
+  BOOST_CHECK_EQUAL(w.st.num_A_to_B, w.st.num_B_to_A);
+  BOOST_CHECK(w.A_fa.str().find('N') != string::npos);
+  BOOST_CHECK(w.A_to_B.str().find("\t-\t") != string::npos);
+}
+
+// Checks that each alignment in psl refers to sequences in a and b, and that
+// its counts agree with the bases of those sequences, as ref-eval sees them.
+void check_alignments(const string& psl, const fasta& a, const fasta& b, size_t expected_num)
+{
+  detail::psl_alignment_input_stream is(boost::make_shared<istringstream>(psl));
+  psl_alignment al;
+  size_t num = 0;
+  while (is >> al) {
+    size_t a_idx = a.names_to_idxs.find(al.a_name_ref());
+    size_t b_idx = b.names_to_idxs.find(al.b_name_ref());
+    BOOST_REQUIRE(a_idx != name_index::npos);
+    BOOST_REQUIRE(b_idx != name_index::npos);
+    BOOST_REQUIRE_EQUAL(static_cast<size_t>(al.q_size()), a.seqs[a_idx].size());
+    BOOST_REQUIRE_EQUAL(static_cast<size_t>(al.t_size()), b.seqs[b_idx].size());
+
+    size_t aligned = 0, mismatches = 0;
+    BOOST_FOREACH(const alignment_segment& seg, al.segments(a.seqs[a_idx], b.seqs[b_idx])) {
+      aligned += seg.b_end - seg.b_start + 1;
+      mismatches += seg.a_mismatches.size();
+    }
+    BOOST_CHECK_EQUAL(aligned, static_cast<size_t>(al.matches() + al.mis_matches() + al.n_count()));
+    BOOST_CHECK_EQUAL(mismatches, static_cast<size_t>(al.mis_matches() + al.n_count()));
+    BOOST_CHECK_GE(al.q_start(), 0);
+    BOOST_CHECK_LE(al.q_end(), al.q_size());
+    int n = al.block_count();
+    BOOST_CHECK_EQUAL(al.t_start(), al.t_starts()[0]);
+    BOOST_CHECK_EQUAL(al.t_end(), al.t_starts()[n - 1] + al.block_sizes()[n - 1]);
+    ++num;
+  }
+  BOOST_CHECK_EQUAL(num, expected_num);
+}
+
+BOOST_AUTO_TEST_CASE(alignments_are_consistent_with_the_sequences)
+{
+  workload w(small_params(3));
+  w.save("test_simulate");
+  fasta A, B;
+  read_fasta(A, "test_simulate.A.fa");
+  read_fasta(B, "test_simulate.B.fa");
+  BOOST_CHECK_EQUAL(A.card, w.st.num_contigs);
+  BOOST_CHECK_EQUAL(B.card, w.st.num_transcripts);
+  check_alignments(w.A_to_B.str(), A, B, w.st.num_A_to_B);
+  check_alignments(w.B_to_A.str(), B, A, w.st.num_B_to_A);
+  workload::remove_files("test_simulate");
+}
+
+BOOST_AUTO_TEST_CASE(expression_is_readable)
+{
+  workload w(small_params(4));
+  w.save("test_simulate");
+  fasta A, B;
+  read_fasta(A, "test_simulate.A.fa");
+  read_fasta(B, "test_simulate.B.fa");
+  expr A_tau(A.card), B_tau(B.card);
+  read_rsem_expr(A_tau, "test_simulate.A.expr", A);
+  read_rsem_expr(B_tau, "test_simulate.B.expr", B);
+  double A_total = 0.0, B_total = 0.0;
+  BOOST_FOREACH(double x, A_tau) A_total += x;
+  BOOST_FOREACH(double x, B_tau) B_total += x;
+  BOOST_CHECK_CLOSE(A_total, 1.0, 0.01);
+  BOOST_CHECK_CLOSE(B_total, 1.0, 0.01);
+  workload::remove_files("test_simulate");
+}
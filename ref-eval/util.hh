@@ -27,17 +27,18 @@
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
 #include "deweylab/bio/formats/fasta.hh"
+#include "compressed_stream.hh"
+#include "seq_arena.hh"
 
 // need to declare "clock_t start" before tic
 #define tic start = clock();
 #define toc std::cerr << "Done in " << 1.0*(clock() - start)/CLOCKS_PER_SEC << " seconds." << std::endl;
 
-boost::shared_ptr<std::ifstream> open_or_throw(const std::string& filename)
+// Opens filename for reading, transparently decompressing it if it is gzip-
+// or BGZF-compressed.
+boost::shared_ptr<std::istream> open_or_throw(const std::string& filename)
 {
-  boost::shared_ptr<std::ifstream> ifs(new std::ifstream(filename.c_str()));
-  if (!*ifs)
-    throw std::runtime_error("Could not open file '" + filename + "'.");
-  return ifs;
+  return open_compressed_or_throw(filename);
 }
 
 // XXX deprecated; use fasta.hh instead
@@ -46,7 +47,7 @@ void read_fasta_names_and_seqs(const std::string& filename,
                                std::vector<std::string>& names,
                                std::map<std::string, size_t>& names_to_idxs)
 {
-  boost::shared_ptr<std::ifstream> ifs = open_or_throw(filename);
+  boost::shared_ptr<std::istream> ifs = open_or_throw(filename);
   deweylab::bio::formats::fasta::InputStream is(*ifs);
   deweylab::bio::formats::fasta::Record rec;
   size_t idx = 0;
@@ -65,7 +66,7 @@ void read_transcript_expression(const std::string& filename,
                                 std::vector<double>& expr,
                                 const std::map<std::string, size_t>& names_to_idxs)
 {
-  boost::shared_ptr<std::ifstream> ifs = open_or_throw(filename);
+  boost::shared_ptr<std::istream> ifs = open_or_throw(filename);
   std::string line;
   std::vector<std::string> col(8);
   { // header
@@ -174,6 +175,33 @@ std::string reverse_complement(const std::string& x)
   return y;
 }
 
+// Sets rc to the reverse complements of the strings in x.
+void reverse_complement(seq_arena& rc, const seq_arena& x)
+{
+  std::vector<size_t> lengths(x.size());
+  for (size_t i = 0; i < x.size(); ++i)
+    lengths[i] = x.length(i);
+  rc.allocate(lengths);
+
+  // Exceptions can't leave the parallel loop, so just note which strings
+  // failed, and then redo the first of them serially to throw its error.
+  std::vector<char> failed(x.size(), 0);
+  #pragma omp parallel for
+  for (int i = 0; i < static_cast<int>(x.size()); ++i) {
+    string_ref s = x[i];
+    char *out = rc.data(i);
+    try {
+      for (size_t j = 0; j < s.size(); ++j)
+        out[j] = complement(s[s.size() - 1 - j]);
+    } catch (const std::runtime_error&) {
+      failed[i] = 1;
+    }
+  }
+  for (size_t i = 0; i < x.size(); ++i)
+    if (failed[i])
+      reverse_complement(x[i].str());
+}
+
 double compute_F1(double precis, double recall)
 {
   if (precis == 0.0 && recall == 0.0)